@@ -19,38 +19,74 @@ GNU General Public License for more details.
  ***************************************************************************/
 
 #include "can.h"
+#include "can_filter.h"
+#include "can_tx_sched.h"
 #include "FreeRTOS.h"
 #include "led.h"
 #include "misc.h"
-#include "queue.h"
+#include "ringbuffer_spsc.h"
 #include "stm32f4xx_can.h"
 #include "stm32f4xx_rcc.h"
 #include "string.h"
+#include "task.h"
 
 /****************************************************************************
  * Definitions
  ***************************************************************************/
 
 #define CAN_TX_BUFFER_DEPTH		    (64)
-#define CAN_MAX_PACKET_HANDLER		(32)
+#define CAN_RX_RING_DEPTH		    (64)
+#define CAN_RX_TASK_STACK_SIZE		(256)
+
+// The frame ring keeps one byte free to tell full from empty.
+#define CAN_RX_RING_BYTES		    (CAN_RX_RING_DEPTH * sizeof(CanRxMsg) + 1)
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef struct
+{
+	ringbuff_spsc  ring;
+	TaskHandle_t   task;
+	CANRxStats_t   stats;
+	uint32_t       error_flags;   // EWGF/EPVF/BOFF as of the last look at ESR
+} CANRxState_t;
 
 /****************************************************************************
  * Global Variables
  ***************************************************************************/
 
-static CANRXEntry_t can1_rx_table[CAN_MAX_PACKET_HANDLER];
-static CANRXEntry_t can2_rx_table[CAN_MAX_PACKET_HANDLER];
+static CANRXIndex_t can1_rx_index, can2_rx_index;
 
-static uint32_t can1_rx_packet_handler_count = 0;
-static uint32_t can2_rx_packet_handler_count = 0;
+static bool can1_initialized = false;
+static bool can2_initialized = false;
 
-static xQueueHandle can1_tx_queue, can2_tx_queue;
+static CANTxSchedEntry_t can1_tx_storage[CAN_TX_BUFFER_DEPTH];
+static CANTxSchedEntry_t can2_tx_storage[CAN_TX_BUFFER_DEPTH];
+
+static CANTxSched_t can1_tx_sched, can2_tx_sched;
+
+static char can1_rx_ring_storage[CAN_RX_RING_BYTES];
+static char can2_rx_ring_storage[CAN_RX_RING_BYTES];
+
+static CANRxState_t can1_rx = { .ring = { .buffer = can1_rx_ring_storage, .maxsize = CAN_RX_RING_BYTES } };
+static CANRxState_t can2_rx = { .ring = { .buffer = can2_rx_ring_storage, .maxsize = CAN_RX_RING_BYTES } };
 
 /****************************************************************************
  * Private Prototypes
  ***************************************************************************/
 
 static void can_dispatch_rx(CAN_TypeDef *can_module, CanRxMsg *packet);
+static void can_apply_filters(CAN_TypeDef *can_module);
+static bool can_queue_tx(CAN_TypeDef *can_module, CanTxMsg *packet, bool coalesce, uint32_t now);
+static void can_tx_pump(CAN_TypeDef *can_module, uint32_t now);
+static void can_tx_isr(CAN_TypeDef *can_module);
+static CANTxSched_t * can_get_tx_sched(CAN_TypeDef *can_module);
+static CANRxState_t * can_get_rx_state(CAN_TypeDef *can_module);
+static void can_rx_isr(CAN_TypeDef *can_module, uint8_t fifo);
+static void can_sce_isr(CAN_TypeDef *can_module);
+static void can_rx_task(void *arg);
 
 /****************************************************************************
  * Public Functions
@@ -74,12 +110,12 @@ void can_init(CAN_TypeDef *can_module, uint32_t baud_rate)
 	if ( can_module == CAN1 )
 	{
 		RCC_APB1PeriphClockCmd(RCC_APB1Periph_CAN1, ENABLE); // turn on CAN1 clock
-		can1_tx_queue = xQueueCreate(CAN_TX_BUFFER_DEPTH,sizeof(CanTxMsg));
+		can_tx_sched_init(&can1_tx_sched, can1_tx_storage, CAN_TX_BUFFER_DEPTH);
 	}
 	else if ( can_module == CAN2 )
 	{
 		RCC_APB1PeriphClockCmd(RCC_APB1Periph_CAN2, ENABLE); // turn on CAN2 clock
-		can2_tx_queue = xQueueCreate(CAN_TX_BUFFER_DEPTH,sizeof(CanTxMsg));
+		can_tx_sched_init(&can2_tx_sched, can2_tx_storage, CAN_TX_BUFFER_DEPTH);
 	}
 
 	CAN_InitTypeDef can_init_struct;
@@ -95,32 +131,38 @@ void can_init(CAN_TypeDef *can_module, uint32_t baud_rate)
 	can_init_struct.CAN_Prescaler = RCC_ClocksStatus.PCLK1_Frequency /
 							baud_rate / (3 + can_init_struct.CAN_BS1 + can_init_struct.CAN_BS2);
 	can_init_struct.CAN_Mode = CAN_Mode_Normal;
-	can_init_struct.CAN_TXFP = ENABLE;
+	// Mailboxes go out by identifier, like the bus, so the scheduler can
+	// preempt a mailbox that holds a lower priority frame.
+	can_init_struct.CAN_TXFP = DISABLE;
 	can_init_struct.CAN_ABOM = ENABLE;
 	CAN_Init(can_module, &can_init_struct);
 
-	// For now, create a filter that passes all messages.
-	// TODO: Autogenerate these?
-	CAN_FilterInitTypeDef CAN_FilterInitStructure;
-	CAN_FilterInitStructure.CAN_FilterNumber = (can_module == CAN1) ? 0 : 14;
-	CAN_FilterInitStructure.CAN_FilterMode = CAN_FilterMode_IdMask;
-	CAN_FilterInitStructure.CAN_FilterScale = CAN_FilterScale_32bit;
-	CAN_FilterInitStructure.CAN_FilterIdHigh = 0x0000;
-	CAN_FilterInitStructure.CAN_FilterIdLow = 0x0000;
-	CAN_FilterInitStructure.CAN_FilterMaskIdHigh = 0x0000;
-	CAN_FilterInitStructure.CAN_FilterMaskIdLow = 0x0000;
-	CAN_FilterInitStructure.CAN_FilterFIFOAssignment = CAN_Filter_FIFO0;
-	CAN_FilterInitStructure.CAN_FilterActivation = ENABLE;
-	CAN_FilterInit(&CAN_FilterInitStructure);
-
-	// Right now, we will only use FIFO0 for receiving packets.  Enable the interrupt.
-	// Also, enable the transmit mailbox empty interrupt in case the software buffer is used.
-	// TODO: RX FIFO overrun interrupt?
-	// TODO: Bus error interrupts?
-	// TODO: Add second FIFO?
-	CAN_ITConfig(can_module, CAN_IT_FMP0, ENABLE);
-
-	// Set up the NVIC for the receive interrupt.
+	// Only let through frames that a registered handler wants.  The filters are
+	// rebuilt every time a handler is registered.
+	CAN_SlaveStartBank(CAN_FILTER_CAN2_START_BANK);
+
+	if ( can_module == CAN1 ) can1_initialized = true;
+	else                      can2_initialized = true;
+
+	can_apply_filters(can_module);
+
+	// Filter banks alternate between the two receive FIFOs, so both are in use.
+	// Enable their message pending and overrun interrupts.
+	//
+	// A given ID always matches the same bank and so always lands in the same
+	// FIFO: frames with one ID are delivered in arrival order.  Frames with
+	// different IDs in different FIFOs are not; whichever FIFO is drained
+	// first wins.  Handlers must not rely on ordering across IDs.
+	CAN_ITConfig(can_module, CAN_IT_FMP0 | CAN_IT_FOV0 | CAN_IT_FMP1 | CAN_IT_FOV1, ENABLE);
+
+	// Count error state changes.  Per-frame error codes (LEC) are deliberately
+	// not interrupt sources: an unacknowledged transmitter would raise one on
+	// every retry.
+	CAN_ITConfig(can_module, CAN_IT_EWG | CAN_IT_EPV | CAN_IT_BOF | CAN_IT_ERR, ENABLE);
+
+	// Set up the NVIC for the receive interrupts.  Both FIFOs MUST share a
+	// priority: they are the two producers of the deferred frame ring, which
+	// is only safe because neither can preempt the other.
 	NVIC_InitTypeDef  NVIC_InitStructure;
 	NVIC_InitStructure.NVIC_IRQChannel = (can_module == CAN1) ? CAN1_RX0_IRQn : CAN2_RX0_IRQn;
 	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 4;
@@ -128,61 +170,181 @@ void can_init(CAN_TypeDef *can_module, uint32_t baud_rate)
 	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
 	NVIC_Init(&NVIC_InitStructure);
 
+	NVIC_InitStructure.NVIC_IRQChannel = (can_module == CAN1) ? CAN1_RX1_IRQn : CAN2_RX1_IRQn;
+	NVIC_Init(&NVIC_InitStructure);
+
+	NVIC_InitStructure.NVIC_IRQChannel = (can_module == CAN1) ? CAN1_SCE_IRQn : CAN2_SCE_IRQn;
+	NVIC_Init(&NVIC_InitStructure);
+
 	// Enable the transmit interrupt as well.  Note that the transmit interrupt will only be enabled
-	// when the buffer becomes full in can_send_packet.
+	// while frames are waiting in the software scheduler.
 	NVIC_InitStructure.NVIC_IRQChannel = (can_module == CAN1) ? CAN1_TX_IRQn : CAN2_TX_IRQn;
 	NVIC_Init(&NVIC_InitStructure);
 }
 
+/**
+ * Moves receive handling out of interrupt context.  From then on the receive
+ * interrupts only drain both hardware FIFOs into a frame ring, and a task at
+ * the given priority runs the registered handlers in batches.  ISR time no
+ * longer depends on what the handlers do, but handlers now run in task
+ * context and must not use FromISR APIs.
+ * @param canModule - CAN module (CAN1 or CAN2).
+ * @param priority - FreeRTOS priority of the dispatch task.
+ * @return False if the task could not be created.
+ */
+bool can_start_rx_task(CAN_TypeDef *can_module, UBaseType_t priority)
+{
+	CANRxState_t *rx = can_get_rx_state(can_module);
+	TaskHandle_t task;
+
+	if ( rx->task != NULL ) return true;
+
+	if ( xTaskCreate( can_rx_task, (can_module == CAN1) ? "can1_rx" : "can2_rx",
+	                  CAN_RX_TASK_STACK_SIZE, can_module, priority, &task ) != pdPASS )
+	{
+		return false;
+	}
+
+	// Publish the handle last; the ISR switches to the ring as soon as it sees it.
+	taskENTER_CRITICAL();
+	rx->task = task;
+	taskEXIT_CRITICAL();
+
+	return true;
+}
+
+/**
+ * Copies out the receive and bus error counters.
+ * @param canModule - CAN module to query (CAN1 or CAN2)
+ * @param stats - Location to put the counters.
+ */
+void can_get_rx_stats(CAN_TypeDef *can_module, CANRxStats_t *stats)
+{
+	CANRxState_t *rx = can_get_rx_state(can_module);
+
+	taskENTER_CRITICAL();
+	*stats = rx->stats;
+	// Leaving an error state raises no interrupt, so forget states that have
+	// since cleared; otherwise the next entry would not be counted.
+	rx->error_flags &= can_module->ESR;
+	taskEXIT_CRITICAL();
+
+	stats->tx_error_counter = CAN_GetLSBTransmitErrorCounter(can_module);
+	stats->rx_error_counter = CAN_GetReceiveErrorCounter(can_module);
+}
+
 /**
  * Sends a CAN packet.  Must NOT be used from an ISR.
+ *
+ * Frames that do not fit in a mailbox wait in a software scheduler that
+ * releases them in bus arbitration order (lowest ID first), so an urgent frame
+ * skips ahead of any backlog of lower priority frames.
  * @param canModule - CAN module to use (CAN1 or CAN2)
  * @param packet - Packet to be sent.
+ * @return False if the packet was dropped because the backlog is full.
  */
-void can_send_packet (CAN_TypeDef * can_module, CanTxMsg * packet )
+bool can_send_packet (CAN_TypeDef * can_module, CanTxMsg * packet )
 {
-	if ( CAN_Transmit(can_module,packet) == CAN_TxStatus_NoMailBox )
-	{
-		// TODO: What should we set this timeout to?
-		xQueueSend( (can_module==CAN1) ? can1_tx_queue : can2_tx_queue, packet, 0 );
+	taskENTER_CRITICAL();
+	bool queued = can_queue_tx(can_module, packet, false, xTaskGetTickCount());
+	taskEXIT_CRITICAL();
 
-		CAN_ITConfig(can_module, CAN_IT_TME, ENABLE);
-	}
+	return queued;
 }
 
 /**
  * Sends a CAN packet from an ISR
  * @param canModule - CAN module to use (CAN1 or CAN2)
  * @param packet - Packet to be sent.
+ * @return False if the packet was dropped because the backlog is full.
  */
-void can_send_packet_isr(CAN_TypeDef *can_module, CanTxMsg * packet )
+bool can_send_packet_isr(CAN_TypeDef *can_module, CanTxMsg * packet )
 {
-	if (CAN_Transmit(can_module,packet) == CAN_TxStatus_NoMailBox)
-	{
-		xQueueSendFromISR((can_module ==CAN1) ? can1_tx_queue : can2_tx_queue, packet, NULL );
+	UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+	bool queued = can_queue_tx(can_module, packet, false, xTaskGetTickCountFromISR());
+	portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
 
-		CAN_ITConfig(can_module,CAN_IT_TME,ENABLE);
-	}
+	return queued;
+}
+
+/**
+ * Sends a periodic CAN packet.  Must NOT be used from an ISR.
+ *
+ * Same as can_send_packet, except that if an earlier periodic packet with the
+ * same ID is still waiting it is updated in place with the new payload rather
+ * than queueing a stale copy behind it.
+ * @param canModule - CAN module to use (CAN1 or CAN2)
+ * @param packet - Packet to be sent.
+ * @return False if the packet was dropped because the backlog is full.
+ */
+bool can_send_periodic_packet (CAN_TypeDef * can_module, CanTxMsg * packet )
+{
+	taskENTER_CRITICAL();
+	bool queued = can_queue_tx(can_module, packet, true, xTaskGetTickCount());
+	taskEXIT_CRITICAL();
+
+	return queued;
+}
+
+/**
+ * Sends a periodic CAN packet from an ISR.  See can_send_periodic_packet.
+ * @param canModule - CAN module to use (CAN1 or CAN2)
+ * @param packet - Packet to be sent.
+ * @return False if the packet was dropped because the backlog is full.
+ */
+bool can_send_periodic_packet_isr (CAN_TypeDef * can_module, CanTxMsg * packet )
+{
+	UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+	bool queued = can_queue_tx(can_module, packet, true, xTaskGetTickCountFromISR());
+	portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+
+	return queued;
+}
+
+/**
+ * Copies out the transmit counters (queued, sent, coalesced, dropped and
+ * latency in ticks).
+ * @param canModule - CAN module to query (CAN1 or CAN2)
+ * @param stats - Location to put the counters.
+ */
+void can_get_tx_stats(CAN_TypeDef *can_module, CANTxStats_t *stats)
+{
+	taskENTER_CRITICAL();
+	*stats = can_get_tx_sched(can_module)->stats;
+	taskEXIT_CRITICAL();
 }
 
 /**
  * Register a packet handler.  Note: more than one packet handler can be assigned
- * to an ID.
+ * to an ID.  Set entry->ide to CAN_Id_Extended to match 29-bit IDs; otherwise
+ * the handler only sees standard frames.  Handlers with a full ID mask are
+ * looked up by binary search in the ISR; handlers that mask out ID bits are
+ * checked one by one, so prefer exact IDs where possible.
+ *
+ * Handlers may be registered at any time, from any task.  The index is
+ * changed in a critical section, which keeps out the receive interrupt and,
+ * once can_start_rx_task has been called, the dispatch task's lookup.
+ *
+ * The hardware acceptance filters are regenerated from the handler table, so
+ * reception pauses briefly while they are rewritten.
  * @param canModule - CAN module to associate the handler with (CAN1 or CAN2).
  * @param entry - Entry to add to the list.
+ * @return False if the handler table is full.
  */
-void can_register_handler(CAN_TypeDef *can_module, CANRXEntry_t * entry)
+bool can_register_handler(CAN_TypeDef *can_module, CANRXEntry_t * entry)
 {
-	if ( can_module == CAN1 )
-	{
-		memcpy( &(can1_rx_table[can1_rx_packet_handler_count]), entry, sizeof(CANRXEntry_t) );
-		can1_rx_packet_handler_count++;
-	}
-	else
+	CANRXIndex_t *index = (can_module == CAN1) ? &can1_rx_index : &can2_rx_index;
+
+	taskENTER_CRITICAL();
+	bool added = can_rx_index_add(index, entry);
+	taskEXIT_CRITICAL();
+
+	if ( added && ((can_module == CAN1) ? can1_initialized : can2_initialized) )
 	{
-		memcpy( &(can2_rx_table[can2_rx_packet_handler_count]), entry, sizeof(CANRXEntry_t) );
-		can2_rx_packet_handler_count++;
+		can_apply_filters(can_module);
 	}
+
+	return added;
 }
 
 
@@ -190,93 +352,297 @@ void can_register_handler(CAN_TypeDef *can_module, CANRXEntry_t * entry)
  * Private Functions
  ***************************************************************************/
 
-static void can_dispatch_rx(CAN_TypeDef *can_module, CanRxMsg *packet)
+static CANTxSched_t * can_get_tx_sched(CAN_TypeDef *can_module)
 {
-	CANRXEntry_t * table = (can_module == CAN1) ? can1_rx_table : can2_rx_table;
-	uint32_t handlerCount = (can_module == CAN1) ? can1_rx_packet_handler_count : can2_rx_packet_handler_count;
+	return (can_module == CAN1) ? &can1_tx_sched : &can2_tx_sched;
+}
 
-	// Note: This purposely allows more than one callback to be registered for
-	// a given packet.
+static CANRxState_t * can_get_rx_state(CAN_TypeDef *can_module)
+{
+	return (can_module == CAN1) ? &can1_rx : &can2_rx;
+}
+
+/**
+ * Queues a frame and moves as much of the backlog as fits into the mailboxes.
+ * Must be called with interrupts masked.
+ */
+static bool can_queue_tx(CAN_TypeDef *can_module, CanTxMsg *packet, bool coalesce, uint32_t now)
+{
+	bool queued = can_tx_sched_push(can_get_tx_sched(can_module), packet, coalesce, now);
+	can_tx_pump(can_module, now);
+	return queued;
+}
+
+/**
+ * Reports every completed mailbox to the scheduler, then fills free mailboxes
+ * from it, most urgent frame first.  A mailbox completes without TXOK only
+ * when it was aborted (automatic retransmission is on), and the scheduler
+ * requeues that frame.  If every mailbox is busy and the next frame outranks
+ * one of them, that mailbox is aborted.  The mailbox empty interrupt is left
+ * on while any mailbox is loaded or there is still a backlog.  Must be called
+ * with interrupts masked.
+ *
+ * Completions are collected here rather than only in can_tx_isr because
+ * can_write pumps too: CAN_Transmit takes any mailbox with TME set, and
+ * setting TXRQ clears that mailbox's RQCP, so a finished abort not reported
+ * first would be lost along with its frame.
+ */
+static void can_tx_pump(CAN_TypeDef *can_module, uint32_t now)
+{
+	static const uint32_t rqcp[CAN_TX_SCHED_MAILBOXES] = { CAN_TSR_RQCP0, CAN_TSR_RQCP1, CAN_TSR_RQCP2 };
+	static const uint32_t txok[CAN_TX_SCHED_MAILBOXES] = { CAN_TSR_TXOK0, CAN_TSR_TXOK1, CAN_TSR_TXOK2 };
+
+	CANTxSched_t *sched = can_get_tx_sched(can_module);
+	uint32_t tsr = can_module->TSR;
+	CanTxMsg next;
+	uint8_t mb;
 
-	for (uint16_t i = 0; i < handlerCount; i++ )
+	for ( mb = 0; mb < CAN_TX_SCHED_MAILBOXES; mb++ )
 	{
-		// TODO: support Extended IDs?
-		if ( (packet->StdId & table[i].mask ) == table[i].id_after_mask)
+		if ( tsr & rqcp[mb] )
 		{
-			table[i].callback(packet);
+			// RQCP is write-one-to-clear and also clears TXOK/ALST/TERR.
+			can_module->TSR = rqcp[mb];
+			can_tx_sched_done(sched, mb, (tsr & txok[mb]) != 0);
 		}
 	}
+
+	while ( can_tx_sched_peek(sched, &next) )
+	{
+		uint8_t mailbox = CAN_Transmit(can_module, &next);
+
+		if ( mailbox == CAN_TxStatus_NoMailBox ) break;
+
+		can_tx_sched_load(sched, mailbox, now);
+	}
+
+	int8_t victim = can_tx_sched_preempt(sched);
+	if ( victim >= 0 )
+	{
+		CAN_CancelTransmit(can_module, victim);
+	}
+
+	CAN_ITConfig(can_module, CAN_IT_TME,
+			(sched->loaded != 0 || can_tx_sched_count(sched) > 0) ? ENABLE : DISABLE);
 }
 
-/****************************************************************************
- * Interrupt Service Routines
- ***************************************************************************/
+/**
+ * Mailbox empty interrupt: collects completions and refills.
+ */
+static void can_tx_isr(CAN_TypeDef *can_module)
+{
+	UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+	can_tx_pump(can_module, xTaskGetTickCountFromISR());
+	portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
 
-void CAN1_RX0_IRQHandler ( void )
+/**
+ * Programs the acceptance filter banks of a module from its handler table.
+ * Banks the table does not need are switched off.
+ */
+static void can_apply_filters(CAN_TypeDef *can_module)
 {
-	led_on(LED_CAN);
-	CanRxMsg packet;
-	CAN_Receive( CAN1, CAN_FIFO0, &packet );
-	can_dispatch_rx(CAN1, &packet);
-	led_off(LED_CAN);
+	CANRXIndex_t *index = (can_module == CAN1) ? &can1_rx_index : &can2_rx_index;
+	uint8_t first_bank = (can_module == CAN1) ? 0 : CAN_FILTER_CAN2_START_BANK;
+
+	CANFilterBank_t banks[CAN_FILTER_BANKS_PER_MODULE];
+	bool pass_all;
+
+	taskENTER_CRITICAL();
+	uint8_t bank_count = can_filter_build(index, banks, CAN_FILTER_BANKS_PER_MODULE, &pass_all);
+	taskEXIT_CRITICAL();
+
+	CAN_FilterInitTypeDef CAN_FilterInitStructure;
+
+	for ( uint8_t i = 0; i < CAN_FILTER_BANKS_PER_MODULE; i++ )
+	{
+		CAN_FilterInitStructure.CAN_FilterNumber = first_bank + i;
+		CAN_FilterInitStructure.CAN_FilterFIFOAssignment = (i & 1) ? CAN_Filter_FIFO1 : CAN_Filter_FIFO0;
+
+		if ( i < bank_count )
+		{
+			CAN_FilterInitStructure.CAN_FilterMode = banks[i].mode;
+			CAN_FilterInitStructure.CAN_FilterScale = banks[i].scale;
+			CAN_FilterInitStructure.CAN_FilterIdHigh = banks[i].id_high;
+			CAN_FilterInitStructure.CAN_FilterIdLow = banks[i].id_low;
+			CAN_FilterInitStructure.CAN_FilterMaskIdHigh = banks[i].mask_id_high;
+			CAN_FilterInitStructure.CAN_FilterMaskIdLow = banks[i].mask_id_low;
+			CAN_FilterInitStructure.CAN_FilterActivation = ENABLE;
+		}
+		else
+		{
+			CAN_FilterInitStructure.CAN_FilterMode = CAN_FilterMode_IdMask;
+			CAN_FilterInitStructure.CAN_FilterScale = CAN_FilterScale_32bit;
+			CAN_FilterInitStructure.CAN_FilterIdHigh = 0x0000;
+			CAN_FilterInitStructure.CAN_FilterIdLow = 0x0000;
+			CAN_FilterInitStructure.CAN_FilterMaskIdHigh = 0x0000;
+			CAN_FilterInitStructure.CAN_FilterMaskIdLow = 0x0000;
+			CAN_FilterInitStructure.CAN_FilterActivation = DISABLE;
+		}
+
+		CAN_FilterInit(&CAN_FilterInitStructure);
+	}
 }
 
-void CAN2_RX0_IRQHandler ( void )
+static void can_dispatch_rx(CAN_TypeDef *can_module, CanRxMsg *packet)
 {
-	led_on(LED_CAN);
-	CanRxMsg packet;
-	CAN_Receive( CAN2, CAN_FIFO0, &packet );
-	can_dispatch_rx(CAN2, &packet);
-	led_off(LED_CAN);
+	// Note: This purposely allows more than one callback to be registered for
+	// a given packet.
+	can_rx_index_dispatch((can_module == CAN1) ? &can1_rx_index : &can2_rx_index, packet);
 }
 
-void CAN1_TX_IRQHandler ( void )
+/**
+ * Empties one hardware FIFO.  Each frame is either dispatched on the spot or,
+ * once can_start_rx_task has been called, queued for the dispatch task.
+ */
+static void can_rx_isr(CAN_TypeDef *can_module, uint8_t fifo)
 {
 	led_on(LED_CAN);
 
-	CanTxMsg toSend;
+	CANRxState_t *rx = can_get_rx_state(can_module);
+	uint32_t fov = (fifo == CAN_FIFO0) ? CAN_IT_FOV0 : CAN_IT_FOV1;
+
+	if ( CAN_GetITStatus(can_module, fov) == SET )
+	{
+		rx->stats.fifo_overrun[fifo]++;
+		CAN_ClearITPendingBit(can_module, fov);
+	}
+
+	CanRxMsg packet;
 
-	if ( xQueueReceiveFromISR(can1_tx_queue,&toSend,NULL) == pdTRUE )
+	while ( CAN_MessagePending(can_module, fifo) > 0 )
 	{
-		if ( CAN_Transmit(CAN1,&toSend) == CAN_TxStatus_NoMailBox )
+		CAN_Receive( can_module, fifo, &packet );
+		rx->stats.received++;
+
+		if ( rx->task == NULL )
 		{
-			// For some reason, we failed again.  Push it back onto the front.
-			xQueueSendToFrontFromISR(can1_tx_queue,&toSend,NULL);
+			can_dispatch_rx(can_module, &packet);
+		}
+		else if ( !ringbuff_spsc_push_back_s(&(rx->ring), &packet, sizeof(CanRxMsg)) )
+		{
+			rx->stats.ring_overrun++;
 		}
 	}
-	else
+
+	BaseType_t woken = pdFALSE;
+
+	if ( rx->task != NULL )
 	{
-		// There are no more messages left in the software buffer.
-		// Disable this interrupt.
-		CAN_ITConfig(CAN1,CAN_IT_TME,DISABLE);
+		vTaskNotifyGiveFromISR(rx->task, &woken);
 	}
 
 	led_off(LED_CAN);
+
+	portEND_SWITCHING_ISR(woken);
 }
 
-void CAN2_TX_IRQHandler ( void )
+/**
+ * Counts error state changes.  EWGF, EPVF and BOFF are levels that stay set
+ * while the condition lasts, so the error interrupt for one of them also
+ * sees the others still set from earlier.  Only flags that were clear last
+ * time are counted.
+ */
+static void can_sce_isr(CAN_TypeDef *can_module)
 {
-	led_on(LED_CAN);
+	CANRxState_t *rx = can_get_rx_state(can_module);
+	uint32_t flags = can_module->ESR & (CAN_ESR_EWGF | CAN_ESR_EPVF | CAN_ESR_BOFF);
+	uint32_t entered = flags & ~rx->error_flags;
 
-	CanTxMsg toSend;
+	if ( entered & CAN_ESR_EWGF ) rx->stats.error_warning++;
+	if ( entered & CAN_ESR_EPVF ) rx->stats.error_passive++;
+	if ( entered & CAN_ESR_BOFF ) rx->stats.bus_off++;
 
-	if ( xQueueReceiveFromISR(can2_tx_queue,&toSend,NULL) == pdTRUE )
+	rx->error_flags = flags;
+
+	rx->stats.last_error_code = CAN_GetLastErrorCode(can_module);
+
+	CAN_ClearITPendingBit(can_module, CAN_IT_ERR);
+}
+
+/**
+ * Dispatch task used by can_start_rx_task.  Sleeps until the receive
+ * interrupt posts frames, then runs the handlers for everything queued.
+ * A handler registered while a frame is being handled takes effect from
+ * the next frame.
+ */
+static void can_rx_task(void *arg)
+{
+	CAN_TypeDef *can_module = arg;
+	CANRxState_t *rx = can_get_rx_state(can_module);
+	CANRXIndex_t *index = (can_module == CAN1) ? &can1_rx_index : &can2_rx_index;
+	CANRXHandlerFxn callbacks[CAN_MAX_PACKET_HANDLER];
+	CanRxMsg packet;
+
+	for (;;)
 	{
-		if ( CAN_Transmit(CAN2,&toSend) == CAN_TxStatus_NoMailBox )
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		while ( ringbuff_spsc_pop_front_s(&(rx->ring), &packet, sizeof(CanRxMsg)) )
 		{
-			// For some reason, we failed again.  Push it back onto the front.
-			xQueueSendToFrontFromISR(can2_tx_queue,&toSend,NULL);
+			// can_register_handler may run in a higher priority task and
+			// shift the index under us, so take the matches under the same
+			// lock it adds with and call them once it is released.
+			taskENTER_CRITICAL();
+			uint16_t calls = can_rx_index_lookup(index, &packet, callbacks);
+			taskEXIT_CRITICAL();
+
+			for ( uint16_t i = 0; i < calls; i++ )
+			{
+				callbacks[i](&packet);
+			}
 		}
 	}
-	else
-	{
-		// There are no more messages left in the software buffer.
-		// Disable this interrupt.
-		CAN_ITConfig(CAN2,CAN_IT_TME,DISABLE);
-	}
+}
+
+/****************************************************************************
+ * Interrupt Service Routines
+ ***************************************************************************/
+
+void CAN1_RX0_IRQHandler ( void )
+{
+	can_rx_isr(CAN1, CAN_FIFO0);
+}
+
+void CAN1_RX1_IRQHandler ( void )
+{
+	can_rx_isr(CAN1, CAN_FIFO1);
+}
+
+void CAN2_RX0_IRQHandler ( void )
+{
+	can_rx_isr(CAN2, CAN_FIFO0);
+}
+
+void CAN2_RX1_IRQHandler ( void )
+{
+	can_rx_isr(CAN2, CAN_FIFO1);
+}
+
+void CAN1_SCE_IRQHandler ( void )
+{
+	can_sce_isr(CAN1);
+}
+
+void CAN2_SCE_IRQHandler ( void )
+{
+	can_sce_isr(CAN2);
+}
+
+void CAN1_TX_IRQHandler ( void )
+{
+	led_on(LED_CAN);
+
+	can_tx_isr(CAN1);
 
 	led_off(LED_CAN);
 }
 
+void CAN2_TX_IRQHandler ( void )
+{
+	led_on(LED_CAN);
 
+	can_tx_isr(CAN2);
 
+	led_off(LED_CAN);
+}
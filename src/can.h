@@ -21,7 +21,11 @@ GNU General Public License for more details.
  * Includes
  ***************************************************************************/
 
+#include "stdbool.h"
+#include "FreeRTOS.h"
 #include "stm32f4xx_can.h"
+#include "can_rx_index.h"
+#include "can_tx_sched.h"
 
 /****************************************************************************
  * Definitions
@@ -33,29 +37,31 @@ GNU General Public License for more details.
  * Typedefs
  ***************************************************************************/
 
-typedef uint32_t CANPacketIDMask_t;
-typedef uint32_t CANPacketId_t;
-
-/**
- * CAN Packet Handler
- * @param packet - new packet to be handled.
- */
-typedef void (*CANRXHandlerFxn)(CanRxMsg * packet);
-
 typedef struct
 {
-	CANPacketIDMask_t  mask;
-	CANPacketId_t      id_after_mask;
-	CANRXHandlerFxn    callback;
-} CANRXEntry_t;
+	uint32_t  received;          // frames read out of the hardware FIFOs
+	uint32_t  fifo_overrun[2];   // FIFO0/FIFO1 overruns (frames lost in hardware)
+	uint32_t  ring_overrun;      // frames lost because the deferred ring was full
+	uint32_t  error_warning;     // entries into error warning
+	uint32_t  error_passive;     // entries into error passive
+	uint32_t  bus_off;           // entries into bus-off
+	uint8_t   last_error_code;   // CAN_ErrorCode_* seen at the last error interrupt
+	uint8_t   tx_error_counter;  // TEC, sampled by can_get_rx_stats
+	uint8_t   rx_error_counter;  // REC, sampled by can_get_rx_stats
+} CANRxStats_t;
 
 /****************************************************************************
  * Public Prototypes
  ***************************************************************************/
 
 void can_init(CAN_TypeDef *can_module, uint32_t baud_rate);
-void can_send_packet(CAN_TypeDef *can_module, CanTxMsg *packet);
-void can_send_packet_isr(CAN_TypeDef *can_module, CanTxMsg *packet);
-void can_register_handler(CAN_TypeDef *can_module, CANRXEntry_t *entry);
+bool can_send_packet(CAN_TypeDef *can_module, CanTxMsg *packet);
+bool can_send_packet_isr(CAN_TypeDef *can_module, CanTxMsg *packet);
+bool can_send_periodic_packet(CAN_TypeDef *can_module, CanTxMsg *packet);
+bool can_send_periodic_packet_isr(CAN_TypeDef *can_module, CanTxMsg *packet);
+void can_get_tx_stats(CAN_TypeDef *can_module, CANTxStats_t *stats);
+bool can_register_handler(CAN_TypeDef *can_module, CANRXEntry_t *entry);
+bool can_start_rx_task(CAN_TypeDef *can_module, UBaseType_t priority);
+void can_get_rx_stats(CAN_TypeDef *can_module, CANRxStats_t *stats);
 
 #endif /* CAN_H */
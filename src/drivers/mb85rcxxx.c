@@ -30,22 +30,28 @@ GNU General Public License for more details.
 
 #define FRAM_I2C_SPEED_HZ	(400000)
 
+// 7-bit address of the first device; the low three bits are set in hardware.
+#define FRAM_BASE_ADDRESS	(0x50)
+
+// A byte takes 9 SCL periods, about 23us at 400kHz.  Allow plenty of slack
+// for queueing behind other bus traffic.
+#define FRAM_TIMEOUT_TICKS(len)	(pdMS_TO_TICKS(20) + pdMS_TO_TICKS((len) / 16))
+
 
 /****************************************************************************
  * Private Variables
  ***************************************************************************/
 
-static I2C_TypeDef* fram_I2Cx = NULL;
-static uint8_t fram_device_address = 0;
-static uint32_t fram_size = 0;
+// Device used by mb85rcxx_init.
+static MB85RCDevice_t fram_default;
 
 
 /****************************************************************************
  * Private Prototypes
  ***************************************************************************/
 
-static bool write ( uint16_t address, void * data, size_t len );
-static bool read ( uint16_t address, void * data, size_t len );
+static bool write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
+static bool read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
 
 
 /****************************************************************************
@@ -53,85 +59,89 @@ static bool read ( uint16_t address, void * data, size_t len );
  ***************************************************************************/
 
 /**
- * Initialize the FRAM.
+ * Initialize the FRAM and make it the default nvmem device.
  * @param I2Cx - I2C Channel.
  * @param framSize - Size of the FRAM in bytes.
  * @param deviceAddress - Physical address of the memory (set in hardware).
  */
 void mb85rcxx_init(I2C_TypeDef *I2Cx, uint32_t size, uint8_t device_address)
 {
-	fram_I2Cx = I2Cx;
-	fram_device_address = device_address;
-    fram_size = size;
+    nvmem_set_default(mb85rcxx_device_init(&fram_default, I2Cx, size, device_address));
+}
+
+/**
+ * Sets up an FRAM as an nvmem device without touching the default, for
+ * boards with more than one.
+ * @param fram - Device state.
+ * @param I2Cx - I2C Channel.
+ * @param size - Size of the FRAM in bytes.
+ * @param device_address - Physical address of the memory (set in hardware).
+ * @return The device handle.
+ */
+NvMemDevice_t * mb85rcxx_device_init ( MB85RCDevice_t *fram, I2C_TypeDef *I2Cx,
+                                       uint32_t size, uint8_t device_address )
+{
+    fram->I2Cx = I2Cx;
+    fram->address = FRAM_BASE_ADDRESS | (0x07 & device_address);
+
+    // nvmem addresses are 16 bits.
+    fram->dev.read = read;
+    fram->dev.write = write;
+    fram->dev.size = (size > 0x10000) ? 0x10000 : size;
+    fram->dev.page_size = 0;
+    fram->dev.endurance = NVMEM_ENDURANCE_FRAM;
 
-    nvmem_init(read, write);
+    return &fram->dev;
 }
 
 /**
- * Write data to FRAM.
+ * Write data to FRAM.  FRAM has no pages or write delay, so any run of
+ * bytes goes out as a single sequential write.  Bounds are checked by nvmem.
  * @param address - Address in RAM to write to.
  * @param data - Data to write.
  * @param len - Length of the data.
  */
-static bool write ( uint16_t address, void * data, size_t len )
+static bool write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
 {
-    // TODO: verify memory in bounds
-
-	// Start a write
-	i2c_start(fram_I2Cx, 0xA0 | (0x07 & fram_device_address),
-				   I2C_Direction_Transmitter);
-
-	// Send the memory address
-	i2c_write(fram_I2Cx, (address >> 8) & 0xFF  );
-	i2c_write(fram_I2Cx, address & 0xFF );
+	MB85RCDevice_t *fram = (MB85RCDevice_t *)dev;
 
-	// send the data
-	for( uint16_t i = 0; i < len; i++ )
-	{
-		i2c_write(fram_I2Cx, ((uint8_t*)data)[i] );
-	}
+	if ( len == 0 ) return true;
+	if ( len > 0xFFFF ) return false;
 
-	i2c_stop(fram_I2Cx);
+	I2CXfer_t xfer = {
+		.address = fram->address,
+		.cmd = { (address >> 8) & 0xFF, address & 0xFF },
+		.cmd_len = 2,
+		.wbuf = data,
+		.wlen = len,
+		.timeout = FRAM_TIMEOUT_TICKS(len)
+	};
 
-    return true;
+	return i2c_xfer(fram->I2Cx, &xfer) == I2C_XFER_OK;
 }
 
 /**
- * Read data from FRAM.
+ * Read data from FRAM.  The memory address is written and the data read
+ * back in one repeated-start transaction.
  * @param address - Address to read from.
  * @param data - Location to put the data.
  * @param len - Length of data to read.
  */
-static bool read ( uint16_t address, void * data, size_t len )
+static bool read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
 {
-    // TODO: verify memory in bounds
-
-	// Start a write to select the address
-	i2c_start(fram_I2Cx, 0xA0 | (0x07 & fram_device_address),
-				   I2C_Direction_Transmitter);
-
-	// Send the memory address
-	i2c_write(fram_I2Cx, (address >> 8) & 0xFF  );
-	i2c_write(fram_I2Cx, address & 0xFF );
-
-	// Restart in read mode
-	i2c_restart(fram_I2Cx, 0xA1 | (0x07 & fram_device_address),
-				   I2C_Direction_Receiver);
-
-    for (uint16_t i = 0; i < len; i++)
-    {
-    	// Nack on the last byte
-    	if ( i == len-1 )
-    	{
-    		((uint8_t*) data)[i] = i2c_read_nack(fram_I2Cx);
-    	}
-    	else
-    	{
-    		((uint8_t*) data)[i] = i2c_read_ack(fram_I2Cx);
-    	}
-    }
-
-    i2c_stop(fram_I2Cx);
-
-    return true;
+	MB85RCDevice_t *fram = (MB85RCDevice_t *)dev;
+
+	if ( len == 0 ) return true;
+	if ( len > 0xFFFF ) return false;
+
+	I2CXfer_t xfer = {
+		.address = fram->address,
+		.cmd = { (address >> 8) & 0xFF, address & 0xFF },
+		.cmd_len = 2,
+		.rbuf = data,
+		.rlen = len,
+		.timeout = FRAM_TIMEOUT_TICKS(len)
+	};
+
+	return i2c_xfer(fram->I2Cx, &xfer) == I2C_XFER_OK;
 }
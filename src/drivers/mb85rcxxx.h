@@ -22,12 +22,26 @@ GNU General Public License for more details.
  ***************************************************************************/
 
 #include "i2c.h"
+#include "nvmem.h"
 #include "stdlib.h"
 
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef struct
+{
+    NvMemDevice_t  dev;         // must be first
+    I2C_TypeDef   *I2Cx;
+    uint8_t        address;     // 7-bit bus address
+} MB85RCDevice_t;
+
 /****************************************************************************
  * Public Functions
  ***************************************************************************/
 
 void mb85rcxx_init ( I2C_TypeDef *I2Cx, uint32_t size, uint8_t device_address );
+NvMemDevice_t * mb85rcxx_device_init ( MB85RCDevice_t *fram, I2C_TypeDef *I2Cx,
+                                       uint32_t size, uint8_t device_address );
 
 #endif /* NVMEM_H */
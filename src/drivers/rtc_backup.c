@@ -0,0 +1,125 @@
+/********************************************************************
+rtc_backup.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "rtc_backup.h"
+#include "rtc.h"
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static bool write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
+static bool read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Presents the free RTC backup registers as a small byte addressed nvmem
+ * device.  They are battery backed RAM: fast, no wear, but only 76 bytes,
+ * which makes them the place for counters that change constantly.  The RTC
+ * must be initialized first.
+ * @param dev - Device state.
+ * @return The device handle.
+ */
+NvMemDevice_t * rtc_backup_device_init ( NvMemDevice_t *dev )
+{
+    dev->read = read;
+    dev->write = write;
+    dev->size = RTC_BACKUP_SIZE;
+    dev->page_size = 0;
+    dev->endurance = NVMEM_ENDURANCE_UNLIMITED;
+
+    return dev;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+ * Registers are little endian words.  Whole aligned words are stored
+ * directly, so a 32-bit counter updates atomically; partial words are read,
+ * modified and written back.
+ */
+static bool write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
+{
+    uint8_t *src = data;
+
+    (void)dev;
+
+    // Register 19 belongs to rtc.c, and nothing past it may be touched even
+    // when the device is called directly rather than through nvmem.
+    if ( (uint32_t)address + len > RTC_BACKUP_SIZE )
+    {
+        return false;
+    }
+
+    while ( len > 0 )
+    {
+        uint8_t reg = address / 4;
+        uint8_t offset = address % 4;
+        uint32_t value;
+
+        if ( offset == 0 && len >= 4 )
+        {
+            value = src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24);
+            rtc_write_backup_register(reg, value);
+
+            address += 4;
+            src += 4;
+            len -= 4;
+            continue;
+        }
+
+        value = rtc_read_backup_register(reg);
+
+        for ( ; offset < 4 && len > 0; offset++, address++, src++, len-- )
+        {
+            value &= ~((uint32_t)0xFF << (8 * offset));
+            value |= (uint32_t)*src << (8 * offset);
+        }
+
+        rtc_write_backup_register(reg, value);
+    }
+
+    return true;
+}
+
+static bool read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
+{
+    uint8_t *dst = data;
+
+    (void)dev;
+
+    if ( (uint32_t)address + len > RTC_BACKUP_SIZE )
+    {
+        return false;
+    }
+
+    for ( ; len > 0; address++, dst++, len-- )
+    {
+        *dst = rtc_read_backup_register(address / 4) >> (8 * (address % 4));
+    }
+
+    return true;
+}
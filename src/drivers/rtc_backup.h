@@ -0,0 +1,40 @@
+/********************************************************************
+rtc_backup.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef RTC_BACKUP_H
+#define RTC_BACKUP_H
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "nvmem.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// Backup registers 0-18 are free; rtc.c keeps its status in 19.
+#define RTC_BACKUP_REGISTERS    (19)
+#define RTC_BACKUP_SIZE         (RTC_BACKUP_REGISTERS * 4)
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+NvMemDevice_t * rtc_backup_device_init ( NvMemDevice_t *dev );
+
+#endif /* RTC_BACKUP_H */
@@ -20,6 +20,21 @@ GNU General Public License for more details.
  ***************************************************************************/
 
 #include "tmp102.h"
+#include "string.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define TMP102_REG_TEMPERATURE    (0x00)
+#define TMP102_TIMEOUT_TICKS      (10)
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static float tmp102_convert ( const uint8_t *data );
+static void  tmp102_done    ( I2CJob_t *job, I2CXferStatus_t status );
 
 /****************************************************************************
  * Public Functions
@@ -31,10 +46,7 @@ bool tmp102_read_temp(I2C_TypeDef *I2Cx, uint8_t address, float *temperature)
 
   if(i2c_read_bytes(I2Cx, address, data, 2) == 2)
   {
-    int16_t temp = data[1] | (data[0] << 8);
-    temp >>= 4;
-
-    *temperature = (float)temp / 16.0f + 273.15f;
+    *temperature = tmp102_convert(data);
 
     return true;
   }
@@ -43,3 +55,53 @@ bool tmp102_read_temp(I2C_TypeDef *I2Cx, uint8_t address, float *temperature)
     return false;
   }
 }
+
+/**
+ * Polls a sensor from a bus scheduler.  Each read sets the pointer register
+ * and reads the result in one repeated-start transaction.
+ * @param sched - Scheduler for the bus the sensor is on.
+ * @param sensor - Sensor state; must stay valid while scheduled.
+ * @param address - 7-bit device address.
+ * @param period - Ticks between reads.
+ */
+void tmp102_schedule(I2CSched_t *sched, TMP102Sensor_t *sensor, uint8_t address,
+                     TickType_t period)
+{
+  memset(&(sensor->job), 0, sizeof(I2CJob_t));
+
+  sensor->job.xfer.address = address;
+  sensor->job.xfer.cmd[0] = TMP102_REG_TEMPERATURE;
+  sensor->job.xfer.cmd_len = 1;
+  sensor->job.xfer.rbuf = sensor->data;
+  sensor->job.xfer.rlen = 2;
+  sensor->job.xfer.timeout = TMP102_TIMEOUT_TICKS;
+  sensor->job.done = tmp102_done;
+  sensor->job.arg = sensor;
+  sensor->valid = false;
+
+  i2c_sched_add(sched, &(sensor->job), period);
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static float tmp102_convert(const uint8_t *data)
+{
+  int16_t temp = data[1] | (data[0] << 8);
+  temp >>= 4;
+
+  return (float)temp / 16.0f + 273.15f;
+}
+
+static void tmp102_done(I2CJob_t *job, I2CXferStatus_t status)
+{
+  TMP102Sensor_t *sensor = job->arg;
+
+  sensor->valid = (status == I2C_XFER_OK);
+
+  if (sensor->valid)
+  {
+    sensor->temperature = tmp102_convert(sensor->data);
+  }
+}
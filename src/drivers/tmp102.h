@@ -22,13 +22,32 @@ GNU General Public License for more details.
  ***************************************************************************/
 
 #include "i2c.h"
+#include "i2c_sched.h"
 #include "stdlib.h"
 #include "stdbool.h"
 
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * A TMP102 polled by an I2C bus scheduler.  temperature holds the latest
+ * good reading; valid says whether the last read succeeded.
+ */
+typedef struct
+{
+  I2CJob_t  job;
+  uint8_t   data[2];
+  float     temperature;  // kelvin
+  bool      valid;
+} TMP102Sensor_t;
+
 /****************************************************************************
  * Public Functions
  ***************************************************************************/
 
 bool tmp102_read_temp(I2C_TypeDef *I2Cx, uint8_t address, float *temperature);
+void tmp102_schedule(I2CSched_t *sched, TMP102Sensor_t *sensor, uint8_t address,
+                     TickType_t period);
 
 #endif
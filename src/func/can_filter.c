@@ -0,0 +1,320 @@
+/********************************************************************
+can_filter.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "can_filter.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// 16-bit filter image: STID[10:0] RTR IDE EXID[17:15]
+#define F16_STID(id)        ((uint16_t)(((id) & 0x7FF) << 5))
+#define F16_RTR             ((uint16_t)0x0010)
+#define F16_IDE             ((uint16_t)0x0008)
+
+// 32-bit filter image: STID[10:0] EXID[17:0] IDE RTR 0
+#define F32_EXID(id)        ((uint32_t)(((id) & 0x1FFFFFFF) << 3))
+#define F32_IDE             ((uint32_t)0x00000004)
+#define F32_RTR             ((uint32_t)0x00000002)
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static bool     can_filter_covered ( const CANRXIndex_t *index, CANPacketId_t id, bool ext );
+static void     can_filter_set32   ( CANFilterBank_t *bank, uint8_t mode, uint32_t id, uint32_t mask );
+static uint16_t can_filter_image16 ( const CanRxMsg *packet );
+static uint32_t can_filter_image32 ( const CanRxMsg *packet );
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Compiles the handlers in a receive index into hardware filter banks so
+ * that frames nobody handles never raise an interrupt.
+ *
+ * Standard exact IDs are packed four to a bank in 16-bit list mode and
+ * standard masked handlers two to a bank in 16-bit mask mode.  Extended IDs
+ * need the 32-bit scale: exact IDs go two to a bank in list mode and each
+ * masked handler takes a whole bank.  Duplicate IDs and exact IDs already
+ * accepted by a masked handler are dropped first.  List entries only admit
+ * data frames; a handler that also needs remote frames should be registered
+ * with a mask.
+ *
+ * If the result does not fit in max_banks, a single pass-all bank is
+ * produced instead and software dispatch does all the filtering, as before.
+ *
+ * This is a pure function so it can be checked off target.
+ * @param index - Registered handlers.
+ * @param banks - Output, at least max_banks entries.
+ * @param max_banks - Banks available to this module.
+ * @param pass_all - Set true if the pass-all fallback was used.
+ * @return Number of banks filled in.
+ */
+uint8_t can_filter_build ( const CANRXIndex_t *index, CANFilterBank_t *banks,
+                           uint8_t max_banks, bool *pass_all )
+{
+	uint16_t mask_vals[CAN_MAX_PACKET_HANDLER];
+	uint16_t mask_masks[CAN_MAX_PACKET_HANDLER];
+	uint16_t list_vals[CAN_MAX_PACKET_HANDLER];
+	uint32_t ext_mask_vals[CAN_MAX_PACKET_HANDLER];
+	uint32_t ext_mask_masks[CAN_MAX_PACKET_HANDLER];
+	uint32_t ext_list_vals[CAN_MAX_PACKET_HANDLER];
+	uint16_t mask_count = 0;
+	uint16_t list_count = 0;
+	uint16_t ext_mask_count = 0;
+	uint16_t ext_list_count = 0;
+	uint16_t i, j;
+
+	*pass_all = false;
+
+	// Standard masked handlers -> 16-bit mask filters on standard frames.
+	for ( i = 0; i < index->masked_std_count; i++ )
+	{
+		const CANRXEntry_t *e = &(index->masked[i]);
+		uint16_t m = e->mask & CAN_STD_ID_MASK;
+
+		// Value bits outside the (standard ID) mask can never match, so the
+		// handler is dead.
+		if ( (e->id_after_mask & ~(CANPacketId_t)m) != 0 ) continue;
+
+		uint16_t val = F16_STID(e->id_after_mask);
+		uint16_t msk = F16_STID(m) | F16_IDE;
+
+		for ( j = 0; j < mask_count; j++ )
+		{
+			if ( mask_vals[j] == val && mask_masks[j] == msk ) break;
+		}
+
+		if ( j == mask_count )
+		{
+			mask_vals[mask_count] = val;
+			mask_masks[mask_count] = msk;
+			mask_count++;
+		}
+	}
+
+	// Extended masked handlers -> 32-bit mask filters on extended frames.
+	for ( ; i < index->masked_count; i++ )
+	{
+		const CANRXEntry_t *e = &(index->masked[i]);
+		uint32_t m = e->mask & CAN_EXT_ID_MASK;
+
+		if ( (e->id_after_mask & ~(CANPacketId_t)m) != 0 ) continue;
+
+		uint32_t val = F32_EXID(e->id_after_mask) | F32_IDE;
+		uint32_t msk = F32_EXID(m) | F32_IDE;
+
+		for ( j = 0; j < ext_mask_count; j++ )
+		{
+			if ( ext_mask_vals[j] == val && ext_mask_masks[j] == msk ) break;
+		}
+
+		if ( j == ext_mask_count )
+		{
+			ext_mask_vals[ext_mask_count] = val;
+			ext_mask_masks[ext_mask_count] = msk;
+			ext_mask_count++;
+		}
+	}
+
+	// Exact handlers -> 16-bit list entries for standard IDs, 32-bit for
+	// extended.  The index is sorted, so duplicates are adjacent.
+	for ( i = 0; i < index->exact_count; i++ )
+	{
+		CANPacketId_t key = index->exact[i].id;
+		bool ext = (key & CAN_RX_INDEX_EXT_FLAG) != 0;
+		CANPacketId_t id = key & ~CAN_RX_INDEX_EXT_FLAG;
+
+		if ( i > 0 && index->exact[i - 1].id == key ) continue;
+		if ( can_filter_covered( index, id, ext ) ) continue;
+
+		if ( ext )
+		{
+			ext_list_vals[ext_list_count++] = F32_EXID(id) | F32_IDE;
+		}
+		else
+		{
+			list_vals[list_count++] = F16_STID(id);
+		}
+	}
+
+	uint16_t needed = (mask_count + 1) / 2 + (list_count + 3) / 4 +
+	                  ext_mask_count + (ext_list_count + 1) / 2;
+
+	if ( needed > max_banks )
+	{
+		if ( max_banks == 0 ) return 0;
+
+		*pass_all = true;
+		banks[0].mode = CAN_FilterMode_IdMask;
+		banks[0].scale = CAN_FilterScale_32bit;
+		banks[0].id_high = 0;
+		banks[0].id_low = 0;
+		banks[0].mask_id_high = 0;
+		banks[0].mask_id_low = 0;
+		return 1;
+	}
+
+	uint8_t n = 0;
+
+	// Unused halves of a bank repeat the previous filter.
+	for ( i = 0; i < mask_count; i += 2 )
+	{
+		j = (i + 1 < mask_count) ? i + 1 : i;
+
+		banks[n].mode = CAN_FilterMode_IdMask;
+		banks[n].scale = CAN_FilterScale_16bit;
+		banks[n].id_low = mask_vals[i];
+		banks[n].mask_id_low = mask_masks[i];
+		banks[n].id_high = mask_vals[j];
+		banks[n].mask_id_high = mask_masks[j];
+		n++;
+	}
+
+	for ( i = 0; i < list_count; i += 4 )
+	{
+		uint16_t last = list_count - 1;
+
+		banks[n].mode = CAN_FilterMode_IdList;
+		banks[n].scale = CAN_FilterScale_16bit;
+		banks[n].id_low = list_vals[i];
+		banks[n].mask_id_low = list_vals[(i + 1 <= last) ? i + 1 : last];
+		banks[n].id_high = list_vals[(i + 2 <= last) ? i + 2 : last];
+		banks[n].mask_id_high = list_vals[(i + 3 <= last) ? i + 3 : last];
+		n++;
+	}
+
+	for ( i = 0; i < ext_mask_count; i++ )
+	{
+		can_filter_set32( &banks[n++], CAN_FilterMode_IdMask, ext_mask_vals[i], ext_mask_masks[i] );
+	}
+
+	for ( i = 0; i < ext_list_count; i += 2 )
+	{
+		j = (i + 1 < ext_list_count) ? i + 1 : i;
+		can_filter_set32( &banks[n++], CAN_FilterMode_IdList, ext_list_vals[i], ext_list_vals[j] );
+	}
+
+	return n;
+}
+
+/**
+ * Evaluates filter banks against a frame the same way the hardware does.
+ * Useful for replaying a bus log to see how many interrupts are avoided.
+ * @return True if any bank accepts the frame.
+ */
+bool can_filter_match ( const CANFilterBank_t *banks, uint8_t bank_count,
+                        const CanRxMsg *packet )
+{
+	uint16_t img16 = can_filter_image16(packet);
+	uint32_t img32 = can_filter_image32(packet);
+
+	for ( uint8_t i = 0; i < bank_count; i++ )
+	{
+		const CANFilterBank_t *b = &banks[i];
+
+		if ( b->scale == CAN_FilterScale_32bit )
+		{
+			uint32_t id   = ((uint32_t)b->id_high << 16) | b->id_low;
+			uint32_t mask = ((uint32_t)b->mask_id_high << 16) | b->mask_id_low;
+
+			if ( b->mode == CAN_FilterMode_IdMask )
+			{
+				if ( ((img32 ^ id) & mask) == 0 ) return true;
+			}
+			else
+			{
+				if ( img32 == id || img32 == mask ) return true;
+			}
+		}
+		else
+		{
+			if ( b->mode == CAN_FilterMode_IdMask )
+			{
+				if ( ((img16 ^ b->id_low) & b->mask_id_low) == 0 ) return true;
+				if ( ((img16 ^ b->id_high) & b->mask_id_high) == 0 ) return true;
+			}
+			else
+			{
+				if ( img16 == b->id_low || img16 == b->mask_id_low ||
+				     img16 == b->id_high || img16 == b->mask_id_high ) return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+ * True if a masked handler in the same ID space already admits this exact ID.
+ */
+static bool can_filter_covered ( const CANRXIndex_t *index, CANPacketId_t id, bool ext )
+{
+	uint16_t first = ext ? index->masked_std_count : 0;
+	uint16_t last = ext ? index->masked_count : index->masked_std_count;
+
+	for ( uint16_t i = first; i < last; i++ )
+	{
+		if ( (id & index->masked[i].mask) == index->masked[i].id_after_mask ) return true;
+	}
+
+	return false;
+}
+
+static void can_filter_set32 ( CANFilterBank_t *bank, uint8_t mode, uint32_t id, uint32_t mask )
+{
+	bank->mode = mode;
+	bank->scale = CAN_FilterScale_32bit;
+	bank->id_high = (uint16_t)(id >> 16);
+	bank->id_low = (uint16_t)id;
+	bank->mask_id_high = (uint16_t)(mask >> 16);
+	bank->mask_id_low = (uint16_t)mask;
+}
+
+static uint16_t can_filter_image16 ( const CanRxMsg *packet )
+{
+	uint16_t rtr = (packet->RTR == CAN_RTR_Remote) ? F16_RTR : 0;
+
+	if ( packet->IDE == CAN_Id_Extended )
+	{
+		return F16_STID(packet->ExtId >> 18) | rtr | F16_IDE |
+		       (uint16_t)((packet->ExtId >> 15) & 0x7);
+	}
+
+	return F16_STID(packet->StdId) | rtr;
+}
+
+static uint32_t can_filter_image32 ( const CanRxMsg *packet )
+{
+	uint32_t rtr = (packet->RTR == CAN_RTR_Remote) ? F32_RTR : 0;
+
+	if ( packet->IDE == CAN_Id_Extended )
+	{
+		return F32_EXID(packet->ExtId) | F32_IDE | rtr;
+	}
+
+	return ((packet->StdId & 0x7FF) << 21) | rtr;
+}
@@ -0,0 +1,66 @@
+/********************************************************************
+can_filter.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef CAN_FILTER_H
+#define CAN_FILTER_H
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "stm32f4xx_can.h"
+#include "can_rx_index.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// bxCAN has 28 filter banks shared by CAN1 and CAN2.  We split them evenly,
+// which is also the reset value of the CAN2 start bank.
+#define CAN_FILTER_BANK_COUNT       (28)
+#define CAN_FILTER_CAN2_START_BANK  (14)
+#define CAN_FILTER_BANKS_PER_MODULE (CAN_FILTER_CAN2_START_BANK)
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * Contents of one filter bank, laid out like the matching fields of
+ * CAN_FilterInitTypeDef so they can be copied straight across.
+ */
+typedef struct
+{
+	uint8_t   mode;           // CAN_FilterMode_IdMask or CAN_FilterMode_IdList
+	uint8_t   scale;          // CAN_FilterScale_16bit or CAN_FilterScale_32bit
+	uint16_t  id_high;
+	uint16_t  id_low;
+	uint16_t  mask_id_high;
+	uint16_t  mask_id_low;
+} CANFilterBank_t;
+
+/****************************************************************************
+ * Public Prototypes
+ ***************************************************************************/
+
+uint8_t can_filter_build ( const CANRXIndex_t *index, CANFilterBank_t *banks,
+                           uint8_t max_banks, bool *pass_all );
+bool    can_filter_match ( const CANFilterBank_t *banks, uint8_t bank_count,
+                           const CanRxMsg *packet );
+
+#endif /* CAN_FILTER_H */
@@ -0,0 +1,228 @@
+/********************************************************************
+can_rx_index.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "can_rx_index.h"
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static uint16_t can_rx_index_lower_bound ( const CANRXIndex_t *index, CANPacketId_t id );
+static void     can_rx_index_select      ( const CANRXIndex_t *index, const CanRxMsg *packet,
+                                           CANPacketId_t *id, CANPacketId_t *key,
+                                           uint16_t *first, uint16_t *last );
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+void can_rx_index_init ( CANRXIndex_t *index )
+{
+	index->exact_count = 0;
+	index->masked_count = 0;
+	index->masked_std_count = 0;
+}
+
+/**
+ * Adds a handler to the index.  The sorted exact table is kept up to date by
+ * insertion, so all the work happens here rather than per frame.
+ * @param index - Index to add to.
+ * @param entry - Handler to add.
+ * @return False if the index is full.
+ */
+bool can_rx_index_add ( CANRXIndex_t *index, const CANRXEntry_t *entry )
+{
+	if ( index->exact_count + index->masked_count >= CAN_MAX_PACKET_HANDLER )
+	{
+		return false;
+	}
+
+	bool ext = (entry->ide == CAN_Id_Extended);
+	CANPacketIDMask_t full = ext ? CAN_EXT_ID_MASK : CAN_STD_ID_MASK;
+	uint16_t i;
+
+	// Handlers that ignore ID bits are scanned.  So are handlers whose value
+	// lies outside their ID space: they can never match, and keeping them out
+	// of the exact table stops them colliding with the other space's keys.
+	if ( (entry->mask & full) != full || (entry->id_after_mask & ~full) != 0 )
+	{
+		if ( ext )
+		{
+			index->masked[index->masked_count++] = *entry;
+			return true;
+		}
+
+		// Standard handlers go at the end of the standard partition, which
+		// pushes the extended ones up by one.
+		for ( i = index->masked_count; i > index->masked_std_count; i-- )
+		{
+			index->masked[i] = index->masked[i - 1];
+		}
+
+		index->masked[i] = *entry;
+		index->masked_std_count++;
+		index->masked_count++;
+		return true;
+	}
+
+	CANPacketId_t key = ext ? (entry->id_after_mask | CAN_RX_INDEX_EXT_FLAG)
+	                        : entry->id_after_mask;
+
+	// Insertion sort step.  Stopping at the first ID that is not larger keeps
+	// handlers for the same ID in registration order.
+	i = index->exact_count;
+
+	while ( i > 0 && index->exact[i - 1].id > key )
+	{
+		index->exact[i] = index->exact[i - 1];
+		i--;
+	}
+
+	index->exact[i].id = key;
+	index->exact[i].callback = entry->callback;
+	index->exact_count++;
+
+	return true;
+}
+
+/**
+ * Collects the handlers that match the packet, in the order they are to be
+ * called: exact handlers first, then masked handlers.  Nothing is called, so
+ * a caller can take the snapshot under a lock and run the handlers after
+ * releasing it.  Since the index never holds more than
+ * CAN_MAX_PACKET_HANDLER handlers, that many slots is always enough.
+ * @param index - Index to search.
+ * @param packet - Received packet.
+ * @param callbacks - Filled with the matching handlers.
+ * @return Number of handlers written to callbacks.
+ */
+uint16_t can_rx_index_lookup ( const CANRXIndex_t *index, const CanRxMsg *packet,
+                               CANRXHandlerFxn callbacks[CAN_MAX_PACKET_HANDLER] )
+{
+	CANPacketId_t id, key;
+	uint16_t first, last;
+	uint16_t count = 0;
+
+	can_rx_index_select( index, packet, &id, &key, &first, &last );
+
+	for ( uint16_t i = can_rx_index_lower_bound( index, key );
+		  i < index->exact_count && index->exact[i].id == key; i++ )
+	{
+		callbacks[count++] = index->exact[i].callback;
+	}
+
+	for ( uint16_t i = first; i < last; i++ )
+	{
+		if ( (id & index->masked[i].mask) == index->masked[i].id_after_mask )
+		{
+			callbacks[count++] = index->masked[i].callback;
+		}
+	}
+
+	return count;
+}
+
+/**
+ * Calls every handler that matches the packet: exact handlers first, then
+ * masked handlers.  The index must not change during the call; see
+ * can_rx_index_lookup for callers that cannot guarantee that.
+ * @param index - Index to dispatch through.
+ * @param packet - Received packet.
+ * @return Number of handlers called.
+ */
+uint16_t can_rx_index_dispatch ( const CANRXIndex_t *index, CanRxMsg *packet )
+{
+	CANPacketId_t id, key;
+	uint16_t first, last;
+	uint16_t calls = 0;
+
+	can_rx_index_select( index, packet, &id, &key, &first, &last );
+
+	for ( uint16_t i = can_rx_index_lower_bound( index, key );
+		  i < index->exact_count && index->exact[i].id == key; i++ )
+	{
+		index->exact[i].callback(packet);
+		calls++;
+	}
+
+	for ( uint16_t i = first; i < last; i++ )
+	{
+		if ( (id & index->masked[i].mask) == index->masked[i].id_after_mask )
+		{
+			index->masked[i].callback(packet);
+			calls++;
+		}
+	}
+
+	return calls;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+ * Returns the position of the first exact handler with an ID >= id.
+ */
+static uint16_t can_rx_index_lower_bound ( const CANRXIndex_t *index, CANPacketId_t id )
+{
+	uint16_t lo = 0;
+	uint16_t hi = index->exact_count;
+
+	while ( lo < hi )
+	{
+		uint16_t mid = (lo + hi) / 2;
+
+		if ( index->exact[mid].id < id )
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/**
+ * Picks out the frame's ID, its key in the exact table and the range of the
+ * masked list that belongs to its ID space.
+ */
+static void can_rx_index_select ( const CANRXIndex_t *index, const CanRxMsg *packet,
+                                  CANPacketId_t *id, CANPacketId_t *key,
+                                  uint16_t *first, uint16_t *last )
+{
+	if ( packet->IDE == CAN_Id_Extended )
+	{
+		*id = packet->ExtId;
+		*key = *id | CAN_RX_INDEX_EXT_FLAG;
+		*first = index->masked_std_count;
+		*last = index->masked_count;
+	}
+	else
+	{
+		*id = packet->StdId;
+		*key = *id;
+		*first = 0;
+		*last = index->masked_std_count;
+	}
+}
@@ -0,0 +1,102 @@
+/********************************************************************
+can_rx_index.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef CAN_RX_INDEX_H
+#define CAN_RX_INDEX_H
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "stm32f4xx_can.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#ifndef CAN_MAX_PACKET_HANDLER
+#define CAN_MAX_PACKET_HANDLER		(32)
+#endif
+
+#define CAN_STD_ID_MASK             ((CANPacketIDMask_t)0x7FF)
+#define CAN_EXT_ID_MASK             ((CANPacketIDMask_t)0x1FFFFFFF)
+
+// Set in CANRXExact_t.id for extended IDs so both ID spaces share one sorted
+// table without colliding.  Standard IDs sort first.
+#define CAN_RX_INDEX_EXT_FLAG       ((CANPacketId_t)0x80000000)
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef uint32_t CANPacketIDMask_t;
+typedef uint32_t CANPacketId_t;
+
+/**
+ * CAN Packet Handler
+ * @param packet - new packet to be handled.
+ */
+typedef void (*CANRXHandlerFxn)(CanRxMsg * packet);
+
+/**
+ * A handler matches a frame when the frame's IDE equals ide and
+ * (id & mask) == id_after_mask, where id is StdId or ExtId accordingly.
+ * ide defaults to CAN_Id_Standard when left zero.
+ */
+typedef struct
+{
+	CANPacketIDMask_t  mask;
+	CANPacketId_t      id_after_mask;
+	CANRXHandlerFxn    callback;
+	uint8_t            ide;        // CAN_Id_Standard or CAN_Id_Extended
+} CANRXEntry_t;
+
+typedef struct
+{
+	CANPacketId_t      id;         // ID, OR'd with CAN_RX_INDEX_EXT_FLAG if extended
+	CANRXHandlerFxn    callback;
+} CANRXExact_t;
+
+/**
+ * Receive dispatch index.  Handlers whose mask covers the whole ID are exact
+ * matches and are kept sorted by ID for a binary search; the rest are kept in
+ * a short list that is scanned linearly.  The masked list is partitioned,
+ * standard handlers first, so a frame only scans handlers for its own ID
+ * space.  Registration order is preserved among handlers for the same exact
+ * ID and among the masked handlers of each ID space.
+ */
+typedef struct
+{
+	CANRXExact_t  exact[CAN_MAX_PACKET_HANDLER];
+	CANRXEntry_t  masked[CAN_MAX_PACKET_HANDLER];
+	uint16_t      exact_count;
+	uint16_t      masked_count;
+	uint16_t      masked_std_count;   // masked[0..masked_std_count) are standard
+} CANRXIndex_t;
+
+/****************************************************************************
+ * Public Prototypes
+ ***************************************************************************/
+
+void     can_rx_index_init     ( CANRXIndex_t *index );
+bool     can_rx_index_add      ( CANRXIndex_t *index, const CANRXEntry_t *entry );
+uint16_t can_rx_index_lookup   ( const CANRXIndex_t *index, const CanRxMsg *packet,
+                                 CANRXHandlerFxn callbacks[CAN_MAX_PACKET_HANDLER] );
+uint16_t can_rx_index_dispatch ( const CANRXIndex_t *index, CanRxMsg *packet );
+
+#endif /* CAN_RX_INDEX_H */
@@ -0,0 +1,369 @@
+/********************************************************************
+can_tx_sched.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "can_tx_sched.h"
+#include "string.h"
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static bool can_tx_sched_before ( const CANTxSchedEntry_t *a, const CANTxSchedEntry_t *b );
+static bool can_tx_sched_insert ( CANTxSched_t *sched, const CANTxSchedEntry_t *entry );
+static void can_tx_sched_take   ( CANTxSched_t *sched, CANTxSchedEntry_t *entry, uint32_t now );
+static void can_tx_sched_up     ( CANTxSched_t *sched, uint16_t i );
+static void can_tx_sched_down   ( CANTxSched_t *sched, uint16_t i );
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Inits a transmit scheduler.
+ * @param sched - Scheduler to init.
+ * @param storage - Array of depth entries to hold the pending frames.
+ * @param depth - Maximum number of pending frames.
+ */
+void can_tx_sched_init ( CANTxSched_t *sched, CANTxSchedEntry_t *storage, uint16_t depth )
+{
+	sched->heap = storage;
+	sched->depth = depth;
+	sched->count = 0;
+	sched->seq = 0;
+	sched->loaded = 0;
+	sched->aborting = 0;
+	memset( &(sched->stats), 0, sizeof(CANTxStats_t) );
+}
+
+/**
+ * Packs the arbitration field of a frame into a key that sorts the same way
+ * the bus arbitrates: bit for bit in transmission order, dominant (0) first.
+ *
+ *   standard: [ID10..0][RTR][IDE=0][        0         ][0]
+ *   extended: [ID28..18][SRR=1][IDE=1][ID17..0][RTR]
+ *
+ * So a standard frame beats an extended frame with the same base ID, and a
+ * data frame beats a remote frame with the same ID.
+ * @param msg - Frame to build the key for.
+ */
+uint32_t can_tx_sched_key ( const CanTxMsg *msg )
+{
+	uint32_t rtr = (msg->RTR == CAN_RTR_Remote) ? 1 : 0;
+
+	if ( msg->IDE == CAN_Id_Extended )
+	{
+		return ((msg->ExtId >> 18) & 0x7FF) << 21 | (1 << 20) | (1 << 19)
+				| (msg->ExtId & 0x3FFFF) << 1 | rtr;
+	}
+
+	return (msg->StdId & 0x7FF) << 21 | (rtr << 20);
+}
+
+/**
+ * Adds a frame to the scheduler.
+ *
+ * When full, the lowest priority pending frame is dropped to make room if the
+ * new frame outranks it; otherwise the new frame is dropped.  Either way the
+ * drop is counted.
+ * @param sched - Scheduler.
+ * @param msg - Frame to queue.
+ * @param coalesce - If true and a coalescing frame with the same arbitration
+ * field is still pending, its payload is replaced instead of queueing a second
+ * copy.  Use for periodic status frames where only the latest value matters.
+ * @param now - Current time, used for latency accounting.
+ * @return True if the frame was queued (or coalesced).
+ */
+bool can_tx_sched_push ( CANTxSched_t *sched, const CanTxMsg *msg, bool coalesce, uint32_t now )
+{
+	uint32_t key = can_tx_sched_key(msg);
+	uint16_t i;
+
+	if ( coalesce )
+	{
+		for ( i = 0; i < sched->count; i++ )
+		{
+			if ( sched->heap[i].coalesce && sched->heap[i].key == key )
+			{
+				// Same key, so the heap position is still valid.  Keep the
+				// original timestamp so latency reflects the oldest wait.
+				sched->heap[i].msg = *msg;
+				sched->stats.coalesced++;
+				return true;
+			}
+		}
+	}
+
+	CANTxSchedEntry_t entry = {
+		.msg = *msg,
+		.key = key,
+		.seq = sched->seq++,
+		.enqueued = now,
+		.coalesce = coalesce
+	};
+
+	if ( !can_tx_sched_insert( sched, &entry ) ) return false;
+
+	sched->stats.queued++;
+	return true;
+}
+
+/**
+ * Copies out the most urgent pending frame without removing it.
+ *
+ * Holds the frame back while a frame with the same arbitration field is still
+ * in a mailbox: with identifier priority the controller would otherwise be
+ * free to send the two in either order.
+ * @return False if nothing is pending or the next frame must wait.
+ */
+bool can_tx_sched_peek ( CANTxSched_t *sched, CanTxMsg *msg )
+{
+	uint8_t mb;
+
+	if ( sched->count == 0 ) return false;
+
+	for ( mb = 0; mb < CAN_TX_SCHED_MAILBOXES; mb++ )
+	{
+		if ( (sched->loaded & (1 << mb)) && sched->mailbox[mb].key == sched->heap[0].key )
+		{
+			return false;
+		}
+	}
+
+	*msg = sched->heap[0].msg;
+	return true;
+}
+
+/**
+ * Removes the most urgent pending frame.  Call once the frame has been
+ * accepted by a mailbox.
+ * @param now - Current time, used for latency accounting.
+ * @return False if nothing is pending.
+ */
+bool can_tx_sched_pop ( CANTxSched_t *sched, CanTxMsg *msg, uint32_t now )
+{
+	CANTxSchedEntry_t entry;
+
+	if ( sched->count == 0 ) return false;
+
+	can_tx_sched_take( sched, &entry, now );
+
+	if ( msg != NULL )
+	{
+		*msg = entry.msg;
+	}
+
+	return true;
+}
+
+uint16_t can_tx_sched_count ( const CANTxSched_t *sched )
+{
+	return sched->count;
+}
+
+/**
+ * Removes the most urgent pending frame and records it as loaded into a
+ * mailbox.  Call once the frame returned by can_tx_sched_peek has been
+ * accepted by that mailbox.
+ * @param mailbox - Mailbox the controller placed the frame in.
+ * @param now - Current time, used for latency accounting.
+ */
+void can_tx_sched_load ( CANTxSched_t *sched, uint8_t mailbox, uint32_t now )
+{
+	if ( sched->count == 0 || mailbox >= CAN_TX_SCHED_MAILBOXES ) return;
+
+	can_tx_sched_take( sched, &(sched->mailbox[mailbox]), now );
+	sched->loaded |= 1 << mailbox;
+}
+
+/**
+ * Picks a mailbox to abort so the most urgent pending frame can take its
+ * place.  Only applies when every mailbox is loaded, no abort is already
+ * outstanding and the pending frame strictly outranks the lowest priority
+ * mailbox frame (equal IDs are never reordered).  The caller requests the
+ * abort and later reports the outcome through can_tx_sched_done.
+ * @return Mailbox to abort, or -1 if none.
+ */
+int8_t can_tx_sched_preempt ( CANTxSched_t *sched )
+{
+	uint8_t all = (1 << CAN_TX_SCHED_MAILBOXES) - 1;
+	uint8_t worst = 0;
+	uint8_t mb;
+
+	if ( sched->count == 0 || sched->loaded != all || sched->aborting != 0 ) return -1;
+
+	for ( mb = 1; mb < CAN_TX_SCHED_MAILBOXES; mb++ )
+	{
+		if ( can_tx_sched_before( &(sched->mailbox[worst]), &(sched->mailbox[mb]) ) )
+		{
+			worst = mb;
+		}
+	}
+
+	if ( sched->heap[0].key >= sched->mailbox[worst].key ) return -1;
+
+	sched->aborting |= 1 << worst;
+	return worst;
+}
+
+/**
+ * Reports that a mailbox has completed, either by sending its frame or by
+ * being aborted.  An aborted frame goes back into the scheduler with its
+ * original sequence number and timestamp, so it keeps its place among frames
+ * with the same ID and its latency covers the whole wait.
+ * @param mailbox - Mailbox that completed.
+ * @param sent - True if the frame went out on the bus.
+ */
+void can_tx_sched_done ( CANTxSched_t *sched, uint8_t mailbox, bool sent )
+{
+	uint8_t bit = 1 << mailbox;
+
+	if ( mailbox >= CAN_TX_SCHED_MAILBOXES || !(sched->loaded & bit) ) return;
+
+	sched->loaded &= ~bit;
+	sched->aborting &= ~bit;
+
+	if ( !sent )
+	{
+		sched->stats.preempted++;
+		can_tx_sched_insert( sched, &(sched->mailbox[mailbox]) );
+	}
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static bool can_tx_sched_before ( const CANTxSchedEntry_t *a, const CANTxSchedEntry_t *b )
+{
+	if ( a->key != b->key ) return a->key < b->key;
+
+	// Equal keys go out in submission order (wrap safe).
+	return (int32_t)(a->seq - b->seq) < 0;
+}
+
+/**
+ * Places an entry in the heap.  When full, the lowest priority pending frame
+ * is dropped to make room if the entry outranks it; otherwise the entry is
+ * dropped.  Either way the drop is counted.
+ */
+static bool can_tx_sched_insert ( CANTxSched_t *sched, const CANTxSchedEntry_t *entry )
+{
+	uint16_t i;
+
+	if ( sched->count < sched->depth )
+	{
+		i = sched->count++;
+	}
+	else
+	{
+		// Full.  The lowest priority frame is always a leaf.
+		uint16_t worst = sched->count / 2;
+
+		for ( i = worst + 1; i < sched->count; i++ )
+		{
+			if ( can_tx_sched_before( &(sched->heap[worst]), &(sched->heap[i]) ) )
+			{
+				worst = i;
+			}
+		}
+
+		sched->stats.dropped++;
+
+		if ( sched->depth == 0 || !can_tx_sched_before( entry, &(sched->heap[worst]) ) )
+		{
+			return false;
+		}
+
+		i = worst;
+	}
+
+	sched->heap[i] = *entry;
+	can_tx_sched_up( sched, i );
+
+	if ( sched->count > sched->stats.depth_max )
+	{
+		sched->stats.depth_max = sched->count;
+	}
+
+	return true;
+}
+
+/**
+ * Removes the head of the heap into entry and accounts its latency.  The heap
+ * must not be empty.
+ */
+static void can_tx_sched_take ( CANTxSched_t *sched, CANTxSchedEntry_t *entry, uint32_t now )
+{
+	*entry = sched->heap[0];
+
+	uint32_t latency = now - entry->enqueued;
+	sched->stats.sent++;
+	sched->stats.latency_sum += latency;
+	if ( latency > sched->stats.latency_max )
+	{
+		sched->stats.latency_max = latency;
+	}
+
+	sched->count--;
+	if ( sched->count > 0 )
+	{
+		sched->heap[0] = sched->heap[sched->count];
+		can_tx_sched_down( sched, 0 );
+	}
+}
+
+static void can_tx_sched_up ( CANTxSched_t *sched, uint16_t i )
+{
+	CANTxSchedEntry_t *heap = sched->heap;
+
+	while ( i > 0 )
+	{
+		uint16_t parent = (i - 1) / 2;
+
+		if ( !can_tx_sched_before( &heap[i], &heap[parent] ) ) break;
+
+		CANTxSchedEntry_t tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+static void can_tx_sched_down ( CANTxSched_t *sched, uint16_t i )
+{
+	CANTxSchedEntry_t *heap = sched->heap;
+
+	for (;;)
+	{
+		uint16_t best = i;
+		uint16_t l = 2 * i + 1;
+		uint16_t r = l + 1;
+
+		if ( l < sched->count && can_tx_sched_before( &heap[l], &heap[best] ) ) best = l;
+		if ( r < sched->count && can_tx_sched_before( &heap[r], &heap[best] ) ) best = r;
+
+		if ( best == i ) break;
+
+		CANTxSchedEntry_t tmp = heap[i];
+		heap[i] = heap[best];
+		heap[best] = tmp;
+		i = best;
+	}
+}
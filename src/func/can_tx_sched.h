@@ -0,0 +1,105 @@
+/********************************************************************
+can_tx_sched.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef CAN_TX_SCHED_H
+#define CAN_TX_SCHED_H
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "stm32f4xx_can.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define CAN_TX_SCHED_MAILBOXES  (3)
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * One pending frame.  key is the frame's arbitration field packed so that a
+ * smaller key wins arbitration on the bus; seq keeps frames with equal keys
+ * in submission order.
+ */
+typedef struct
+{
+	CanTxMsg  msg;
+	uint32_t  key;
+	uint32_t  seq;
+	uint32_t  enqueued;
+	bool      coalesce;
+} CANTxSchedEntry_t;
+
+typedef struct
+{
+	uint32_t  queued;       // frames accepted into the scheduler
+	uint32_t  sent;         // frames handed to a mailbox (again if preempted)
+	uint32_t  coalesced;    // periodic frames that replaced a pending copy
+	uint32_t  dropped;      // frames lost because the scheduler was full
+	uint32_t  preempted;    // mailbox frames aborted for a more urgent one
+	uint32_t  latency_max;  // worst time from push to mailbox, in ticks
+	uint32_t  latency_sum;  // total time from push to mailbox, in ticks
+	uint16_t  depth_max;    // high-water mark of pending frames
+} CANTxStats_t;
+
+/**
+ * Software transmit backlog ordered like the bus orders it: a binary min-heap
+ * on the arbitration field, so whenever a mailbox frees up the most urgent
+ * pending frame goes next regardless of when it was submitted.
+ *
+ * It also tracks what sits in each hardware mailbox.  The controller must
+ * arbitrate its mailboxes by identifier (bxCAN TXFP = 0).  When all mailboxes
+ * are loaded and a pending frame outranks one of them, can_tx_sched_preempt
+ * names the mailbox to abort, and the aborted frame goes back into the heap.
+ * So a pending frame never waits behind a lower priority frame in a mailbox,
+ * except one whose transmission has already started.
+ *
+ * The scheduler is pure data and does no locking; the caller must serialize
+ * access (can.c does so with a critical section) and supplies the time.
+ */
+typedef struct
+{
+	CANTxSchedEntry_t  *heap;
+	uint16_t            depth;
+	uint16_t            count;
+	uint32_t            seq;
+	CANTxSchedEntry_t   mailbox[CAN_TX_SCHED_MAILBOXES];
+	uint8_t             loaded;     // bit per mailbox holding a frame
+	uint8_t             aborting;   // bit per mailbox with an abort requested
+	CANTxStats_t        stats;
+} CANTxSched_t;
+
+/****************************************************************************
+ * Public Prototypes
+ ***************************************************************************/
+
+void     can_tx_sched_init       ( CANTxSched_t *sched, CANTxSchedEntry_t *storage, uint16_t depth );
+uint32_t can_tx_sched_key        ( const CanTxMsg *msg );
+bool     can_tx_sched_push       ( CANTxSched_t *sched, const CanTxMsg *msg, bool coalesce, uint32_t now );
+bool     can_tx_sched_peek       ( CANTxSched_t *sched, CanTxMsg *msg );
+bool     can_tx_sched_pop        ( CANTxSched_t *sched, CanTxMsg *msg, uint32_t now );
+uint16_t can_tx_sched_count      ( const CANTxSched_t *sched );
+void     can_tx_sched_load       ( CANTxSched_t *sched, uint8_t mailbox, uint32_t now );
+int8_t   can_tx_sched_preempt    ( CANTxSched_t *sched );
+void     can_tx_sched_done       ( CANTxSched_t *sched, uint8_t mailbox, bool sent );
+
+#endif /* CAN_TX_SCHED_H */
@@ -21,16 +21,28 @@ GNU General Public License for more details.
 #include "foc.h"
 #include "math.h"
 #include "arm_math.h"
+#include "math_limits.h"
 
 /****************************************************************************
  * Definitions
  ***************************************************************************/
 
-#define max(a,b)	(((a) > (b)) ? (a) : (b))
-#define min(a,b)	(((a) < (b)) ? (a) : (b))
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
 
-#define max3(a,b,c) (max((a), max((b),(c))))
-#define min3(a,b,c) (min((a), min((b),(c))))
+static inline void foc_clarke     ( float Ia, float Ib, float *Ialpha, float *Ibeta );
+static inline void foc_park       ( float Ialpha, float Ibeta, float s, float c,
+                                    float *Id, float *Iq );
+static inline void foc_inv_park   ( float Vd, float Vq, float s, float c,
+                                    float *Valpha, float *Vbeta );
+static inline void foc_inv_clarke ( float Valpha, float Vbeta,
+                                    float *Va, float *Vb, float *Vc );
+static inline void foc_svm        ( float Va, float Vb, float Vc, float Vbus,
+                                    float *V1, float *V2, float *V3, float *Vk );
+static inline float foc_svm_project ( float *Va, float *Vb, float *Vc, float Vbus );
+static focSvmMode_t foc_svm_select ( focControl_t *foc );
+static bool         foc_dpwm_top   ( focSvmMode_t mode, float Va, float Vb, float Vc );
 
 /****************************************************************************
  * Public Functions
@@ -46,8 +58,7 @@ GNU General Public License for more details.
  */
 void FOC_Clarke ( focControl_t *foc )
 {
-	foc->Ialpha = foc->Ia;
-	foc->Ibeta  = ((1.0f/sqrtf(3.0f)) * foc->Ia) + ((2.0f/sqrtf(3.0f)) * foc->Ib);
+	foc_clarke(foc->Ia, foc->Ib, &(foc->Ialpha), &(foc->Ibeta));
 }
 
 /**
@@ -62,6 +73,22 @@ void FOC_SinCos ( focControl_t *foc )
 	arm_sin_cos_f32(foc->theta,&(foc->sinTheta),&(foc->cosTheta));
 }
 
+/**
+ * Same as FOC_SinCos, for an angle kept as a phase accumulator.  Uses the
+ * interpolated table in foc_angle.c rather than arm_sin_cos_f32 and sets
+ * theta to match.
+ * @param foc - FOC data structure.
+ * @param phase - Rotor electrical angle.
+ * [OUT] theta
+ * [OUT] sinTheta
+ * [OUT] cosTheta
+ */
+void FOC_SinCosPhase ( focControl_t *foc, focPhase_t phase )
+{
+	foc->theta = FOC_PhaseToDegrees(phase);
+	FOC_PhaseSinCos(phase, &(foc->sinTheta), &(foc->cosTheta));
+}
+
 /**
  * Does the Ialpha,Ibeta->Id,Iq transform.
  * @param foc - FOC data structure.
@@ -74,8 +101,7 @@ void FOC_SinCos ( focControl_t *foc )
  */
 void FOC_Park ( focControl_t *foc )
 {
-	foc->Id =  foc->Ialpha * foc->cosTheta + foc->Ibeta * foc->sinTheta;
-	foc->Iq = -foc->Ialpha * foc->sinTheta + foc->Ibeta * foc->cosTheta;
+	foc_park(foc->Ialpha, foc->Ibeta, foc->sinTheta, foc->cosTheta, &(foc->Id), &(foc->Iq));
 }
 
 /**
@@ -90,8 +116,7 @@ void FOC_Park ( focControl_t *foc )
  */
 void FOC_InvPark ( focControl_t *foc )
 {
-	foc->Valpha = foc->Vd * foc->cosTheta - foc->Vq * foc->sinTheta;
-	foc->Vbeta =  foc->Vd * foc->sinTheta + foc->Vq * foc->cosTheta;
+	foc_inv_park(foc->Vd, foc->Vq, foc->sinTheta, foc->cosTheta, &(foc->Valpha), &(foc->Vbeta));
 }
 
 /**
@@ -105,44 +130,373 @@ void FOC_InvPark ( focControl_t *foc )
  */
 void FOC_InvClarke ( focControl_t *foc )
 {
-	foc->Va = foc->Valpha;
-	foc->Vb = -foc->Valpha * 0.5f + sqrtf(3.0f)/2.0f * foc->Vbeta;
-	foc->Vc = -foc->Valpha * 0.5f - sqrtf(3.0f)/2.0f * foc->Vbeta;
+	foc_inv_clarke(foc->Valpha, foc->Vbeta, &(foc->Va), &(foc->Vb), &(foc->Vc));
 }
 
 /**
  * Uses space vector modulation to determine the PWM vectors to apply to the motor.
+ * The zero sequence comes from svmMode (see focSvmMode_t).  In DPWM modes
+ * clampedPhase (0-2 for a-c, or FOC_PHASE_NONE) and clampedHigh tell the
+ * timer driver which leg can be left parked on a rail this period.
+ *
+ * A vector outside the hexagon (overmodulation) is scaled back onto its
+ * edge, keeping its angle, before modulating.  Va, Vb and Vc, and Valpha,
+ * Vbeta, Vd and Vq with them, are updated to what was actually applied, so
+ * Vd and Vq can go straight to PI_Track.
  * @param foc - FOC data structure.
  * [IN]  Va
  * [IN]  Vb
  * [IN]  Vc
+ * [IN]  Vbus
+ * [IN]  svmMode
  * [OUT] Va
  * [OUT] Vb
  * [OUT] Vc
+ * [OUT] Valpha, Vbeta, Vd, Vq - Scaled with the vector in overmodulation.
  * [OUT] V1
  * [OUT] V2
  * [OUT] V3
  * [OUT] Vk
+ * [OUT] Da, Db, Dc - Duty cycles, 0 to 1.
+ * [OUT] modIndex - Voltage vector length, 1.0 at the edge of the linear range.
+ * [OUT] svmActive - Mode actually used (differs from svmMode in FOC_SVM_AUTO).
+ * [OUT] clampedPhase
+ * [OUT] clampedHigh
  */
 void FOC_SVM( focControl_t *foc )
 {
-	//foc->Va *= 0.5f;
-	//foc->Vb *= 0.5f;
-	//foc->Vc *= 0.5f;
+	focSvmMode_t mode = foc_svm_select(foc);
+
+	float scale = foc_svm_project(&(foc->Va), &(foc->Vb), &(foc->Vc), foc->Vbus);
+
+	if ( scale < 1.0f )
+	{
+		foc->Valpha *= scale;
+		foc->Vbeta *= scale;
+		foc->Vd *= scale;
+		foc->Vq *= scale;
+	}
+
+	if ( mode == FOC_SVM_SVPWM )
+	{
+		foc_svm(foc->Va, foc->Vb, foc->Vc, foc->Vbus, &(foc->V1), &(foc->V2), &(foc->V3), &(foc->Vk));
+		foc->clampedPhase = FOC_PHASE_NONE;
+		foc->clampedHigh = false;
+	}
+	else
+	{
+		float v[3] = { foc->Va, foc->Vb, foc->Vc };
+		float halfVbus = 0.5f * foc->Vbus;
+		int8_t hi = 0, lo = 0;
 
-	foc->Vk = ( ( max3(foc->Va, foc->Vb, foc->Vc) + min3(foc->Va, foc->Vb, foc->Vc) ) * 0.5f );
+		for ( int8_t i = 1; i < 3; i++ )
+		{
+			if ( v[i] > v[hi] ) hi = i;
+			if ( v[i] < v[lo] ) lo = i;
+		}
 
-	float halfVbus = 0.5f * foc->Vbus;
+		// Clamping the highest leg to the top rail (or the lowest to the
+		// bottom) is the only choice that keeps the other two in range.
+		if ( foc_dpwm_top(mode, foc->Va, foc->Vb, foc->Vc) )
+		{
+			foc->Vk = v[hi] - halfVbus;
+			foc->clampedPhase = hi;
+			foc->clampedHigh = true;
+		}
+		else
+		{
+			foc->Vk = v[lo] + halfVbus;
+			foc->clampedPhase = lo;
+			foc->clampedHigh = false;
+		}
 
-	foc->V1 = (foc->Va - foc->Vk) + halfVbus;
-	foc->V2 = (foc->Vb - foc->Vk) + halfVbus;
-	foc->V3 = (foc->Vc - foc->Vk) + halfVbus;
+		foc->V1 = (foc->Va - foc->Vk) + halfVbus;
+		foc->V2 = (foc->Vb - foc->Vk) + halfVbus;
+		foc->V3 = (foc->Vc - foc->Vk) + halfVbus;
+	}
+
+	if ( foc->Vbus > 0.0f )
+	{
+		float invVbus = 1.0f / foc->Vbus;
+
+		foc->Da = limitf32(foc->V1 * invVbus, 1.0f, 0.0f);
+		foc->Db = limitf32(foc->V2 * invVbus, 1.0f, 0.0f);
+		foc->Dc = limitf32(foc->V3 * invVbus, 1.0f, 0.0f);
+	}
+	else
+	{
+		foc->Da = foc->Db = foc->Dc = 0.0f;
+	}
 }
 
+/**
+ * Limits Vd,Vq to a circle before InvPark, so saturated current regulators
+ * give up torque (q) before flux (d) instead of clipping independently.
+ * Feed Vd and Vq back with PI_Track after FOC_SVM, which scales them again
+ * if it had to overmodulate, so the regulators do not wind up.
+ * @param foc - FOC data structure.
+ * @param modIndexMax - Radius as a modulation index: FOC_MOD_INDEX_LINEAR
+ * for the circle inscribed in the hexagon, up to FOC_MOD_INDEX_HEXAGON to
+ * let FOC_SVM overmodulate into the corners of the hexagon for more
+ * voltage at top speed.
+ * [IN]  Vbus
+ * [IN]  Vd
+ * [IN]  Vq
+ * [OUT] Vd
+ * [OUT] Vq
+ * @return True if either axis was limited.
+ */
+bool FOC_LimitVoltage ( focControl_t *foc, float modIndexMax )
+{
+	float vMax = modIndexMax * foc->Vbus * (1.0f/sqrtf(3.0f));
+	float vd = limitf32(foc->Vd, vMax, -vMax);
+	float vqMax = sqrt_f32(maxf32(vMax * vMax - vd * vd, 0.0f));
+	float vq = limitf32(foc->Vq, vqMax, -vqMax);
+	bool limited = (vd != foc->Vd) || (vq != foc->Vq);
+
+	foc->Vd = vd;
+	foc->Vq = vq;
+
+	return limited;
+}
+
+/**
+ * Runs the whole chain in one call: Clarke, SinCos, Park, InvPark,
+ * InvClarke and SVM.  Vd and Vq are whatever the current regulators last
+ * produced, so this is the usual "measure, then apply the last command"
+ * ordering of a current loop that updates its PIs between calls.
+ *
+ * Every output is identical, bit for bit, to calling the stages one by one.
+ * @param foc - FOC data structure.
+ * [IN]  Ia, Ib, theta, Vd, Vq, Vbus
+ * [OUT] everything else
+ */
+void FOC_Step ( focControl_t *foc )
+{
+	arm_sin_cos_f32(foc->theta, &(foc->sinTheta), &(foc->cosTheta));
+
+	foc_clarke(foc->Ia, foc->Ib, &(foc->Ialpha), &(foc->Ibeta));
+	foc_park(foc->Ialpha, foc->Ibeta, foc->sinTheta, foc->cosTheta, &(foc->Id), &(foc->Iq));
+
+	foc_inv_park(foc->Vd, foc->Vq, foc->sinTheta, foc->cosTheta, &(foc->Valpha), &(foc->Vbeta));
+	foc_inv_clarke(foc->Valpha, foc->Vbeta, &(foc->Va), &(foc->Vb), &(foc->Vc));
+	FOC_SVM(foc);
+}
+
+/**
+ * FOC_Step over a structure of arrays, for several axes at once or for
+ * replaying a capture offline.  Intermediate values are kept in registers
+ * and only the outputs in focBatch_t are stored.  The modulation is always
+ * plain SVPWM, since the DPWM modes carry per-axis state.
+ *
+ * The sin/cos lookup runs as its own pass; the remaining two passes are
+ * branch free straight line code over restrict pointers, which GCC
+ * vectorizes on hosts with SIMD (and which keeps the M4 FPU pipeline full
+ * otherwise).  Results match FOC_Step exactly, but only for a FOC_Step
+ * whose svmMode is FOC_SVM_SVPWM; any other mode changes V1-V3.
+ * @param batch - Input and output arrays, all at least n long.
+ * @param n - Number of samples.
+ */
+void FOC_StepBatch ( const focBatch_t *batch, uint32_t n )
+{
+	const float * restrict Ia    = batch->Ia;
+	const float * restrict Ib    = batch->Ib;
+	const float * restrict Vd    = batch->Vd;
+	const float * restrict Vq    = batch->Vq;
+	const float * restrict Vbus  = batch->Vbus;
+	float * restrict sinTheta    = batch->sinTheta;
+	float * restrict cosTheta    = batch->cosTheta;
+	float * restrict Id          = batch->Id;
+	float * restrict Iq          = batch->Iq;
+	float * restrict V1          = batch->V1;
+	float * restrict V2          = batch->V2;
+	float * restrict V3          = batch->V3;
+	uint32_t i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		arm_sin_cos_f32(batch->theta[i], &sinTheta[i], &cosTheta[i]);
+	}
+
+	for ( i = 0; i < n; i++ )
+	{
+		float Ialpha, Ibeta;
+
+		foc_clarke(Ia[i], Ib[i], &Ialpha, &Ibeta);
+		foc_park(Ialpha, Ibeta, sinTheta[i], cosTheta[i], &Id[i], &Iq[i]);
+	}
+
+	for ( i = 0; i < n; i++ )
+	{
+		float Valpha, Vbeta, Va, Vb, Vc, Vk;
+
+		foc_inv_park(Vd[i], Vq[i], sinTheta[i], cosTheta[i], &Valpha, &Vbeta);
+		foc_inv_clarke(Valpha, Vbeta, &Va, &Vb, &Vc);
+		foc_svm_project(&Va, &Vb, &Vc, Vbus[i]);
+		foc_svm(Va, Vb, Vc, Vbus[i], &V1[i], &V2[i], &V3[i], &Vk);
+	}
+}
+
+/**
+ * Wraps an angle in degrees to +/-180.  Takes the same time for any angle.
+ */
 float FOC_WrapAngle( float angle )
 {
-  while (angle > 180.0f)  { angle -= 360.0f; }
-  while (angle < -180.0f) { angle += 360.0f; }
+  if ( angle > 180.0f || angle < -180.0f )
+  {
+    angle -= 360.0f * floorf((angle + 180.0f) * (1.0f / 360.0f));
+  }
 
   return angle;
 }
+
+/**
+ * Wraps an angle in radians to +/-pi.  Takes the same time for any angle.
+ */
+float FOC_WrapAngleRad( float angle )
+{
+  if ( angle > PI || angle < -PI )
+  {
+    angle -= (2.0f * PI) * floorf((angle + PI) * (1.0f / (2.0f * PI)));
+  }
+
+  return angle;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+// The stages are written once here and shared by the single stage, fused and
+// batch entry points so all three do exactly the same arithmetic.
+
+static inline void foc_clarke ( float Ia, float Ib, float *Ialpha, float *Ibeta )
+{
+	*Ialpha = Ia;
+	*Ibeta  = ((1.0f/sqrtf(3.0f)) * Ia) + ((2.0f/sqrtf(3.0f)) * Ib);
+}
+
+static inline void foc_park ( float Ialpha, float Ibeta, float s, float c,
+                              float *Id, float *Iq )
+{
+	*Id =  Ialpha * c + Ibeta * s;
+	*Iq = -Ialpha * s + Ibeta * c;
+}
+
+static inline void foc_inv_park ( float Vd, float Vq, float s, float c,
+                                  float *Valpha, float *Vbeta )
+{
+	*Valpha = Vd * c - Vq * s;
+	*Vbeta =  Vd * s + Vq * c;
+}
+
+static inline void foc_inv_clarke ( float Valpha, float Vbeta,
+                                    float *Va, float *Vb, float *Vc )
+{
+	*Va = Valpha;
+	*Vb = -Valpha * 0.5f + sqrtf(3.0f)/2.0f * Vbeta;
+	*Vc = -Valpha * 0.5f - sqrtf(3.0f)/2.0f * Vbeta;
+}
+
+static inline void foc_svm ( float Va, float Vb, float Vc, float Vbus,
+                             float *V1, float *V2, float *V3, float *Vk )
+{
+	float k = ( ( max3f32(Va, Vb, Vc) + min3f32(Va, Vb, Vc) ) * 0.5f );
+
+	float halfVbus = 0.5f * Vbus;
+
+	*Vk = k;
+	*V1 = (Va - k) + halfVbus;
+	*V2 = (Vb - k) + halfVbus;
+	*V3 = (Vc - k) + halfVbus;
+}
+
+/**
+ * Scales a vector outside the hexagon back onto it.  The line-to-line
+ * spread max - min can be at most Vbus; scaling all three phases keeps the
+ * angle (minimum phase error overmodulation).
+ * @return The scale applied, 1.0 if the vector was inside the hexagon.
+ */
+static inline float foc_svm_project ( float *Va, float *Vb, float *Vc, float Vbus )
+{
+	float spread = max3f32(*Va, *Vb, *Vc) - min3f32(*Va, *Vb, *Vc);
+	float k = 1.0f;
+
+	if ( spread > Vbus && spread > 0.0f )
+	{
+		k = maxf32(Vbus, 0.0f) / spread;
+
+		*Va *= k;
+		*Vb *= k;
+		*Vc *= k;
+	}
+
+	return k;
+}
+
+/**
+ * Updates modIndex and picks the modulation mode for this period.
+ */
+static focSvmMode_t foc_svm_select ( focControl_t *foc )
+{
+	float beta = (foc->Vb - foc->Vc) * (1.0f/sqrtf(3.0f));
+	float len = sqrt_f32(foc->Va * foc->Va + beta * beta);
+
+	foc->modIndex = (foc->Vbus > 0.0f) ? (sqrtf(3.0f) * len / foc->Vbus) : 0.0f;
+
+	if ( foc->svmMode != FOC_SVM_AUTO )
+	{
+		foc->svmActive = foc->svmMode;
+	}
+	else if ( foc->svmActive != FOC_SVM_DPWM1 )
+	{
+		foc->svmActive = (foc->modIndex > FOC_SVM_AUTO_DPWM_ENTER) ? FOC_SVM_DPWM1 : FOC_SVM_SVPWM;
+	}
+	else if ( foc->modIndex < FOC_SVM_AUTO_DPWM_EXIT )
+	{
+		foc->svmActive = FOC_SVM_SVPWM;
+	}
+
+	return foc->svmActive;
+}
+
+/**
+ * True if this period clamps the highest leg high, false if it clamps the
+ * lowest leg low.  DPWM1 clamps whichever leg is furthest from zero.
+ * DPWM0 and DPWM2 make the same decision on the phase voltages rotated by
+ * +30 and -30 degrees (line-to-line differences, which are the phase
+ * voltages rotated and scaled by sqrt(3)).  DPWM3 is the opposite of DPWM1.
+ */
+static bool foc_dpwm_top ( focSvmMode_t mode, float Va, float Vb, float Vc )
+{
+	float a = Va, b = Vb, c = Vc;
+
+	switch ( mode )
+	{
+	case FOC_SVM_DPWM0:
+		a = Va - Vb;
+		b = Vb - Vc;
+		c = Vc - Va;
+		break;
+
+	case FOC_SVM_DPWM2:
+		a = Va - Vc;
+		b = Vb - Va;
+		c = Vc - Vb;
+		break;
+
+	case FOC_SVM_DPWM3:
+		return ( max3f32(a, b, c) + min3f32(a, b, c) ) < 0.0f;
+
+	case FOC_SVM_DPWMMAX:
+		return true;
+
+	case FOC_SVM_DPWMMIN:
+		return false;
+
+	default:
+		break;
+	}
+
+	return ( max3f32(a, b, c) + min3f32(a, b, c) ) >= 0.0f;
+}
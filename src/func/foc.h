@@ -17,10 +17,57 @@ GNU General Public License for more details.
 #ifndef FOC_H_
 #define FOC_H_
 
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "foc_angle.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// FOC_SVM_AUTO switches to DPWM1 above the first modulation index and back
+// to SVPWM below the second.
+#define FOC_SVM_AUTO_DPWM_ENTER		(0.65f)
+#define FOC_SVM_AUTO_DPWM_EXIT		(0.55f)
+
+// Voltage limits for FOC_LimitVoltage.  1.0 is the circle inscribed in the
+// SVM hexagon; 2/sqrt(3) is the circle through its corners.  FOC_SVM
+// projects anything between the two back onto the hexagon's edge, which
+// adds harmonics but never reaches six-step.
+#define FOC_MOD_INDEX_LINEAR		(1.0f)
+#define FOC_MOD_INDEX_HEXAGON		(1.1547005f)
+
+#define FOC_PHASE_NONE				(-1)
+
 /****************************************************************************
  * Typedefs
  ***************************************************************************/
 
+/**
+ * Zero sequence used by FOC_SVM.  SVPWM centres the three legs; the DPWM
+ * modes clamp one leg to a rail for 120 degrees of every cycle, which cuts
+ * switching by a third at the cost of more current ripple at low
+ * modulation index.  DPWM0 and DPWM2 move the clamp window 30 degrees
+ * ahead of or behind the voltage peak, for leading or lagging power
+ * factor loads; DPWM1 centres it on the peak; DPWM3 clamps the 30 degree
+ * shoulders either side instead.  DPWMMAX and DPWMMIN always clamp the
+ * highest leg high or the lowest leg low.
+ */
+typedef enum {
+	FOC_SVM_SVPWM = 0,
+	FOC_SVM_DPWM0,
+	FOC_SVM_DPWM1,
+	FOC_SVM_DPWM2,
+	FOC_SVM_DPWM3,
+	FOC_SVM_DPWMMAX,
+	FOC_SVM_DPWMMIN,
+	FOC_SVM_AUTO
+} focSvmMode_t;
+
 typedef struct {
 	float Ia;
 	float Ib;
@@ -44,19 +91,55 @@ typedef struct {
 	float V2;
 	float V3;
 	float Vk;
+	float Da;
+	float Db;
+	float Dc;
+	float modIndex;
+	focSvmMode_t svmMode;
+	focSvmMode_t svmActive;
+	int8_t clampedPhase;
+	bool clampedHigh;
 } focControl_t;
 
+/**
+ * Structure of arrays for FOC_StepBatch.  Element i of every array belongs
+ * to sample (or axis) i.
+ */
+typedef struct {
+	// Inputs
+	const float *Ia;
+	const float *Ib;
+	const float *theta;
+	const float *Vd;
+	const float *Vq;
+	const float *Vbus;
+
+	// Outputs
+	float *sinTheta;
+	float *cosTheta;
+	float *Id;
+	float *Iq;
+	float *V1;
+	float *V2;
+	float *V3;
+} focBatch_t;
+
 /****************************************************************************
  * Public Functions
  ***************************************************************************/
 
 void FOC_Clarke    ( focControl_t *foc );
 void FOC_SinCos    ( focControl_t *foc );
+void FOC_SinCosPhase ( focControl_t *foc, focPhase_t phase );
 void FOC_Park      ( focControl_t *foc );
 void FOC_InvPark   ( focControl_t *foc );
 void FOC_InvClarke ( focControl_t *foc );
 void FOC_SVM       ( focControl_t *foc );
+void FOC_Step      ( focControl_t *foc );
+bool FOC_LimitVoltage ( focControl_t *foc, float modIndexMax );
+void FOC_StepBatch ( const focBatch_t *batch, uint32_t n );
 
 float FOC_WrapAngle( float angle );
+float FOC_WrapAngleRad( float angle );
 
 #endif /* FOC_H_ */
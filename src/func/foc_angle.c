@@ -0,0 +1,278 @@
+/********************************************************************
+foc_angle.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "foc_angle.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define PI_F				(3.14159265358979f)
+
+#define FRAC_BITS			(32 - FOC_SIN_TABLE_BITS)
+#define QUARTER_TURN		((focPhase_t)1 << 30)
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+// sin(2*pi*i/FOC_SIN_TABLE_SIZE), one extra point so interpolation never
+// has to wrap.
+static const float foc_sin_table[FOC_SIN_TABLE_SIZE + 1] = {
+	 0.000000000f,  0.012271538f,  0.024541229f,  0.036807223f,
+	 0.049067674f,  0.061320736f,  0.073564564f,  0.085797312f,
+	 0.098017140f,  0.110222207f,  0.122410675f,  0.134580709f,
+	 0.146730474f,  0.158858143f,  0.170961889f,  0.183039888f,
+	 0.195090322f,  0.207111376f,  0.219101240f,  0.231058108f,
+	 0.242980180f,  0.254865660f,  0.266712757f,  0.278519689f,
+	 0.290284677f,  0.302005949f,  0.313681740f,  0.325310292f,
+	 0.336889853f,  0.348418680f,  0.359895037f,  0.371317194f,
+	 0.382683432f,  0.393992040f,  0.405241314f,  0.416429560f,
+	 0.427555093f,  0.438616239f,  0.449611330f,  0.460538711f,
+	 0.471396737f,  0.482183772f,  0.492898192f,  0.503538384f,
+	 0.514102744f,  0.524589683f,  0.534997620f,  0.545324988f,
+	 0.555570233f,  0.565731811f,  0.575808191f,  0.585797857f,
+	 0.595699304f,  0.605511041f,  0.615231591f,  0.624859488f,
+	 0.634393284f,  0.643831543f,  0.653172843f,  0.662415778f,
+	 0.671558955f,  0.680600998f,  0.689540545f,  0.698376249f,
+	 0.707106781f,  0.715730825f,  0.724247083f,  0.732654272f,
+	 0.740951125f,  0.749136395f,  0.757208847f,  0.765167266f,
+	 0.773010453f,  0.780737229f,  0.788346428f,  0.795836905f,
+	 0.803207531f,  0.810457198f,  0.817584813f,  0.824589303f,
+	 0.831469612f,  0.838224706f,  0.844853565f,  0.851355193f,
+	 0.857728610f,  0.863972856f,  0.870086991f,  0.876070094f,
+	 0.881921264f,  0.887639620f,  0.893224301f,  0.898674466f,
+	 0.903989293f,  0.909167983f,  0.914209756f,  0.919113852f,
+	 0.923879533f,  0.928506080f,  0.932992799f,  0.937339012f,
+	 0.941544065f,  0.945607325f,  0.949528181f,  0.953306040f,
+	 0.956940336f,  0.960430519f,  0.963776066f,  0.966976471f,
+	 0.970031253f,  0.972939952f,  0.975702130f,  0.978317371f,
+	 0.980785280f,  0.983105487f,  0.985277642f,  0.987301418f,
+	 0.989176510f,  0.990902635f,  0.992479535f,  0.993906970f,
+	 0.995184727f,  0.996312612f,  0.997290457f,  0.998118113f,
+	 0.998795456f,  0.999322385f,  0.999698819f,  0.999924702f,
+	 1.000000000f,  0.999924702f,  0.999698819f,  0.999322385f,
+	 0.998795456f,  0.998118113f,  0.997290457f,  0.996312612f,
+	 0.995184727f,  0.993906970f,  0.992479535f,  0.990902635f,
+	 0.989176510f,  0.987301418f,  0.985277642f,  0.983105487f,
+	 0.980785280f,  0.978317371f,  0.975702130f,  0.972939952f,
+	 0.970031253f,  0.966976471f,  0.963776066f,  0.960430519f,
+	 0.956940336f,  0.953306040f,  0.949528181f,  0.945607325f,
+	 0.941544065f,  0.937339012f,  0.932992799f,  0.928506080f,
+	 0.923879533f,  0.919113852f,  0.914209756f,  0.909167983f,
+	 0.903989293f,  0.898674466f,  0.893224301f,  0.887639620f,
+	 0.881921264f,  0.876070094f,  0.870086991f,  0.863972856f,
+	 0.857728610f,  0.851355193f,  0.844853565f,  0.838224706f,
+	 0.831469612f,  0.824589303f,  0.817584813f,  0.810457198f,
+	 0.803207531f,  0.795836905f,  0.788346428f,  0.780737229f,
+	 0.773010453f,  0.765167266f,  0.757208847f,  0.749136395f,
+	 0.740951125f,  0.732654272f,  0.724247083f,  0.715730825f,
+	 0.707106781f,  0.698376249f,  0.689540545f,  0.680600998f,
+	 0.671558955f,  0.662415778f,  0.653172843f,  0.643831543f,
+	 0.634393284f,  0.624859488f,  0.615231591f,  0.605511041f,
+	 0.595699304f,  0.585797857f,  0.575808191f,  0.565731811f,
+	 0.555570233f,  0.545324988f,  0.534997620f,  0.524589683f,
+	 0.514102744f,  0.503538384f,  0.492898192f,  0.482183772f,
+	 0.471396737f,  0.460538711f,  0.449611330f,  0.438616239f,
+	 0.427555093f,  0.416429560f,  0.405241314f,  0.393992040f,
+	 0.382683432f,  0.371317194f,  0.359895037f,  0.348418680f,
+	 0.336889853f,  0.325310292f,  0.313681740f,  0.302005949f,
+	 0.290284677f,  0.278519689f,  0.266712757f,  0.254865660f,
+	 0.242980180f,  0.231058108f,  0.219101240f,  0.207111376f,
+	 0.195090322f,  0.183039888f,  0.170961889f,  0.158858143f,
+	 0.146730474f,  0.134580709f,  0.122410675f,  0.110222207f,
+	 0.098017140f,  0.085797312f,  0.073564564f,  0.061320736f,
+	 0.049067674f,  0.036807223f,  0.024541229f,  0.012271538f,
+	 0.000000000f, -0.012271538f, -0.024541229f, -0.036807223f,
+	-0.049067674f, -0.061320736f, -0.073564564f, -0.085797312f,
+	-0.098017140f, -0.110222207f, -0.122410675f, -0.134580709f,
+	-0.146730474f, -0.158858143f, -0.170961889f, -0.183039888f,
+	-0.195090322f, -0.207111376f, -0.219101240f, -0.231058108f,
+	-0.242980180f, -0.254865660f, -0.266712757f, -0.278519689f,
+	-0.290284677f, -0.302005949f, -0.313681740f, -0.325310292f,
+	-0.336889853f, -0.348418680f, -0.359895037f, -0.371317194f,
+	-0.382683432f, -0.393992040f, -0.405241314f, -0.416429560f,
+	-0.427555093f, -0.438616239f, -0.449611330f, -0.460538711f,
+	-0.471396737f, -0.482183772f, -0.492898192f, -0.503538384f,
+	-0.514102744f, -0.524589683f, -0.534997620f, -0.545324988f,
+	-0.555570233f, -0.565731811f, -0.575808191f, -0.585797857f,
+	-0.595699304f, -0.605511041f, -0.615231591f, -0.624859488f,
+	-0.634393284f, -0.643831543f, -0.653172843f, -0.662415778f,
+	-0.671558955f, -0.680600998f, -0.689540545f, -0.698376249f,
+	-0.707106781f, -0.715730825f, -0.724247083f, -0.732654272f,
+	-0.740951125f, -0.749136395f, -0.757208847f, -0.765167266f,
+	-0.773010453f, -0.780737229f, -0.788346428f, -0.795836905f,
+	-0.803207531f, -0.810457198f, -0.817584813f, -0.824589303f,
+	-0.831469612f, -0.838224706f, -0.844853565f, -0.851355193f,
+	-0.857728610f, -0.863972856f, -0.870086991f, -0.876070094f,
+	-0.881921264f, -0.887639620f, -0.893224301f, -0.898674466f,
+	-0.903989293f, -0.909167983f, -0.914209756f, -0.919113852f,
+	-0.923879533f, -0.928506080f, -0.932992799f, -0.937339012f,
+	-0.941544065f, -0.945607325f, -0.949528181f, -0.953306040f,
+	-0.956940336f, -0.960430519f, -0.963776066f, -0.966976471f,
+	-0.970031253f, -0.972939952f, -0.975702130f, -0.978317371f,
+	-0.980785280f, -0.983105487f, -0.985277642f, -0.987301418f,
+	-0.989176510f, -0.990902635f, -0.992479535f, -0.993906970f,
+	-0.995184727f, -0.996312612f, -0.997290457f, -0.998118113f,
+	-0.998795456f, -0.999322385f, -0.999698819f, -0.999924702f,
+	-1.000000000f, -0.999924702f, -0.999698819f, -0.999322385f,
+	-0.998795456f, -0.998118113f, -0.997290457f, -0.996312612f,
+	-0.995184727f, -0.993906970f, -0.992479535f, -0.990902635f,
+	-0.989176510f, -0.987301418f, -0.985277642f, -0.983105487f,
+	-0.980785280f, -0.978317371f, -0.975702130f, -0.972939952f,
+	-0.970031253f, -0.966976471f, -0.963776066f, -0.960430519f,
+	-0.956940336f, -0.953306040f, -0.949528181f, -0.945607325f,
+	-0.941544065f, -0.937339012f, -0.932992799f, -0.928506080f,
+	-0.923879533f, -0.919113852f, -0.914209756f, -0.909167983f,
+	-0.903989293f, -0.898674466f, -0.893224301f, -0.887639620f,
+	-0.881921264f, -0.876070094f, -0.870086991f, -0.863972856f,
+	-0.857728610f, -0.851355193f, -0.844853565f, -0.838224706f,
+	-0.831469612f, -0.824589303f, -0.817584813f, -0.810457198f,
+	-0.803207531f, -0.795836905f, -0.788346428f, -0.780737229f,
+	-0.773010453f, -0.765167266f, -0.757208847f, -0.749136395f,
+	-0.740951125f, -0.732654272f, -0.724247083f, -0.715730825f,
+	-0.707106781f, -0.698376249f, -0.689540545f, -0.680600998f,
+	-0.671558955f, -0.662415778f, -0.653172843f, -0.643831543f,
+	-0.634393284f, -0.624859488f, -0.615231591f, -0.605511041f,
+	-0.595699304f, -0.585797857f, -0.575808191f, -0.565731811f,
+	-0.555570233f, -0.545324988f, -0.534997620f, -0.524589683f,
+	-0.514102744f, -0.503538384f, -0.492898192f, -0.482183772f,
+	-0.471396737f, -0.460538711f, -0.449611330f, -0.438616239f,
+	-0.427555093f, -0.416429560f, -0.405241314f, -0.393992040f,
+	-0.382683432f, -0.371317194f, -0.359895037f, -0.348418680f,
+	-0.336889853f, -0.325310292f, -0.313681740f, -0.302005949f,
+	-0.290284677f, -0.278519689f, -0.266712757f, -0.254865660f,
+	-0.242980180f, -0.231058108f, -0.219101240f, -0.207111376f,
+	-0.195090322f, -0.183039888f, -0.170961889f, -0.158858143f,
+	-0.146730474f, -0.134580709f, -0.122410675f, -0.110222207f,
+	-0.098017140f, -0.085797312f, -0.073564564f, -0.061320736f,
+	-0.049067674f, -0.036807223f, -0.024541229f, -0.012271538f,
+	 0.000000000f
+};
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static inline float foc_sin_lookup ( focPhase_t phase );
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Sine and cosine of a phase by table lookup and linear interpolation.
+ * Constant time, no branches, and no range reduction since every phase is
+ * already in range.
+ * @param phase - Angle.
+ * @param sinVal - Output sine.
+ * @param cosVal - Output cosine.
+ */
+void FOC_PhaseSinCos ( focPhase_t phase, float *sinVal, float *cosVal )
+{
+	*sinVal = foc_sin_lookup(phase);
+	*cosVal = foc_sin_lookup(phase + QUARTER_TURN);
+}
+
+/**
+ * Converts to radians, -pi to pi.
+ */
+float FOC_PhaseToRadians ( focPhase_t phase )
+{
+	return (float)(int32_t)phase * (2.0f * PI_F / FOC_PHASE_TURN_F);
+}
+
+/**
+ * Converts to degrees, -180 to 180.
+ */
+float FOC_PhaseToDegrees ( focPhase_t phase )
+{
+	return (float)(int32_t)phase * (360.0f / FOC_PHASE_TURN_F);
+}
+
+/**
+ * Converts from radians.  Any angle within +/-pi is exact to float
+ * precision; larger ones are wrapped, with the precision float has left.
+ */
+focPhase_t FOC_PhaseFromRadians ( float radians )
+{
+	return FOC_PhaseFromDegrees(radians * (180.0f / PI_F));
+}
+
+/**
+ * Converts from degrees.  Larger angles are wrapped in a fixed number of
+ * operations.
+ */
+focPhase_t FOC_PhaseFromDegrees ( float degrees )
+{
+	// Fold into [-1/2, 1/2) turn first so the conversion to a 32 bit integer
+	// cannot overflow; what is discarded is whole turns.
+	float turns = degrees * (1.0f / 360.0f);
+	turns -= (float)(int32_t)turns;
+
+	if ( turns >= 0.5f )  { turns -= 1.0f; }
+	if ( turns < -0.5f )  { turns += 1.0f; }
+
+	return (focPhase_t)(int32_t)(turns * FOC_PHASE_TURN_F);
+}
+
+/**
+ * Sets up encoder to electrical phase conversion.  Exact when countsPerRev
+ * is a power of two; otherwise the error is a fraction of a count.
+ * @param enc - Encoder state.
+ * @param countsPerRev - Encoder counts per mechanical revolution.
+ * @param polePairs - Motor pole pairs.
+ */
+void FOC_EncoderInit ( focEncoder_t *enc, uint32_t countsPerRev, uint8_t polePairs )
+{
+	enc->scale = (uint32_t)((((uint64_t)polePairs << 32) + countsPerRev / 2) / countsPerRev);
+	enc->offset = 0;
+}
+
+/**
+ * Sets the offset so that count reads as phase, e.g. after locking the
+ * rotor to a known electrical angle.
+ */
+void FOC_EncoderAlign ( focEncoder_t *enc, uint32_t count, focPhase_t phase )
+{
+	enc->offset = phase - count * enc->scale;
+}
+
+/**
+ * Converts an encoder reading straight to electrical phase.  One multiply
+ * and one add; the pole pair wrap falls out of the overflow.
+ */
+focPhase_t FOC_EncoderPhase ( const focEncoder_t *enc, uint32_t count )
+{
+	return count * enc->scale + enc->offset;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static inline float foc_sin_lookup ( focPhase_t phase )
+{
+	uint32_t i = phase >> FRAC_BITS;
+	float frac = (float)(phase & ((1u << FRAC_BITS) - 1)) * (1.0f / (float)(1u << FRAC_BITS));
+	float y0 = foc_sin_table[i];
+
+	return y0 + frac * (foc_sin_table[i + 1] - y0);
+}
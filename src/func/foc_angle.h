@@ -0,0 +1,72 @@
+/********************************************************************
+foc_angle.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef FOC_ANGLE_H_
+#define FOC_ANGLE_H_
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdint.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// Sine table resolution.  512 points with linear interpolation is good to
+// about 2e-5, well below current sensor noise.
+#define FOC_SIN_TABLE_BITS	(9)
+#define FOC_SIN_TABLE_SIZE	(1u << FOC_SIN_TABLE_BITS)
+
+#define FOC_PHASE_TURN_F	(4294967296.0f)		// one turn, as a float
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * Angle as a fraction of a turn in unsigned q32: 0 is 0 degrees and 2^32
+ * would be 360.  Adding and subtracting wraps for free, so an accumulator
+ * never needs wrapping and never loses precision.  Cast to q31_t it is
+ * also the -180 to 180 degree angle arm_sin_cos_q31 takes.
+ */
+typedef uint32_t focPhase_t;
+
+/**
+ * Incremental or absolute encoder to electrical phase conversion.
+ */
+typedef struct {
+	uint32_t   scale;		// electrical phase per count
+	focPhase_t offset;		// electrical phase at count 0
+} focEncoder_t;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+void       FOC_PhaseSinCos     ( focPhase_t phase, float *sinVal, float *cosVal );
+
+float      FOC_PhaseToRadians  ( focPhase_t phase );
+float      FOC_PhaseToDegrees  ( focPhase_t phase );
+focPhase_t FOC_PhaseFromRadians( float radians );
+focPhase_t FOC_PhaseFromDegrees( float degrees );
+
+void       FOC_EncoderInit     ( focEncoder_t *enc, uint32_t countsPerRev, uint8_t polePairs );
+void       FOC_EncoderAlign    ( focEncoder_t *enc, uint32_t count, focPhase_t phase );
+focPhase_t FOC_EncoderPhase    ( const focEncoder_t *enc, uint32_t count );
+
+#endif /* FOC_ANGLE_H_ */
@@ -0,0 +1,124 @@
+/********************************************************************
+foc_observer.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "foc_observer.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define PI_F				(3.14159265358979f)
+
+// Default observer convergence rate, rad/s.  gamma * lambda^2 sets how
+// fast the flux estimate is pulled back onto the lambda circle.
+#define OBSERVER_RATE		(1000.0f)
+
+// Default PLL bandwidth, rad/s.
+#define OBSERVER_PLL_BW		(200.0f)
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Inits an observer with default tuning.
+ * @param obs - Observer.
+ * @param dt - Update period, seconds.
+ * @param R - Phase resistance, ohms.
+ * @param L - Phase inductance, henries.
+ * @param lambda - Flux linkage, volt-seconds (peak phase back-EMF / omega).
+ */
+void FOC_ObserverInit ( focObserver_t *obs, float dt, float R, float L, float lambda )
+{
+	obs->R = R;
+	obs->L = L;
+	obs->lambda = lambda;
+	obs->dt = dt;
+
+	obs->gamma = OBSERVER_RATE / (lambda * lambda);
+	obs->phaseScale = dt * (FOC_PHASE_TURN_F / (2.0f * PI_F));
+
+	FOC_ObserverSetPLL(obs, OBSERVER_PLL_BW);
+	FOC_ObserverReset(obs);
+}
+
+/**
+ * Sets the PLL gains for a critically damped loop.
+ * @param obs - Observer.
+ * @param bandwidth - Natural frequency, rad/s.  Higher tracks acceleration
+ * better, lower rejects more noise.
+ */
+void FOC_ObserverSetPLL ( focObserver_t *obs, float bandwidth )
+{
+	obs->pllKp = 2.0f * bandwidth;
+	obs->pllKi = bandwidth * bandwidth;
+}
+
+/**
+ * Starts over from the rotor at 0 degrees and standing still.
+ */
+void FOC_ObserverReset ( focObserver_t *obs )
+{
+	obs->xAlpha = obs->lambda;
+	obs->xBeta = 0.0f;
+	obs->omegaInt = 0.0f;
+	obs->phase = 0;
+	obs->omega = 0.0f;
+}
+
+/**
+ * Runs one observer step.  Call every period after FOC_Clarke and before
+ * FOC_InvPark, so Valpha,Vbeta still hold the voltage that was applied
+ * over the period just measured.  Then feed phase to FOC_SinCosPhase.
+ *
+ * One table lookup and about 30 flops; no atan2.
+ * @param obs - Observer.
+ * @param foc - FOC data structure.
+ * [IN]  Ialpha
+ * [IN]  Ibeta
+ * [IN]  Valpha
+ * [IN]  Vbeta
+ */
+void FOC_ObserverUpdate ( focObserver_t *obs, const focControl_t *foc )
+{
+	float dt = obs->dt;
+
+	// Stator flux: integrate v - R*i.  eta is the part due to the magnet,
+	// which should lie on a circle of radius lambda; the error pulls the
+	// estimate back onto it, which removes the integrator drift.
+	float etaAlpha = obs->xAlpha - obs->L * foc->Ialpha;
+	float etaBeta = obs->xBeta - obs->L * foc->Ibeta;
+	float err = obs->lambda * obs->lambda - (etaAlpha * etaAlpha + etaBeta * etaBeta);
+	float k = 0.5f * obs->gamma * err;
+
+	obs->xAlpha += (foc->Valpha - obs->R * foc->Ialpha + k * etaAlpha) * dt;
+	obs->xBeta += (foc->Vbeta - obs->R * foc->Ibeta + k * etaBeta) * dt;
+
+	// PLL on the magnet flux angle.  The phase detector is the sine of the
+	// angle error, normalized by lambda.
+	float s, c;
+	FOC_PhaseSinCos(obs->phase, &s, &c);
+
+	float e = (etaBeta * c - etaAlpha * s) * (1.0f / obs->lambda);
+
+	obs->omegaInt += obs->pllKi * e * dt;
+	obs->omega = obs->pllKp * e + obs->omegaInt;
+	obs->phase += (focPhase_t)(int32_t)(obs->omega * obs->phaseScale);
+}
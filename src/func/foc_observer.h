@@ -0,0 +1,67 @@
+/********************************************************************
+foc_observer.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef FOC_OBSERVER_H_
+#define FOC_OBSERVER_H_
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "foc.h"
+#include "foc_angle.h"
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * Sensorless rotor angle and speed estimator for a surface PMSM: a
+ * nonlinear flux observer (Ortega et al.) followed by a PLL.
+ */
+typedef struct {
+	// Motor
+	float R;			// phase resistance, ohms
+	float L;			// phase inductance, henries
+	float lambda;		// permanent magnet flux linkage, volt-seconds
+
+	// Tuning
+	float gamma;		// observer gain; see FOC_ObserverInit
+	float pllKp;
+	float pllKi;
+	float dt;
+
+	// State
+	float xAlpha;		// stator flux estimate
+	float xBeta;
+	float omegaInt;
+	float phaseScale;	// rad/s to phase per step
+
+	// Outputs
+	focPhase_t phase;	// electrical angle
+	float omega;		// electrical speed, rad/s
+} focObserver_t;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+void FOC_ObserverInit      ( focObserver_t *obs, float dt, float R, float L, float lambda );
+void FOC_ObserverSetPLL    ( focObserver_t *obs, float bandwidth );
+void FOC_ObserverReset     ( focObserver_t *obs );
+void FOC_ObserverUpdate    ( focObserver_t *obs, const focControl_t *foc );
+
+#endif /* FOC_OBSERVER_H_ */
@@ -0,0 +1,177 @@
+/********************************************************************
+foc_q31.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "foc_q31.h"
+#include "math_limits.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define Q31_ONE_BY_SQRT3	((q31_t)0x49E69D16)		// 1/sqrt(3)
+#define Q31_SQRT3_BY_2		((q31_t)0x6ED9EBA1)		// sqrt(3)/2
+
+// Sums of q31 products are accumulated in q62 and narrowed once, which
+// rounds once where chained mul_q31/add_q31 would round at every step.
+#define Q62(a,b)	((q63_t)(a) * (b))
+#define Q62_TO_Q31(x)	(sat_q31((x) >> 31))
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Loads the phase currents straight from raw ADC counts, with no trip
+ * through float.
+ * @param foc - FOC data structure.
+ * @param countA - Phase A ADC reading.
+ * @param countB - Phase B ADC reading.
+ * @param offsetA - Phase A reading at zero current.
+ * @param offsetB - Phase B reading at zero current.
+ * [OUT] Ia
+ * [OUT] Ib
+ */
+void FOC_Q31_FromADC ( focControlQ31_t *foc, uint16_t countA, uint16_t countB,
+                       uint16_t offsetA, uint16_t offsetB )
+{
+	// The difference is negative half the time, and left shifting a
+	// negative value is undefined; the multiply compiles to the same shift.
+	foc->Ia = ((q31_t)countA - (q31_t)offsetA) * (1 << (31 - FOC_Q31_ADC_BITS));
+	foc->Ib = ((q31_t)countB - (q31_t)offsetB) * (1 << (31 - FOC_Q31_ADC_BITS));
+}
+
+/**
+ * This does the a,b,c -> alpha,beta transform.
+ * @param foc - FOC data structure.
+ * [IN]  Ia
+ * [IN]  Ib
+ * [OUT] Ialpha
+ * [OUT] Ibeta
+ */
+void FOC_Q31_Clarke ( focControlQ31_t *foc )
+{
+	foc->Ialpha = foc->Ia;
+	foc->Ibeta  = Q62_TO_Q31( Q62(foc->Ia, Q31_ONE_BY_SQRT3) + 2 * Q62(foc->Ib, Q31_ONE_BY_SQRT3) );
+}
+
+/**
+ * This finds the sin and cos of the rotor angle.
+ * @param foc - FOC data structure.
+ * [IN]  theta
+ * [OUT] sinTheta
+ * [OUT] cosTheta
+ */
+void FOC_Q31_SinCos ( focControlQ31_t *foc )
+{
+	arm_sin_cos_q31(foc->theta, &(foc->sinTheta), &(foc->cosTheta));
+}
+
+/**
+ * Does the Ialpha,Ibeta->Id,Iq transform.
+ * @param foc - FOC data structure.
+ * [IN]  Ialpha
+ * [IN]  Ibeta
+ * [IN]  sinTheta
+ * [IN]  cosTheta
+ * [OUT] Id
+ * [OUT] Iq
+ */
+void FOC_Q31_Park ( focControlQ31_t *foc )
+{
+	foc->Id = Q62_TO_Q31(  Q62(foc->Ialpha, foc->cosTheta) + Q62(foc->Ibeta, foc->sinTheta) );
+	foc->Iq = Q62_TO_Q31( -Q62(foc->Ialpha, foc->sinTheta) + Q62(foc->Ibeta, foc->cosTheta) );
+}
+
+/**
+ * Does the Vd,Vq->Valpha,Vbeta transform.
+ * @param foc - FOC data structure.
+ * [IN]  Vd
+ * [IN]  Vq
+ * [IN]  sinTheta
+ * [IN]  cosTheta
+ * [OUT] Valpha
+ * [OUT] Vbeta
+ */
+void FOC_Q31_InvPark ( focControlQ31_t *foc )
+{
+	foc->Valpha = Q62_TO_Q31( Q62(foc->Vd, foc->cosTheta) - Q62(foc->Vq, foc->sinTheta) );
+	foc->Vbeta  = Q62_TO_Q31( Q62(foc->Vd, foc->sinTheta) + Q62(foc->Vq, foc->cosTheta) );
+}
+
+/**
+ * Does the Valpha,Vbeta->Va,Vb,Vc transform.
+ * @param foc - FOC data structure.
+ * [IN]  Valpha
+ * [IN]  Vbeta
+ * [OUT] Va
+ * [OUT] Vb
+ * [OUT] Vc
+ */
+void FOC_Q31_InvClarke ( focControlQ31_t *foc )
+{
+	q63_t half = Q62(foc->Valpha, -(1 << 30));			// -0.5 * Valpha
+
+	foc->Va = foc->Valpha;
+	foc->Vb = Q62_TO_Q31( half + Q62(foc->Vbeta, Q31_SQRT3_BY_2) );
+	foc->Vc = Q62_TO_Q31( half - Q62(foc->Vbeta, Q31_SQRT3_BY_2) );
+}
+
+/**
+ * Uses space vector modulation to determine the PWM vectors to apply to the motor.
+ * @param foc - FOC data structure.
+ * [IN]  Va
+ * [IN]  Vb
+ * [IN]  Vc
+ * [IN]  Vbus
+ * [OUT] V1
+ * [OUT] V2
+ * [OUT] V3
+ * [OUT] Vk
+ */
+void FOC_Q31_SVM ( focControlQ31_t *foc )
+{
+	q31_t hi = max3_q31(foc->Va, foc->Vb, foc->Vc);
+	q31_t lo = min3_q31(foc->Va, foc->Vb, foc->Vc);
+
+	foc->Vk = (q31_t)(((q63_t)hi + lo) >> 1);
+
+	// Each phase is within (hi - lo) / 2 of Vk, so only the add can saturate.
+	q31_t halfVbus = foc->Vbus >> 1;
+
+	foc->V1 = add_q31( sub_q31(foc->Va, foc->Vk), halfVbus );
+	foc->V2 = add_q31( sub_q31(foc->Vb, foc->Vk), halfVbus );
+	foc->V3 = add_q31( sub_q31(foc->Vc, foc->Vk), halfVbus );
+}
+
+/**
+ * Runs the whole chain in one call, like FOC_Step.
+ * @param foc - FOC data structure.
+ * [IN]  Ia, Ib, theta, Vd, Vq, Vbus
+ * [OUT] everything else
+ */
+void FOC_Q31_Step ( focControlQ31_t *foc )
+{
+	FOC_Q31_Clarke(foc);
+	FOC_Q31_SinCos(foc);
+	FOC_Q31_Park(foc);
+	FOC_Q31_InvPark(foc);
+	FOC_Q31_InvClarke(foc);
+	FOC_Q31_SVM(foc);
+}
@@ -0,0 +1,85 @@
+/********************************************************************
+foc_q31.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef FOC_Q31_H_
+#define FOC_Q31_H_
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdint.h"
+#include "arm_math.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// Resolution of the phase current ADC.  A count is scaled so the full ADC
+// span maps to 1.0 (q31 full scale).
+#ifndef FOC_Q31_ADC_BITS
+#define FOC_Q31_ADC_BITS	(12)
+#endif
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * Fixed point twin of focControl_t.  Currents and voltages are fractions of
+ * the full scale chosen by the caller; theta is -1.0 to 1.0 for -180 to 180
+ * degrees, which is the format arm_sin_cos_q31 takes.  Every stage
+ * saturates instead of wrapping.
+ */
+typedef struct {
+	q31_t Ia;
+	q31_t Ib;
+	q31_t Ialpha;
+	q31_t Ibeta;
+	q31_t Id;
+	q31_t Iq;
+	q31_t theta;
+	q31_t sinTheta;
+	q31_t cosTheta;
+	q31_t Vd;
+	q31_t Vq;
+	q31_t Valpha;
+	q31_t Vbeta;
+	q31_t Va;
+	q31_t Vb;
+	q31_t Vc;
+	q31_t Vbus;
+	q31_t V1;
+	q31_t V2;
+	q31_t V3;
+	q31_t Vk;
+} focControlQ31_t;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+void FOC_Q31_FromADC   ( focControlQ31_t *foc, uint16_t countA, uint16_t countB,
+                         uint16_t offsetA, uint16_t offsetB );
+void FOC_Q31_Clarke    ( focControlQ31_t *foc );
+void FOC_Q31_SinCos    ( focControlQ31_t *foc );
+void FOC_Q31_Park      ( focControlQ31_t *foc );
+void FOC_Q31_InvPark   ( focControlQ31_t *foc );
+void FOC_Q31_InvClarke ( focControlQ31_t *foc );
+void FOC_Q31_SVM       ( focControlQ31_t *foc );
+void FOC_Q31_Step      ( focControlQ31_t *foc );
+
+#endif /* FOC_Q31_H_ */
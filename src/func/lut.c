@@ -0,0 +1,176 @@
+/********************************************************************
+lut.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "lut.h"
+#include "stddef.h"
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Inits an axis with evenly spaced breakpoints x0, x0+step, ...
+ */
+void LUT_AxisInitUniform ( lutAxis_t *axis, float x0, float step, uint16_t n )
+{
+	axis->x = NULL;
+	axis->invWidth = NULL;
+	axis->x0 = x0;
+	axis->invStep = 1.0f / step;
+	axis->n = n;
+}
+
+/**
+ * Inits an axis with arbitrary ascending breakpoints.
+ * @param axis - Axis.
+ * @param x - Breakpoints, kept by reference.
+ * @param invWidth - Storage for n-1 reciprocals, filled in here.
+ * @param n - Number of breakpoints.
+ */
+void LUT_AxisInit ( lutAxis_t *axis, const float *x, float *invWidth, uint16_t n )
+{
+	for ( uint16_t i = 0; i + 1 < n; i++ )
+	{
+		invWidth[i] = 1.0f / (x[i + 1] - x[i]);
+	}
+
+	axis->x = x;
+	axis->invWidth = invWidth;
+	axis->x0 = x[0];
+	axis->invStep = 0.0f;
+	axis->n = n;
+}
+
+/**
+ * Finds the cell holding x and how far across it x is.  Inputs beyond
+ * either end are held at the end value.
+ * @param axis - Axis.
+ * @param x - Input.
+ * @param i - Output cell, 0 to n-2.
+ * @param frac - Output fraction, 0 to 1.
+ */
+void LUT_Locate ( const lutAxis_t *axis, float x, uint16_t *i, float *frac )
+{
+	uint16_t last = axis->n - 2;
+	float f;
+
+	if ( axis->x == NULL )
+	{
+		f = (x - axis->x0) * axis->invStep;
+
+		if ( f <= 0.0f )
+		{
+			*i = 0;
+			*frac = 0.0f;
+			return;
+		}
+
+		if ( f >= (float)(last + 1) )
+		{
+			*i = last;
+			*frac = 1.0f;
+			return;
+		}
+
+		uint16_t k = (uint16_t)f;
+
+		*i = k;
+		*frac = f - (float)k;
+		return;
+	}
+
+	const float *xs = axis->x;
+
+	if ( x <= xs[0] )
+	{
+		*i = 0;
+		*frac = 0.0f;
+		return;
+	}
+
+	if ( x >= xs[last + 1] )
+	{
+		*i = last;
+		*frac = 1.0f;
+		return;
+	}
+
+	// Largest lo with xs[lo] <= x.
+	uint16_t lo = 0;
+	uint16_t hi = last + 1;
+
+	while ( hi - lo > 1 )
+	{
+		uint16_t mid = (lo + hi) / 2;
+
+		if ( xs[mid] <= x )
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	*i = lo;
+	*frac = (x - xs[lo]) * axis->invWidth[lo];
+}
+
+float LUT_Lerp1D ( const float *y, uint16_t i, float frac )
+{
+	return y[i] + frac * (y[i + 1] - y[i]);
+}
+
+/**
+ * Bilinear interpolation in a row-major table, z[j * nx + i].
+ */
+float LUT_Lerp2D ( const float *z, uint16_t nx, uint16_t i, float fx,
+                   uint16_t j, float fy )
+{
+	const float *row = &z[j * nx + i];
+	float lo = row[0] + fx * (row[1] - row[0]);
+	float hi = row[nx] + fx * (row[nx + 1] - row[nx]);
+
+	return lo + fy * (hi - lo);
+}
+
+float LUT_Interp1D ( const lutAxis_t *axis, const float *y, float x )
+{
+	uint16_t i;
+	float f;
+
+	LUT_Locate(axis, x, &i, &f);
+	return LUT_Lerp1D(y, i, f);
+}
+
+/**
+ * Looks up z(x, y) in a table with ax->n columns and ay->n rows.
+ */
+float LUT_Interp2D ( const lutAxis_t *ax, const lutAxis_t *ay, const float *z,
+                     float x, float y )
+{
+	uint16_t i, j;
+	float fx, fy;
+
+	LUT_Locate(ax, x, &i, &fx);
+	LUT_Locate(ay, y, &j, &fy);
+	return LUT_Lerp2D(z, ax->n, i, fx, j, fy);
+}
@@ -0,0 +1,60 @@
+/********************************************************************
+lut.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef LUT_H_
+#define LUT_H_
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdint.h"
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * Breakpoints of one table axis.  A uniform axis is located with one
+ * multiply; a non-uniform one with a binary search.  Either way the
+ * fraction within the cell comes from a precomputed reciprocal, so a
+ * lookup never divides.
+ */
+typedef struct {
+	const float *x;				// non-uniform breakpoints, ascending; NULL if uniform
+	float       *invWidth;		// non-uniform: 1/(x[i+1]-x[i]), n-1 entries
+	float        x0;			// uniform: first breakpoint
+	float        invStep;		// uniform: 1/spacing
+	uint16_t     n;				// number of breakpoints, at least 2
+} lutAxis_t;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+void  LUT_AxisInitUniform ( lutAxis_t *axis, float x0, float step, uint16_t n );
+void  LUT_AxisInit        ( lutAxis_t *axis, const float *x, float *invWidth, uint16_t n );
+
+void  LUT_Locate          ( const lutAxis_t *axis, float x, uint16_t *i, float *frac );
+float LUT_Lerp1D          ( const float *y, uint16_t i, float frac );
+float LUT_Lerp2D          ( const float *z, uint16_t nx, uint16_t i, float fx,
+                            uint16_t j, float fy );
+
+float LUT_Interp1D        ( const lutAxis_t *axis, const float *y, float x );
+float LUT_Interp2D        ( const lutAxis_t *ax, const lutAxis_t *ay, const float *z,
+                            float x, float y );
+
+#endif /* LUT_H_ */
@@ -17,6 +17,169 @@ GNU General Public License for more details.
 #ifndef MATHLIMITS_H
 #define MATHLIMITS_H
 
-float limitf32 ( float val, float upper, float lower );
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdint.h"
+#include "math.h"
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+// Everything here is static inline so it costs nothing at the call site.
+// maxf32/minf32 use VMAXNM/VMINNM where the FPU has them (ARMv8); elsewhere,
+// including the M4, they are written as a compare and select, which GCC
+// emits as VCMP plus a conditional move with no branch (and as MAXSS/MINSS
+// on a host, where loops over them vectorize).  fmaxf/fminf would become
+// library calls there.  Either way a NaN input to limitf32 comes out as the
+// lower limit rather than passing through.
+
+static inline float maxf32 ( float a, float b )
+{
+#if defined(__ARM_FEATURE_NUMERIC_MAXMIN)
+	return fmaxf(a, b);
+#else
+	return (a > b) ? a : b;
+#endif
+}
+
+static inline float minf32 ( float a, float b )
+{
+#if defined(__ARM_FEATURE_NUMERIC_MAXMIN)
+	return fminf(a, b);
+#else
+	return (a < b) ? a : b;
+#endif
+}
+
+static inline float max3f32 ( float a, float b, float c )
+{
+	return maxf32(a, maxf32(b, c));
+}
+
+static inline float min3f32 ( float a, float b, float c )
+{
+	return minf32(a, minf32(b, c));
+}
+
+/**
+ * Clamps val to [lower, upper].
+ */
+static inline float limitf32 ( float val, float upper, float lower )
+{
+	return minf32(maxf32(val, lower), upper);
+}
+
+/**
+ * Clamps every element of an array in place.
+ */
+static inline void limitf32_array ( float *val, uint32_t n, float upper, float lower )
+{
+	for ( uint32_t i = 0; i < n; i++ )
+	{
+		val[i] = minf32(maxf32(val[i], lower), upper);
+	}
+}
+
+/**
+ * Square root with no errno handling: one VSQRT on the M4.  Negative
+ * inputs give NaN.  Not called sqrtf32, which GCC and newer C libraries
+ * already declare for _Float32.
+ */
+static inline float sqrt_f32 ( float x )
+{
+#if defined(__ARM_ARCH) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+	float r;
+	__asm__ ( "vsqrt.f32 %0, %1" : "=t" (r) : "t" (x) );
+	return r;
+#else
+	return sqrtf(x);
+#endif
+}
+
+/**
+ * 1/sqrt(x) for normal x > 0 to about 5e-6 relative error, without a
+ * divide: an integer estimate refined by two Newton steps.  Subnormal x
+ * (below FLT_MIN) gives a wrong result.
+ */
+static inline float rsqrtf32 ( float x )
+{
+	union { float f; uint32_t u; } v = { .f = x };
+	float h = 0.5f * x;
+
+	v.u = 0x5F375A86u - (v.u >> 1);
+	v.f = v.f * (1.5f - h * v.f * v.f);
+	v.f = v.f * (1.5f - h * v.f * v.f);
+
+	return v.f;
+}
+
+/**
+ * 1/x for |x| from FLT_MIN to 2^125 (4e37) to about 7e-6 relative error,
+ * without a divide: an integer estimate refined by two Newton steps.
+ * Above that the estimate is subnormal and the result wrong.  Worth it
+ * where the VDIV latency is on the critical path.
+ */
+static inline float recipf32 ( float x )
+{
+	union { float f; uint32_t u; } v = { .f = x };
+
+	v.u = 0x7EF311C3u - v.u;
+	v.f = v.f * (2.0f - x * v.f);
+	v.f = v.f * (2.0f - x * v.f);
+
+	return v.f;
+}
+
+/**
+ * Saturating q31 arithmetic.  GCC turns these into QADD/QSUB-like
+ * sequences; results pin at the limits instead of wrapping.
+ */
+static inline int32_t sat_q31 ( int64_t x )
+{
+	return (x > INT32_MAX) ? INT32_MAX : ((x < INT32_MIN) ? INT32_MIN : (int32_t)x);
+}
+
+static inline int32_t add_q31 ( int32_t a, int32_t b )
+{
+	return sat_q31((int64_t)a + b);
+}
+
+static inline int32_t sub_q31 ( int32_t a, int32_t b )
+{
+	return sat_q31((int64_t)a - b);
+}
+
+static inline int32_t mul_q31 ( int32_t a, int32_t b )
+{
+	return sat_q31(((int64_t)a * b) >> 31);
+}
+
+static inline int32_t limit_q31 ( int32_t val, int32_t upper, int32_t lower )
+{
+	return (val > upper) ? upper : ((val < lower) ? lower : val);
+}
+
+static inline int32_t max_q31 ( int32_t a, int32_t b )
+{
+	return (a > b) ? a : b;
+}
+
+static inline int32_t min_q31 ( int32_t a, int32_t b )
+{
+	return (a < b) ? a : b;
+}
+
+static inline int32_t max3_q31 ( int32_t a, int32_t b, int32_t c )
+{
+	return max_q31(a, max_q31(b, c));
+}
+
+static inline int32_t min3_q31 ( int32_t a, int32_t b, int32_t c )
+{
+	return min_q31(a, min_q31(b, c));
+}
 
 #endif /* MATHLIMITS_H_ */
@@ -45,3 +45,29 @@ float PI_Control ( pi_t *pi )
 
 	return limitf32( error * pi->kp + pi->accumulator, pi->outMax, pi->outMin);
 }
+
+/**
+ * Changes the gains without a step in the output.  The integral term is
+ * already in output units, so only the proportional change needs to be
+ * taken up by the accumulator.  Cheap enough to call every cycle.
+ */
+void PI_SetGains ( pi_t *pi, float kp, float ki )
+{
+	float error = pi->reference - pi->measured;
+
+	pi->accumulator = limitf32( pi->accumulator - (kp - pi->kp) * error, pi->outMax, pi->outMin);
+	pi->kp = kp;
+	pi->ki = ki;
+}
+
+/**
+ * Anti-windup feedback for when a later stage (e.g. FOC_LimitVoltage)
+ * could not apply what PI_Control asked for.  Backs the integrator off so
+ * the output would have been exactly what was applied.
+ */
+void PI_Track ( pi_t *pi, float applied )
+{
+	float error = pi->reference - pi->measured;
+
+	pi->accumulator = limitf32( applied - error * pi->kp, pi->outMax, pi->outMin);
+}
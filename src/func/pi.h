@@ -31,5 +31,7 @@ typedef struct {
 void  PI_Init    ( pi_t *pi, float dt );
 void  PI_Reset   ( pi_t *pi );
 float PI_Control ( pi_t *pi );
+void  PI_SetGains( pi_t *pi, float kp, float ki );
+void  PI_Track   ( pi_t *pi, float applied );
 
 #endif /* PI_H_ */
@@ -0,0 +1,68 @@
+/********************************************************************
+pi_sched.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "pi_sched.h"
+#include "stddef.h"
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Looks up the gains for the operating point and applies them bumplessly
+ * with PI_SetGains.  Each axis is located once and shared by both tables.
+ * @param sched - Schedule.
+ * @param x1 - Position on axis1.
+ * @param x2 - Position on axis2; ignored for a 1-D schedule.
+ */
+void PI_ScheduleUpdate ( piSchedule_t *sched, float x1, float x2 )
+{
+	uint16_t i, j;
+	float fx, fy;
+	float kp, ki;
+
+	LUT_Locate(sched->axis1, x1, &i, &fx);
+
+	if ( sched->axis2 == NULL )
+	{
+		kp = LUT_Lerp1D(sched->kpTable, i, fx);
+		ki = LUT_Lerp1D(sched->kiTable, i, fx);
+	}
+	else
+	{
+		uint16_t nx = sched->axis1->n;
+
+		LUT_Locate(sched->axis2, x2, &j, &fy);
+		kp = LUT_Lerp2D(sched->kpTable, nx, i, fx, j, fy);
+		ki = LUT_Lerp2D(sched->kiTable, nx, i, fx, j, fy);
+	}
+
+	PI_SetGains(sched->pi, kp, ki);
+}
+
+/**
+ * PI_ScheduleUpdate followed by PI_Control.  Set reference and measured
+ * on the pi_t first.
+ */
+float PI_ScheduleControl ( piSchedule_t *sched, float x1, float x2 )
+{
+	PI_ScheduleUpdate(sched, x1, x2);
+	return PI_Control(sched->pi);
+}
@@ -0,0 +1,51 @@
+/********************************************************************
+pi_sched.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef PI_SCHED_H_
+#define PI_SCHED_H_
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "pi.h"
+#include "lut.h"
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * Gain schedule for one pi_t.  kp and ki come from tables over one or two
+ * operating point variables (e.g. speed, bus voltage).  For two axes the
+ * tables are row-major, axis1->n columns by axis2->n rows.
+ */
+typedef struct {
+	pi_t            *pi;
+	const lutAxis_t *axis1;
+	const lutAxis_t *axis2;		// NULL for a 1-D schedule
+	const float     *kpTable;
+	const float     *kiTable;
+} piSchedule_t;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+void  PI_ScheduleUpdate  ( piSchedule_t *sched, float x1, float x2 );
+float PI_ScheduleControl ( piSchedule_t *sched, float x1, float x2 );
+
+#endif /* PI_SCHED_H_ */
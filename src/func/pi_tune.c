@@ -0,0 +1,204 @@
+/********************************************************************
+pi_tune.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "pi_tune.h"
+#include "math.h"
+#include "math_limits.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define PI_F			(3.14159265358979f)
+
+// The first periods are start-up transient and are not measured.
+#define SETTLE_EDGES	(2)
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void pi_tune_finish ( piTune_t *tune );
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Starts a tuning run.  Set the pi_t dt, output limits and reference
+ * first; the plant should be at rest with zero output, since SIMC takes
+ * the plant gain from how far the average measurement moves from there.
+ * @param tune - Tuner.
+ * @param pi - Controller to tune.  Its gains are written when done.
+ * @param rule - Tuning rule.
+ * @param hysteresis - Relay band around the reference.
+ * @param cycles - Periods to average.
+ * @param timeout - Give up after this many seconds.
+ */
+void PI_TuneStart ( piTune_t *tune, pi_t *pi, piTuneRule_t rule,
+                    float hysteresis, uint8_t cycles, float timeout )
+{
+	tune->pi = pi;
+	tune->rule = rule;
+	tune->hysteresis = hysteresis;
+	tune->cycles = (cycles > 0) ? cycles : 1;
+	tune->timeout = timeout;
+
+	tune->high = true;
+	tune->edges = 0;
+	tune->time = 0.0f;
+	tune->lastEdge = 0.0f;
+	tune->startMeasured = pi->measured;
+	tune->peakMax = -INFINITY;
+	tune->peakMin = INFINITY;
+	tune->periodSum = 0.0f;
+	tune->amplitudeSum = 0.0f;
+	tune->outputSum = 0.0f;
+	tune->measuredSum = 0.0f;
+	tune->samples = 0;
+
+	tune->ku = 0.0f;
+	tune->tu = 0.0f;
+	tune->status = PI_TUNE_RUNNING;
+}
+
+/**
+ * Runs one period of the relay test.  Use in place of PI_Control: set the
+ * pi_t measured value, call this, and apply the returned output.  Once
+ * status is PI_TUNE_DONE the gains are in the pi_t and PI_Control can take
+ * over; on PI_TUNE_FAILED they are left alone.  Returns 0 when not running.
+ */
+float PI_TuneStep ( piTune_t *tune )
+{
+	pi_t *pi = tune->pi;
+
+	if ( tune->status != PI_TUNE_RUNNING )
+	{
+		return 0.0f;
+	}
+
+	float error = pi->reference - pi->measured;
+
+	tune->time += pi->dt;
+	tune->peakMax = maxf32(tune->peakMax, pi->measured);
+	tune->peakMin = minf32(tune->peakMin, pi->measured);
+
+	if ( tune->high && error < -tune->hysteresis )
+	{
+		tune->high = false;
+	}
+	else if ( !tune->high && error > tune->hysteresis )
+	{
+		// A period runs from one switch to high to the next.
+		tune->high = true;
+		tune->edges++;
+
+		if ( tune->edges > SETTLE_EDGES )
+		{
+			tune->periodSum += tune->time - tune->lastEdge;
+			tune->amplitudeSum += 0.5f * (tune->peakMax - tune->peakMin);
+
+			if ( tune->edges - SETTLE_EDGES >= tune->cycles )
+			{
+				pi_tune_finish(tune);
+				return 0.0f;
+			}
+		}
+
+		tune->lastEdge = tune->time;
+		tune->peakMax = pi->measured;
+		tune->peakMin = pi->measured;
+	}
+
+	if ( tune->time > tune->timeout )
+	{
+		tune->status = PI_TUNE_FAILED;
+		return 0.0f;
+	}
+
+	float out = tune->high ? pi->outMax : pi->outMin;
+
+	if ( tune->edges >= SETTLE_EDGES )
+	{
+		tune->outputSum += out;
+		tune->measuredSum += pi->measured;
+		tune->samples++;
+	}
+
+	return out;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+ * Turns the measured oscillation into gains.
+ */
+static void pi_tune_finish ( piTune_t *tune )
+{
+	pi_t *pi = tune->pi;
+	float d = 0.5f * (pi->outMax - pi->outMin);
+	float a = tune->amplitudeSum / tune->cycles;
+	float h = tune->hysteresis;
+
+	// Describing function of a relay with hysteresis.
+	float aEff = sqrtf(maxf32(a * a - h * h, 0.0f));
+
+	if ( aEff <= 0.0f )
+	{
+		tune->status = PI_TUNE_FAILED;
+		return;
+	}
+
+	tune->ku = 4.0f * d / (PI_F * aEff);
+	tune->tu = tune->periodSum / tune->cycles;
+
+	float kp = 0.45f * tune->ku;
+	float ki = kp * 1.2f / tune->tu;
+
+	if ( tune->rule == PI_TUNE_SIMC && tune->samples > 0 )
+	{
+		// Fit K exp(-Ls) / (Ts + 1) through the static gain and the
+		// ultimate point, then apply SIMC with tau_c = L.
+		float meanOut = tune->outputSum / tune->samples;
+		float meanMeas = tune->measuredSum / tune->samples;
+		float w = 2.0f * PI_F / tune->tu;
+		float K = (meanOut != 0.0f) ? (meanMeas - tune->startMeasured) / meanOut : 0.0f;
+		float kk = K * tune->ku;
+
+		// Without K*Ku > 1 there is no FOPDT fit; keep Ziegler-Nichols.
+		if ( kk > 1.0f )
+		{
+			float wT = sqrtf(kk * kk - 1.0f);
+			float T = wT / w;
+			float L = (PI_F - atanf(wT)) / w;
+
+			kp = T / (2.0f * K * L);
+			ki = kp / minf32(T, 8.0f * L);
+		}
+	}
+
+	pi->kp = kp;
+	pi->ki = ki;
+	PI_Reset(pi);
+
+	tune->status = PI_TUNE_DONE;
+}
@@ -0,0 +1,83 @@
+/********************************************************************
+pi_tune.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef PI_TUNE_H_
+#define PI_TUNE_H_
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "pi.h"
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef enum {
+	PI_TUNE_ZN = 0,		// Ziegler-Nichols from the ultimate point; aggressive
+	PI_TUNE_SIMC		// Skogestad SIMC from a fitted first order plus dead time model
+} piTuneRule_t;
+
+typedef enum {
+	PI_TUNE_RUNNING = 0,
+	PI_TUNE_DONE,
+	PI_TUNE_FAILED
+} piTuneStatus_t;
+
+/**
+ * Relay feedback auto-tuner (Astrom-Hagglund).  Toggles the plant between
+ * the pi_t output limits around the reference until it settles into a
+ * steady oscillation, then derives gains from its amplitude and period.
+ */
+typedef struct {
+	pi_t          *pi;
+	piTuneRule_t   rule;
+	float          hysteresis;	// relay band, measurement units; set above noise
+	uint8_t        cycles;		// oscillation periods to average
+	float          timeout;		// seconds
+
+	// State
+	bool           high;
+	uint8_t        edges;
+	float          time;
+	float          lastEdge;
+	float          startMeasured;
+	float          peakMax;
+	float          peakMin;
+	float          periodSum;
+	float          amplitudeSum;
+	float          outputSum;
+	float          measuredSum;
+	uint32_t       samples;
+
+	// Results
+	float          ku;			// ultimate gain
+	float          tu;			// ultimate period, seconds
+	piTuneStatus_t status;
+} piTune_t;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+void  PI_TuneStart ( piTune_t *tune, pi_t *pi, piTuneRule_t rule,
+                     float hysteresis, uint8_t cycles, float timeout );
+float PI_TuneStep  ( piTune_t *tune );
+
+#endif /* PI_TUNE_H_ */
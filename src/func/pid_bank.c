@@ -0,0 +1,105 @@
+/********************************************************************
+pid_bank.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "pid_bank.h"
+#include "string.h"
+#include "math_limits.h"
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Inits a bank with every loop zeroed: no gains, zero limits.
+ * @param bank - Bank.
+ * @param count - Number of loops in use, at most PID_BANK_MAX_LOOPS.
+ */
+void PID_BankInit ( pidBank_t *bank, uint8_t count )
+{
+	memset(bank, 0, sizeof(pidBank_t));
+	bank->count = (count < PID_BANK_MAX_LOOPS) ? count : PID_BANK_MAX_LOOPS;
+}
+
+/**
+ * Sets one loop's gains.  The period is folded in here so the update only
+ * multiplies.
+ * @param bank - Bank.
+ * @param loop - Loop index.
+ * @param dt - Update period, seconds.
+ * @param kp - Proportional gain.
+ * @param ki - Integral gain, per second.
+ * @param kd - Derivative gain, seconds.  Acts on the measurement only, so
+ * reference steps do not kick the output.
+ * @param kb - Back-calculation anti-windup gain, per second.  The
+ * integrator is pulled toward the limit at this rate while the output is
+ * saturated; ki/kp is a common choice, 0 disables it (the integrator is
+ * then only clamped to the output limits).  Keep kb*dt below 1.
+ */
+void PID_BankSetGains ( pidBank_t *bank, uint8_t loop, float dt,
+                        float kp, float ki, float kd, float kb )
+{
+	bank->kp[loop] = kp;
+	bank->kiDt[loop] = ki * dt;
+	bank->kdByDt[loop] = kd / dt;
+	bank->kbDt[loop] = kb * dt;
+}
+
+void PID_BankSetLimits ( pidBank_t *bank, uint8_t loop, float outMin, float outMax )
+{
+	bank->outMin[loop] = outMin;
+	bank->outMax[loop] = outMax;
+}
+
+/**
+ * Clears one loop's integrator and output.  The derivative restarts from
+ * the current measurement, so set measured first.
+ */
+void PID_BankReset ( pidBank_t *bank, uint8_t loop )
+{
+	bank->integrator[loop] = 0.0f;
+	bank->output[loop] = 0.0f;
+	bank->lastMeasured[loop] = bank->measured[loop];
+}
+
+/**
+ * Runs every loop once.  The body has no branches or calls, so GCC
+ * vectorizes it where the target has SIMD.  With kd, kb and feedForward
+ * zero each loop behaves like PI_Control.
+ *
+ *   integrator += ki*dt*e             (clamped to the output limits)
+ *   u           = kp*e + integrator + kd*d(-measured)/dt + feedForward
+ *   output      = clamp(u)
+ *   integrator += kb*dt*(output - u)
+ */
+void PID_BankUpdate ( pidBank_t *bank )
+{
+	for ( uint8_t i = 0; i < bank->count; i++ )
+	{
+		float error = bank->reference[i] - bank->measured[i];
+		float deriv = bank->kdByDt[i] * (bank->lastMeasured[i] - bank->measured[i]);
+		float integ = limitf32(bank->integrator[i] + bank->kiDt[i] * error, bank->outMax[i], bank->outMin[i]);
+		float u = bank->kp[i] * error + integ + deriv + bank->feedForward[i];
+		float y = limitf32(u, bank->outMax[i], bank->outMin[i]);
+
+		bank->integrator[i] = integ + bank->kbDt[i] * (y - u);
+		bank->lastMeasured[i] = bank->measured[i];
+		bank->output[i] = y;
+	}
+}
@@ -0,0 +1,79 @@
+/********************************************************************
+pid_bank.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef PID_BANK_H_
+#define PID_BANK_H_
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdint.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#ifndef PID_BANK_MAX_LOOPS
+#define PID_BANK_MAX_LOOPS	(8)
+#endif
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * A set of PID loops stored as structure of arrays, so PID_BankUpdate runs
+ * all of them in one straight line pass.  Loop i is element i of every
+ * array.  Set reference, measured and feedForward, call PID_BankUpdate,
+ * then read output.
+ */
+typedef struct {
+	// Inputs
+	float reference[PID_BANK_MAX_LOOPS];
+	float measured[PID_BANK_MAX_LOOPS];
+	float feedForward[PID_BANK_MAX_LOOPS];
+
+	// Outputs
+	float output[PID_BANK_MAX_LOOPS];
+
+	// Gains, already scaled by the period
+	float kp[PID_BANK_MAX_LOOPS];
+	float kiDt[PID_BANK_MAX_LOOPS];
+	float kdByDt[PID_BANK_MAX_LOOPS];
+	float kbDt[PID_BANK_MAX_LOOPS];
+	float outMax[PID_BANK_MAX_LOOPS];
+	float outMin[PID_BANK_MAX_LOOPS];
+
+	// State
+	float integrator[PID_BANK_MAX_LOOPS];
+	float lastMeasured[PID_BANK_MAX_LOOPS];
+
+	uint8_t count;
+} pidBank_t;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+void PID_BankInit      ( pidBank_t *bank, uint8_t count );
+void PID_BankSetGains  ( pidBank_t *bank, uint8_t loop, float dt,
+                         float kp, float ki, float kd, float kb );
+void PID_BankSetLimits ( pidBank_t *bank, uint8_t loop, float outMin, float outMax );
+void PID_BankReset     ( pidBank_t *bank, uint8_t loop );
+void PID_BankUpdate    ( pidBank_t *bank );
+
+#endif /* PID_BANK_H_ */
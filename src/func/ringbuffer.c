@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 ///@date 2012-01-27
 
 #include "ringbuffer.h"
+#include "string.h"
 
 // Authors note: Jan 27, 2012
 //
@@ -40,14 +41,132 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 // clarity and simplicity.  I have been testing all functionality during the
 // development to ensure there are not off-by-1 errors or the like
 
+// All index arithmetic goes through the helpers below so that the same code
+// serves both index schemes:
+//
+// - default: front/back always lie in 0..maxsize-1 and every step is a
+//   compare-and-wrap; the fill level is kept in count.
+// - RINGBUFF_POW2: front/back run freely and are only masked when the storage
+//   is addressed, so stepping never branches and the fill level is simply
+//   back - front (unsigned wraparound takes care of overflow).
+
+#ifdef RINGBUFF_POW2
+
+static inline ringbuff_size_t rb_used(const ringbuff *rb)
+{
+  return rb->back - rb->front;
+}
+
+static inline void rb_used_add(ringbuff *rb, ringbuff_size_t n) { (void)rb; (void)n; }
+static inline void rb_used_sub(ringbuff *rb, ringbuff_size_t n) { (void)rb; (void)n; }
+
+static inline ringbuff_size_t rb_phys(const ringbuff *rb, ringbuff_size_t index)
+{
+  return index & (rb->maxsize - 1);
+}
 
-void ringbuff_init(ringbuff * rb, char * buffer, ringbuff_size_t buffsize)
+static inline ringbuff_size_t rb_advance(const ringbuff *rb, ringbuff_size_t index, ringbuff_size_t n)
 {
+  (void)rb;
+  return index + n;
+}
+
+static inline ringbuff_size_t rb_retreat(const ringbuff *rb, ringbuff_size_t index, ringbuff_size_t n)
+{
+  (void)rb;
+  return index - n;
+}
+
+#else
+
+static inline ringbuff_size_t rb_used(const ringbuff *rb)
+{
+  return rb->count;
+}
+
+static inline void rb_used_add(ringbuff *rb, ringbuff_size_t n) { rb->count += n; }
+static inline void rb_used_sub(ringbuff *rb, ringbuff_size_t n) { rb->count -= n; }
+
+static inline ringbuff_size_t rb_phys(const ringbuff *rb, ringbuff_size_t index)
+{
+  (void)rb;
+  return index;
+}
+
+static inline ringbuff_size_t rb_advance(const ringbuff *rb, ringbuff_size_t index, ringbuff_size_t n)
+{
+  uint32_t i = (uint32_t)index + n;
+
+  if(i >= rb->maxsize)
+  {
+    i -= rb->maxsize;
+  }
+
+  return (ringbuff_size_t)i;
+}
+
+static inline ringbuff_size_t rb_retreat(const ringbuff *rb, ringbuff_size_t index, ringbuff_size_t n)
+{
+  if(n > index)
+  {
+    return index + rb->maxsize - n;
+  }
+
+  return index - n;
+}
+
+#endif
+
+// copies n bytes into the storage starting at index, in at most two segments
+static void rb_copy_in(ringbuff *rb, ringbuff_size_t index, const char * src, ringbuff_size_t n)
+{
+  ringbuff_size_t p = rb_phys(rb, index);
+  ringbuff_size_t first = rb->maxsize - p;
+
+  if(first > n)
+  {
+    first = n;
+  }
+
+  memcpy(&rb->buffer[p], src, first);
+  memcpy(rb->buffer, src + first, n - first);
+}
+
+// copies n bytes out of the storage starting at index, in at most two segments
+static void rb_copy_out(const ringbuff *rb, ringbuff_size_t index, char * dst, ringbuff_size_t n)
+{
+  ringbuff_size_t p = rb_phys(rb, index);
+  ringbuff_size_t first = rb->maxsize - p;
+
+  if(first > n)
+  {
+    first = n;
+  }
+
+  memcpy(dst, &rb->buffer[p], first);
+  memcpy(dst + first, rb->buffer, n - first);
+}
+
+
+bool ringbuff_init(ringbuff * rb, char * buffer, ringbuff_size_t buffsize)
+{
+#ifdef RINGBUFF_POW2
+  //the mask only works for a power of two; anything else gets no storage, so
+  //every push fails instead of corrupting memory
+  bool fits = buffsize != 0 && (buffsize & (buffsize - 1)) == 0;
+#else
+  bool fits = 1;
+#endif
+
   rb->buffer = buffer;
-  rb->maxsize = buffsize;
+  rb->maxsize = fits ? buffsize : 0;
+#ifndef RINGBUFF_POW2
   rb->count = 0;
+#endif
   rb->front = 0;
   rb->back = 0;
+
+  return fits;
 }
 
 static bool ringbuff_push_front_int(ringbuff *rb, char c, bool disableInterrupts)
@@ -55,7 +174,7 @@ static bool ringbuff_push_front_int(ringbuff *rb, char c, bool disableInterrupts
   //if (disableInterrupts) interrupts_dis();
 
   //check if there is room
-  if(rb->count >= rb->maxsize)
+  if(rb_used(rb) >= rb->maxsize)
   {
     //indicate failure
     //if (disableInterrupts) interrupts_en();
@@ -63,17 +182,10 @@ static bool ringbuff_push_front_int(ringbuff *rb, char c, bool disableInterrupts
   }
 
   //decrement front to indicate that we are adding a char
-  if(rb->front == 0)
-  {
-    rb->front = rb->maxsize-1;
-  }
-  else
-  {
-    rb->front--;
-  }
+  rb->front = rb_retreat(rb, rb->front, 1);
 
-  rb->buffer[rb->front] = c;
-  rb->count++;
+  rb->buffer[rb_phys(rb, rb->front)] = c;
+  rb_used_add(rb, 1);
 
   //if (disableInterrupts) interrupts_en();
 
@@ -86,7 +198,7 @@ static bool ringbuff_push_back_int(ringbuff *rb, char c, bool disableInterrupts)
 
 
   //check if there is room
-  if(rb->count >= rb->maxsize)
+  if(rb_used(rb) >= rb->maxsize)
   {
     //indicate failure
     return 0;
@@ -94,15 +206,10 @@ static bool ringbuff_push_back_int(ringbuff *rb, char c, bool disableInterrupts)
 
   //if (disableInterrupts) interrupts_dis();
 
-  rb->buffer[rb->back] = c;
-  rb->count++;
+  rb->buffer[rb_phys(rb, rb->back)] = c;
+  rb_used_add(rb, 1);
   //increment back to indicate that we are adding a char
-  rb->back++;
-
-  if(rb->back >= rb->maxsize)
-  {
-    rb->back = 0;
-  }
+  rb->back = rb_advance(rb, rb->back, 1);
 
   //if (disableInterrupts) interrupts_en();
 
@@ -113,22 +220,17 @@ static bool ringbuff_push_back_int(ringbuff *rb, char c, bool disableInterrupts)
 static bool ringbuff_pop_front_int(ringbuff *rb, char* c, bool disableInterrupts)
 {
 
-  if(rb->count <= 0)
+  if(rb_used(rb) <= 0)
   {
     return 0;
   }
 
   //if (disableInterrupts) interrupts_dis();
 
-  *c = rb->buffer[rb->front];
-  rb->front++;
+  *c = rb->buffer[rb_phys(rb, rb->front)];
+  rb->front = rb_advance(rb, rb->front, 1);
 
-  if(rb->front >= rb->maxsize)
-  {
-    rb->front = 0;
-  }
-
-  rb->count--;
+  rb_used_sub(rb, 1);
 
   //if (disableInterrupts) interrupts_en();
 
@@ -138,7 +240,7 @@ static bool ringbuff_pop_front_int(ringbuff *rb, char* c, bool disableInterrupts
 static bool ringbuff_pop_back_int(ringbuff *rb, char* c, bool disableInterrupts)
 {
   //check if the ringbuffer is empty
-  if(rb->count <= 0)
+  if(rb_used(rb) <= 0)
   {
     //indicate failure
     return 0;
@@ -147,17 +249,10 @@ static bool ringbuff_pop_back_int(ringbuff *rb, char* c, bool disableInterrupts)
   //if (disableInterrupts) interrupts_dis();
 
   //decrement back to get to the empty index
-  if(rb->back == 0)
-  {
-    rb->back = rb->maxsize-1;
-  }
-  else
-  {
-    rb->back--;
-  }
-  *c = rb->buffer[rb->back];
+  rb->back = rb_retreat(rb, rb->back, 1);
+  *c = rb->buffer[rb_phys(rb, rb->back)];
 
-  rb->count--;
+  rb_used_sub(rb, 1);
 
   //if (disableInterrupts) interrupts_en();
 
@@ -166,41 +261,39 @@ static bool ringbuff_pop_back_int(ringbuff *rb, char* c, bool disableInterrupts)
 
 bool ringbuff_push_front(ringbuff *rb, char c)
 {
-  ringbuff_push_front_int(rb,c,true);
+  return ringbuff_push_front_int(rb,c,true);
 }
 
 bool ringbuff_pop_front(ringbuff *rb, char* c)
 {
-  ringbuff_pop_front_int(rb,c,true);
+  return ringbuff_pop_front_int(rb,c,true);
 }
 
 bool ringbuff_push_back(ringbuff *rb, char c)
 {
-  ringbuff_push_back_int(rb,c,true);
+  return ringbuff_push_back_int(rb,c,true);
 }
 
 bool ringbuff_pop_back(ringbuff *rb, char* c)
 {
-  ringbuff_pop_back_int(rb,c,true);
+  return ringbuff_pop_back_int(rb,c,true);
 }
 
 bool ringbuff_push_front_s(ringbuff *rb, void * data, ringbuff_size_t n)
 {
-  char * cdata = data;
-  int i;
-
   //see if there is room for the addition
-  if(rb->count + n > rb->maxsize){
+  if((uint32_t)rb_used(rb) + n > rb->maxsize){
     //indicate failure if there is not
     return 0;
   }
 
   //interrupts_dis();
 
-  for(i = n-1; i >= 0; i--)
-  {
-    ringbuff_push_front_int(rb, cdata[i],false);
-  }
+  //the last byte ends up just before the old front, so the data comes off
+  //the front in the same order it went in
+  rb->front = rb_retreat(rb, rb->front, n);
+  rb_copy_in(rb, rb->front, data, n);
+  rb_used_add(rb, n);
 
   //interrupts_en();
 
@@ -209,23 +302,17 @@ bool ringbuff_push_front_s(ringbuff *rb, void * data, ringbuff_size_t n)
 
 bool ringbuff_pop_front_s(ringbuff *rb, void * data, ringbuff_size_t n)
 {
-  char * cdata = data;
-  int i;
-
-
-
   //see if there are enough bytes of data in the ringbuffer for this to work
-  if(rb->count < n)
+  if(rb_used(rb) < n)
   {
     return 0;
   }
 
   //interrupts_dis();
 
-  for(i = 0; i < n; i++)
-  {
-    ringbuff_pop_front_int(rb, &(cdata[i]),false);
-  }
+  rb_copy_out(rb, rb->front, data, n);
+  rb->front = rb_advance(rb, rb->front, n);
+  rb_used_sub(rb, n);
 
   //interrupts_en();
 
@@ -234,21 +321,17 @@ bool ringbuff_pop_front_s(ringbuff *rb, void * data, ringbuff_size_t n)
 
 bool ringbuff_push_back_s(ringbuff *rb, void * data, ringbuff_size_t n)
 {
-  char * cdata = data;
-  int i;
-
   //see if there is room for the addition
-  if(rb->count + n > rb->maxsize)
+  if((uint32_t)rb_used(rb) + n > rb->maxsize)
   {
     return 0;
   }
 
   //interrupts_dis();
 
-  for(i = 0; i < n; i++)
-  {
-    ringbuff_push_back_int(rb, cdata[i],false);
-  }
+  rb_copy_in(rb, rb->back, data, n);
+  rb->back = rb_advance(rb, rb->back, n);
+  rb_used_add(rb, n);
 
   //interrupts_en();
 
@@ -257,21 +340,17 @@ bool ringbuff_push_back_s(ringbuff *rb, void * data, ringbuff_size_t n)
 
 bool ringbuff_pop_back_s(ringbuff *rb, void * data, ringbuff_size_t n)
 {
-  char * cdata = data;
-  int i;
-
   //see if there are enough bytes of data in the ringbuffer for this to work
-  if(rb->count < n)
+  if(rb_used(rb) < n)
   {
     return 0;
   }
 
   //interrupts_dis();
 
-  for(i = n-1; i >= 0; i--)
-  {
-    ringbuff_pop_back_int(rb, &(cdata[i]),false);
-  }
+  rb->back = rb_retreat(rb, rb->back, n);
+  rb_copy_out(rb, rb->back, data, n);
+  rb_used_sub(rb, n);
 
   //interrupts_en();
 
@@ -280,10 +359,8 @@ bool ringbuff_pop_back_s(ringbuff *rb, void * data, ringbuff_size_t n)
 
 bool ringbuff_peek_back(ringbuff * rb, char * c, ringbuff_size_t n)
 {
-  ringbuff_size_t index;
-
   // n should be in the range from 0..rb->count
-  if ( n >= rb->count)
+  if ( n >= rb_used(rb))
   {
     return 0;
   }
@@ -291,15 +368,7 @@ bool ringbuff_peek_back(ringbuff * rb, char * c, ringbuff_size_t n)
   //interrupts_dis();
 
   //add 1 because back points 1 past the end
-  n += 1;
-  if( n > rb->back ){
-    index = rb->back + rb->maxsize - n;
-  }
-  else{
-    index = rb->back - n;
-  }
-
-  *c = rb->buffer[index];
+  *c = rb->buffer[rb_phys(rb, rb_retreat(rb, rb->back, n + 1))];
 
   //interrupts_en();
 
@@ -308,23 +377,15 @@ bool ringbuff_peek_back(ringbuff * rb, char * c, ringbuff_size_t n)
 
 bool ringbuff_peek_front(ringbuff * rb, char * c, ringbuff_size_t n)
 {
-  ringbuff_size_t index;
-
   // n should be in the range from 0..rb->count
-  if ( n >= rb->count)
+  if ( n >= rb_used(rb))
   {
     return 0;
   }
 
   //interrupts_dis();
 
-  index=n + rb->front;
-  if(index >= rb->maxsize)
-  {
-    index -= rb->maxsize;
-  }
-
-  *c = rb->buffer[index];
+  *c = rb->buffer[rb_phys(rb, rb_advance(rb, rb->front, n))];
 
   //interrupts_en();
 
@@ -333,65 +394,104 @@ bool ringbuff_peek_front(ringbuff * rb, char * c, ringbuff_size_t n)
 
 bool ringbuff_peek_back_s(ringbuff * rb, void * data, ringbuff_size_t struct_size, ringbuff_size_t n)
 {
-  ringbuff_size_t index_from_back=(n+1)*struct_size;
-  ringbuff_size_t index;
+  uint32_t index_from_back = ((uint32_t)n + 1) * struct_size;
 
-  int i;
-  if(index_from_back > rb->count)
+  if(index_from_back > rb_used(rb))
   {
     return 0;
   }
 
   //interrupts_dis();
 
-  if(index_from_back > rb->back)
-  {
-    index = rb->back + rb->maxsize - index_from_back;
-  }
-  else
+  rb_copy_out(rb, rb_retreat(rb, rb->back, index_from_back), data, struct_size);
+
+  //interrupts_en();
+
+  return 1;
+}
+
+bool ringbuff_peek_front_s(ringbuff * rb, void * data, ringbuff_size_t struct_size, ringbuff_size_t n)
+{
+  uint32_t index_from_front = (uint32_t)n * struct_size;
+
+  //the whole struct has to be in the buffer, not just its first byte
+  if(index_from_front + struct_size > rb_used(rb))
   {
-    index = rb->back - index_from_back;
+    return 0;
   }
 
-  for(i = 0; i < struct_size; i++)
-  {
-    ((char *)data)[i] = rb->buffer[index++];
+  //interrupts_dis();
 
-    if(index >= rb->maxsize)
-      index = 0;
-  }
+  rb_copy_out(rb, rb_advance(rb, rb->front, index_from_front), data, struct_size);
 
   //interrupts_en();
 
   return 1;
 }
 
-bool ringbuff_peek_front_s(ringbuff * rb, void * data, ringbuff_size_t struct_size, ringbuff_size_t n)
+ringbuff_size_t ringbuff_reserve_back(ringbuff * rb, char ** ptr)
 {
-  ringbuff_size_t index_from_front=(n)*struct_size;
-  ringbuff_size_t index;
-  int i;
+  ringbuff_size_t back = rb_phys(rb, rb->back);
+  ringbuff_size_t room = rb->maxsize - rb_used(rb);
+
+  *ptr = &rb->buffer[back];
+
+  //vacant bytes run from back up to front, or up to the end of the storage,
+  //whichever comes first
+  if(room > rb->maxsize - back)
+  {
+    room = rb->maxsize - back;
+  }
+
+  return room;
+}
 
-  if(index_from_front > rb->count)
+bool ringbuff_commit_back(ringbuff * rb, ringbuff_size_t n)
+{
+  if((uint32_t)rb_used(rb) + n > rb->maxsize)
   {
     return 0;
   }
 
   //interrupts_dis();
 
-  index = index_from_front + rb->front;
-  if(index > rb->maxsize)
+  rb->back = rb_advance(rb, rb->back, n);
+  rb_used_add(rb, n);
+
+  //interrupts_en();
+
+  return 1;
+}
+
+ringbuff_size_t ringbuff_peek_contig(ringbuff * rb, char ** ptr)
+{
+  ringbuff_size_t front = rb_phys(rb, rb->front);
+  ringbuff_size_t avail = rb_used(rb);
+
+  *ptr = &rb->buffer[front];
+
+  //occupied bytes run from front up to back, or up to the end of the storage
+  //if the data wraps
+  if(avail > rb->maxsize - front)
   {
-    index -= rb->maxsize;
+    avail = rb->maxsize - front;
   }
 
-  for(i = 0; i < struct_size; i++)
+  return avail;
+}
+
+bool ringbuff_consume(ringbuff * rb, ringbuff_size_t n)
+{
+  if(rb_used(rb) < n)
   {
-    ((char *)data)[i] = rb->buffer[index++];
-    if(index >= rb->maxsize)
-      index = 0;
+    return 0;
   }
 
+  //interrupts_dis();
+
+  rb->front = rb_advance(rb, rb->front, n);
+  rb_used_sub(rb, n);
+
   //interrupts_en();
 
   return 1;
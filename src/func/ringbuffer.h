@@ -55,12 +55,24 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
   The _s versions of the pop and push commands allow structs (or any datatype)
   to be pushed or popped onto the queue by interpreting the input data as a
   stream of bytes.
+
+  Defining RINGBUFF_POW2 for the whole build selects the power-of-two variant:
+  sizes become 32 bits (so buffers can exceed 64 KiB), front and back run
+  freely and are masked with maxsize-1 when addressing the buffer, and the
+  count is derived from back - front instead of being stored.  Every push/pop
+  is then branch free apart from the full/empty check.  In this mode .maxsize
+  MUST be a power of two; ringbuff_init refuses any other size, a designated
+  initializer cannot.
 */
 
 #include "stdbool.h"
 #include "stdint.h"
 
+#ifdef RINGBUFF_POW2
+typedef uint32_t ringbuff_size_t;
+#else
 typedef uint16_t ringbuff_size_t;
+#endif
 
 typedef struct ringbuff_struct
 {
@@ -85,8 +97,10 @@ typedef struct ringbuff_struct
         hold) */
     ringbuff_size_t maxsize;
 
+#ifndef RINGBUFF_POW2
     /// The current number of objects in the ringbuffer
     ringbuff_size_t count;
+#endif
 } ringbuff;
 
 /**
@@ -99,8 +113,11 @@ typedef struct ringbuff_struct
   \param rb a pointer to the ringbuffer to initialize
   \param buffer a pointer to a memory buffer designated for this ringbuffer
   \param buffsize the size of the buffer for this ringbuffer in bytes
+
+  \returns 1 if successful, 0 if failed(with RINGBUFF_POW2, buffsize is not a
+  power of two; the ringbuffer is then left with no room at all)
 */
-void ringbuff_init(ringbuff * rb, char * buffer, ringbuff_size_t buffsize);
+bool ringbuff_init(ringbuff * rb, char * buffer, ringbuff_size_t buffsize);
 
 
 /**
@@ -287,4 +304,63 @@ struct_size, ringbuff_size_t n);
 bool ringbuff_peek_front_s(ringbuff * rb, void * data, ringbuff_size_t
 struct_size, ringbuff_size_t n);
 
+/**
+  \brief reserves the largest contiguous vacant span at the back of the
+  ringbuffer for in-place writing (e.g. by a DMA engine)
+
+  Nothing is added to the ringbuffer until ringbuff_commit_back is called, so
+  the span can be filled at leisure.  The span stops at the end of the storage
+  even if there is more room after the wrap; reserve again after committing to
+  get the rest.
+
+  \code
+  char * dst;
+  ringbuff_size_t room = ringbuff_reserve_back(&rb, &dst);
+  n = cobs_decode(frame, frame_len, (uint8_t *)dst);  // n <= room
+  ringbuff_commit_back(&rb, n);
+  \endcode
+
+  \param rb a pointer to the ringbuffer to reserve space in
+  \param ptr set to the first vacant byte of the span
+
+  \returns the length of the span in bytes, 0 if the buffer is full
+*/
+ringbuff_size_t ringbuff_reserve_back(ringbuff * rb, char ** ptr);
+
+/**
+  \brief adds n bytes previously written into a reserved span to the back of
+  the ringbuffer
+
+  \param rb a pointer to the ringbuffer
+  \param n the number of bytes written, at most the reserved length
+
+  \returns 1 if successfull, 0 if failed(n is larger than the vacant span)
+*/
+bool ringbuff_commit_back(ringbuff * rb, ringbuff_size_t n);
+
+/**
+  \brief returns the largest contiguous readable span at the front of the
+  ringbuffer without copying it out
+
+  The span stays in the ringbuffer until ringbuff_consume is called.  If the
+  data wraps, only the part up to the end of the storage is returned; consume
+  it and peek again for the rest.
+
+  \param rb a pointer to the ringbuffer to read from
+  \param ptr set to the first byte of the span
+
+  \returns the length of the span in bytes, 0 if the buffer is empty
+*/
+ringbuff_size_t ringbuff_peek_contig(ringbuff * rb, char ** ptr);
+
+/**
+  \brief drops n bytes off of the front of the ringbuffer
+
+  \param rb a pointer to the ringbuffer
+  \param n the number of bytes to drop
+
+  \returns 1 if successfull, 0 if failed(the buffer holds fewer than n bytes)
+*/
+bool ringbuff_consume(ringbuff * rb, ringbuff_size_t n);
+
 #endif //RINGBUFFER_H
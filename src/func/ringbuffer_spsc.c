@@ -0,0 +1,240 @@
+/********************************************************************
+ringbuffer_spsc.c - lock-free single-producer/single-consumer fifo.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#include "ringbuffer_spsc.h"
+#include "string.h"
+
+// Each side loads its own index relaxed (nobody else writes it), loads the
+// other side's index with acquire and publishes its own index with release.
+// On the Cortex-M4 this compiles to plain loads/stores plus a DMB.
+
+#define LOAD_OWN(x)       __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define LOAD_OTHER(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define PUBLISH(x, v)     __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+static inline ringbuff_size_t ringbuff_spsc_used(ringbuff_size_t front,
+  ringbuff_size_t back, ringbuff_size_t maxsize)
+{
+  return (back >= front) ? (back - front) : (back + maxsize - front);
+}
+
+// Advance an index by n and wrap it.  The sum is formed in 32 bits because
+// with 16 bit indices and maxsize > 32768, idx + n can exceed 0xFFFF.
+static inline ringbuff_size_t ringbuff_spsc_advance(ringbuff_size_t idx,
+  ringbuff_size_t n, ringbuff_size_t maxsize)
+{
+  uint32_t next = (uint32_t)idx + n;
+
+  if(next >= maxsize)
+  {
+    next -= maxsize;
+  }
+
+  return (ringbuff_size_t)next;
+}
+
+void ringbuff_spsc_init(ringbuff_spsc * rb, char * buffer, ringbuff_size_t buffsize)
+{
+  rb->buffer = buffer;
+  rb->maxsize = buffsize;
+  rb->front = 0;
+  rb->back = 0;
+}
+
+bool ringbuff_spsc_push_back(ringbuff_spsc *rb, char c)
+{
+  ringbuff_size_t back = LOAD_OWN(rb->back);
+  ringbuff_size_t next = back + 1;
+
+  if(next >= rb->maxsize)
+  {
+    next = 0;
+  }
+
+  //full when advancing back would make it collide with front
+  if(next == LOAD_OTHER(rb->front))
+  {
+    return 0;
+  }
+
+  rb->buffer[back] = c;
+  PUBLISH(rb->back, next);
+
+  return 1;
+}
+
+bool ringbuff_spsc_pop_front(ringbuff_spsc *rb, char * c)
+{
+  ringbuff_size_t front = LOAD_OWN(rb->front);
+
+  if(front == LOAD_OTHER(rb->back))
+  {
+    return 0;
+  }
+
+  *c = rb->buffer[front];
+
+  front++;
+  if(front >= rb->maxsize)
+  {
+    front = 0;
+  }
+
+  PUBLISH(rb->front, front);
+
+  return 1;
+}
+
+bool ringbuff_spsc_push_back_s(ringbuff_spsc *rb, const void * data, ringbuff_size_t n)
+{
+  const char * cdata = data;
+  ringbuff_size_t back = LOAD_OWN(rb->back);
+  ringbuff_size_t front = LOAD_OTHER(rb->front);
+  ringbuff_size_t first;
+
+  //see if there is room for the addition (one slot always stays empty)
+  if(ringbuff_spsc_used(front, back, rb->maxsize) + n >= rb->maxsize)
+  {
+    return 0;
+  }
+
+  //copy up to the end of the storage, then wrap for the remainder
+  first = rb->maxsize - back;
+  if(first > n)
+  {
+    first = n;
+  }
+
+  memcpy(&rb->buffer[back], cdata, first);
+  memcpy(rb->buffer, cdata + first, n - first);
+
+  back = ringbuff_spsc_advance(back, n, rb->maxsize);
+
+  PUBLISH(rb->back, back);
+
+  return 1;
+}
+
+bool ringbuff_spsc_pop_front_s(ringbuff_spsc *rb, void * data, ringbuff_size_t n)
+{
+  char * cdata = data;
+  ringbuff_size_t front = LOAD_OWN(rb->front);
+  ringbuff_size_t back = LOAD_OTHER(rb->back);
+  ringbuff_size_t first;
+
+  if(ringbuff_spsc_used(front, back, rb->maxsize) < n)
+  {
+    return 0;
+  }
+
+  first = rb->maxsize - front;
+  if(first > n)
+  {
+    first = n;
+  }
+
+  memcpy(cdata, &rb->buffer[front], first);
+  memcpy(cdata + first, rb->buffer, n - first);
+
+  front = ringbuff_spsc_advance(front, n, rb->maxsize);
+
+  PUBLISH(rb->front, front);
+
+  return 1;
+}
+
+ringbuff_size_t ringbuff_spsc_count(ringbuff_spsc *rb)
+{
+  ringbuff_size_t front = __atomic_load_n(&rb->front, __ATOMIC_ACQUIRE);
+  ringbuff_size_t back = __atomic_load_n(&rb->back, __ATOMIC_ACQUIRE);
+
+  return ringbuff_spsc_used(front, back, rb->maxsize);
+}
+
+ringbuff_size_t ringbuff_spsc_space(ringbuff_spsc *rb)
+{
+  return rb->maxsize - 1 - ringbuff_spsc_count(rb);
+}
+
+ringbuff_size_t ringbuff_spsc_reserve_back(ringbuff_spsc *rb, char ** ptr)
+{
+  ringbuff_size_t back = LOAD_OWN(rb->back);
+  ringbuff_size_t front = LOAD_OTHER(rb->front);
+
+  *ptr = &rb->buffer[back];
+
+  //stop one short of front so that the empty slot is never handed out
+  if(back < front)
+  {
+    return front - back - 1;
+  }
+
+  if(front == 0)
+  {
+    return rb->maxsize - back - 1;
+  }
+
+  return rb->maxsize - back;
+}
+
+bool ringbuff_spsc_commit_back(ringbuff_spsc *rb, ringbuff_size_t n)
+{
+  ringbuff_size_t back = LOAD_OWN(rb->back);
+  ringbuff_size_t front = LOAD_OTHER(rb->front);
+
+  if(ringbuff_spsc_used(front, back, rb->maxsize) + n >= rb->maxsize)
+  {
+    return 0;
+  }
+
+  back = ringbuff_spsc_advance(back, n, rb->maxsize);
+
+  PUBLISH(rb->back, back);
+
+  return 1;
+}
+
+ringbuff_size_t ringbuff_spsc_peek_contig(ringbuff_spsc *rb, char ** ptr)
+{
+  ringbuff_size_t front = LOAD_OWN(rb->front);
+  ringbuff_size_t back = LOAD_OTHER(rb->back);
+
+  *ptr = &rb->buffer[front];
+
+  if(front <= back)
+  {
+    return back - front;
+  }
+
+  return rb->maxsize - front;
+}
+
+bool ringbuff_spsc_consume(ringbuff_spsc *rb, ringbuff_size_t n)
+{
+  ringbuff_size_t front = LOAD_OWN(rb->front);
+  ringbuff_size_t back = LOAD_OTHER(rb->back);
+
+  if(ringbuff_spsc_used(front, back, rb->maxsize) < n)
+  {
+    return 0;
+  }
+
+  front = ringbuff_spsc_advance(front, n, rb->maxsize);
+
+  PUBLISH(rb->front, front);
+
+  return 1;
+}
@@ -0,0 +1,162 @@
+/********************************************************************
+ringbuffer_spsc.h - lock-free single-producer/single-consumer fifo.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef RINGBUFFER_SPSC_H
+#define RINGBUFFER_SPSC_H
+
+/**
+  \brief a lock-free single-producer/single-consumer ringbuffer
+
+  Unlike ::ringbuff there is no shared count field.  The producer only ever
+  writes back and the consumer only ever writes front, so one ISR and one task
+  (or two tasks) can share the buffer without disabling interrupts.  Index
+  updates are published with release ordering and observed with acquire
+  ordering, so the data bytes are always visible before the index that covers
+  them.
+
+  One slot is kept empty to tell a full buffer from an empty one, so the buffer
+  holds at most maxsize-1 bytes.  It can be pre-initialized the same way as
+  ::ringbuff:
+
+  \code
+  #define mybuffsize 256
+  char mybuffer[mybuffsize];
+  ringbuff_spsc myringbuff = {
+    .buffer = mybuffer,
+    .maxsize = mybuffsize,
+  };
+  \endcode
+
+  Only the back can be pushed and only the front can be popped (fifo).  The _s
+  versions copy the data in at most two memcpy segments.
+*/
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "ringbuffer.h"
+
+typedef struct ringbuff_spsc_struct
+{
+    /// the location in memory the data is actually stored
+    char * buffer;
+
+    /// index of the first occupied byte, only written by the consumer
+    volatile ringbuff_size_t front;
+
+    /// index of the first vacant byte, only written by the producer
+    volatile ringbuff_size_t back;
+
+    /// the size of the buffer in bytes (holds at most maxsize-1 bytes)
+    ringbuff_size_t maxsize;
+} ringbuff_spsc;
+
+/**
+  \brief initializes a spsc ringbuffer to work with the buffer pointed by
+  buffer of size buffsize
+
+  \param rb a pointer to the ringbuffer to initialize
+  \param buffer a pointer to a memory buffer designated for this ringbuffer
+  \param buffsize the size of the buffer for this ringbuffer in bytes
+*/
+void ringbuff_spsc_init(ringbuff_spsc * rb, char * buffer, ringbuff_size_t buffsize);
+
+/**
+  \brief pushes a char onto the back of the ringbuffer (producer side)
+
+  \returns 1 if successful, 0 if failed(the buffer is already full)
+*/
+bool ringbuff_spsc_push_back(ringbuff_spsc *rb, char c);
+
+/**
+  \brief pops a char off of the front of the ringbuffer (consumer side)
+
+  \returns 1 if successful, 0 if failed(the buffer is already empty)
+*/
+bool ringbuff_spsc_pop_front(ringbuff_spsc *rb, char * c);
+
+/**
+  \brief pushes n bytes (or a struct) onto the back of the ringbuffer
+  (producer side)
+
+  \param rb a pointer to the ringbuffer to add the data to
+  \param data a pointer to the first byte of data to be added
+  \param n the number of bytes to add
+
+  \returns 1 if successful, 0 if failed(the buffer doesn't have room).  Either
+  all n bytes are pushed or none are.
+*/
+bool ringbuff_spsc_push_back_s(ringbuff_spsc *rb, const void * data, ringbuff_size_t n);
+
+/**
+  \brief pops n bytes (or a struct) off of the front of the ringbuffer
+  (consumer side)
+
+  \param rb a pointer to the ringbuffer to pop the data from
+  \param data a pointer to the location to store the first byte of data
+  \param n the number of bytes to pop
+
+  \returns 1 if successful, 0 if failed(fewer than n bytes are available).
+  Either all n bytes are popped or none are.
+*/
+bool ringbuff_spsc_pop_front_s(ringbuff_spsc *rb, void * data, ringbuff_size_t n);
+
+/**
+  \brief returns the number of bytes currently in the ringbuffer
+
+  This is a snapshot: from the consumer it is a lower bound (the producer may
+  add more), from the producer it is an upper bound.
+*/
+ringbuff_size_t ringbuff_spsc_count(ringbuff_spsc *rb);
+
+/**
+  \brief returns the number of bytes that can currently be pushed
+*/
+ringbuff_size_t ringbuff_spsc_space(ringbuff_spsc *rb);
+
+/**
+  \brief reserves the largest contiguous vacant span at the back of the
+  ringbuffer for in-place writing (producer side)
+
+  Same contract as ringbuff_reserve_back.  Suited to a DMA engine or an ISR
+  that decodes straight into the ring's storage.
+
+  \returns the length of the span in bytes, 0 if the buffer is full
+*/
+ringbuff_size_t ringbuff_spsc_reserve_back(ringbuff_spsc *rb, char ** ptr);
+
+/**
+  \brief publishes n bytes written into a reserved span (producer side)
+
+  \returns 1 if successful, 0 if failed(n is larger than the vacant span)
+*/
+bool ringbuff_spsc_commit_back(ringbuff_spsc *rb, ringbuff_size_t n);
+
+/**
+  \brief returns the largest contiguous readable span at the front of the
+  ringbuffer without copying it out (consumer side)
+
+  \returns the length of the span in bytes, 0 if the buffer is empty
+*/
+ringbuff_size_t ringbuff_spsc_peek_contig(ringbuff_spsc *rb, char ** ptr);
+
+/**
+  \brief releases n bytes off of the front of the ringbuffer (consumer side)
+
+  \returns 1 if successful, 0 if failed(fewer than n bytes are available)
+*/
+bool ringbuff_spsc_consume(ringbuff_spsc *rb, ringbuff_size_t n);
+
+#endif //RINGBUFFER_SPSC_H
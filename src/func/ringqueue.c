@@ -0,0 +1,202 @@
+/********************************************************************
+ringqueue.c - fixed-stride fifo of same-size records.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#include "ringqueue.h"
+#include "string.h"
+
+// front and back are kept as 32 bit byte offsets so the single record
+// push/pop paths never multiply; only indexed access and the batch calls do.
+// ringqueue_init guarantees capacity*elem_size fits in 32 bits.
+
+static inline uint32_t rq_bytes(const ringqueue * q)
+{
+  return (uint32_t)q->capacity * q->elem_size;
+}
+
+static inline uint32_t rq_step(const ringqueue * q, uint32_t offset, uint32_t bytes)
+{
+  uint32_t o = offset + bytes;
+
+  if(o >= rq_bytes(q))
+  {
+    o -= rq_bytes(q);
+  }
+
+  return o;
+}
+
+// copies n records starting at byte offset into the storage, wrapping once
+static void rq_copy_in(ringqueue * q, uint32_t offset, const char * src,
+                       ringbuff_size_t n)
+{
+  uint32_t len = (uint32_t)n * q->elem_size;
+  uint32_t first = rq_bytes(q) - offset;
+
+  if(first > len)
+  {
+    first = len;
+  }
+
+  memcpy(&q->buffer[offset], src, first);
+  memcpy(q->buffer, src + first, len - first);
+}
+
+static void rq_copy_out(const ringqueue * q, uint32_t offset, char * dst,
+                        ringbuff_size_t n)
+{
+  uint32_t len = (uint32_t)n * q->elem_size;
+  uint32_t first = rq_bytes(q) - offset;
+
+  if(first > len)
+  {
+    first = len;
+  }
+
+  memcpy(dst, &q->buffer[offset], first);
+  memcpy(dst + first, q->buffer, len - first);
+}
+
+bool ringqueue_init(ringqueue * q, void * buffer, ringbuff_size_t elem_size,
+                    ringbuff_size_t capacity, bool overwrite)
+{
+  bool fits = elem_size != 0 && (uint64_t)elem_size * capacity <= UINT32_MAX;
+
+  q->buffer = buffer;
+  q->elem_size = elem_size;
+  q->capacity = fits ? capacity : 0;
+  q->overwrite = overwrite;
+  ringqueue_clear(q);
+
+  return fits;
+}
+
+void ringqueue_clear(ringqueue * q)
+{
+  q->front = 0;
+  q->back = 0;
+  q->count = 0;
+}
+
+ringbuff_size_t ringqueue_count(const ringqueue * q)
+{
+  return q->count;
+}
+
+bool ringqueue_push(ringqueue * q, const void * elem)
+{
+  if(q->count >= q->capacity)
+  {
+    if(!q->overwrite || q->capacity == 0)
+    {
+      return 0;
+    }
+
+    //drop the oldest record to make room
+    q->front = rq_step(q, q->front, q->elem_size);
+    q->count--;
+  }
+
+  memcpy(&q->buffer[q->back], elem, q->elem_size);
+  q->back = rq_step(q, q->back, q->elem_size);
+  q->count++;
+
+  return 1;
+}
+
+bool ringqueue_pop(ringqueue * q, void * elem)
+{
+  if(q->count == 0)
+  {
+    return 0;
+  }
+
+  memcpy(elem, &q->buffer[q->front], q->elem_size);
+  q->front = rq_step(q, q->front, q->elem_size);
+  q->count--;
+
+  return 1;
+}
+
+ringbuff_size_t ringqueue_push_n(ringqueue * q, const void * elems, ringbuff_size_t n)
+{
+  const char * src = elems;
+  ringbuff_size_t room = q->capacity - q->count;
+  ringbuff_size_t pushed = n;
+
+  if(n > room)
+  {
+    if(!q->overwrite)
+    {
+      n = room;
+      pushed = room;
+    }
+    else
+    {
+      //only the newest capacity records can survive
+      if(n > q->capacity)
+      {
+        src += (uint32_t)(n - q->capacity) * q->elem_size;
+        n = q->capacity;
+      }
+
+      //drop just enough of the oldest records to fit the rest
+      room = n - room;
+      q->front = rq_step(q, q->front, (uint32_t)room * q->elem_size);
+      q->count -= room;
+    }
+  }
+
+  rq_copy_in(q, q->back, src, n);
+  q->back = rq_step(q, q->back, (uint32_t)n * q->elem_size);
+  q->count += n;
+
+  return pushed;
+}
+
+ringbuff_size_t ringqueue_pop_n(ringqueue * q, void * elems, ringbuff_size_t n)
+{
+  if(n > q->count)
+  {
+    n = q->count;
+  }
+
+  rq_copy_out(q, q->front, elems, n);
+  q->front = rq_step(q, q->front, (uint32_t)n * q->elem_size);
+  q->count -= n;
+
+  return n;
+}
+
+void * ringqueue_at(const ringqueue * q, ringbuff_size_t n)
+{
+  if(n >= q->count)
+  {
+    return NULL;
+  }
+
+  return &q->buffer[rq_step(q, q->front, (uint32_t)n * q->elem_size)];
+}
+
+void * ringqueue_at_back(const ringqueue * q, ringbuff_size_t n)
+{
+  if(n >= q->count)
+  {
+    return NULL;
+  }
+
+  //newest record is count-1 records after the front
+  return &q->buffer[rq_step(q, q->front, (uint32_t)(q->count - 1 - n) * q->elem_size)];
+}
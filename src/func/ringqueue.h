@@ -0,0 +1,166 @@
+/********************************************************************
+ringqueue.h - fixed-stride fifo of same-size records.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef RINGQUEUE_H
+#define RINGQUEUE_H
+
+/**
+  \brief a ring of fixed-size records
+
+  Where ::ringbuff is a byte stream that happens to be able to carry structs,
+  a ringqueue knows its element size.  The storage is a whole number of
+  records, so a record never straddles the wrap: pushing or popping one record
+  is a single memcpy and indexing the nth record is one multiply.
+
+  In overwrite mode a push onto a full queue drops the oldest record instead
+  of failing, which makes it a sliding history window.
+
+  The easiest way to create one is with RINGQUEUE_STATIC:
+
+  \code
+  RINGQUEUE_STATIC(foc_history, focControl_t, 1000, true);
+
+  ringqueue_push(&foc_history, &foc);
+  focControl_t * last = ringqueue_at_back(&foc_history, 0);
+  \endcode
+*/
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "ringbuffer.h"
+
+typedef struct ringqueue_struct
+{
+    /// the location in memory the records are actually stored
+    char * buffer;
+
+    /// size of one record in bytes
+    ringbuff_size_t elem_size;
+
+    /// number of records the storage holds
+    ringbuff_size_t capacity;
+
+    /// byte offset of the oldest record (32 bits, the storage may be larger
+    /// than ringbuff_size_t can index)
+    uint32_t front;
+
+    /// byte offset one record past the newest record
+    uint32_t back;
+
+    /// number of records currently in the queue
+    ringbuff_size_t count;
+
+    /// when true a push onto a full queue drops the oldest record
+    bool overwrite;
+} ringqueue;
+
+/**
+  \brief statically allocates and initializes a ringqueue called name that
+  holds up to depth records of type
+
+  The storage is declared with the record type so it has the record's
+  alignment, and records can be accessed in place through ringqueue_at.
+  depth must fit in a ringbuff_size_t and the storage in 32 bits; both are
+  checked at compile time.
+*/
+#define RINGQUEUE_STATIC(name, type, depth, overwrite_oldest)            \
+  _Static_assert((depth) == (ringbuff_size_t)(depth) &&                  \
+                 (uint64_t)sizeof(type) * (depth) <= UINT32_MAX,         \
+                 "ringqueue " #name " is too large");                    \
+  static type name##_storage[(depth)];                                   \
+  static ringqueue name = {                                              \
+    .buffer = (char *)name##_storage,                                    \
+    .elem_size = sizeof(type),                                           \
+    .capacity = (depth),                                                 \
+    .overwrite = (overwrite_oldest),                                     \
+  }
+
+/**
+  \brief initializes a ringqueue over buffer
+
+  \param q a pointer to the ringqueue to initialize
+  \param buffer storage for at least capacity*elem_size bytes, aligned for
+  the record type if records are to be accessed in place
+  \param elem_size the size of one record in bytes
+  \param capacity the number of records buffer holds
+  \param overwrite true to drop the oldest record when pushing onto a full
+  queue, false to fail the push instead
+  \returns 1 if successfull, 0 if elem_size is 0 or capacity*elem_size does
+  not fit in 32 bits (the queue is then left with no capacity)
+*/
+bool ringqueue_init(ringqueue * q, void * buffer, ringbuff_size_t elem_size,
+                    ringbuff_size_t capacity, bool overwrite);
+
+/**
+  \brief empties the queue
+*/
+void ringqueue_clear(ringqueue * q);
+
+/**
+  \brief returns the number of records in the queue
+*/
+ringbuff_size_t ringqueue_count(const ringqueue * q);
+
+/**
+  \brief pushes one record onto the back of the queue
+
+  \returns 1 if successfull, 0 if failed(the queue is full and not in
+  overwrite mode)
+*/
+bool ringqueue_push(ringqueue * q, const void * elem);
+
+/**
+  \brief pops the oldest record off of the front of the queue
+
+  \returns 1 if successfull, 0 if failed(the queue is empty)
+*/
+bool ringqueue_pop(ringqueue * q, void * elem);
+
+/**
+  \brief pushes up to n consecutive records onto the back of the queue
+
+  Copies in at most two memcpy segments.  In overwrite mode all n records are
+  accepted and the oldest ones are dropped as needed (if n exceeds the
+  capacity, only the last capacity records are kept).
+
+  \returns the number of records from elems that were pushed
+*/
+ringbuff_size_t ringqueue_push_n(ringqueue * q, const void * elems, ringbuff_size_t n);
+
+/**
+  \brief pops up to n of the oldest records into elems, oldest first
+
+  \returns the number of records popped
+*/
+ringbuff_size_t ringqueue_pop_n(ringqueue * q, void * elems, ringbuff_size_t n);
+
+/**
+  \brief returns a pointer to the nth oldest record (0 is the front) without
+  removing it
+
+  \returns NULL if the queue holds n or fewer records
+*/
+void * ringqueue_at(const ringqueue * q, ringbuff_size_t n);
+
+/**
+  \brief returns a pointer to the nth newest record (0 is the last pushed)
+  without removing it
+
+  \returns NULL if the queue holds n or fewer records
+*/
+void * ringqueue_at_back(const ringqueue * q, ringbuff_size_t n);
+
+#endif //RINGQUEUE_H
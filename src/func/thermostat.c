@@ -20,6 +20,14 @@ GNU General Public License for more details.
  ***************************************************************************/
 
 #include "thermostat.h"
+#include "string.h"
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static float thermostat_min_temperature ( const float *temperatures, uint8_t count );
+static void  thermostat_plan ( ThermostatPlan_t *plan );
 
 
 /****************************************************************************
@@ -28,17 +36,193 @@ GNU General Public License for more details.
 
  FunctionalState thermostat_control_heat(Thermostat_t* config)
  {
- 	float min = 1000.0f;
+ 	if (config->temperature_count == 0) return DISABLE;
 
  	// find the min (we control off that)
- 	for (uint8_t i=0; i < config->temperature_count; i++)
- 	{
- 		if (config->temperatures[i] < min) min = config->temperatures[i];
- 	}
+ 	float min = thermostat_min_temperature(config->temperatures, config->temperature_count);
 
  	if (config->state == ENABLE)
  		return min < (config->setpoint + config->hysteresis) ? ENABLE : DISABLE;
  	else
  		return min < (config->setpoint - config->hysteresis) ? ENABLE : DISABLE;
  	
- }
\ No newline at end of file
+ }
+
+/**
+ * Sets up time proportional control of several heater zones that share a
+ * supply.  Each zone needs its pi_t set up first (PI_Init with dt equal
+ * to the window length in seconds, then kp, ki and reference); its output
+ * limits are set here to a duty cycle of 0 to 1.
+ * @param plan - Plan state.
+ * @param zones - Zones, kept by reference.
+ * @param zone_count - Number of zones.
+ * @param window - PWM window in calls to thermostat_plan_update, 1 to
+ * THERMOSTAT_MAX_WINDOW.  Sets the duty resolution.
+ * @param power_budget - Most heater power allowed on at once, same units
+ * as the zone powers.
+ */
+void thermostat_plan_init(ThermostatPlan_t* plan, ThermostatZone_t* zones, uint8_t zone_count,
+                          uint16_t window, float power_budget)
+{
+	plan->zones = zones;
+	plan->zone_count = zone_count;
+	plan->window = (window > THERMOSTAT_MAX_WINDOW) ? THERMOSTAT_MAX_WINDOW :
+	               (window < 1) ? 1 : window;
+	plan->power_budget = power_budget;
+	plan->tick = 0;
+
+	for (uint8_t z = 0; z < zone_count; z++)
+	{
+		zones[z].pi.outMin = 0.0f;
+		zones[z].pi.outMax = 1.0f;
+		zones[z].duty = 0.0f;
+		zones[z].on_ticks = 0;
+		zones[z].offset = 0;
+		zones[z].state = DISABLE;
+		zones[z].cutoff = DISABLE;
+		zones[z].switches = 0;
+	}
+}
+
+/**
+ * Call at a fixed rate, then drive each heater from its zone's state.
+ *
+ * At the start of every window each zone's PI sets a duty cycle.  The
+ * on-times are then laid out across the window so the heaters on at any
+ * instant never exceed the power budget: zones take turns rather than all
+ * switching on together at the window start.  A zone that cannot get all
+ * the on-time it asked for is cut back and its PI told (PI_Track), so it
+ * does not wind up.
+ *
+ * Independently of the plan, a zone more than its hysteresis above its
+ * setpoint is cut off at once.  The cut off holds until the zone is more
+ * than its hysteresis below the setpoint, so it cannot chatter at the top
+ * of the band; meanwhile the zone gets no on-time and its PI tracks the
+ * zero output.
+ */
+void thermostat_plan_update(ThermostatPlan_t* plan)
+{
+	if (plan->tick == 0)
+	{
+		thermostat_plan(plan);
+	}
+
+	for (uint8_t z = 0; z < plan->zone_count; z++)
+	{
+		ThermostatZone_t* zone = &plan->zones[z];
+		uint16_t t = (plan->tick + plan->window - zone->offset) % plan->window;
+		FunctionalState state = (t < zone->on_ticks) ? ENABLE : DISABLE;
+
+		if (zone->temperature_count > 0)
+		{
+			float min = thermostat_min_temperature(zone->temperatures, zone->temperature_count);
+
+			if (zone->cutoff == ENABLE)
+			{
+				if (min < zone->pi.reference - zone->hysteresis) zone->cutoff = DISABLE;
+			}
+			else if (min > zone->pi.reference + zone->hysteresis)
+			{
+				zone->cutoff = ENABLE;
+			}
+
+			if (zone->cutoff == ENABLE)
+			{
+				state = DISABLE;
+				zone->pi.measured = min;
+				PI_Track(&zone->pi, 0.0f);
+			}
+		}
+
+		if (state != zone->state)
+		{
+			zone->switches++;
+			zone->state = state;
+		}
+	}
+
+	plan->tick = (plan->tick + 1 < plan->window) ? plan->tick + 1 : 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static float thermostat_min_temperature ( const float *temperatures, uint8_t count )
+{
+	float min = temperatures[0];
+
+	for (uint8_t i = 1; i < count; i++)
+	{
+		if (temperatures[i] < min) min = temperatures[i];
+	}
+
+	return min;
+}
+
+/**
+ * Runs the zone PIs and places each zone's on-time in the window.  Zones
+ * are placed in order; each starts where the previous one ended and takes
+ * the start that gives it the longest run within the budget.
+ */
+static void thermostat_plan(ThermostatPlan_t* plan)
+{
+	float load[THERMOSTAT_MAX_WINDOW];
+	uint16_t window = plan->window;
+	uint16_t cursor = 0;
+
+	memset(load, 0, sizeof(load));
+
+	for (uint8_t z = 0; z < plan->zone_count; z++)
+	{
+		ThermostatZone_t* zone = &plan->zones[z];
+
+		// A cut off zone's PI is tracking zero; leave its share to the others.
+		if (zone->temperature_count == 0 || zone->cutoff == ENABLE)
+		{
+			zone->duty = 0.0f;
+			zone->on_ticks = 0;
+			continue;
+		}
+
+		zone->pi.measured = thermostat_min_temperature(zone->temperatures, zone->temperature_count);
+
+		float duty = PI_Control(&zone->pi);
+		uint16_t want = (uint16_t)(duty * window + 0.5f);
+		uint16_t best_len = 0;
+		uint16_t best_start = cursor;
+
+		for (uint16_t i = 0; i < window && best_len < want; i++)
+		{
+			uint16_t start = (cursor + i) % window;
+			uint16_t len = 0;
+
+			while (len < want && load[(start + len) % window] + zone->power <= plan->power_budget)
+			{
+				len++;
+			}
+
+			if (len > best_len)
+			{
+				best_len = len;
+				best_start = start;
+			}
+		}
+
+		for (uint16_t i = 0; i < best_len; i++)
+		{
+			load[(best_start + i) % window] += zone->power;
+		}
+
+		zone->offset = best_start;
+		zone->on_ticks = best_len;
+		zone->duty = (float)best_len / window;
+
+		if (best_len < want)
+		{
+			PI_Track(&zone->pi, zone->duty);
+		}
+
+		cursor = (best_start + best_len) % window;
+	}
+}
@@ -25,6 +25,13 @@ GNU General Public License for more details.
 
 #include "stdint.h"
 #include "stm32f4xx.h"
+#include "pi.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define THERMOSTAT_MAX_WINDOW	(100)
 
 /****************************************************************************
  * Typedefs
@@ -38,6 +45,36 @@ typedef struct {
 	FunctionalState state;
 } Thermostat_t;
 
+/**
+ * One heater zone under time proportional control.  The setpoint is
+ * pi.reference.  Above setpoint + hysteresis the zone is cut off, and it
+ * stays off until it falls below setpoint - hysteresis, as with
+ * thermostat_control_heat.
+ */
+typedef struct {
+	pi_t pi;
+	float hysteresis;
+	float power;
+	uint8_t temperature_count;
+	float* temperatures;
+
+	// Outputs
+	FunctionalState state;
+	FunctionalState cutoff;
+	float duty;
+	uint16_t on_ticks;
+	uint16_t offset;
+	uint32_t switches;
+} ThermostatZone_t;
+
+typedef struct {
+	ThermostatZone_t* zones;
+	uint8_t zone_count;
+	uint16_t window;
+	uint16_t tick;
+	float power_budget;
+} ThermostatPlan_t;
+
 
 /****************************************************************************
  * Prototypes
@@ -45,5 +82,9 @@ typedef struct {
 
  FunctionalState thermostat_control_heat(Thermostat_t* config);
 
+void thermostat_plan_init(ThermostatPlan_t* plan, ThermostatZone_t* zones, uint8_t zone_count,
+                          uint16_t window, float power_budget);
+void thermostat_plan_update(ThermostatPlan_t* plan);
+
 
 #endif
\ No newline at end of file
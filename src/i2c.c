@@ -20,12 +20,15 @@ GNU General Public License for more details.
 
 #include "FreeRTOS.h"
 #include "i2c.h"
+#include "misc.h"
 #include "semphr.h"
 #include "stdbool.h"
 #include "stm32f4xx_gpio.h"
 #include "stm32f4xx.h"
 #include "stm32f4xx_i2c.h"
 #include "stm32f4xx_rcc.h"
+#include "task.h"
+#include "timers.h"
 
 
 /****************************************************************************
@@ -33,14 +36,47 @@ GNU General Public License for more details.
  ***************************************************************************/
 
 #define I2C_TIMEOUT 5000
+#define I2C_LOCK_TIMEOUT_TICKS    (1000)
+
+#define I2C_XFER_TIMEOUT_TICKS    (1000)
+#define I2C_XFER_IT_ALL           (I2C_IT_EVT | I2C_IT_BUF | I2C_IT_ERR)
+#define I2C_XFER_ERROR_FLAGS      (I2C_SR1_AF | I2C_SR1_ARLO | I2C_SR1_BERR | I2C_SR1_OVR)
+
+#if !configUSE_TIMERS || !INCLUDE_xTimerPendFunctionCall
+#error "the I2C engine needs configUSE_TIMERS and INCLUDE_xTimerPendFunctionCall"
+#endif
+
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef struct
+{
+  I2C_TypeDef     *I2Cx;
+  I2C_InitTypeDef  init;        // kept to reinit the peripheral after a hang
+  I2CXfer_t       *head;        // on the wire once running
+  I2CXfer_t       *tail;
+  TaskHandle_t     waiter;      // polled user waiting for the engine to stop
+  bool             running;     // engine owns the bus
+  bool             polled;      // a polled user owns the bus
+  bool             deferred;    // start pending until the last STOP is out
+  bool             timing;      // head's timeout is running from head->started
+  bool             reading;     // head is in its read phase
+  bool             addressed;   // address of the current phase acknowledged
+} I2CEngine_t;
 
 
 /****************************************************************************
  * Global Variables
  ***************************************************************************/
 
+// Serializes the tasks using the polled API.  The engine never takes it; bus
+// ownership between the two is decided by the running/polled flags.
 static xSemaphoreHandle i2c_mutex[3];
 
+static I2CEngine_t i2c_engine[3];
+
 
 /****************************************************************************
  * Private Prototypes
@@ -50,6 +86,17 @@ static uint8_t i2c_lock           ( I2C_TypeDef *I2Cx );
 static void    i2c_unlock         ( I2C_TypeDef *I2Cx );
 static uint8_t i2c_get_channel_id ( I2C_TypeDef *I2Cx );
 
+static void i2c_engine_next      ( I2CEngine_t *e, BaseType_t *woken );
+static void i2c_engine_start     ( I2CEngine_t *e, BaseType_t *woken );
+static void i2c_engine_deferred  ( void *arg, uint32_t unused );
+static void i2c_engine_write_end ( I2CEngine_t *e, BaseType_t *woken );
+static void i2c_engine_finish    ( I2CEngine_t *e, I2CXferStatus_t status, BaseType_t *woken );
+static void i2c_engine_complete  ( I2CXfer_t *xfer, I2CXferStatus_t status, BaseType_t *woken );
+static void i2c_engine_reset     ( I2CEngine_t *e );
+static bool i2c_engine_tx_byte   ( I2CXfer_t *xfer, uint8_t *data );
+static void i2c_engine_event_isr ( I2CEngine_t *e );
+static void i2c_engine_error_isr ( I2CEngine_t *e );
+
 
 /****************************************************************************
  * Public Functions
@@ -86,6 +133,17 @@ void i2c_init( I2C_TypeDef* I2Cx, I2C_InitTypeDef* I2C_init,
 	// Init the I2C mutex
 	i2c_mutex[i2c_get_channel_id(I2Cx)] = xSemaphoreCreateMutex();
 
+  I2CEngine_t *e = &i2c_engine[i2c_get_channel_id(I2Cx)];
+  e->I2Cx = I2Cx;
+  e->init = *I2C_init;
+  e->head = NULL;
+  e->tail = NULL;
+  e->waiter = NULL;
+  e->running = false;
+  e->polled = false;
+  e->deferred = false;
+  e->timing = false;
+
 	// Enable the I2C clock.
   uint32_t clock_map[] = {RCC_APB1Periph_I2C1, RCC_APB1Periph_I2C2, RCC_APB1Periph_I2C3 };
 	RCC_APB1PeriphClockCmd(clock_map[i2c_get_channel_id(I2Cx)], ENABLE);
@@ -94,6 +152,22 @@ void i2c_init( I2C_TypeDef* I2Cx, I2C_InitTypeDef* I2C_init,
   I2C_Cmd(I2Cx, ENABLE);
 
 	I2C_Init(I2Cx, I2C_init);
+
+  // Event and error interrupts for the transaction engine.  They stay masked
+  // in the peripheral until a transaction is started.
+  IRQn_Type ev_irq[] = { I2C1_EV_IRQn, I2C2_EV_IRQn, I2C3_EV_IRQn };
+  IRQn_Type er_irq[] = { I2C1_ER_IRQn, I2C2_ER_IRQn, I2C3_ER_IRQn };
+
+  NVIC_InitTypeDef nvic_init = {
+      .NVIC_IRQChannel = ev_irq[i2c_get_channel_id(I2Cx)],
+      .NVIC_IRQChannelPreemptionPriority = 5,
+      .NVIC_IRQChannelSubPriority = 0,
+      .NVIC_IRQChannelCmd = ENABLE
+  };
+  NVIC_Init(&nvic_init);
+
+  nvic_init.NVIC_IRQChannel = er_irq[i2c_get_channel_id(I2Cx)];
+  NVIC_Init(&nvic_init);
 }
 
 /**
@@ -111,7 +185,10 @@ bool i2c_start(I2C_TypeDef* I2Cx, uint8_t address, uint8_t direction)
   // wait until I2C1 is not busy anymore
   while(I2C_GetFlagStatus(I2Cx, I2C_FLAG_BUSY)) {
     timeout--;
-    if (timeout == 0) return false;
+    if (timeout == 0) {
+      i2c_unlock(I2Cx);
+      return false;
+    }
   };
 
   return i2c_restart(I2Cx, address, direction);
@@ -164,31 +241,155 @@ bool i2c_restart(I2C_TypeDef* I2Cx, uint8_t address, uint8_t direction)
 }
 
 
+/**
+ * Reads bytes from a device, sleeping rather than polling while the
+ * transfer runs.
+ * @return Number of bytes read (0 on any failure).
+ */
 uint16_t i2c_read_bytes(I2C_TypeDef *I2Cx, uint8_t address, uint8_t *buf,
                   uint16_t bytes)
 {
-  if (!i2c_start( I2Cx, address, I2C_Direction_Receiver )) return 0;
+  I2CXfer_t xfer = {
+      .address = address,
+      .rbuf = buf,
+      .rlen = bytes,
+      .timeout = I2C_XFER_TIMEOUT_TICKS
+  };
+
+  return (i2c_xfer(I2Cx, &xfer) == I2C_XFER_OK) ? bytes : 0;
+}
+
+/**
+ * Queues a transaction.  Transactions run back to back in submission order,
+ * driven entirely by the I2C interrupts, and the polled API is locked out
+ * until the queue drains.  Completion is reported through xfer->callback
+ * and/or a task notification to xfer->notify.
+ *
+ * Task context only, and not from a completion callback.  Never blocks: while
+ * a polled user owns the bus the transaction waits in the queue (and can time
+ * out there), and the queue starts when i2c_stop releases the bus.
+ * @param I2Cx - I2C module
+ * @param xfer - Transaction; must stay valid until it completes.
+ * @return False if the module has not been initialized.
+ */
+bool i2c_xfer_submit( I2C_TypeDef *I2Cx, I2CXfer_t *xfer )
+{
+  I2CEngine_t *e = &i2c_engine[i2c_get_channel_id(I2Cx)];
+
+  if (e->I2Cx == NULL) return false;
+
+  xfer->status = I2C_XFER_PENDING;
+  xfer->count = 0;
+  xfer->next = NULL;
+  xfer->submitted = xTaskGetTickCount();
+
+  taskENTER_CRITICAL();
+
+  if (e->tail != NULL) e->tail->next = xfer;
+  else                 e->head = xfer;
+  e->tail = xfer;
+
+  if (!e->running && !e->polled)
+  {
+    e->running = true;
+    i2c_engine_start(e, NULL);
+  }
+
+  taskEXIT_CRITICAL();
+
+  return true;
+}
+
+/**
+ * Runs a transaction and sleeps until it finishes or times out.  Uses the
+ * calling task's notification value.
+ * @param I2Cx - I2C module
+ * @param xfer - Transaction; notify is overwritten.
+ * @return Final status.
+ */
+I2CXferStatus_t i2c_xfer( I2C_TypeDef *I2Cx, I2CXfer_t *xfer )
+{
+  xfer->notify = xTaskGetCurrentTaskHandle();
 
-  uint16_t count = 0;
+  if (!i2c_xfer_submit(I2Cx, xfer)) return I2C_XFER_BUSY;
 
-  // receive everything but the last byte which needs to be NAKd
-  while(count < (bytes - 1))
+  while (xfer->status == I2C_XFER_PENDING)
   {
-    if (!i2c_read(I2Cx, ENABLE, &buf[count]))
+    TickType_t wait = i2c_xfer_service(I2Cx);
+
+    // A stale notification from an earlier timed out transaction just
+    // costs another pass through the loop.
+    if (xfer->status == I2C_XFER_PENDING) ulTaskNotifyTake(pdTRUE, wait);
+  }
+
+  return xfer->status;
+}
+
+/**
+ * Expires transactions that have outlived their timeout.  While the engine
+ * runs, only the transaction on the wire can expire, timed from when it got
+ * there; the ones queued behind it wait their turn however long the queue.
+ * While a polled user holds the bus, queued transactions are timed from
+ * submission.  A transaction stuck on the wire is aborted and the
+ * peripheral reinitialized before the queue continues.  i2c_xfer does this
+ * itself; callers that only use callbacks should call it periodically.
+ * @param I2Cx - I2C module
+ * @return Ticks until the next transaction could expire, or portMAX_DELAY
+ * if none is queued.
+ */
+TickType_t i2c_xfer_service( I2C_TypeDef *I2Cx )
+{
+  I2CEngine_t *e = &i2c_engine[i2c_get_channel_id(I2Cx)];
+  TickType_t now = xTaskGetTickCount();
+  TickType_t wait = portMAX_DELAY;
+
+  taskENTER_CRITICAL();
+
+  if (e->running)
+  {
+    I2CXfer_t *xfer = e->head;
+
+    if ((TickType_t)(now - xfer->started) >= xfer->timeout)
     {
-      i2c_stop( I2Cx );
-      return count;
+      i2c_engine_reset(e);
+
+      e->head = xfer->next;
+      if (e->head == NULL) e->tail = NULL;
+      e->timing = false;
+
+      i2c_engine_complete(xfer, I2C_XFER_TIMEOUT, NULL);
+      i2c_engine_next(e, NULL);
     }
-    count++;
+
+    if (e->running) wait = e->head->timeout - (TickType_t)(now - e->head->started);
   }
 
-  if (i2c_read(I2Cx, DISABLE, &buf[count]))
+  I2CXfer_t **link = &e->head;
+  I2CXfer_t *last = NULL;
+
+  while (!e->running && *link != NULL)
   {
-    count++;
+    I2CXfer_t *xfer = *link;
+    TickType_t elapsed = now - xfer->submitted;
+
+    if (elapsed >= xfer->timeout)
+    {
+      *link = xfer->next;
+      i2c_engine_complete(xfer, I2C_XFER_TIMEOUT, NULL);
+    }
+    else
+    {
+      if (xfer->timeout - elapsed < wait) wait = xfer->timeout - elapsed;
+      last = xfer;
+      link = &xfer->next;
+    }
   }
 
-  i2c_stop( I2Cx );
-  return count;
+  if (!e->running) e->tail = last;
+
+  taskEXIT_CRITICAL();
+
+  return wait;
 }
 
 /**
@@ -252,12 +453,422 @@ static uint8_t i2c_get_channel_id(I2C_TypeDef *I2Cx)
 	else 				   return 2;
 }
 
+/**
+ * Takes the bus for a polled user.  The mutex orders polled users among
+ * themselves (with priority inheritance); if the engine is running, the
+ * caller then waits for it to stop after the transaction on the wire.
+ */
 static uint8_t i2c_lock(I2C_TypeDef *I2Cx)
 {
-	return xSemaphoreTake(i2c_mutex[i2c_get_channel_id(I2Cx)], 1000);
+  I2CEngine_t *e = &i2c_engine[i2c_get_channel_id(I2Cx)];
+  TickType_t start = xTaskGetTickCount();
+  bool owned;
+
+  if (!xSemaphoreTake(i2c_mutex[i2c_get_channel_id(I2Cx)], I2C_LOCK_TIMEOUT_TICKS))
+  {
+    return false;
+  }
+
+  taskENTER_CRITICAL();
+  owned = !e->running;
+  if (owned) e->polled = true;
+  else       e->waiter = xTaskGetCurrentTaskHandle();
+  taskEXIT_CRITICAL();
+
+  while (!owned)
+  {
+    TickType_t elapsed = xTaskGetTickCount() - start;
+
+    if (elapsed < I2C_LOCK_TIMEOUT_TICKS)
+    {
+      ulTaskNotifyTake(pdTRUE, I2C_LOCK_TIMEOUT_TICKS - elapsed);
+    }
+
+    taskENTER_CRITICAL();
+    owned = e->polled;
+    if (owned || elapsed >= I2C_LOCK_TIMEOUT_TICKS) e->waiter = NULL;
+    taskEXIT_CRITICAL();
+
+    if (!owned && elapsed >= I2C_LOCK_TIMEOUT_TICKS)
+    {
+      xSemaphoreGive(i2c_mutex[i2c_get_channel_id(I2Cx)]);
+      return false;
+    }
+  }
+
+  return true;
 }
 
+/**
+ * Releases the bus from a polled user and starts anything that was queued
+ * in the meantime.
+ */
 static void i2c_unlock(I2C_TypeDef *I2Cx)
 {
-	xSemaphoreGive(i2c_mutex[i2c_get_channel_id(I2Cx)]);
+  I2CEngine_t *e = &i2c_engine[i2c_get_channel_id(I2Cx)];
+
+  taskENTER_CRITICAL();
+  e->polled = false;
+  if (e->head != NULL && !e->running)
+  {
+    e->running = true;
+    i2c_engine_start(e, NULL);
+  }
+  taskEXIT_CRITICAL();
+
+  xSemaphoreGive(i2c_mutex[i2c_get_channel_id(I2Cx)]);
+}
+
+/**
+ * Starts the next queued transaction, or stops the engine if there is none
+ * or a polled user is waiting for the bus.  woken is NULL when called from a
+ * task.
+ */
+static void i2c_engine_next( I2CEngine_t *e, BaseType_t *woken )
+{
+  if (e->head != NULL && e->waiter == NULL)
+  {
+    i2c_engine_start(e, woken);
+    return;
+  }
+
+  I2C_ITConfig(e->I2Cx, I2C_XFER_IT_ALL, DISABLE);
+  e->running = false;
+  e->deferred = false;
+  e->timing = false;
+
+  if (e->waiter != NULL)
+  {
+    e->polled = true;
+
+    if (woken != NULL) vTaskNotifyGiveFromISR(e->waiter, woken);
+    else               xTaskNotifyGive(e->waiter);
+  }
+}
+
+/**
+ * Puts the head transaction on the wire.  If the previous transaction's STOP
+ * is still going out, CR1 must not be written until the hardware clears it.
+ * That takes a few bit times, too long to spin in the event ISR, so the start
+ * is retried from the timer service task instead.
+ */
+static void i2c_engine_start( I2CEngine_t *e, BaseType_t *woken )
+{
+  I2C_TypeDef *I2Cx = e->I2Cx;
+  I2CXfer_t *xfer = e->head;
+
+  // The timeout runs from the first attempt, so a STOP that never clears
+  // still expires the transaction.
+  if (!e->timing)
+  {
+    e->timing = true;
+    xfer->started = (woken != NULL) ? xTaskGetTickCountFromISR() : xTaskGetTickCount();
+  }
+
+  if (I2Cx->CR1 & I2C_CR1_STOP)
+  {
+    I2C_ITConfig(I2Cx, I2C_XFER_IT_ALL, DISABLE);
+
+    // If the timer queue is full the transaction is recovered by
+    // i2c_xfer_service once it times out.
+    if (!e->deferred)
+    {
+      e->deferred = true;
+      if (woken != NULL) xTimerPendFunctionCallFromISR(i2c_engine_deferred, e, 0, woken);
+      else               xTimerPendFunctionCall(i2c_engine_deferred, e, 0, 0);
+    }
+    return;
+  }
+
+  e->deferred = false;
+
+  xfer->count = 0;
+  e->reading = (xfer->cmd_len == 0 && xfer->wlen == 0 && xfer->rlen > 0);
+  e->addressed = false;
+
+  I2C_NACKPositionConfig(I2Cx, I2C_NACKPosition_Current);
+  I2C_AcknowledgeConfig(I2Cx, ENABLE);
+  I2C_ITConfig(I2Cx, I2C_IT_EVT | I2C_IT_ERR, ENABLE);
+  I2C_ITConfig(I2Cx, I2C_IT_BUF, e->reading ? DISABLE : ENABLE);
+  I2C_GenerateSTART(I2Cx, ENABLE);
+}
+
+/**
+ * Deferred start, run by the timer service task.
+ */
+static void i2c_engine_deferred( void *arg, uint32_t unused )
+{
+  I2CEngine_t *e = arg;
+
+  (void)unused;
+
+  taskENTER_CRITICAL();
+  if (e->deferred)
+  {
+    // Clear first so that a STOP still in progress pends another retry.
+    e->deferred = false;
+    i2c_engine_next(e, NULL);
+  }
+  taskEXIT_CRITICAL();
+}
+
+/**
+ * Called once the last write byte has left the shift register (or straight
+ * after the address for an empty write phase).
+ */
+static void i2c_engine_write_end( I2CEngine_t *e, BaseType_t *woken )
+{
+  I2CXfer_t *xfer = e->head;
+
+  if (xfer->rlen > 0)
+  {
+    e->reading = true;
+    e->addressed = false;
+    xfer->count = 0;
+    I2C_ITConfig(e->I2Cx, I2C_IT_BUF, DISABLE);
+    I2C_GenerateSTART(e->I2Cx, ENABLE);
+  }
+  else
+  {
+    I2C_GenerateSTOP(e->I2Cx, ENABLE);
+    i2c_engine_finish(e, I2C_XFER_OK, woken);
+  }
+}
+
+/**
+ * Retires the transaction on the wire and moves to the next one.
+ */
+static void i2c_engine_finish( I2CEngine_t *e, I2CXferStatus_t status, BaseType_t *woken )
+{
+  I2CXfer_t *xfer = e->head;
+
+  e->head = xfer->next;
+  if (e->head == NULL) e->tail = NULL;
+  e->timing = false;
+
+  i2c_engine_complete(xfer, status, woken);
+  i2c_engine_next(e, woken);
+}
+
+static void i2c_engine_complete( I2CXfer_t *xfer, I2CXferStatus_t status, BaseType_t *woken )
+{
+  // Read everything needed before publishing the status; the owner may
+  // reuse the descriptor as soon as it sees it.
+  I2CXferCallback callback = xfer->callback;
+  TaskHandle_t notify = xfer->notify;
+
+  xfer->status = status;
+
+  if (callback != NULL)
+  {
+    callback(xfer);
+  }
+
+  if (notify != NULL)
+  {
+    if (woken != NULL) vTaskNotifyGiveFromISR(notify, woken);
+    else               xTaskNotifyGive(notify);
+  }
+}
+
+/**
+ * Abandons whatever is on the wire and puts the peripheral back in a known
+ * state.
+ */
+static void i2c_engine_reset( I2CEngine_t *e )
+{
+  I2C_ITConfig(e->I2Cx, I2C_XFER_IT_ALL, DISABLE);
+  I2C_GenerateSTOP(e->I2Cx, ENABLE);
+
+  I2C_SoftwareResetCmd(e->I2Cx, ENABLE);
+  I2C_SoftwareResetCmd(e->I2Cx, DISABLE);
+
+  I2C_Cmd(e->I2Cx, ENABLE);
+  I2C_Init(e->I2Cx, &e->init);
+}
+
+/**
+ * Next byte of the write phase: cmd first, then wbuf.
+ * @return False once both are exhausted.
+ */
+static bool i2c_engine_tx_byte( I2CXfer_t *xfer, uint8_t *data )
+{
+  if (xfer->count < xfer->cmd_len)
+  {
+    *data = xfer->cmd[xfer->count];
+  }
+  else if (xfer->count - xfer->cmd_len < xfer->wlen)
+  {
+    *data = xfer->wbuf[xfer->count - xfer->cmd_len];
+  }
+  else
+  {
+    return false;
+  }
+
+  xfer->count++;
+  return true;
+}
+
+/**
+ * Event interrupt.  Reception follows the reference manual's sequences for
+ * the master receiver: the last byte's NACK and the STOP have to be set up
+ * before the byte arrives, so the final two or three bytes are paced by BTF
+ * rather than RXNE.
+ */
+static void i2c_engine_event_isr( I2CEngine_t *e )
+{
+  I2C_TypeDef *I2Cx = e->I2Cx;
+  I2CXfer_t *xfer = e->head;
+  BaseType_t woken = pdFALSE;
+  uint16_t sr1 = I2Cx->SR1;
+
+  if (xfer == NULL)
+  {
+    I2C_ITConfig(I2Cx, I2C_XFER_IT_ALL, DISABLE);
+    return;
+  }
+
+  if (sr1 & I2C_SR1_SB)
+  {
+    e->addressed = false;
+    I2C_Send7bitAddress(I2Cx, xfer->address << 1,
+                        e->reading ? I2C_Direction_Receiver : I2C_Direction_Transmitter);
+  }
+  else if (sr1 & I2C_SR1_ADDR)
+  {
+    e->addressed = true;
+
+    if (e->reading)
+    {
+      // One byte and more than three are paced by RXNE; two and three by BTF.
+      if (xfer->rlen == 1)
+      {
+        I2C_AcknowledgeConfig(I2Cx, DISABLE);
+        (void)I2Cx->SR2;
+        I2C_GenerateSTOP(I2Cx, ENABLE);
+        I2C_ITConfig(I2Cx, I2C_IT_BUF, ENABLE);
+      }
+      else if (xfer->rlen == 2)
+      {
+        I2C_AcknowledgeConfig(I2Cx, DISABLE);
+        I2C_NACKPositionConfig(I2Cx, I2C_NACKPosition_Next);
+        (void)I2Cx->SR2;
+      }
+      else
+      {
+        I2C_AcknowledgeConfig(I2Cx, ENABLE);
+        (void)I2Cx->SR2;
+        if (xfer->rlen > 3) I2C_ITConfig(I2Cx, I2C_IT_BUF, ENABLE);
+      }
+    }
+    else
+    {
+      uint8_t data;
+
+      (void)I2Cx->SR2;
+
+      if (i2c_engine_tx_byte(xfer, &data)) I2C_SendData(I2Cx, data);
+      else                                 i2c_engine_write_end(e, &woken);
+    }
+  }
+  else if (!e->addressed)
+  {
+    // Stale TXE/BTF from the write phase until the repeated START goes out.
+  }
+  else if (e->reading)
+  {
+    uint16_t left = xfer->rlen - xfer->count;
+
+    if ((sr1 & I2C_SR1_BTF) && left == 3)
+    {
+      I2C_AcknowledgeConfig(I2Cx, DISABLE);
+      xfer->rbuf[xfer->count++] = I2C_ReceiveData(I2Cx);
+    }
+    else if ((sr1 & I2C_SR1_BTF) && left == 2)
+    {
+      I2C_GenerateSTOP(I2Cx, ENABLE);
+      xfer->rbuf[xfer->count++] = I2C_ReceiveData(I2Cx);
+      xfer->rbuf[xfer->count++] = I2C_ReceiveData(I2Cx);
+      I2C_NACKPositionConfig(I2Cx, I2C_NACKPosition_Current);
+      i2c_engine_finish(e, I2C_XFER_OK, &woken);
+    }
+    else if ((sr1 & I2C_SR1_RXNE) && (left > 3 || left == 1))
+    {
+      xfer->rbuf[xfer->count++] = I2C_ReceiveData(I2Cx);
+
+      if (left == 4)      I2C_ITConfig(I2Cx, I2C_IT_BUF, DISABLE);
+      else if (left == 1) i2c_engine_finish(e, I2C_XFER_OK, &woken);
+    }
+  }
+  else if (sr1 & (I2C_SR1_TXE | I2C_SR1_BTF))
+  {
+    uint8_t data;
+
+    if (i2c_engine_tx_byte(xfer, &data))  I2C_SendData(I2Cx, data);
+    else if (sr1 & I2C_SR1_BTF)           i2c_engine_write_end(e, &woken);
+    else                                  I2C_ITConfig(I2Cx, I2C_IT_BUF, DISABLE);
+  }
+
+  portEND_SWITCHING_ISR(woken);
+}
+
+/**
+ * Error interrupt.  A NACK ends the transaction with a STOP; after lost
+ * arbitration the peripheral has already dropped out of master mode.
+ */
+static void i2c_engine_error_isr( I2CEngine_t *e )
+{
+  I2C_TypeDef *I2Cx = e->I2Cx;
+  BaseType_t woken = pdFALSE;
+  uint16_t sr1 = I2Cx->SR1;
+
+  I2Cx->SR1 = (uint16_t)~(sr1 & I2C_XFER_ERROR_FLAGS);
+
+  if (!(sr1 & I2C_SR1_ARLO)) I2C_GenerateSTOP(I2Cx, ENABLE);
+  I2C_NACKPositionConfig(I2Cx, I2C_NACKPosition_Current);
+
+  if (e->head == NULL)
+  {
+    I2C_ITConfig(I2Cx, I2C_XFER_IT_ALL, DISABLE);
+    return;
+  }
+
+  i2c_engine_finish(e, (sr1 & I2C_SR1_AF) ? I2C_XFER_NACK : I2C_XFER_BUS_ERROR, &woken);
+
+  portEND_SWITCHING_ISR(woken);
+}
+
+/****************************************************************************
+ * Interrupt Service Routines
+ ***************************************************************************/
+
+void I2C1_EV_IRQHandler ( void )
+{
+  i2c_engine_event_isr(&i2c_engine[0]);
+}
+
+void I2C1_ER_IRQHandler ( void )
+{
+  i2c_engine_error_isr(&i2c_engine[0]);
+}
+
+void I2C2_EV_IRQHandler ( void )
+{
+  i2c_engine_event_isr(&i2c_engine[1]);
+}
+
+void I2C2_ER_IRQHandler ( void )
+{
+  i2c_engine_error_isr(&i2c_engine[1]);
+}
+
+void I2C3_EV_IRQHandler ( void )
+{
+  i2c_engine_event_isr(&i2c_engine[2]);
+}
+
+void I2C3_ER_IRQHandler ( void )
+{
+  i2c_engine_error_isr(&i2c_engine[2]);
 }
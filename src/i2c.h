@@ -23,11 +23,75 @@ GNU General Public License for more details.
  ***************************************************************************/
 
 #include "stdbool.h"
+#include "stdint.h"
+#include "FreeRTOS.h"
+#include "task.h"
 #include "stm32f4xx.h"
 #include "stm32f4xx_i2c.h"
 #include "gpio.h"
 
 
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define I2C_XFER_CMD_MAX    (4)
+
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef enum
+{
+  I2C_XFER_PENDING = 0,   // queued or on the wire
+  I2C_XFER_OK,
+  I2C_XFER_NACK,          // address or data byte not acknowledged
+  I2C_XFER_BUS_ERROR,     // misplaced start/stop or arbitration lost
+  I2C_XFER_TIMEOUT,
+  I2C_XFER_BUSY           // module not initialized
+} I2CXferStatus_t;
+
+struct I2CXfer;
+
+/**
+ * Completion callback.  Runs in interrupt context, except for a transaction
+ * that timed out, whose callback runs wherever the timeout was detected.
+ */
+typedef void (*I2CXferCallback)(struct I2CXfer *xfer);
+
+/**
+ * One bus transaction: START, address+W, cmd, wbuf, then (if rlen > 0) a
+ * repeated START, address+R, rbuf, STOP.  Either phase may be empty.  cmd is
+ * for short headers such as a register or memory address, so wbuf can point
+ * straight at the caller's payload.
+ *
+ * The descriptor belongs to the engine from submission until status leaves
+ * I2C_XFER_PENDING.
+ */
+typedef struct I2CXfer
+{
+  uint8_t          address;                 // 7-bit address, unshifted
+  uint8_t          cmd[I2C_XFER_CMD_MAX];
+  uint8_t          cmd_len;
+  const uint8_t   *wbuf;
+  uint16_t         wlen;
+  uint8_t         *rbuf;
+  uint16_t         rlen;
+  TickType_t       timeout;                 // ticks on the wire, see i2c_xfer_service
+  I2CXferCallback  callback;                // optional
+  void            *arg;                     // for the callback's use
+  TaskHandle_t     notify;                  // optional, given on completion
+
+  // Engine state.
+  volatile I2CXferStatus_t status;
+  uint16_t         count;                   // bytes moved in the current phase
+  TickType_t       submitted;
+  TickType_t       started;                 // reached the head of a running queue
+  struct I2CXfer  *next;
+} I2CXfer_t;
+
+
 /****************************************************************************
  * Public Prototypes
  ***************************************************************************/
@@ -43,5 +107,9 @@ void    i2c_stop    ( I2C_TypeDef* I2Cx );
 
 uint16_t i2c_read_bytes ( I2C_TypeDef *I2Cx, uint8_t address, uint8_t *buf, uint16_t bytes );
 
+bool            i2c_xfer_submit  ( I2C_TypeDef *I2Cx, I2CXfer_t *xfer );
+I2CXferStatus_t i2c_xfer         ( I2C_TypeDef *I2Cx, I2CXfer_t *xfer );
+TickType_t      i2c_xfer_service ( I2C_TypeDef *I2Cx );
+
 
 #endif /* I2C_H_ */
@@ -0,0 +1,355 @@
+/********************************************************************
+i2c_sched.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "i2c_sched.h"
+#include "string.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// Set while no batch is on the bus or in its done handlers.
+#define I2C_SCHED_IDLE            (1 << 0)
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void       i2c_sched_task ( void *arg );
+static TickType_t i2c_sched_poll ( I2CSched_t *sched );
+static void       i2c_sched_run  ( I2CSched_t *sched );
+static uint32_t   i2c_sched_bits ( const I2CXfer_t *xfer );
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Starts a scheduler for one bus.  All jobs that fall due together are
+ * handed to the transaction engine in one go, so they run back to back
+ * without the bus being released or the task waking between them.
+ * @param sched - Scheduler to start.
+ * @param I2Cx - I2C module, already set up with i2c_init.
+ * @param bus_hz - SCL frequency, used for the utilization estimate.
+ * @param priority - FreeRTOS priority of the scheduler task.
+ * @return False if the task could not be created.
+ */
+bool i2c_sched_start( I2CSched_t *sched, I2C_TypeDef *I2Cx, uint32_t bus_hz,
+                      UBaseType_t priority )
+{
+  sched->I2Cx = I2Cx;
+  sched->bus_hz = bus_hz;
+  sched->jobs = NULL;
+  sched->batch_len = 0;
+  memset(&(sched->stats), 0, sizeof(I2CSchedStats_t));
+  sched->stats.since = xTaskGetTickCount();
+
+  sched->events = xEventGroupCreate();
+  if (sched->events == NULL) return false;
+  xEventGroupSetBits(sched->events, I2C_SCHED_IDLE);
+
+  return xTaskCreate(i2c_sched_task, "i2c_sched", I2C_SCHED_TASK_STACK_SIZE,
+                     sched, priority, &(sched->task)) == pdPASS;
+}
+
+/**
+ * Adds a job.  It first runs as soon as the scheduler gets to it, then
+ * every period ticks.  A one-shot (period 0) is dropped after it runs.
+ * Jobs due together run in the order they were added.  Re-adding a job
+ * that is still scheduled (e.g. a one-shot from its own done handler) just
+ * reschedules it.
+ * @param sched - Scheduler.
+ * @param job - Job with xfer and done filled in.  Must stay valid while
+ * scheduled.
+ * @param period - Ticks between runs, or 0 for a one-shot.
+ */
+void i2c_sched_add( I2CSched_t *sched, I2CJob_t *job, TickType_t period )
+{
+  taskENTER_CRITICAL();
+
+  I2CJob_t **link = &(sched->jobs);
+  while (*link != NULL && *link != job) link = &((*link)->next);
+
+  if (*link == NULL)
+  {
+    job->next = NULL;
+    *link = job;
+    memset(&(job->stats), 0, sizeof(I2CJobStats_t));
+  }
+
+  job->period = period;
+  job->due = xTaskGetTickCount();
+  job->remove = false;
+
+  taskEXIT_CRITICAL();
+
+  xTaskNotifyGive(sched->task);
+}
+
+/**
+ * Unschedules a job and waits until the scheduler is done with it, so the
+ * job may be freed or reused as soon as this returns.  A run already on the
+ * bus still completes and calls the done handler first.
+ *
+ * From a done handler (including the job's own) it returns at once; a job
+ * later in the same batch then has its handler skipped.
+ */
+void i2c_sched_remove( I2CSched_t *sched, I2CJob_t *job )
+{
+  bool in_batch = false;
+  uint8_t i;
+
+  taskENTER_CRITICAL();
+
+  I2CJob_t **link = &(sched->jobs);
+  while (*link != NULL && *link != job) link = &((*link)->next);
+  if (*link != NULL) *link = job->next;
+
+  for (i = 0; i < sched->batch_len; i++)
+  {
+    if (sched->batch[i] == job)
+    {
+      in_batch = true;
+
+      // The scheduler task itself only ever looks at later slots again.
+      if (xTaskGetCurrentTaskHandle() == sched->task) sched->batch[i] = NULL;
+    }
+  }
+
+  taskEXIT_CRITICAL();
+
+  if (in_batch && xTaskGetCurrentTaskHandle() != sched->task)
+  {
+    // Cleared in the same critical section that fills the batch, so once
+    // set again the batch holding this job is finished.
+    xEventGroupWaitBits(sched->events, I2C_SCHED_IDLE, pdFALSE, pdTRUE, portMAX_DELAY);
+  }
+}
+
+void i2c_sched_get_stats( I2CSched_t *sched, I2CSchedStats_t *stats )
+{
+  taskENTER_CRITICAL();
+  *stats = sched->stats;
+  taskEXIT_CRITICAL();
+}
+
+/**
+ * Estimated share of the bus spent on the wire since the stats were last
+ * reset, from the bits each job moves at bus_hz.
+ * @return Utilization in percent.
+ */
+float i2c_sched_utilization( I2CSched_t *sched )
+{
+  I2CSchedStats_t stats;
+  i2c_sched_get_stats(sched, &stats);
+
+  TickType_t elapsed = xTaskGetTickCount() - stats.since;
+  if (elapsed == 0) return 0.0f;
+
+  return 100.0f * (float)stats.bus_bits * (float)configTICK_RATE_HZ /
+         ((float)sched->bus_hz * (float)elapsed);
+}
+
+void i2c_sched_reset_stats( I2CSched_t *sched )
+{
+  taskENTER_CRITICAL();
+  memset(&(sched->stats), 0, sizeof(I2CSchedStats_t));
+  sched->stats.since = xTaskGetTickCount();
+  taskEXIT_CRITICAL();
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static void i2c_sched_task( void *arg )
+{
+  I2CSched_t *sched = arg;
+
+  for (;;)
+  {
+    TickType_t wait = i2c_sched_poll(sched);
+
+    // Woken early by i2c_sched_add or a stale engine notification.
+    if (wait > 0) ulTaskNotifyTake(pdTRUE, wait);
+  }
+}
+
+/**
+ * One pass of the scheduler task: drops removed jobs and runs everything
+ * that is due as one batch.
+ * @return Ticks until the next job is due; 0 if a batch ran, as more may
+ * have fallen due meanwhile.
+ */
+static TickType_t i2c_sched_poll( I2CSched_t *sched )
+{
+  TickType_t now = xTaskGetTickCount();
+  TickType_t wait = portMAX_DELAY;
+  uint8_t n = 0;
+
+  // Collect everything due, drop removed jobs and find the next wake up.
+  taskENTER_CRITICAL();
+
+  I2CJob_t **link = &(sched->jobs);
+
+  while (*link != NULL)
+  {
+    I2CJob_t *job = *link;
+
+    if (job->remove)
+    {
+      *link = job->next;
+      continue;
+    }
+
+    if ((int32_t)(now - job->due) >= 0)
+    {
+      if (n < I2C_SCHED_MAX_BATCH) sched->batch[n++] = job;
+    }
+    else if ((TickType_t)(job->due - now) < wait)
+    {
+      wait = job->due - now;
+    }
+
+    link = &(job->next);
+  }
+
+  if (n > 0)
+  {
+    sched->batch_len = n;
+    xEventGroupClearBits(sched->events, I2C_SCHED_IDLE);
+  }
+
+  taskEXIT_CRITICAL();
+
+  if (n == 0) return wait;
+
+  i2c_sched_run(sched);
+
+  taskENTER_CRITICAL();
+  sched->batch_len = 0;
+  taskEXIT_CRITICAL();
+
+  xEventGroupSetBits(sched->events, I2C_SCHED_IDLE);
+
+  return 0;
+}
+
+/**
+ * Puts the batch on the bus, waits for all of it and then runs the done
+ * handlers.  A handler may remove a later job in the batch, which clears its
+ * slot.
+ */
+static void i2c_sched_run( I2CSched_t *sched )
+{
+  I2CJob_t **batch = sched->batch;
+  uint8_t n = sched->batch_len;
+  TickType_t finished[I2C_SCHED_MAX_BATCH];
+  uint8_t i;
+
+  for (i = 0; i < n; i++)
+  {
+    batch[i]->xfer.callback = NULL;
+    batch[i]->xfer.notify = sched->task;
+    i2c_xfer_submit(sched->I2Cx, &(batch[i]->xfer));
+  }
+
+  // The engine finishes jobs in order, so wait on each in turn.  Each job's
+  // timeout runs from when it reaches the wire, not from the submission
+  // above, so a long batch does not eat into the timeouts at its tail.
+  for (i = 0; i < n; )
+  {
+    if (batch[i]->xfer.status != I2C_XFER_PENDING)
+    {
+      finished[i++] = xTaskGetTickCount();
+      continue;
+    }
+
+    TickType_t wait = i2c_xfer_service(sched->I2Cx);
+
+    if (batch[i]->xfer.status == I2C_XFER_PENDING) ulTaskNotifyTake(pdTRUE, wait);
+  }
+
+  TickType_t now = xTaskGetTickCount();
+
+  for (i = 0; i < n; i++)
+  {
+    I2CJob_t *job = batch[i];
+
+    if (job == NULL) continue;
+
+    I2CXferStatus_t status = job->xfer.status;
+    TickType_t latency = finished[i] - job->due;
+
+    job->stats.runs++;
+    job->stats.latency_sum += latency;
+    if (latency > job->stats.latency_max) job->stats.latency_max = latency;
+    if (status != I2C_XFER_OK) job->stats.failures++;
+
+    taskENTER_CRITICAL();
+    sched->stats.transactions++;
+    if (status != I2C_XFER_OK) sched->stats.failures++;
+    sched->stats.bus_bits += i2c_sched_bits(&(job->xfer));
+    taskEXIT_CRITICAL();
+
+    // Reschedule before the handler so it may remove the job.  A job that
+    // fell a whole period behind skips the missed runs rather than bursting.
+    if (job->period == 0)
+    {
+      job->remove = true;
+    }
+    else
+    {
+      job->due += job->period;
+      if ((int32_t)(now - job->due) >= 0) job->due = now + job->period;
+    }
+
+    if (job->done != NULL)
+    {
+      job->done(job, status);
+    }
+  }
+
+  taskENTER_CRITICAL();
+  sched->stats.bursts++;
+  taskEXIT_CRITICAL();
+}
+
+/**
+ * SCL periods a transaction occupies: START, address and 9 bits per byte
+ * for each phase, then STOP.
+ */
+static uint32_t i2c_sched_bits( const I2CXfer_t *xfer )
+{
+  bool write = (xfer->cmd_len + xfer->wlen > 0 || xfer->rlen == 0);
+  uint32_t bits = 2;
+
+  if (write)
+  {
+    bits += 9 * (1 + xfer->cmd_len + xfer->wlen);
+  }
+
+  if (xfer->rlen > 0)
+  {
+    bits += (write ? 1 : 0) + 9 * (1 + xfer->rlen);
+  }
+
+  return bits;
+}
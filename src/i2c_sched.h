@@ -0,0 +1,115 @@
+/********************************************************************
+i2c_sched.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef I2C_SCHED_H
+#define I2C_SCHED_H
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdbool.h"
+#include "stdint.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "event_groups.h"
+#include "i2c.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// Most jobs the scheduler puts on the bus in one burst.
+#ifndef I2C_SCHED_MAX_BATCH
+#define I2C_SCHED_MAX_BATCH       (16)
+#endif
+
+#define I2C_SCHED_TASK_STACK_SIZE (256)
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+struct I2CJob;
+
+/**
+ * Job completion handler.  Runs in the scheduler task, so it may block
+ * briefly, but every job behind it on the bus waits.
+ */
+typedef void (*I2CJobDoneFxn)(struct I2CJob *job, I2CXferStatus_t status);
+
+typedef struct
+{
+  uint32_t    runs;
+  uint32_t    failures;
+  TickType_t  latency_max;    // due time to completion
+  uint32_t    latency_sum;
+} I2CJobStats_t;
+
+/**
+ * A transaction the scheduler runs once or every period ticks.  Set up
+ * xfer (address, cmd, buffers, timeout) and done; the scheduler owns the
+ * rest.  A write-then-read (e.g. register pointer, then data) is a single
+ * xfer and goes out as one repeated-start transaction.
+ */
+typedef struct I2CJob
+{
+  I2CXfer_t       xfer;
+  TickType_t      period;     // 0 for a one-shot
+  I2CJobDoneFxn   done;       // optional
+  void           *arg;        // for the handler's use
+  I2CJobStats_t   stats;
+
+  // Scheduler state.
+  TickType_t      due;
+  bool            remove;
+  struct I2CJob  *next;
+} I2CJob_t;
+
+typedef struct
+{
+  uint32_t    transactions;
+  uint32_t    failures;
+  uint32_t    bursts;         // times the bus was taken for a batch of jobs
+  uint32_t    bus_bits;       // estimated SCL periods spent on the wire
+  TickType_t  since;          // start of the measurement window
+} I2CSchedStats_t;
+
+typedef struct
+{
+  I2C_TypeDef        *I2Cx;
+  uint32_t            bus_hz;
+  I2CJob_t           *jobs;
+  TaskHandle_t        task;
+  EventGroupHandle_t  events;
+  I2CJob_t           *batch[I2C_SCHED_MAX_BATCH];   // jobs on the bus or in their handlers
+  uint8_t             batch_len;
+  I2CSchedStats_t     stats;
+} I2CSched_t;
+
+/****************************************************************************
+ * Public Prototypes
+ ***************************************************************************/
+
+bool  i2c_sched_start       ( I2CSched_t *sched, I2C_TypeDef *I2Cx, uint32_t bus_hz,
+                              UBaseType_t priority );
+void  i2c_sched_add         ( I2CSched_t *sched, I2CJob_t *job, TickType_t period );
+void  i2c_sched_remove      ( I2CSched_t *sched, I2CJob_t *job );
+void  i2c_sched_get_stats   ( I2CSched_t *sched, I2CSchedStats_t *stats );
+float i2c_sched_utilization ( I2CSched_t *sched );
+void  i2c_sched_reset_stats ( I2CSched_t *sched );
+
+#endif /* I2C_SCHED_H */
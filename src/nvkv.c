@@ -0,0 +1,575 @@
+/********************************************************************
+nvkv.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "nvkv.h"
+#include "nvmem.h"
+#include "string.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// Half header: magic, generation, CRC of both.
+#define NVKV_MAGIC          (0x564B564EUL)
+#define NVKV_HEADER_SIZE    (10)
+
+// Record: key, length, CRC of the generation, key, length and value.
+// Seeding the CRC with the generation means records left over from an
+// earlier use of the same half can never pass for current ones.
+#define NVKV_RECORD_SIZE    (6)
+
+#define NVKV_DELETED        (0xFFFF)
+
+// Records up to this size are assembled in RAM and written in one go.
+#define NVKV_INLINE_SIZE    (64)
+
+// Chunk used when streaming values through the CRC.
+#define NVKV_CHUNK_SIZE     (32)
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static bool        nvkv_scan         ( NvKv_t *kv );
+static bool        nvkv_append       ( NvKv_t *kv, uint16_t key, const void *data, uint16_t len );
+static bool        nvkv_copy_record  ( NvKv_t *kv, const NvKvSlot_t *slot, uint8_t to,
+                                       uint16_t offset, uint32_t seq );
+static bool        nvkv_write_end    ( NvKv_t *kv, uint8_t half, uint32_t offset, uint32_t seq );
+static bool        nvkv_read_header  ( NvKv_t *kv, uint8_t half, uint32_t *seq );
+static bool        nvkv_write_header ( NvKv_t *kv, uint8_t half, uint32_t seq );
+static NvKvSlot_t *nvkv_find         ( NvKv_t *kv, uint16_t key );
+static void        nvkv_index_put    ( NvKv_t *kv, NvKvSlot_t *slot, uint16_t key,
+                                       uint16_t offset, uint16_t len );
+static uint16_t    nvkv_address      ( const NvKv_t *kv, uint8_t half, uint16_t offset );
+static uint16_t    nvkv_record_size  ( uint16_t len );
+static uint16_t    nvkv_crc_seed     ( uint32_t seq );
+static uint16_t    nvkv_crc          ( uint16_t crc, const uint8_t *data, uint16_t len );
+static void        nvkv_put16        ( uint8_t *buf, uint16_t value );
+static uint16_t    nvkv_get16        ( const uint8_t *buf );
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Opens the store in nvmem region [base, base + size), formatting it if
+ * neither half holds a valid header.  Scans the active half to rebuild the
+ * index; a record torn by a power cut fails its CRC and ends the log there,
+ * leaving the previous value of that key in effect.
+ * @param kv - Store state.
+ * @param base - nvmem address of the region.
+ * @param size - Size of the region in bytes.
+ * @return False if the region is too small or nvmem could not be read.
+ */
+bool nvkv_mount ( NvKv_t *kv, uint16_t base, uint16_t size )
+{
+    uint32_t seq0, seq1;
+
+    kv->base = base;
+    kv->half_size = size / 2;
+
+    if ( kv->half_size < NVKV_HEADER_SIZE + NVKV_RECORD_SIZE )
+    {
+        return false;
+    }
+
+    bool valid0 = nvkv_read_header(kv, 0, &seq0);
+    bool valid1 = nvkv_read_header(kv, 1, &seq1);
+
+    if ( !valid0 && !valid1 )
+    {
+        return nvkv_format(kv);
+    }
+
+    // The newer generation wins.  The older half is left over from before
+    // the last compaction, or from one that was cut short.
+    if ( valid1 && (!valid0 || seq1 > seq0) )
+    {
+        kv->active = 1;
+        kv->seq = seq1;
+    }
+    else
+    {
+        kv->active = 0;
+        kv->seq = seq0;
+    }
+
+    return nvkv_scan(kv);
+}
+
+/**
+ * Erases every key.
+ */
+bool nvkv_format ( NvKv_t *kv )
+{
+    uint8_t zero[NVKV_HEADER_SIZE] = { 0 };
+
+    // Generation 1 is reused by every format, so the end marker has to be
+    // down before the header.
+    if ( !nvmem_write(nvkv_address(kv, 1, 0), zero, sizeof(zero)) ||
+         !nvmem_write(nvkv_address(kv, 0, 0), zero, sizeof(zero)) ||
+         !nvkv_write_end(kv, 0, NVKV_HEADER_SIZE, 1) || !nvmem_flush() ||
+         !nvkv_write_header(kv, 0, 1) || !nvmem_flush() )
+    {
+        return false;
+    }
+
+    kv->active = 0;
+    kv->seq = 1;
+
+    return nvkv_scan(kv);
+}
+
+/**
+ * Looks a key up in the index and reads its value.
+ * @param kv - Store.
+ * @param key - Key to read.
+ * @param data - Buffer for the value.
+ * @param max_len - Size of the buffer.
+ * @param len - If not NULL, set to the value's length whenever the key
+ * exists, even if the buffer is too small.
+ * @return False if the key is missing, the buffer is too small or the read
+ * failed.
+ */
+bool nvkv_get ( NvKv_t *kv, uint16_t key, void *data, uint16_t max_len, uint16_t *len )
+{
+    NvKvSlot_t *slot = nvkv_find(kv, key);
+
+    if ( slot->offset == 0 || slot->len == NVKV_DELETED )
+    {
+        return false;
+    }
+
+    if ( len != NULL )
+    {
+        *len = slot->len;
+    }
+
+    if ( slot->len > max_len )
+    {
+        return false;
+    }
+
+    return nvmem_read(nvkv_address(kv, kv->active, slot->offset + NVKV_RECORD_SIZE),
+                      data, slot->len);
+}
+
+/**
+ * Stores a value.  Costs two short writes at the end of the log (the end
+ * marker, then the record), plus a compaction when the active half is full.
+ * The new value is durable (even with the nvmem cache enabled) once this
+ * returns true.
+ * @return False if the store is full or nvmem failed; the old value stays.
+ */
+bool nvkv_set ( NvKv_t *kv, uint16_t key, const void *data, uint16_t len )
+{
+    if ( len > NVKV_MAX_VALUE )
+    {
+        return false;
+    }
+
+    return nvkv_append(kv, key, data, len);
+}
+
+bool nvkv_delete ( NvKv_t *kv, uint16_t key )
+{
+    NvKvSlot_t *slot = nvkv_find(kv, key);
+
+    if ( slot->offset == 0 || slot->len == NVKV_DELETED )
+    {
+        return true;
+    }
+
+    return nvkv_append(kv, key, NULL, NVKV_DELETED);
+}
+
+/**
+ * Copies the live records into the inactive half and switches to it.  The
+ * new half only becomes valid when its header is written, after all of the
+ * records, so a power cut at any point leaves one complete generation.
+ * Alternating halves also spreads wear over the whole region.
+ *
+ * The copy is terminated by an end marker, a record header whose CRC is
+ * deliberately wrong.  A compaction that was cut short leaves records of the
+ * next generation behind, and the retry reuses that generation; without the
+ * marker a scan would run on into them and bring back deleted keys.
+ */
+bool nvkv_compact ( NvKv_t *kv )
+{
+    uint8_t to = kv->active ^ 1;
+    uint32_t seq = kv->seq + 1;
+    uint16_t offset = NVKV_HEADER_SIZE;
+
+    for ( uint16_t i = 0; i < NVKV_INDEX_SIZE; i++ )
+    {
+        const NvKvSlot_t *slot = &kv->index[i];
+
+        if ( slot->offset == 0 || slot->len == NVKV_DELETED )
+        {
+            continue;
+        }
+
+        if ( !nvkv_copy_record(kv, slot, to, offset, seq) )
+        {
+            return false;
+        }
+
+        offset += nvkv_record_size(slot->len);
+    }
+
+    // Everything copied, and the end marker, must be on the device before the
+    // header is.
+    if ( !nvkv_write_end(kv, to, offset, seq) || !nvmem_flush() ||
+         !nvkv_write_header(kv, to, seq) || !nvmem_flush() )
+    {
+        return false;
+    }
+
+    kv->active = to;
+    kv->seq = seq;
+
+    // Rebuilding from the new half drops the deleted keys and checks the copy.
+    return nvkv_scan(kv);
+}
+
+/**
+ * Bytes left in the active half before the next compaction.
+ */
+uint16_t nvkv_free ( const NvKv_t *kv )
+{
+    return kv->half_size - kv->head;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+ * Rebuilds the index from the active half, stopping at the first record
+ * that does not check out.
+ */
+static bool nvkv_scan ( NvKv_t *kv )
+{
+    uint8_t rec[NVKV_RECORD_SIZE];
+    uint8_t chunk[NVKV_CHUNK_SIZE];
+    uint16_t offset = NVKV_HEADER_SIZE;
+
+    memset(kv->index, 0, sizeof(kv->index));
+    kv->key_count = 0;
+    kv->live_bytes = 0;
+
+    while ( (uint32_t)offset + NVKV_RECORD_SIZE <= kv->half_size )
+    {
+        uint16_t address = nvkv_address(kv, kv->active, offset);
+
+        if ( !nvmem_read(address, rec, NVKV_RECORD_SIZE) )
+        {
+            return false;
+        }
+
+        uint16_t key = nvkv_get16(&rec[0]);
+        uint16_t len = nvkv_get16(&rec[2]);
+        uint16_t size = nvkv_record_size(len);
+
+        if ( (uint32_t)offset + size > kv->half_size )
+        {
+            break;
+        }
+
+        uint16_t crc = nvkv_crc(nvkv_crc_seed(kv->seq), rec, 4);
+
+        for ( uint16_t pos = NVKV_RECORD_SIZE; pos < size; pos += NVKV_CHUNK_SIZE )
+        {
+            uint16_t n = (size - pos < NVKV_CHUNK_SIZE) ? size - pos : NVKV_CHUNK_SIZE;
+
+            if ( !nvmem_read(address + pos, chunk, n) )
+            {
+                return false;
+            }
+
+            crc = nvkv_crc(crc, chunk, n);
+        }
+
+        if ( crc != nvkv_get16(&rec[4]) )
+        {
+            break;
+        }
+
+        NvKvSlot_t *slot = nvkv_find(kv, key);
+
+        if ( slot->offset == 0 && kv->key_count >= NVKV_MAX_KEYS )
+        {
+            break;
+        }
+
+        nvkv_index_put(kv, slot, key, offset, len);
+        offset += size;
+    }
+
+    kv->head = offset;
+
+    return true;
+}
+
+static bool nvkv_append ( NvKv_t *kv, uint16_t key, const void *data, uint16_t len )
+{
+    uint16_t size = nvkv_record_size(len);
+    NvKvSlot_t *slot = nvkv_find(kv, key);
+    uint16_t replaced = (slot->offset != 0 && slot->len != NVKV_DELETED) ?
+                        nvkv_record_size(slot->len) : 0;
+
+    // Would not fit even in a freshly compacted half.
+    if ( (uint32_t)NVKV_HEADER_SIZE + kv->live_bytes - replaced + size > kv->half_size )
+    {
+        return false;
+    }
+
+    if ( (uint32_t)kv->head + size > kv->half_size ||
+         (slot->offset == 0 && kv->key_count >= NVKV_MAX_KEYS) )
+    {
+        if ( !nvkv_compact(kv) )
+        {
+            return false;
+        }
+
+        slot = nvkv_find(kv, key);
+
+        if ( slot->offset == 0 && kv->key_count >= NVKV_MAX_KEYS )
+        {
+            return false;
+        }
+    }
+
+    // The new end marker must be on the device before the record that ends
+    // at it, or a power cut in between could expose what lies beyond.
+    if ( !nvkv_write_end(kv, kv->active, (uint32_t)kv->head + size, kv->seq) ||
+         !nvmem_flush() )
+    {
+        return false;
+    }
+
+    uint8_t buf[NVKV_INLINE_SIZE];
+    uint16_t vlen = size - NVKV_RECORD_SIZE;
+    uint16_t address = nvkv_address(kv, kv->active, kv->head);
+
+    nvkv_put16(&buf[0], key);
+    nvkv_put16(&buf[2], len);
+
+    uint16_t crc = nvkv_crc(nvkv_crc_seed(kv->seq), buf, 4);
+    crc = nvkv_crc(crc, data, vlen);
+    nvkv_put16(&buf[4], crc);
+
+    bool ok;
+
+    if ( size <= NVKV_INLINE_SIZE )
+    {
+        if ( vlen > 0 ) memcpy(&buf[NVKV_RECORD_SIZE], data, vlen);
+        ok = nvmem_write(address, buf, size);
+    }
+    else
+    {
+        // The CRC covers the value, so the order of these two writes does
+        // not matter for power loss.
+        ok = nvmem_write(address + NVKV_RECORD_SIZE, (void *)data, vlen) &&
+             nvmem_write(address, buf, NVKV_RECORD_SIZE);
+    }
+
+    if ( !ok || !nvmem_flush() )
+    {
+        return false;
+    }
+
+    nvkv_index_put(kv, slot, key, kv->head, len);
+    kv->head += size;
+
+    return true;
+}
+
+/**
+ * Streams one live record into the other half under the new generation.
+ */
+static bool nvkv_copy_record ( NvKv_t *kv, const NvKvSlot_t *slot, uint8_t to,
+                               uint16_t offset, uint32_t seq )
+{
+    uint8_t rec[NVKV_RECORD_SIZE];
+    uint8_t chunk[NVKV_CHUNK_SIZE];
+    uint16_t src = nvkv_address(kv, kv->active, slot->offset + NVKV_RECORD_SIZE);
+    uint16_t dst = nvkv_address(kv, to, offset);
+
+    nvkv_put16(&rec[0], slot->key);
+    nvkv_put16(&rec[2], slot->len);
+
+    uint16_t crc = nvkv_crc(nvkv_crc_seed(seq), rec, 4);
+
+    for ( uint16_t pos = 0; pos < slot->len; pos += NVKV_CHUNK_SIZE )
+    {
+        uint16_t n = (slot->len - pos < NVKV_CHUNK_SIZE) ? slot->len - pos : NVKV_CHUNK_SIZE;
+
+        if ( !nvmem_read(src + pos, chunk, n) ||
+             !nvmem_write(dst + NVKV_RECORD_SIZE + pos, chunk, n) )
+        {
+            return false;
+        }
+
+        crc = nvkv_crc(crc, chunk, n);
+    }
+
+    nvkv_put16(&rec[4], crc);
+
+    return nvmem_write(dst, rec, NVKV_RECORD_SIZE);
+}
+
+/**
+ * Writes the end marker at offset.  Nothing is needed when there is no room
+ * for a record there, since a scan stops at the end of the half anyway.
+ */
+static bool nvkv_write_end ( NvKv_t *kv, uint8_t half, uint32_t offset, uint32_t seq )
+{
+    uint8_t rec[NVKV_RECORD_SIZE];
+
+    if ( offset + NVKV_RECORD_SIZE > kv->half_size )
+    {
+        return true;
+    }
+
+    nvkv_put16(&rec[0], 0);
+    nvkv_put16(&rec[2], 0);
+    nvkv_put16(&rec[4], nvkv_crc(nvkv_crc_seed(seq), rec, 4) ^ 0xFFFF);
+
+    return nvmem_write(nvkv_address(kv, half, offset), rec, NVKV_RECORD_SIZE);
+}
+
+static bool nvkv_read_header ( NvKv_t *kv, uint8_t half, uint32_t *seq )
+{
+    uint8_t hdr[NVKV_HEADER_SIZE];
+
+    if ( !nvmem_read(nvkv_address(kv, half, 0), hdr, NVKV_HEADER_SIZE) )
+    {
+        return false;
+    }
+
+    uint32_t magic = nvkv_get16(&hdr[0]) | ((uint32_t)nvkv_get16(&hdr[2]) << 16);
+    *seq = nvkv_get16(&hdr[4]) | ((uint32_t)nvkv_get16(&hdr[6]) << 16);
+
+    return magic == NVKV_MAGIC && nvkv_crc(0xFFFF, hdr, 8) == nvkv_get16(&hdr[8]);
+}
+
+static bool nvkv_write_header ( NvKv_t *kv, uint8_t half, uint32_t seq )
+{
+    uint8_t hdr[NVKV_HEADER_SIZE];
+
+    nvkv_put16(&hdr[0], NVKV_MAGIC & 0xFFFF);
+    nvkv_put16(&hdr[2], NVKV_MAGIC >> 16);
+    nvkv_put16(&hdr[4], seq & 0xFFFF);
+    nvkv_put16(&hdr[6], seq >> 16);
+    nvkv_put16(&hdr[8], nvkv_crc(0xFFFF, hdr, 8));
+
+    return nvmem_write(nvkv_address(kv, half, 0), hdr, NVKV_HEADER_SIZE);
+}
+
+/**
+ * Returns the index slot holding key, or the free slot where it belongs.
+ * Slots are never freed between rebuilds, so linear probing always ends at
+ * one or the other.
+ */
+static NvKvSlot_t *nvkv_find ( NvKv_t *kv, uint16_t key )
+{
+    uint16_t i = (uint16_t)(key * 40503u) % NVKV_INDEX_SIZE;
+
+    while ( kv->index[i].offset != 0 && kv->index[i].key != key )
+    {
+        i = (i + 1) % NVKV_INDEX_SIZE;
+    }
+
+    return &kv->index[i];
+}
+
+static void nvkv_index_put ( NvKv_t *kv, NvKvSlot_t *slot, uint16_t key,
+                             uint16_t offset, uint16_t len )
+{
+    if ( slot->offset == 0 )
+    {
+        slot->key = key;
+        kv->key_count++;
+    }
+    else if ( slot->len != NVKV_DELETED )
+    {
+        kv->live_bytes -= nvkv_record_size(slot->len);
+    }
+
+    slot->offset = offset;
+    slot->len = len;
+
+    if ( len != NVKV_DELETED )
+    {
+        kv->live_bytes += nvkv_record_size(len);
+    }
+}
+
+static uint16_t nvkv_address ( const NvKv_t *kv, uint8_t half, uint16_t offset )
+{
+    return kv->base + half * kv->half_size + offset;
+}
+
+static uint16_t nvkv_record_size ( uint16_t len )
+{
+    return NVKV_RECORD_SIZE + ((len == NVKV_DELETED) ? 0 : len);
+}
+
+static uint16_t nvkv_crc_seed ( uint32_t seq )
+{
+    uint8_t buf[4];
+
+    nvkv_put16(&buf[0], seq & 0xFFFF);
+    nvkv_put16(&buf[2], seq >> 16);
+
+    return nvkv_crc(0xFFFF, buf, 4);
+}
+
+/**
+ * CRC-16/CCITT, bitwise.  Records are short and written rarely, so a table
+ * is not worth the flash.
+ */
+static uint16_t nvkv_crc ( uint16_t crc, const uint8_t *data, uint16_t len )
+{
+    while ( len-- > 0 )
+    {
+        crc ^= (uint16_t)(*data++) << 8;
+
+        for ( uint8_t bit = 0; bit < 8; bit++ )
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+
+    return crc;
+}
+
+static void nvkv_put16 ( uint8_t *buf, uint16_t value )
+{
+    buf[0] = value & 0xFF;
+    buf[1] = value >> 8;
+}
+
+static uint16_t nvkv_get16 ( const uint8_t *buf )
+{
+    return buf[0] | ((uint16_t)buf[1] << 8);
+}
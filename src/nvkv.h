@@ -0,0 +1,85 @@
+/********************************************************************
+nvkv.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef NVKV_H
+#define NVKV_H
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "stdint.h"
+#include "stdbool.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// Most distinct keys a store can hold.  The RAM index has twice as many
+// slots so probes stay short.
+#ifndef NVKV_MAX_KEYS
+#define NVKV_MAX_KEYS       (32)
+#endif
+
+#define NVKV_INDEX_SIZE     (2 * NVKV_MAX_KEYS)
+
+// Largest value; the length field reserves 0xFFFF to mark a deletion.
+#define NVKV_MAX_VALUE      (0xFFFE)
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef struct
+{
+    uint16_t  key;
+    uint16_t  offset;       // record offset within the active half, 0 if free
+    uint16_t  len;          // value length
+} NvKvSlot_t;
+
+/**
+ * A key-value store kept as an append-only log in one region of nvmem.
+ *
+ * The region is split into two halves.  Updates append a CRC protected
+ * record to the active half; when it fills up, the live records are copied
+ * into the other half, which then becomes active.  At mount the active half
+ * is scanned once to build the RAM index, so lookups never touch the log.
+ */
+typedef struct
+{
+    uint16_t    base;           // nvmem address of the region
+    uint16_t    half_size;
+    uint8_t     active;         // 0 or 1
+    uint32_t    seq;            // generation of the active half
+    uint16_t    head;           // first free offset in the active half
+    uint16_t    live_bytes;     // size of the records still referenced
+    uint16_t    key_count;
+    NvKvSlot_t  index[NVKV_INDEX_SIZE];
+} NvKv_t;
+
+/****************************************************************************
+ * Public Prototypes
+ ***************************************************************************/
+
+bool     nvkv_mount   ( NvKv_t *kv, uint16_t base, uint16_t size );
+bool     nvkv_format  ( NvKv_t *kv );
+bool     nvkv_get     ( NvKv_t *kv, uint16_t key, void *data, uint16_t max_len, uint16_t *len );
+bool     nvkv_set     ( NvKv_t *kv, uint16_t key, const void *data, uint16_t len );
+bool     nvkv_delete  ( NvKv_t *kv, uint16_t key );
+bool     nvkv_compact ( NvKv_t *kv );
+uint16_t nvkv_free    ( const NvKv_t *kv );
+
+#endif /* NVKV_H */
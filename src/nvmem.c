@@ -20,52 +20,561 @@ GNU General Public License for more details.
  ***************************************************************************/
 
 #include "nvmem.h"
+#include "semphr.h"
+#include "string.h"
+#include "task.h"
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef struct
+{
+    uint16_t  base;         // device address of the first byte in the line
+    bool      valid;
+    uint16_t  dirty_lo;     // bytes [dirty_lo, dirty_hi) need writing back
+    uint16_t  dirty_hi;
+} NvMemLine_t;
 
 /****************************************************************************
  * Private variables
  ***************************************************************************/
 
+// Device behind nvmem_read/nvmem_write.
+static NvMemDevice_t *nvm_default = NULL;
+
+// Wraps the function pairs given to nvmem_init as a device.
 static NvMemWriteFxn nvm_write_fxn = NULL;
 static NvMemReadFxn nvm_read_fxn = NULL;
+static NvMemDevice_t nvm_fxn_device;
+
+// Write-back cache.  Caching is off until nvm_cache_lock exists.
+static SemaphoreHandle_t nvm_cache_lock = NULL;
+static NvMemLine_t nvm_lines[NVMEM_CACHE_LINES];
+static uint8_t nvm_cache[NVMEM_CACHE_LINES * NVMEM_CACHE_LINE_SIZE];
+static TickType_t nvm_max_age = 0;
+static TickType_t nvm_dirty_since = 0;
+static bool nvm_dirty = false;
+
+static NvMemCacheStats_t nvm_stats;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static bool nvmem_fxn_write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
+static bool nvmem_fxn_read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
+static bool nvmem_backend_write ( uint32_t address, void * data, size_t len );
+static bool nvmem_backend_read ( uint32_t address, void * data, size_t len );
+static bool nvmem_cache_load ( uint32_t base, uint16_t *slot );
+static bool nvmem_cache_flush_line ( uint16_t slot );
+static bool nvmem_cache_flush_all ( void );
+static void nvmem_cache_invalidate ( void );
 
 /****************************************************************************
  * Public Functions
  ***************************************************************************/
 
+/**
+ * Makes a read/write function pair the default device.  Kept for backends
+ * that only ever exist once; new drivers should provide an NvMemDevice_t.
+ */
 void nvmem_init ( NvMemReadFxn read_fxn, NvMemWriteFxn write_fxn )
 {
     nvm_read_fxn = read_fxn;
     nvm_write_fxn = write_fxn;
+
+    nvm_fxn_device.read = nvmem_fxn_read;
+    nvm_fxn_device.write = nvmem_fxn_write;
+    nvm_fxn_device.size = 0x10000;
+    nvm_fxn_device.page_size = 0;
+    nvm_fxn_device.endurance = NVMEM_ENDURANCE_FRAM;
+
+    nvmem_set_default(&nvm_fxn_device);
+}
+
+/**
+ * Selects the device behind nvmem_read/nvmem_write (and the cache).  With the
+ * cache on, dirty data is first written back to the old device and the cache
+ * is then emptied.
+ * @return False if the write back failed.  The old device stays the default
+ * and its dirty data stays cached.
+ */
+bool nvmem_set_default ( NvMemDevice_t *dev )
+{
+    if ( nvm_cache_lock == NULL )
+    {
+        nvm_default = dev;
+        return true;
+    }
+
+    xSemaphoreTake(nvm_cache_lock, portMAX_DELAY);
+
+    bool ok = (nvm_default == NULL) || nvmem_cache_flush_all();
+
+    if ( ok )
+    {
+        nvm_default = dev;
+        nvmem_cache_invalidate();
+    }
+
+    xSemaphoreGive(nvm_cache_lock);
+
+    return ok;
+}
+
+NvMemDevice_t * nvmem_get_default ( void )
+{
+    return nvm_default;
+}
+
+/**
+ * Writes to a specific device, uncached.  Writes are split at the device's
+ * page boundaries.
+ * @return False if out of range or the device failed.
+ */
+bool nvmem_device_write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
+{
+    if ( dev == NULL || (uint32_t)address + len > dev->size )
+    {
+        return false;
+    }
+
+    uint8_t *src = data;
+
+    while ( len > 0 )
+    {
+        size_t n = len;
+
+        if ( dev->page_size != 0 && address % dev->page_size + n > dev->page_size )
+        {
+            n = dev->page_size - address % dev->page_size;
+        }
+
+        if ( !dev->write(dev, address, src, n) )
+        {
+            return false;
+        }
+
+        address += n;
+        src += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/**
+ * Reads from a specific device, uncached.
+ * @return False if out of range or the device failed.
+ */
+bool nvmem_device_read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
+{
+    if ( dev == NULL || (uint32_t)address + len > dev->size )
+    {
+        return false;
+    }
+
+    return dev->read(dev, address, data, len);
 }
 
 /**
- * Write data to NvMem.
+ * Write data to NvMem.  With the cache enabled, data is only written back
+ * on nvmem_flush/nvmem_service, and bytes that already hold the new value
+ * are never written at all.
  * @param address - Address in RAM to write to.
  * @param data - Data to write.
  * @param len - Length of the data.
  */
 bool nvmem_write ( uint16_t address, void * data, size_t len )
 {
-    if ( nvm_write_fxn != NULL )
+    if ( nvm_default == NULL )
     {
-        return nvm_write_fxn(address, data, len );
+        return false;
     }
 
-    return false;
+    if ( nvm_cache_lock == NULL )
+    {
+        nvm_stats.bytes_requested += len;
+        return nvmem_backend_write(address, data, len);
+    }
+
+    xSemaphoreTake(nvm_cache_lock, portMAX_DELAY);
+
+    nvm_stats.bytes_requested += len;
+
+    const uint8_t *src = data;
+    uint32_t addr = address;
+    bool ok = true;
+
+    while ( len > 0 && ok )
+    {
+        uint16_t offset = addr % NVMEM_CACHE_LINE_SIZE;
+        size_t n = NVMEM_CACHE_LINE_SIZE - offset;
+        uint16_t slot;
+
+        if ( n > len ) n = len;
+
+        ok = nvmem_cache_load(addr - offset, &slot);
+
+        if ( ok )
+        {
+            NvMemLine_t *line = &nvm_lines[slot];
+            uint8_t *cached = &nvm_cache[slot * NVMEM_CACHE_LINE_SIZE];
+
+            for ( uint16_t i = offset; i < offset + n; i++, src++ )
+            {
+                if ( cached[i] == *src )
+                {
+                    nvm_stats.bytes_unchanged++;
+                    continue;
+                }
+
+                cached[i] = *src;
+
+                if ( line->dirty_lo == line->dirty_hi )
+                {
+                    line->dirty_lo = i;
+                    line->dirty_hi = i + 1;
+                }
+                else
+                {
+                    if ( i < line->dirty_lo ) line->dirty_lo = i;
+                    if ( i >= line->dirty_hi ) line->dirty_hi = i + 1;
+                }
+
+                if ( !nvm_dirty )
+                {
+                    nvm_dirty = true;
+                    nvm_dirty_since = xTaskGetTickCount();
+                }
+            }
+
+            addr += n;
+            len -= n;
+        }
+    }
+
+    xSemaphoreGive(nvm_cache_lock);
+
+    return ok;
 }
 
 /**
- * Read data from NvMem.
+ * Read data from NvMem.  Cached lines are served from RAM; the gaps between
+ * them are read straight from the device without being cached.
  * @param address - Address to read from.
  * @param data - Location to put the data.
  * @param len - Length of data to read.
  */
 bool nvmem_read ( uint16_t address, void * data, size_t len )
 {
-    if ( nvm_read_fxn != NULL )
+    if ( nvm_default == NULL )
+    {
+        return false;
+    }
+
+    if ( nvm_cache_lock == NULL )
     {
-        return nvm_read_fxn(address, data, len );
+        return nvmem_backend_read(address, data, len);
+    }
+
+    xSemaphoreTake(nvm_cache_lock, portMAX_DELAY);
+
+    uint8_t *dst = data;
+    uint32_t addr = address;
+    bool ok = true;
+
+    // Uncached bytes are gathered into one device read per gap.
+    uint32_t gap_addr = 0;
+    uint8_t *gap_dst = NULL;
+    size_t gap_len = 0;
+
+    while ( len > 0 && ok )
+    {
+        uint16_t offset = addr % NVMEM_CACHE_LINE_SIZE;
+        uint32_t base = addr - offset;
+        uint16_t slot = (base / NVMEM_CACHE_LINE_SIZE) % NVMEM_CACHE_LINES;
+        size_t n = NVMEM_CACHE_LINE_SIZE - offset;
+
+        if ( n > len ) n = len;
+
+        if ( nvm_lines[slot].valid && nvm_lines[slot].base == base )
+        {
+            if ( gap_len > 0 )
+            {
+                ok = nvmem_backend_read(gap_addr, gap_dst, gap_len);
+                gap_len = 0;
+            }
+
+            memcpy(dst, &nvm_cache[slot * NVMEM_CACHE_LINE_SIZE + offset], n);
+        }
+        else
+        {
+            if ( gap_len == 0 )
+            {
+                gap_addr = addr;
+                gap_dst = dst;
+            }
+
+            gap_len += n;
+        }
+
+        addr += n;
+        dst += n;
+        len -= n;
     }
 
-    return false;
+    if ( ok && gap_len > 0 )
+    {
+        ok = nvmem_backend_read(gap_addr, gap_dst, gap_len);
+    }
+
+    xSemaphoreGive(nvm_cache_lock);
+
+    return ok;
+}
+
+/**
+ * Turns on the write-back cache.  Call after nvmem_init.  The backing
+ * device's size must be a multiple of NVMEM_CACHE_LINE_SIZE.
+ *
+ * Until data is flushed it only exists in RAM, so anything that must
+ * survive a reset should be followed by nvmem_flush.
+ * @param max_age - Longest dirty data may wait before nvmem_service writes
+ * it back.
+ * @return False if the cache lock could not be created.
+ */
+bool nvmem_cache_enable ( TickType_t max_age )
+{
+    nvm_max_age = max_age;
+
+    if ( nvm_cache_lock == NULL )
+    {
+        nvmem_cache_invalidate();
+        nvm_cache_lock = xSemaphoreCreateMutex();
+    }
+
+    return nvm_cache_lock != NULL;
+}
+
+/**
+ * Writes back all dirty data.  Dirty runs that continue across consecutive
+ * lines go out as a single write.
+ * @return False if a device write failed.  The failed data stays dirty.
+ */
+bool nvmem_flush ( void )
+{
+    if ( nvm_cache_lock == NULL )
+    {
+        return true;
+    }
+
+    xSemaphoreTake(nvm_cache_lock, portMAX_DELAY);
+    bool ok = nvmem_cache_flush_all();
+    xSemaphoreGive(nvm_cache_lock);
+
+    return ok;
+}
+
+/**
+ * Flushes if the oldest dirty data has waited longer than the max_age
+ * given to nvmem_cache_enable.  Call periodically.
+ * @return False if a flush was attempted and failed.
+ */
+bool nvmem_service ( void )
+{
+    if ( nvm_cache_lock == NULL || !nvm_dirty )
+    {
+        return true;
+    }
+
+    if ( (TickType_t)(xTaskGetTickCount() - nvm_dirty_since) < nvm_max_age )
+    {
+        return true;
+    }
+
+    return nvmem_flush();
+}
+
+/**
+ * Copies out the cache counters.  They are updated under the cache lock;
+ * with the cache off there is no lock and callers must serialize nvmem
+ * access themselves, as for the device.
+ */
+void nvmem_get_cache_stats ( NvMemCacheStats_t *stats )
+{
+    if ( nvm_cache_lock == NULL )
+    {
+        *stats = nvm_stats;
+        return;
+    }
+
+    xSemaphoreTake(nvm_cache_lock, portMAX_DELAY);
+    *stats = nvm_stats;
+    xSemaphoreGive(nvm_cache_lock);
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static bool nvmem_fxn_write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
+{
+    (void)dev;
+
+    return nvm_write_fxn(address, data, len);
+}
+
+static bool nvmem_fxn_read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
+{
+    (void)dev;
+
+    return nvm_read_fxn(address, data, len);
+}
+
+static bool nvmem_backend_write ( uint32_t address, void * data, size_t len )
+{
+    // Checked here, so a write the device would refuse is not counted.
+    if ( address + len > nvm_default->size ) return false;
+
+    nvm_stats.device_writes++;
+    nvm_stats.device_bytes_written += len;
+
+    return nvmem_device_write(nvm_default, address, data, len);
+}
+
+static bool nvmem_backend_read ( uint32_t address, void * data, size_t len )
+{
+    if ( address + len > nvm_default->size ) return false;
+
+    nvm_stats.device_reads++;
+    nvm_stats.device_bytes_read += len;
+
+    return nvmem_device_read(nvm_default, address, data, len);
+}
+
+/**
+ * Makes sure the line starting at base is cached, writing back whatever
+ * it replaces.
+ * @param base - Line aligned device address.
+ * @param slot - Set to the cache slot holding the line.
+ */
+static bool nvmem_cache_load ( uint32_t base, uint16_t *slot )
+{
+    *slot = (base / NVMEM_CACHE_LINE_SIZE) % NVMEM_CACHE_LINES;
+
+    NvMemLine_t *line = &nvm_lines[*slot];
+
+    if ( line->valid && line->base == base )
+    {
+        return true;
+    }
+
+    if ( !nvmem_cache_flush_line(*slot) )
+    {
+        return false;
+    }
+
+    line->valid = false;
+
+    if ( !nvmem_backend_read(base, &nvm_cache[*slot * NVMEM_CACHE_LINE_SIZE],
+                            NVMEM_CACHE_LINE_SIZE) )
+    {
+        return false;
+    }
+
+    line->base = base;
+    line->valid = true;
+    line->dirty_lo = 0;
+    line->dirty_hi = 0;
+
+    return true;
+}
+
+static bool nvmem_cache_flush_line ( uint16_t slot )
+{
+    NvMemLine_t *line = &nvm_lines[slot];
+
+    if ( !line->valid || line->dirty_lo == line->dirty_hi )
+    {
+        return true;
+    }
+
+    if ( !nvmem_backend_write(line->base + line->dirty_lo,
+                             &nvm_cache[slot * NVMEM_CACHE_LINE_SIZE + line->dirty_lo],
+                             line->dirty_hi - line->dirty_lo) )
+    {
+        return false;
+    }
+
+    line->dirty_lo = 0;
+    line->dirty_hi = 0;
+
+    return true;
+}
+
+static bool nvmem_cache_flush_all ( void )
+{
+    bool ok = true;
+
+    for ( uint16_t i = 0; i < NVMEM_CACHE_LINES; i++ )
+    {
+        NvMemLine_t *first = &nvm_lines[i];
+
+        if ( !first->valid || first->dirty_lo == first->dirty_hi )
+        {
+            continue;
+        }
+
+        // Extend the run while the dirty bytes carry on into the next slot,
+        // which (direct mapped) is also the next line on the device.
+        uint16_t last = i;
+        size_t len = first->dirty_hi - first->dirty_lo;
+
+        while ( last + 1 < NVMEM_CACHE_LINES )
+        {
+            NvMemLine_t *cur = &nvm_lines[last];
+            NvMemLine_t *next = &nvm_lines[last + 1];
+
+            if ( cur->dirty_hi != NVMEM_CACHE_LINE_SIZE || !next->valid ||
+                 next->base != cur->base + NVMEM_CACHE_LINE_SIZE ||
+                 next->dirty_lo != 0 || next->dirty_hi == 0 )
+            {
+                break;
+            }
+
+            len += next->dirty_hi;
+            last++;
+        }
+
+        if ( nvmem_backend_write(first->base + first->dirty_lo,
+                                &nvm_cache[i * NVMEM_CACHE_LINE_SIZE + first->dirty_lo], len) )
+        {
+            for ( uint16_t j = i; j <= last; j++ )
+            {
+                nvm_lines[j].dirty_lo = 0;
+                nvm_lines[j].dirty_hi = 0;
+            }
+        }
+        else
+        {
+            ok = false;
+        }
+
+        i = last;
+    }
+
+    if ( ok )
+    {
+        nvm_dirty = false;
+    }
+
+    return ok;
+}
+
+static void nvmem_cache_invalidate ( void )
+{
+    memset(nvm_lines, 0, sizeof(nvm_lines));
+    nvm_dirty = false;
 }
@@ -24,6 +24,22 @@ GNU General Public License for more details.
 #include "stdint.h"
 #include "stdlib.h"
 #include "stdbool.h"
+#include "FreeRTOS.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// Write-back cache geometry.  The cache is direct mapped, so consecutive
+// lines of the device sit next to each other in RAM and dirty runs can be
+// flushed as one burst.
+#ifndef NVMEM_CACHE_LINES
+#define NVMEM_CACHE_LINES       (8)
+#endif
+
+#ifndef NVMEM_CACHE_LINE_SIZE
+#define NVMEM_CACHE_LINE_SIZE   (32)
+#endif
 
 /****************************************************************************
  * Typedefs
@@ -32,6 +48,46 @@ GNU General Public License for more details.
 typedef bool (*NvMemWriteFxn) ( uint16_t address, void * data, size_t len );
 typedef bool (*NvMemReadFxn) ( uint16_t address, void * data, size_t len );
 
+/**
+ * How many rewrites a device's cells take.  Ordered, so a higher class can
+ * take more writes.
+ */
+typedef enum
+{
+    NVMEM_ENDURANCE_FLASH = 0,      // ~10k erase cycles
+    NVMEM_ENDURANCE_EEPROM,         // ~1M writes
+    NVMEM_ENDURANCE_FRAM,           // ~1e12 writes, effectively unlimited
+    NVMEM_ENDURANCE_UNLIMITED       // battery backed RAM
+} NvMemEndurance_t;
+
+struct NvMemDevice;
+
+typedef bool (*NvMemDevWriteFxn) ( struct NvMemDevice *dev, uint16_t address, void * data, size_t len );
+typedef bool (*NvMemDevReadFxn) ( struct NvMemDevice *dev, uint16_t address, void * data, size_t len );
+
+/**
+ * A non-volatile memory device.  Drivers embed this as the first member of
+ * their own state and recover it from the dev pointer passed to read/write.
+ */
+typedef struct NvMemDevice
+{
+    NvMemDevReadFxn   read;
+    NvMemDevWriteFxn  write;
+    uint32_t          size;         // bytes
+    uint16_t          page_size;    // writes must not cross a page; 0 if no pages
+    NvMemEndurance_t  endurance;
+} NvMemDevice_t;
+
+typedef struct
+{
+    uint32_t  bytes_requested;      // bytes passed to nvmem_write
+    uint32_t  bytes_unchanged;      // of those, bytes that already held the value
+    uint32_t  device_writes;        // write transactions issued to the device
+    uint32_t  device_bytes_written;
+    uint32_t  device_reads;         // read transactions issued to the device
+    uint32_t  device_bytes_read;
+} NvMemCacheStats_t;
+
 /****************************************************************************
  * Public Functions
  ***************************************************************************/
@@ -40,5 +96,15 @@ void nvmem_init ( NvMemReadFxn read_fxn, NvMemWriteFxn write_fxn );
 bool nvmem_write ( uint16_t address, void * data, size_t len );
 bool nvmem_read ( uint16_t address, void * data, size_t len );
 
+bool nvmem_set_default ( NvMemDevice_t *dev );
+NvMemDevice_t * nvmem_get_default ( void );
+bool nvmem_device_write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
+bool nvmem_device_read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
+
+bool nvmem_cache_enable ( TickType_t max_age );
+bool nvmem_flush ( void );
+bool nvmem_service ( void );
+void nvmem_get_cache_stats ( NvMemCacheStats_t *stats );
+
 
 #endif /* NVMEM_H */
@@ -0,0 +1,173 @@
+/********************************************************************
+nvmem_tier.c
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "nvmem_tier.h"
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static bool nvmem_tier_write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
+static bool nvmem_tier_read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len );
+static bool nvmem_tier_access ( NvMemTiered_t *tiered, uint16_t address, uint8_t *data,
+                                size_t len, bool write );
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+ * Builds one device out of several, placing each region by how hard it is
+ * written.  Hot regions go to the highest endurance device with room (RTC
+ * backup registers, then FRAM); bulk regions go to the lowest endurance
+ * device with room, saving the scarce high endurance space.  Regions are
+ * laid out back to back in the order given, so callers just see one
+ * address space, and the layout is the same on every boot as long as the
+ * region list is.
+ *
+ * Use it directly or make it the default with nvmem_set_default.
+ * @param tiered - Device state.
+ * @param devices - Devices to spread the regions over.
+ * @param device_count - Number of devices (at most NVMEM_TIER_MAX_DEVICES).
+ * @param regions - Regions with size and tier set.  Kept by reference.
+ * @param region_count - Number of regions.
+ * @return The device handle, or NULL if the regions do not fit.
+ */
+NvMemDevice_t * nvmem_tier_init ( NvMemTiered_t *tiered,
+                                  NvMemDevice_t **devices, uint8_t device_count,
+                                  NvMemRegion_t *regions, uint8_t region_count )
+{
+    uint32_t used[NVMEM_TIER_MAX_DEVICES] = { 0 };
+    uint32_t address = 0;
+
+    if ( device_count == 0 || device_count > NVMEM_TIER_MAX_DEVICES )
+    {
+        return NULL;
+    }
+
+    tiered->dev.endurance = NVMEM_ENDURANCE_UNLIMITED;
+
+    for ( uint8_t r = 0; r < region_count; r++ )
+    {
+        NvMemRegion_t *region = &regions[r];
+        int8_t best = -1;
+
+        for ( uint8_t d = 0; d < device_count; d++ )
+        {
+            if ( used[d] + region->size > devices[d]->size )
+            {
+                continue;
+            }
+
+            if ( best < 0 ||
+                 (region->tier == NVMEM_TIER_HOT && devices[d]->endurance > devices[best]->endurance) ||
+                 (region->tier == NVMEM_TIER_BULK && devices[d]->endurance < devices[best]->endurance) )
+            {
+                best = d;
+            }
+        }
+
+        if ( best < 0 || address + region->size > 0x10000 )
+        {
+            return NULL;
+        }
+
+        region->address = address;
+        region->device = devices[best];
+        region->device_address = used[best];
+
+        used[best] += region->size;
+        address += region->size;
+
+        if ( devices[best]->endurance < tiered->dev.endurance )
+        {
+            tiered->dev.endurance = devices[best]->endurance;
+        }
+    }
+
+    tiered->regions = regions;
+    tiered->region_count = region_count;
+
+    tiered->dev.read = nvmem_tier_read;
+    tiered->dev.write = nvmem_tier_write;
+    tiered->dev.size = address;
+    tiered->dev.page_size = 0;
+
+    return &tiered->dev;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static bool nvmem_tier_write ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
+{
+    return nvmem_tier_access((NvMemTiered_t *)dev, address, data, len, true);
+}
+
+static bool nvmem_tier_read ( NvMemDevice_t *dev, uint16_t address, void * data, size_t len )
+{
+    return nvmem_tier_access((NvMemTiered_t *)dev, address, data, len, false);
+}
+
+/**
+ * Splits an access at region boundaries and forwards each piece.
+ */
+static bool nvmem_tier_access ( NvMemTiered_t *tiered, uint16_t address, uint8_t *data,
+                                size_t len, bool write )
+{
+    uint8_t r = 0;
+
+    while ( len > 0 )
+    {
+        while ( r < tiered->region_count &&
+                (uint32_t)tiered->regions[r].address + tiered->regions[r].size <= address )
+        {
+            r++;
+        }
+
+        if ( r == tiered->region_count )
+        {
+            return false;
+        }
+
+        NvMemRegion_t *region = &tiered->regions[r];
+        uint16_t offset = address - region->address;
+        size_t n = region->size - offset;
+
+        if ( n > len ) n = len;
+
+        bool ok = write ?
+            nvmem_device_write(region->device, region->device_address + offset, data, n) :
+            nvmem_device_read(region->device, region->device_address + offset, data, n);
+
+        if ( !ok )
+        {
+            return false;
+        }
+
+        address += n;
+        data += n;
+        len -= n;
+    }
+
+    return true;
+}
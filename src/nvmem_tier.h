@@ -0,0 +1,71 @@
+/********************************************************************
+nvmem_tier.h
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef NVMEM_TIER_H
+#define NVMEM_TIER_H
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "nvmem.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define NVMEM_TIER_MAX_DEVICES  (4)
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef enum
+{
+    NVMEM_TIER_BULK = 0,    // written now and then: configuration, logs
+    NVMEM_TIER_HOT          // rewritten constantly: counters, state
+} NvMemTierClass_t;
+
+/**
+ * One range of the tiered address space.  The caller fills in size and
+ * tier; nvmem_tier_init fills in the rest.
+ */
+typedef struct
+{
+    uint16_t          size;
+    NvMemTierClass_t  tier;
+
+    uint16_t          address;          // start in the tiered device
+    NvMemDevice_t    *device;           // where it ended up
+    uint16_t          device_address;
+} NvMemRegion_t;
+
+typedef struct
+{
+    NvMemDevice_t   dev;                // must be first
+    NvMemRegion_t  *regions;
+    uint8_t         region_count;
+} NvMemTiered_t;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+NvMemDevice_t * nvmem_tier_init ( NvMemTiered_t *tiered,
+                                  NvMemDevice_t **devices, uint8_t device_count,
+                                  NvMemRegion_t *regions, uint8_t region_count );
+
+#endif /* NVMEM_TIER_H */
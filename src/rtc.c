@@ -659,7 +659,7 @@ void rtc_write_backup_register(uint8_t location, uint32_t value) {
   }
 
   /* Write data to backup register */
-  *(uint32_t *)((&RTC->BKP0R) + 4 * location) = value;
+  (&RTC->BKP0R)[location] = value;
 }
 
 uint32_t rtc_read_backup_register(uint8_t location){
@@ -669,7 +669,7 @@ uint32_t rtc_read_backup_register(uint8_t location){
   }
 
   /* Read data from backup register */
-  return *(uint32_t *)((&RTC->BKP0R) + 4 * location);
+  return (&RTC->BKP0R)[location];
 }
 
 /* Callbacks */
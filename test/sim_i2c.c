@@ -0,0 +1,659 @@
+/********************************************************************
+sim_i2c.c - simulated I2C peripheral and kernel for the I2C host tests.
+
+The transaction engine is built in here, with the StdPeriph I2C calls it
+makes acting on a simulated register block, and just enough of FreeRTOS
+for one task: blocking is where time passes and the interrupts and the
+timer service task get to run.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "FreeRTOS.h"
+#include <string.h>
+
+// The port's yield is Cortex-M assembly; on the host it only has to be seen.
+#undef portYIELD
+#define portYIELD()     (yields++)
+
+static int yields;
+
+// The engine's state and ISRs are private, so it is built in here.
+#include "i2c.c"
+
+#include "sim_i2c.h"
+#include "event_groups.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define TIMER_MAX       8
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef struct
+{
+	PendedFunction_t  fn;
+	void             *arg;
+} timer_call_t;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static bool bus_irq(void);
+static bool bus_event(void);
+static void bus_log(const char *fmt, unsigned value);
+
+/****************************************************************************
+ * Public Variables
+ ***************************************************************************/
+
+I2C_TypeDef sim_regs;
+sim_bus_t sim_bus;
+TickType_t sim_ticks;
+int sim_timer_count;
+int sim_timer_pends;
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static int critical;
+static uint32_t notified;
+static int self;                    // stands in for the one task
+static EventBits_t event_bits;
+
+static timer_call_t timer_queue[TIMER_MAX];
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+/**
+  \brief sets up the engine on the simulated peripheral
+*/
+void sim_init(void)
+{
+	I2C_InitTypeDef init = { .I2C_ClockSpeed = 400000 };
+	GPIODefStruct_t sda = { 0 }, scl = { 0 };
+
+	i2c_init(&sim_regs, &init, &sda, &scl);
+	CHECK(i2c_engine[2].I2Cx == &sim_regs);
+}
+
+/**
+  \brief puts the bus and the slave back to a known state; the engine must
+  be idle
+*/
+void sim_bus_reset(void)
+{
+	CHECK(sim_engine_idle());
+
+	memset(&sim_bus, 0, sizeof(sim_bus));
+	sim_bus.nack_data = -1;
+
+	for(int i = 0; i < 256; i++)
+	{
+		sim_bus.mem[i] = i ^ 0x5A;
+	}
+
+	sim_regs.SR1 = 0;
+	sim_regs.SR2 = 0;
+	sim_timer_count = 0;
+	sim_timer_pends = 0;
+}
+
+/**
+  \brief runs the hardware until it has nothing left to do: one interrupt,
+  if one is pending, then one step of bus activity, and so on
+*/
+void sim_bus_run(void)
+{
+	for(int i = 0; i < 10000; i++)
+	{
+		bool isr = bus_irq();
+		bool moved = bus_event();
+
+		if(!isr && !moved) return;
+	}
+
+	CHECK(!"bus livelock");
+}
+
+/**
+  \brief runs what was pended to the timer service task
+  \return true if anything ran
+*/
+bool sim_timers_run(void)
+{
+	timer_call_t calls[TIMER_MAX];
+	int n = sim_timer_count;
+
+	memcpy(calls, timer_queue, sizeof(calls));
+	sim_timer_count = 0;
+
+	for(int i = 0; i < n; i++)
+	{
+		calls[i].fn(calls[i].arg, 0);
+	}
+
+	return n > 0;
+}
+
+/**
+  \brief lets the hardware and the timer task run until both are idle
+*/
+void sim_run(void)
+{
+	do
+	{
+		sim_bus_run();
+	} while(sim_timers_run());
+}
+
+/**
+  \brief takes or releases the bus the way the polled API does
+*/
+void sim_hold_bus(bool hold)
+{
+	if(hold) CHECK(i2c_lock(&sim_regs));
+	else     i2c_unlock(&sim_regs);
+}
+
+bool sim_engine_idle(void)
+{
+	return !i2c_engine[2].running && i2c_engine[2].head == NULL && i2c_engine[2].tail == NULL;
+}
+
+bool sim_engine_deferred(void)
+{
+	return i2c_engine[2].deferred;
+}
+
+I2CXfer_t * sim_engine_head(void)
+{
+	return i2c_engine[2].head;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief calls the ISR for a pending, enabled interrupt, error first.  SR1
+  error flags are rc_w0, so writes to SR1 can only clear bits; and the engine
+  clears ADDR by reading SR2, which is taken as read once the ISR has seen
+  ADDR.
+*/
+static bool bus_irq(void)
+{
+	uint16_t sr1 = sim_regs.SR1;
+	uint16_t cr2 = sim_regs.CR2;
+
+	CHECK(critical == 0);
+
+	if((cr2 & I2C_IT_ERR) && (sr1 & SIM_SR1_ERRORS))
+	{
+		I2C3_ER_IRQHandler();
+		sim_regs.SR1 &= sr1;
+		return true;
+	}
+
+	bool event = (sr1 & (I2C_SR1_SB | I2C_SR1_ADDR | I2C_SR1_BTF)) != 0;
+	bool buffer = (sr1 & (I2C_SR1_TXE | I2C_SR1_RXNE)) != 0;
+
+	if(!(cr2 & I2C_IT_EVT) || !(event || ((cr2 & I2C_IT_BUF) && buffer)))
+	{
+		return false;
+	}
+
+	I2C3_EV_IRQHandler();
+
+	if((sr1 & I2C_SR1_ADDR) && sim_bus.state == BUS_ADDRESSED)
+	{
+		sim_regs.SR1 &= ~I2C_SR1_ADDR;
+		sim_bus.state = sim_bus.receiver ? BUS_RX : BUS_TX;
+		if(!sim_bus.receiver && !sim_bus.dr_full) sim_regs.SR1 |= I2C_SR1_TXE;
+	}
+
+	return true;
+}
+
+/**
+  \brief one step of bus activity: a START or STOP condition, the address,
+  or one data byte.  Returns false while the bus is waiting on software or
+  on time to pass.
+*/
+static bool bus_event(void)
+{
+	if(sim_bus.stall) return false;
+
+	if((sim_regs.CR1 & I2C_CR1_START) && !(sim_regs.CR1 & I2C_CR1_STOP))
+	{
+		if(!sim_bus.starting)
+		{
+			sim_bus.starting = true;
+			sim_bus.start_at = sim_ticks + sim_bus.start_delay;
+		}
+
+		if((int32_t)(sim_ticks - sim_bus.start_at) < 0) return false;
+
+		if(sim_bus.state == BUS_IDLE) sim_bus.transactions++;
+
+		sim_regs.CR1 &= ~I2C_CR1_START;
+		sim_regs.SR1 = I2C_SR1_SB;
+		sim_regs.SR2 = I2C_SR2_MSL | I2C_SR2_BUSY;
+		sim_bus.state = BUS_START;
+		sim_bus.starting = false;
+		sim_bus.dr_full = sim_bus.shift_full = sim_bus.rx_done = false;
+		bus_log("S", 0);
+		return true;
+	}
+
+	switch(sim_bus.state)
+	{
+	case BUS_ADDRESS:
+		sim_bus.receiver = sim_bus.address & 1;
+		sim_bus.written = 0;
+
+		if((sim_bus.address >> 1) != SIM_SLAVE || sim_bus.nack_address)
+		{
+			bus_log("%02XN", sim_bus.address);
+			sim_regs.SR1 |= I2C_SR1_AF;
+			sim_bus.state = BUS_NACKED;
+		}
+		else
+		{
+			bus_log("%02X", sim_bus.address);
+			sim_regs.SR1 |= I2C_SR1_ADDR;
+			sim_bus.ack_last = (sim_regs.CR1 & I2C_CR1_ACK) != 0;
+			sim_bus.state = BUS_ADDRESSED;
+		}
+		return true;
+
+	case BUS_TX:
+		if(sim_bus.shift_full)
+		{
+			sim_bus.shift_full = false;
+
+			if(sim_bus.written == sim_bus.nack_data)
+			{
+				bus_log("%02xN", sim_bus.shift);
+				sim_regs.SR1 |= I2C_SR1_AF;
+				sim_bus.state = BUS_NACKED;
+				return true;
+			}
+
+			bus_log("%02x", sim_bus.shift);
+			if(sim_bus.written++ == 0) sim_bus.pointer = sim_bus.shift;
+			else                       sim_bus.mem[sim_bus.pointer++] = sim_bus.shift;
+
+			if(!sim_bus.dr_full) sim_regs.SR1 |= I2C_SR1_BTF;
+			return true;
+		}
+
+		if(sim_bus.dr_full)
+		{
+			sim_bus.shift = sim_regs.DR;
+			sim_bus.shift_full = true;
+			sim_bus.dr_full = false;
+			sim_regs.SR1 |= I2C_SR1_TXE;
+			return true;
+		}
+		break;
+
+	case BUS_RX:
+		if(!sim_bus.rx_done && !sim_bus.shift_full)
+		{
+			uint8_t data = sim_bus.mem[sim_bus.pointer++];
+			bool ack_now = (sim_regs.CR1 & I2C_CR1_ACK) != 0;
+
+			// with POS set, ACK applies to the byte after the one in the
+			// shift register
+			bool ack = (sim_regs.CR1 & I2C_CR1_POS) ? sim_bus.ack_last : ack_now;
+
+			sim_bus.ack_last = ack_now;
+			bus_log(ack ? "%02x" : "%02xN", data);
+
+			if(sim_regs.SR1 & I2C_SR1_RXNE)
+			{
+				sim_bus.shift = data;
+				sim_bus.shift_full = true;
+				sim_regs.SR1 |= I2C_SR1_BTF;
+			}
+			else
+			{
+				sim_regs.DR = data;
+				sim_regs.SR1 |= I2C_SR1_RXNE;
+			}
+
+			sim_bus.rx_done = !ack;
+			return true;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	// STOP goes out after the byte in progress; a receiver only stops
+	// clocking bytes in once it has NACKed one
+	if((sim_regs.CR1 & I2C_CR1_STOP) && !sim_bus.stop_hold &&
+	   sim_bus.state != BUS_START && sim_bus.state != BUS_ADDRESS &&
+	   sim_bus.state != BUS_ADDRESSED &&
+	   (sim_bus.state != BUS_RX || sim_bus.rx_done) &&
+	   !(sim_bus.state == BUS_TX && sim_bus.shift_full))
+	{
+		sim_regs.CR1 &= ~I2C_CR1_STOP;
+		sim_regs.SR1 &= ~(I2C_SR1_TXE | I2C_SR1_BTF);
+		sim_regs.SR2 = 0;
+		sim_bus.state = BUS_IDLE;
+		bus_log("P", 0);
+		return true;
+	}
+
+	return false;
+}
+
+/**
+  \brief appends to the wire log: S and P for START and STOP, addresses in
+  upper case hex, data in lower case, N after a byte that was not ACKed
+*/
+static void bus_log(const char *fmt, unsigned value)
+{
+	size_t len = strlen(sim_bus.log);
+
+	CHECK(len + 8 < SIM_LOG_MAX);
+	if(len > 0) sim_bus.log[len++] = ' ';
+	snprintf(sim_bus.log + len, SIM_LOG_MAX - len, fmt, value);
+}
+
+/****************************************************************************
+ * StdPeriph I2C, acting on the simulated registers
+ ***************************************************************************/
+
+void I2C_DeInit(I2C_TypeDef *I2Cx)
+{
+	memset(I2Cx, 0, sizeof(*I2Cx));
+}
+
+void I2C_Init(I2C_TypeDef *I2Cx, I2C_InitTypeDef *init)
+{
+	I2Cx->CR1 |= I2C_CR1_ACK;
+}
+
+void I2C_Cmd(I2C_TypeDef *I2Cx, FunctionalState state)
+{
+	if(state) I2Cx->CR1 |= I2C_CR1_PE;
+	else      I2Cx->CR1 &= ~I2C_CR1_PE;
+}
+
+void I2C_GenerateSTART(I2C_TypeDef *I2Cx, FunctionalState state)
+{
+	// CR1 must not be written while the hardware still has a STOP to send
+	CHECK(!(I2Cx->CR1 & I2C_CR1_STOP));
+
+	if(state) I2Cx->CR1 |= I2C_CR1_START;
+	else      I2Cx->CR1 &= ~I2C_CR1_START;
+}
+
+void I2C_GenerateSTOP(I2C_TypeDef *I2Cx, FunctionalState state)
+{
+	if(state) I2Cx->CR1 |= I2C_CR1_STOP;
+	else      I2Cx->CR1 &= ~I2C_CR1_STOP;
+}
+
+void I2C_Send7bitAddress(I2C_TypeDef *I2Cx, uint8_t address, uint8_t direction)
+{
+	CHECK(sim_bus.state == BUS_START);
+
+	address = (direction == I2C_Direction_Receiver) ? (address | 1) : (address & ~1);
+	I2Cx->DR = address;
+	I2Cx->SR1 &= ~I2C_SR1_SB;
+	sim_bus.address = address;
+	sim_bus.state = BUS_ADDRESS;
+}
+
+void I2C_AcknowledgeConfig(I2C_TypeDef *I2Cx, FunctionalState state)
+{
+	if(state) I2Cx->CR1 |= I2C_CR1_ACK;
+	else      I2Cx->CR1 &= ~I2C_CR1_ACK;
+}
+
+void I2C_NACKPositionConfig(I2C_TypeDef *I2Cx, uint16_t position)
+{
+	if(position == I2C_NACKPosition_Next) I2Cx->CR1 |= I2C_NACKPosition_Next;
+	else                                  I2Cx->CR1 &= I2C_NACKPosition_Current;
+}
+
+void I2C_ITConfig(I2C_TypeDef *I2Cx, uint16_t it, FunctionalState state)
+{
+	if(state) I2Cx->CR2 |= it;
+	else      I2Cx->CR2 &= ~it;
+}
+
+void I2C_SendData(I2C_TypeDef *I2Cx, uint8_t data)
+{
+	CHECK(!sim_bus.dr_full);
+
+	I2Cx->DR = data;
+	I2Cx->SR1 &= ~(I2C_SR1_TXE | I2C_SR1_BTF);
+	sim_bus.dr_full = true;
+}
+
+uint8_t I2C_ReceiveData(I2C_TypeDef *I2Cx)
+{
+	uint8_t data = I2Cx->DR;
+
+	CHECK(I2Cx->SR1 & I2C_SR1_RXNE);
+
+	if(sim_bus.shift_full)
+	{
+		I2Cx->DR = sim_bus.shift;
+		I2Cx->SR1 &= ~I2C_SR1_BTF;
+		sim_bus.shift_full = false;
+	}
+	else
+	{
+		I2Cx->SR1 &= ~I2C_SR1_RXNE;
+	}
+
+	return data;
+}
+
+void I2C_SoftwareResetCmd(I2C_TypeDef *I2Cx, FunctionalState state)
+{
+	if(state)
+	{
+		I2Cx->CR1 = I2C_CR1_SWRST;
+		I2Cx->SR1 = 0;
+		I2Cx->SR2 = 0;
+		sim_bus.state = BUS_IDLE;
+		sim_bus.dr_full = sim_bus.shift_full = sim_bus.starting = false;
+		sim_bus.resets++;
+	}
+	else
+	{
+		I2Cx->CR1 &= ~I2C_CR1_SWRST;
+	}
+}
+
+FlagStatus I2C_GetFlagStatus(I2C_TypeDef *I2Cx, uint32_t flag)
+{
+	CHECK(!"polled API not simulated");
+	return RESET;
+}
+
+ErrorStatus I2C_CheckEvent(I2C_TypeDef *I2Cx, uint32_t event)
+{
+	CHECK(!"polled API not simulated");
+	return ERROR;
+}
+
+/****************************************************************************
+ * Board support
+ ***************************************************************************/
+
+void RCC_AHB1PeriphClockCmd(uint32_t periph, FunctionalState state) {}
+void RCC_APB1PeriphClockCmd(uint32_t periph, FunctionalState state) {}
+void GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *init) {}
+void GPIO_PinAFConfig(GPIO_TypeDef *GPIOx, uint16_t source, uint8_t af) {}
+void NVIC_Init(NVIC_InitTypeDef *init) {}
+
+/****************************************************************************
+ * FreeRTOS, for a single task
+ ***************************************************************************/
+
+void vPortEnterCritical(void)
+{
+	critical++;
+}
+
+void vPortExitCritical(void)
+{
+	CHECK(critical > 0);
+	critical--;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return sim_ticks;
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+	return sim_ticks;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return (TaskHandle_t)&self;
+}
+
+/**
+  \brief ticks pass one at a time until a notification arrives or the wait
+  is up, with the hardware and the timer task running at each
+*/
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+	uint32_t value;
+
+	CHECK(critical == 0);
+
+	sim_run();
+
+	for(TickType_t t = 0; notified == 0 && t < wait; t++)
+	{
+		CHECK(wait != portMAX_DELAY);
+		sim_ticks++;
+		sim_run();
+	}
+
+	value = notified;
+	notified = clear ? 0 : (notified ? notified - 1 : 0);
+	return value;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+	CHECK(task == (TaskHandle_t)&self && action == eIncrement);
+	notified++;
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+	CHECK(task == (TaskHandle_t)&self);
+	notified++;
+	*woken = pdTRUE;
+}
+
+BaseType_t xTaskGenericCreate(TaskFunction_t code, const char * const name, const uint16_t stack,
+                              void * const arg, UBaseType_t priority, TaskHandle_t * const task,
+                              StackType_t * const buffer, const MemoryRegion_t * const regions)
+{
+	// never scheduled; the test runs the task's work itself
+	*task = (TaskHandle_t)&self;
+	return pdPASS;
+}
+
+BaseType_t xTimerPendFunctionCall(PendedFunction_t fn, void *arg, uint32_t unused, TickType_t wait)
+{
+	CHECK(sim_timer_count < TIMER_MAX);
+	timer_queue[sim_timer_count].fn = fn;
+	timer_queue[sim_timer_count++].arg = arg;
+	sim_timer_pends++;
+	return pdPASS;
+}
+
+BaseType_t xTimerPendFunctionCallFromISR(PendedFunction_t fn, void *arg, uint32_t unused,
+                                         BaseType_t *woken)
+{
+	return xTimerPendFunctionCall(fn, arg, unused, 0);
+}
+
+QueueHandle_t xQueueCreateMutex(const uint8_t type)
+{
+	return (QueueHandle_t)&self;
+}
+
+BaseType_t xQueueGenericReceive(QueueHandle_t queue, void * const buffer, TickType_t wait,
+                                const BaseType_t peek)
+{
+	return pdTRUE;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t queue, const void * const item, TickType_t wait,
+                             const BaseType_t position)
+{
+	return pdTRUE;
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+	return (EventGroupHandle_t)&event_bits;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, const EventBits_t bits)
+{
+	event_bits |= bits;
+	return event_bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, const EventBits_t bits)
+{
+	EventBits_t old = event_bits;
+
+	event_bits &= ~bits;
+	return old;
+}
+
+/**
+  \brief with only one task nothing else can set the bits, so they must
+  already be set
+*/
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, const EventBits_t bits,
+                                const BaseType_t clear, const BaseType_t all, TickType_t wait)
+{
+	CHECK((event_bits & bits) == bits);
+	return event_bits;
+}
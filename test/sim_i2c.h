@@ -0,0 +1,108 @@
+/********************************************************************
+sim_i2c.h - simulated I2C peripheral and kernel for the I2C host tests.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef SIM_I2C_H
+#define SIM_I2C_H
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "i2c.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define SIM_SLAVE       0x50
+#define SIM_LOG_MAX     1024
+
+#define SIM_SR1_ERRORS  (I2C_SR1_AF | I2C_SR1_ARLO | I2C_SR1_BERR | I2C_SR1_OVR)
+#define SIM_CR2_IT      (I2C_IT_EVT | I2C_IT_BUF | I2C_IT_ERR)
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef enum
+{
+	BUS_IDLE,
+	BUS_START,          // SB set, waiting for the address in DR
+	BUS_ADDRESS,        // address in DR, not yet shifted out
+	BUS_ADDRESSED,      // ADDR set, waiting for the SR2 read
+	BUS_TX,
+	BUS_RX,
+	BUS_NACKED          // AF set, waiting for STOP
+} sim_bus_state_t;
+
+/**
+ * An I2C peripheral in master mode as far as the engine can tell, wired to
+ * one memory-like slave at SIM_SLAVE: the first byte written sets the
+ * pointer, later bytes are stored and reads return from the pointer on.
+ * Everything but a START happens in no time.
+ */
+typedef struct
+{
+	sim_bus_state_t  state;
+	bool             receiver;
+	uint8_t          address;       // last address byte, with the R/W bit
+	bool             dr_full;       // TX: DR written, not yet in the shift register
+	bool             shift_full;    // TX: byte on the wire; RX: second byte held (BTF)
+	uint8_t          shift;
+	bool             ack_last;      // ACK as sampled for the byte before, for POS
+	bool             rx_done;       // RX: last byte NACKed, nothing more comes
+	uint16_t         written;       // data bytes the slave took in this transaction
+	bool             starting;      // START seen, goes out at start_at
+	TickType_t       start_at;
+
+	bool             stall;         // the peripheral never answers
+	bool             stop_hold;     // STOP stays in CR1 until cleared
+	bool             nack_address;
+	int              nack_data;     // the slave NACKs this data byte (0 based), -1 never
+	TickType_t       start_delay;   // ticks from a START request to SB
+
+	uint8_t          mem[256];
+	uint8_t          pointer;
+	int              resets;        // SWRST pulses
+	int              transactions;  // STARTs that were not repeated STARTs
+	char             log[SIM_LOG_MAX];  // what went over the wire
+} sim_bus_t;
+
+/****************************************************************************
+ * Public Variables
+ ***************************************************************************/
+
+extern I2C_TypeDef  sim_regs;       // not I2C1/2, so it is channel 2
+extern sim_bus_t    sim_bus;
+extern TickType_t   sim_ticks;
+extern int          sim_timer_count;    // calls waiting for the timer task
+extern int          sim_timer_pends;    // calls ever pended
+
+/****************************************************************************
+ * Public Prototypes
+ ***************************************************************************/
+
+void         sim_init          ( void );
+void         sim_bus_reset     ( void );
+void         sim_bus_run       ( void );
+bool         sim_timers_run    ( void );
+void         sim_run           ( void );
+void         sim_hold_bus      ( bool hold );
+bool         sim_engine_idle   ( void );
+bool         sim_engine_deferred ( void );
+I2CXfer_t *  sim_engine_head   ( void );
+
+#endif /* SIM_I2C_H */
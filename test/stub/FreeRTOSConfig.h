@@ -0,0 +1,40 @@
+/********************************************************************
+FreeRTOSConfig.h - minimal kernel configuration for the host tests.
+
+Only the headers are compiled on the host; nothing here is scheduled.
+********************************************************************/
+
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#define configUSE_PREEMPTION 1
+#define configUSE_IDLE_HOOK 0
+#define configUSE_TICK_HOOK 0
+#define configCPU_CLOCK_HZ 168000000
+#define configTICK_RATE_HZ 1000
+#define configMAX_PRIORITIES 5
+#define configMINIMAL_STACK_SIZE 128
+#define configTOTAL_HEAP_SIZE 20000
+#define configMAX_TASK_NAME_LEN 16
+#define configUSE_16_BIT_TICKS 0
+#define configIDLE_SHOULD_YIELD 1
+#define configUSE_MUTEXES 1
+#define configUSE_TIMERS 1
+#define configTIMER_TASK_PRIORITY 2
+#define configTIMER_QUEUE_LENGTH 10
+#define configTIMER_TASK_STACK_DEPTH 256
+#define configKERNEL_INTERRUPT_PRIORITY (15<<4)
+#define configMAX_SYSCALL_INTERRUPT_PRIORITY (5<<4)
+#define INCLUDE_vTaskDelay 1
+#define INCLUDE_vTaskDelayUntil 1
+#define INCLUDE_xTaskGetSchedulerState 1
+#define configUSE_CO_ROUTINES 0
+#define INCLUDE_vTaskPrioritySet 1
+#define INCLUDE_uxTaskPriorityGet 1
+#define INCLUDE_vTaskDelete 1
+#define INCLUDE_vTaskSuspend 1
+#define INCLUDE_xTaskGetCurrentTaskHandle 1
+#define configUSE_TASK_NOTIFICATIONS 1
+#define INCLUDE_xTimerPendFunctionCall 1
+
+#endif
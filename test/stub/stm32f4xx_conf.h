@@ -0,0 +1,24 @@
+/********************************************************************
+stm32f4xx_conf.h - peripheral header selection for the host tests.
+********************************************************************/
+
+#ifndef STM32F4XX_CONF_H
+#define STM32F4XX_CONF_H
+
+#include "stm32f4xx_adc.h"
+#include "stm32f4xx_can.h"
+#include "stm32f4xx_dma.h"
+#include "stm32f4xx_exti.h"
+#include "stm32f4xx_gpio.h"
+#include "stm32f4xx_i2c.h"
+#include "stm32f4xx_pwr.h"
+#include "stm32f4xx_rcc.h"
+#include "stm32f4xx_rtc.h"
+#include "stm32f4xx_sdio.h"
+#include "stm32f4xx_syscfg.h"
+#include "stm32f4xx_tim.h"
+#include "stm32f4xx_usart.h"
+#include "misc.h"
+#define assert_param(expr) ((void)0)
+
+#endif
@@ -0,0 +1,60 @@
+/********************************************************************
+test.h - minimal check macros and timing for the host-side tests.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+/**
+  \brief aborts the test with the failing expression and location if cond is
+  false
+*/
+#define CHECK(cond) do { \
+	if(!(cond)) { \
+		fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+		exit(1); \
+	} \
+} while(0)
+
+/**
+  \brief like CHECK, but for floating point values that must agree within tol
+*/
+#define CHECK_NEAR(a, b, tol) do { \
+	double _a = (a), _b = (b); \
+	if(!(fabs(_a - _b) <= (tol))) { \
+		fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed: %g vs %g (tol %g)\n", \
+			__FILE__, __LINE__, #a, #b, _a, _b, (double)(tol)); \
+		exit(1); \
+	} \
+} while(0)
+
+/**
+  \brief monotonic host time in ns, for the benchmarks.  Benchmarks only
+  report; host timings say nothing about the M4, but show regressions.
+*/
+static inline double test_now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+#endif
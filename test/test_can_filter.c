@@ -0,0 +1,344 @@
+/********************************************************************
+test_can_filter.c - host tests for the CAN acceptance filter builder.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "can_filter.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define LOG_FRAMES      20000
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_banks(void);
+static void test_replay(void);
+static void test_extended(void);
+static void test_pass_all(void);
+static uint32_t replay(const CANRXIndex_t *index, const CANFilterBank_t *banks,
+		uint8_t bank_count, bool pass_all);
+static CanRxMsg frame(uint32_t id, bool ext, bool remote);
+static void add(CANRXIndex_t *index, uint32_t mask, uint32_t id, bool ext);
+static void handler(CanRxMsg *packet);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static uint32_t handled;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_banks();
+	test_replay();
+	test_extended();
+	test_pass_all();
+
+	printf("can_filter: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief exact IDs pack four to a 16-bit list bank and masks two to a 16-bit
+  mask bank; duplicates and IDs a mask already admits take no room
+*/
+static void test_banks(void)
+{
+	CANRXIndex_t index;
+	CANFilterBank_t banks[CAN_FILTER_BANKS_PER_MODULE];
+	CanRxMsg msg;
+	bool pass_all;
+
+	can_rx_index_init(&index);
+	for(uint32_t id = 0x100; id < 0x105; id++)
+	{
+		add(&index, 0x7FF, id, false);
+	}
+	add(&index, 0x7FF, 0x100, false);
+	add(&index, 0x7FF, 0x234, false);     // inside the mask below
+	add(&index, 0x700, 0x200, false);
+	add(&index, 0x7F0, 0x7F0, false);
+	add(&index, 0x700, 0x200, false);     // same mask twice
+
+	CHECK(can_filter_build(&index, banks, CAN_FILTER_BANKS_PER_MODULE, &pass_all) == 3);
+	CHECK(!pass_all);
+
+	CHECK(banks[0].mode == CAN_FilterMode_IdMask && banks[0].scale == CAN_FilterScale_16bit);
+	CHECK(banks[1].mode == CAN_FilterMode_IdList && banks[1].scale == CAN_FilterScale_16bit);
+	CHECK(banks[2].mode == CAN_FilterMode_IdList && banks[2].scale == CAN_FilterScale_16bit);
+
+	// 0x104 is alone in the second list bank and fills all four slots
+	CHECK(banks[2].id_low == banks[2].mask_id_low && banks[2].id_low == banks[2].id_high);
+	CHECK(banks[2].id_low == (0x104 << 5));
+
+	msg = frame(0x104, false, false);
+	CHECK(can_filter_match(banks, 3, &msg));
+	msg = frame(0x105, false, false);
+	CHECK(!can_filter_match(banks, 3, &msg));
+	msg = frame(0x2AB, false, false);
+	CHECK(can_filter_match(banks, 3, &msg));
+
+	// list entries are data frames only; masks take remote frames too
+	msg = frame(0x101, false, true);
+	CHECK(!can_filter_match(banks, 3, &msg));
+	msg = frame(0x2AB, false, true);
+	CHECK(can_filter_match(banks, 3, &msg));
+
+	// standard filters never admit an extended frame
+	msg = frame(0x101, true, false);
+	CHECK(!can_filter_match(banks, 3, &msg));
+	msg = frame(0x101 << 18, true, false);
+	CHECK(!can_filter_match(banks, 3, &msg));
+	msg = frame(0x2AB << 18, true, false);
+	CHECK(!can_filter_match(banks, 3, &msg));
+}
+
+/**
+  \brief replays a bus log through the built banks: every frame a handler
+  wants gets through, every other frame is stopped in hardware
+*/
+static void test_replay(void)
+{
+	CANRXIndex_t index;
+	CANFilterBank_t banks[CAN_FILTER_BANKS_PER_MODULE];
+	uint8_t n;
+	bool pass_all;
+
+	// a node that listens to a handful of IDs and one block
+	can_rx_index_init(&index);
+	add(&index, 0x7FF, 0x010, false);
+	add(&index, 0x7FF, 0x080, false);
+	add(&index, 0x7FF, 0x081, false);
+	add(&index, 0x7FF, 0x700, false);
+	add(&index, 0x7FF, 0x7FF, false);
+	add(&index, 0x7FF, 0x000, false);
+	add(&index, 0x7F8, 0x180, false);
+
+	n = can_filter_build(&index, banks, CAN_FILTER_BANKS_PER_MODULE, &pass_all);
+	CHECK(!pass_all && n == 3);
+
+	uint32_t passed = replay(&index, banks, n, false);
+
+	printf("can_filter: %u of %u frames raise an interrupt, %u avoided\n",
+			passed, LOG_FRAMES, LOG_FRAMES - passed);
+	CHECK(passed < LOG_FRAMES / 2);
+}
+
+/**
+  \brief extended handlers get 32-bit banks, two exact IDs or one mask to a
+  bank, and the same number as a standard and as an extended ID are told
+  apart in both directions
+*/
+static void test_extended(void)
+{
+	CANRXIndex_t index;
+	CANFilterBank_t banks[CAN_FILTER_BANKS_PER_MODULE];
+	CanRxMsg msg;
+	uint8_t n;
+	bool pass_all;
+
+	// extended 0x123 only
+	can_rx_index_init(&index);
+	add(&index, CAN_EXT_ID_MASK, 0x123, true);
+
+	n = can_filter_build(&index, banks, CAN_FILTER_BANKS_PER_MODULE, &pass_all);
+	CHECK(n == 1 && !pass_all);
+	CHECK(banks[0].mode == CAN_FilterMode_IdList && banks[0].scale == CAN_FilterScale_32bit);
+	CHECK(banks[0].id_high == 0 && banks[0].id_low == (0x123 << 3 | 0x4));
+
+	msg = frame(0x123, true, false);
+	CHECK(can_filter_match(banks, n, &msg));
+	msg = frame(0x123, false, false);
+	CHECK(!can_filter_match(banks, n, &msg));
+
+	// standard 0x123 only
+	can_rx_index_init(&index);
+	add(&index, 0x7FF, 0x123, false);
+
+	n = can_filter_build(&index, banks, CAN_FILTER_BANKS_PER_MODULE, &pass_all);
+	CHECK(n == 1);
+	msg = frame(0x123, false, false);
+	CHECK(can_filter_match(banks, n, &msg));
+	msg = frame(0x123, true, false);
+	CHECK(!can_filter_match(banks, n, &msg));
+
+	// both, plus three more extended IDs, an extended mask and a standard
+	// mask that must not leak into the extended space
+	add(&index, CAN_EXT_ID_MASK, 0x123, true);
+	add(&index, CAN_EXT_ID_MASK, 0x1FFFFFFF, true);
+	add(&index, CAN_EXT_ID_MASK, 0x18FF0001, true);
+	add(&index, CAN_EXT_ID_MASK, 0x0CF00400, true);
+	add(&index, 0x1FFFFF00, 0x18FEF100, true);
+	add(&index, 0x7F0, 0x200, false);
+
+	// 16-bit: one mask bank, one list bank.  32-bit: one mask bank, two
+	// list banks for four IDs
+	n = can_filter_build(&index, banks, CAN_FILTER_BANKS_PER_MODULE, &pass_all);
+	CHECK(n == 5 && !pass_all);
+	CHECK(banks[2].mode == CAN_FilterMode_IdMask && banks[2].scale == CAN_FilterScale_32bit);
+	CHECK(banks[3].mode == CAN_FilterMode_IdList && banks[4].mode == CAN_FilterMode_IdList);
+
+	msg = frame(0x18FEF1AB, true, false);
+	CHECK(can_filter_match(banks, n, &msg));
+	msg = frame(0x18FEF1AB, true, true);           // masks take remote frames
+	CHECK(can_filter_match(banks, n, &msg));
+	msg = frame(0x18FEF2AB, true, false);
+	CHECK(!can_filter_match(banks, n, &msg));
+	msg = frame(0x1FFFFFFF, true, false);
+	CHECK(can_filter_match(banks, n, &msg));
+	msg = frame(0x0CF00400, true, true);            // list is data only
+	CHECK(!can_filter_match(banks, n, &msg));
+	msg = frame(0x201 << 18, true, false);          // standard mask's base ID
+	CHECK(!can_filter_match(banks, n, &msg));
+	msg = frame(0x7FF, false, false);               // 0x1FFFFFFF's base ID
+	CHECK(!can_filter_match(banks, n, &msg));
+
+	add(&index, 0x1FFFFF00, 0x0CF00400, true);
+	add(&index, CAN_EXT_ID_MASK, 0x0CF00456, true);  // inside the mask above
+	n = can_filter_build(&index, banks, CAN_FILTER_BANKS_PER_MODULE, &pass_all);
+	CHECK(n == 6);
+
+	replay(&index, banks, n, false);
+}
+
+/**
+  \brief too many handlers for the banks: one bank that admits everything,
+  and software dispatch filters as it did before
+*/
+static void test_pass_all(void)
+{
+	CANRXIndex_t index;
+	CANFilterBank_t banks[CAN_FILTER_BANKS_PER_MODULE];
+	CanRxMsg msg;
+	bool pass_all;
+
+	can_rx_index_init(&index);
+	for(uint32_t i = 0; i < CAN_MAX_PACKET_HANDLER; i++)
+	{
+		add(&index, (i & 1) ? 0x7FF : 0x7FE, i * 64, false);
+	}
+
+	CHECK(can_filter_build(&index, banks, CAN_FILTER_BANKS_PER_MODULE, &pass_all) == 12);
+	CHECK(!pass_all);
+	CHECK(can_filter_build(&index, banks, 11, &pass_all) == 1);
+	CHECK(pass_all);
+
+	CHECK(banks[0].mode == CAN_FilterMode_IdMask && banks[0].scale == CAN_FilterScale_32bit);
+	msg = frame(0x555, false, false);
+	CHECK(can_filter_match(banks, 1, &msg));
+	msg = frame(0x555, false, true);
+	CHECK(can_filter_match(banks, 1, &msg));
+	msg = frame(0x1ABCDEF0, true, false);
+	CHECK(can_filter_match(banks, 1, &msg));
+
+	CHECK(replay(&index, banks, 1, true) == LOG_FRAMES);
+
+	CHECK(can_filter_build(&index, banks, 0, &pass_all) == 0);
+}
+
+/**
+  \brief runs LOG_FRAMES frames of mixed standard and extended traffic
+  through the banks and the index, checks the banks admit exactly the frames
+  a handler wants (or everything, for pass_all) and returns how many they let
+  through.  Remote frames are left out: list banks only admit data frames.
+*/
+static uint32_t replay(const CANRXIndex_t *index, const CANFilterBank_t *banks,
+		uint8_t bank_count, bool pass_all)
+{
+	static const uint16_t periodic[] = { 0x010, 0x080, 0x081, 0x181, 0x187, 0x700, 0x7FF };
+	static const uint32_t periodic_ext[] = {
+		0x123, 0x1FFFFFFF, 0x18FF0001, 0x18FEF1AB, 0x0CF004FF, 0x0CF00400
+	};
+	uint32_t seed = 3;
+	uint32_t passed = 0;
+
+	for(uint32_t f = 0; f < LOG_FRAMES; f++)
+	{
+		CanRxMsg msg;
+		bool pass, wanted;
+
+		seed = seed * 1103515245u + 12345u;
+
+		if(f % 3 == 0)
+		{
+			msg = frame(periodic[(seed >> 16) % 7], false, false);
+		}
+		else if(f % 3 == 1 && (seed >> 12) % 4 == 0)
+		{
+			msg = frame((seed >> 3) & CAN_EXT_ID_MASK, true, false);
+		}
+		else if(f % 3 == 1 && (seed >> 12) % 4 == 1)
+		{
+			msg = frame(periodic_ext[(seed >> 16) % 6], true, false);
+		}
+		else
+		{
+			msg = frame((seed >> 16) & 0x7FF, false, false);
+		}
+
+		handled = 0;
+		can_rx_index_dispatch(index, &msg);
+		wanted = handled > 0;
+		pass = can_filter_match(banks, bank_count, &msg);
+
+		CHECK(pass == (wanted || pass_all));
+		passed += pass;
+	}
+
+	return passed;
+}
+
+static CanRxMsg frame(uint32_t id, bool ext, bool remote)
+{
+	CanRxMsg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.IDE = ext ? CAN_Id_Extended : CAN_Id_Standard;
+	msg.StdId = ext ? 0 : id;
+	msg.ExtId = ext ? id : 0;
+	msg.RTR = remote ? CAN_RTR_Remote : CAN_RTR_Data;
+
+	return msg;
+}
+
+static void add(CANRXIndex_t *index, uint32_t mask, uint32_t id, bool ext)
+{
+	CANRXEntry_t entry = { mask, id, handler, ext ? CAN_Id_Extended : CAN_Id_Standard };
+
+	CHECK(can_rx_index_add(index, &entry));
+}
+
+static void handler(CanRxMsg *packet)
+{
+	(void)packet;
+	handled++;
+}
@@ -0,0 +1,409 @@
+/********************************************************************
+test_can_rx_index.c - host tests for the CAN receive dispatch index.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "can_rx_index.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define LOG_MAX         16
+#define BENCH_FRAMES    (1u << 20)
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_sorted_insert(void);
+static void test_duplicates(void);
+static void test_edges(void);
+static void test_exact_before_masked(void);
+static void test_extended(void);
+static void test_full(void);
+static void test_lookup(void);
+static void bench(void);
+static uint16_t linear_dispatch(const CANRXEntry_t *table, uint16_t count, CanRxMsg *packet);
+static void add(CANRXIndex_t *index, uint32_t mask, uint32_t id, bool ext, CANRXHandlerFxn fxn);
+static uint16_t dispatch(const CANRXIndex_t *index, uint32_t id, bool ext);
+static void handler_a(CanRxMsg *packet);
+static void handler_b(CanRxMsg *packet);
+static void handler_c(CanRxMsg *packet);
+static void handler_count(CanRxMsg *packet);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static char log_calls[LOG_MAX + 1];     // which handlers ran, in order
+static uint8_t log_len;
+static uint32_t handled;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_sorted_insert();
+	test_duplicates();
+	test_edges();
+	test_exact_before_masked();
+	test_extended();
+	test_full();
+	test_lookup();
+	bench();
+
+	printf("can_rx_index: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief exact handlers added in any order end up sorted, masked ones do not
+  enter the exact table
+*/
+static void test_sorted_insert(void)
+{
+	CANRXIndex_t index;
+	uint32_t id = 0x5A5;
+
+	can_rx_index_init(&index);
+
+	for(int i = 0; i < 20; i++)
+	{
+		id = (id * 1103515245u + 12345u) & 0x7FF;
+		add(&index, 0x7FF, id, false, handler_a);
+	}
+	add(&index, 0x7F0, 0x120, false, handler_b);
+	add(&index, 0xFFFF, 0x321, false, handler_b);   // extra mask bits are fine
+
+	CHECK(index.exact_count == 21 && index.masked_count == 1);
+	for(int i = 1; i < index.exact_count; i++)
+	{
+		CHECK(index.exact[i - 1].id <= index.exact[i].id);
+	}
+
+	// every exact ID is found
+	for(int i = 0; i < index.exact_count; i++)
+	{
+		CHECK(dispatch(&index, index.exact[i].id, false) >= 1);
+	}
+}
+
+/**
+  \brief handlers for the same ID all run, in registration order, however
+  they were interleaved with others
+*/
+static void test_duplicates(void)
+{
+	CANRXIndex_t index;
+
+	can_rx_index_init(&index);
+	add(&index, 0x7FF, 0x200, false, handler_b);
+	add(&index, 0x7FF, 0x100, false, handler_c);
+	add(&index, 0x7FF, 0x200, false, handler_a);
+	add(&index, 0x7FF, 0x300, false, handler_c);
+	add(&index, 0x7FF, 0x200, false, handler_c);
+
+	CHECK(dispatch(&index, 0x200, false) == 3);
+	CHECK(strcmp(log_calls, "bac") == 0);
+	CHECK(dispatch(&index, 0x100, false) == 1);
+	CHECK(strcmp(log_calls, "c") == 0);
+}
+
+/**
+  \brief the binary search at both ends of the table and the ID space, and
+  on misses between, below and above the entries
+*/
+static void test_edges(void)
+{
+	CANRXIndex_t index;
+
+	can_rx_index_init(&index);
+	CHECK(dispatch(&index, 0x000, false) == 0);
+
+	add(&index, 0x7FF, 0x400, false, handler_a);
+	CHECK(dispatch(&index, 0x400, false) == 1);
+	CHECK(dispatch(&index, 0x3FF, false) == 0);
+	CHECK(dispatch(&index, 0x401, false) == 0);
+
+	add(&index, 0x7FF, 0x000, false, handler_b);
+	add(&index, 0x7FF, 0x7FF, false, handler_c);
+	add(&index, 0x7FF, 0x001, false, handler_a);
+	add(&index, 0x7FF, 0x7FE, false, handler_a);
+
+	CHECK(dispatch(&index, 0x000, false) == 1 && strcmp(log_calls, "b") == 0);
+	CHECK(dispatch(&index, 0x7FF, false) == 1 && strcmp(log_calls, "c") == 0);
+	CHECK(dispatch(&index, 0x001, false) == 1);
+	CHECK(dispatch(&index, 0x7FE, false) == 1);
+	CHECK(dispatch(&index, 0x002, false) == 0);
+	CHECK(dispatch(&index, 0x7FD, false) == 0);
+	CHECK(dispatch(&index, 0x3FF, false) == 0);
+}
+
+/**
+  \brief a frame that matches both kinds gets its exact handlers first, even
+  when the masked handler was registered first
+*/
+static void test_exact_before_masked(void)
+{
+	CANRXIndex_t index;
+
+	can_rx_index_init(&index);
+	add(&index, 0x700, 0x100, false, handler_c);
+	add(&index, 0x000, 0x000, false, handler_b);     // everything
+	add(&index, 0x7FF, 0x123, false, handler_a);
+
+	CHECK(dispatch(&index, 0x123, false) == 3);
+	CHECK(strcmp(log_calls, "acb") == 0);
+	CHECK(dispatch(&index, 0x1FF, false) == 2);
+	CHECK(strcmp(log_calls, "cb") == 0);
+	CHECK(dispatch(&index, 0x223, false) == 1);
+	CHECK(strcmp(log_calls, "b") == 0);
+}
+
+/**
+  \brief standard and extended IDs are separate spaces: the same number in
+  each reaches only its own handlers, exact and masked alike
+*/
+static void test_extended(void)
+{
+	CANRXIndex_t index;
+
+	can_rx_index_init(&index);
+	add(&index, 0x7FF, 0x123, false, handler_a);
+	add(&index, CAN_EXT_ID_MASK, 0x123, true, handler_b);
+	add(&index, CAN_EXT_ID_MASK, 0x1FFFFFFF, true, handler_c);
+	add(&index, 0x1FFFFF00, 0x12345600, true, handler_c);
+	add(&index, 0x700, 0x100, false, handler_c);      // standard partition, added last
+
+	CHECK(index.exact_count == 3);
+	CHECK(index.exact[0].id == 0x123);
+	CHECK(index.exact[1].id == (0x123 | CAN_RX_INDEX_EXT_FLAG));
+	CHECK(index.exact[2].id == (0x1FFFFFFF | CAN_RX_INDEX_EXT_FLAG));
+	CHECK(index.masked_std_count == 1 && index.masked_count == 2);
+	CHECK(index.masked[0].ide != CAN_Id_Extended);
+
+	CHECK(dispatch(&index, 0x123, false) == 2 && strcmp(log_calls, "ac") == 0);
+	CHECK(dispatch(&index, 0x123, true) == 1 && strcmp(log_calls, "b") == 0);
+	CHECK(dispatch(&index, 0x1FFFFFFF, true) == 1 && strcmp(log_calls, "c") == 0);
+	CHECK(dispatch(&index, 0x7FF, true) == 0);
+	CHECK(dispatch(&index, 0x123456AB, true) == 1 && strcmp(log_calls, "c") == 0);
+	CHECK(dispatch(&index, 0x100, true) == 0);        // standard mask, extended frame
+	CHECK(dispatch(&index, 0x1AB, false) == 1);
+
+	// a standard handler for an ID that does not fit 11 bits never matches,
+	// and in particular not the extended frame its key would alias
+	add(&index, CAN_EXT_ID_MASK, 0x80000123, false, handler_a);
+	CHECK(dispatch(&index, 0x123, true) == 1 && strcmp(log_calls, "b") == 0);
+	CHECK(dispatch(&index, 0x123, false) == 2);
+}
+
+static void test_full(void)
+{
+	CANRXIndex_t index;
+	CANRXEntry_t entry = { 0x7FF, 0, handler_count, CAN_Id_Standard };
+
+	can_rx_index_init(&index);
+
+	for(int i = 0; i < CAN_MAX_PACKET_HANDLER; i++)
+	{
+		entry.id_after_mask = i;
+		entry.mask = (i & 1) ? 0x7FF : 0x7FE;
+		CHECK(can_rx_index_add(&index, &entry));
+	}
+	CHECK(!can_rx_index_add(&index, &entry));
+	CHECK(index.exact_count + index.masked_count == CAN_MAX_PACKET_HANDLER);
+}
+
+/**
+  \brief a lookup is a snapshot in dispatch order: adding handlers after it,
+  which shifts the sorted table, does not change what it calls, and a full
+  index that matches every handler still fits the callback array
+*/
+static void test_lookup(void)
+{
+	CANRXIndex_t index;
+	CANRXHandlerFxn callbacks[CAN_MAX_PACKET_HANDLER];
+	CanRxMsg packet = { .StdId = 0x200, .IDE = CAN_Id_Standard };
+	uint16_t count;
+
+	can_rx_index_init(&index);
+	add(&index, 0x700, 0x200, false, handler_c);
+	add(&index, 0x7FF, 0x200, false, handler_b);
+	add(&index, 0x7FF, 0x300, false, handler_a);
+
+	count = can_rx_index_lookup(&index, &packet, callbacks);
+	CHECK(count == 2);
+	CHECK(callbacks[0] == handler_b && callbacks[1] == handler_c);
+
+	add(&index, 0x7FF, 0x100, false, handler_a);
+	add(&index, 0x7FF, 0x200, false, handler_a);
+	CHECK(index.exact[1].callback == handler_b);
+	CHECK(callbacks[0] == handler_b && callbacks[1] == handler_c);
+
+	CHECK(can_rx_index_lookup(&index, &packet, callbacks) == 3);
+	CHECK(callbacks[0] == handler_b && callbacks[1] == handler_a && callbacks[2] == handler_c);
+
+	can_rx_index_init(&index);
+
+	for(int i = 0; i < CAN_MAX_PACKET_HANDLER; i++)
+	{
+		add(&index, (i & 1) ? 0x7FF : 0x000, (i & 1) ? 0x200 : 0x000, false, handler_count);
+	}
+	CHECK(can_rx_index_lookup(&index, &packet, callbacks) == CAN_MAX_PACKET_HANDLER);
+}
+
+/**
+  \brief host ns/frame through the index against the linear scan it
+  replaced, for growing handler counts.  Half the frames have a handler.
+  Reported only.
+*/
+static void bench(void)
+{
+	static CanRxMsg frames[256];
+	CANRXEntry_t table[CAN_MAX_PACKET_HANDLER];
+	CANRXIndex_t index;
+	uint32_t seed = 7;
+
+	for(uint16_t n = 4; n <= CAN_MAX_PACKET_HANDLER; n *= 2)
+	{
+		double t0, index_ns, linear_ns;
+		uint32_t index_calls, linear_calls;
+
+		can_rx_index_init(&index);
+		for(uint16_t i = 0; i < n; i++)
+		{
+			CANRXEntry_t entry = { 0x7FF, (i * 37u + 5u) & 0x7FF, handler_count, CAN_Id_Standard };
+
+			table[i] = entry;
+			CHECK(can_rx_index_add(&index, &entry));
+		}
+
+		memset(frames, 0, sizeof(frames));
+		for(uint16_t f = 0; f < 256; f++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			frames[f].IDE = CAN_Id_Standard;
+			frames[f].StdId = (f & 1) ? table[(seed >> 16) % n].id_after_mask
+			                          : (seed >> 16) & 0x7FF;
+		}
+
+		handled = 0;
+		t0 = test_now_ns();
+		for(uint32_t f = 0; f < BENCH_FRAMES; f++)
+		{
+			can_rx_index_dispatch(&index, &frames[f & 255]);
+		}
+		index_ns = (test_now_ns() - t0) / BENCH_FRAMES;
+		index_calls = handled;
+
+		handled = 0;
+		t0 = test_now_ns();
+		for(uint32_t f = 0; f < BENCH_FRAMES; f++)
+		{
+			linear_dispatch(table, n, &frames[f & 255]);
+		}
+		linear_ns = (test_now_ns() - t0) / BENCH_FRAMES;
+		linear_calls = handled;
+
+		CHECK(index_calls == linear_calls);
+		printf("can_rx_index: %2u handlers, index %.1f ns/frame, linear %.1f ns/frame\n",
+				n, index_ns, linear_ns);
+	}
+}
+
+// the dispatch loop can.c had before the index
+static uint16_t linear_dispatch(const CANRXEntry_t *table, uint16_t count, CanRxMsg *packet)
+{
+	uint16_t calls = 0;
+
+	for(uint16_t i = 0; i < count; i++)
+	{
+		if((packet->StdId & table[i].mask) == table[i].id_after_mask)
+		{
+			table[i].callback(packet);
+			calls++;
+		}
+	}
+
+	return calls;
+}
+
+static void add(CANRXIndex_t *index, uint32_t mask, uint32_t id, bool ext, CANRXHandlerFxn fxn)
+{
+	CANRXEntry_t entry = { mask, id, fxn, ext ? CAN_Id_Extended : CAN_Id_Standard };
+
+	CHECK(can_rx_index_add(index, &entry));
+}
+
+/**
+  \brief dispatches one frame and returns the number of handlers called;
+  log_calls names them in order
+*/
+static uint16_t dispatch(const CANRXIndex_t *index, uint32_t id, bool ext)
+{
+	CanRxMsg packet;
+	uint16_t calls;
+
+	memset(&packet, 0, sizeof(packet));
+	packet.IDE = ext ? CAN_Id_Extended : CAN_Id_Standard;
+	packet.StdId = ext ? 0 : id;
+	packet.ExtId = ext ? id : 0;
+
+	log_len = 0;
+	calls = can_rx_index_dispatch(index, &packet);
+	log_calls[log_len] = '\0';
+
+	CHECK(calls == log_len);
+	return calls;
+}
+
+static void handler_a(CanRxMsg *packet)
+{
+	(void)packet;
+	CHECK(log_len < LOG_MAX);
+	log_calls[log_len++] = 'a';
+}
+
+static void handler_b(CanRxMsg *packet)
+{
+	(void)packet;
+	CHECK(log_len < LOG_MAX);
+	log_calls[log_len++] = 'b';
+}
+
+static void handler_c(CanRxMsg *packet)
+{
+	(void)packet;
+	CHECK(log_len < LOG_MAX);
+	log_calls[log_len++] = 'c';
+}
+
+static void handler_count(CanRxMsg *packet)
+{
+	(void)packet;
+	handled++;
+}
@@ -0,0 +1,576 @@
+/********************************************************************
+test_can_tx_sched.c - host tests for the CAN transmit scheduler.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "can_tx_sched.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define SCHED_DEPTH     64
+#define SIM_SLOTS       200000      // frame times on the simulated bus
+
+#define ID_URGENT       0x010
+#define ID_STATUS       0x200       // periodic, coalesced
+#define ID_BULK         0x600
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+ * One bxCAN transmit mailbox as far as the scheduler can tell: TXRQ, ABRQ
+ * and the RQCP/TXOK completion flags.
+ */
+typedef struct
+{
+	bool      pending;
+	bool      complete;
+	bool      ok;
+	CanTxMsg  msg;
+} sim_mailbox_t;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static CanTxMsg frame(uint32_t id, bool ext, uint16_t count);
+static uint16_t frame_count(const CanTxMsg *msg);
+static void test_order(void);
+static void test_mailboxes(void);
+static void test_abort_race(void);
+static void test_simulation(void);
+static uint8_t sim_transmit(CanTxMsg *msg);
+static void sim_cancel(uint8_t mb);
+static void sim_pump(uint32_t now);
+static void sim_isr(uint32_t now);
+static int8_t sim_arbitrate(void);
+static void sim_complete(uint32_t now);
+static void sim_send(uint32_t id, bool ext, bool coalesce, uint32_t now);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static CANTxSchedEntry_t storage[SCHED_DEPTH];
+static CANTxSched_t sched;
+
+static sim_mailbox_t mailbox[CAN_TX_SCHED_MAILBOXES];
+static int8_t on_bus = -1;
+
+static uint16_t sent_count[0x800];      // per standard ID, next counter to use
+static int32_t bus_count[0x800];        // per standard ID, last counter seen
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_order();
+	test_mailboxes();
+	test_abort_race();
+	test_simulation();
+
+	printf("can_tx_sched: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static CanTxMsg frame(uint32_t id, bool ext, uint16_t count)
+{
+	CanTxMsg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.IDE = ext ? CAN_Id_Extended : CAN_Id_Standard;
+	msg.StdId = ext ? 0 : id;
+	msg.ExtId = ext ? id : 0;
+	msg.RTR = CAN_RTR_Data;
+	msg.DLC = 2;
+	msg.Data[0] = count & 0xFF;
+	msg.Data[1] = count >> 8;
+
+	return msg;
+}
+
+static uint16_t frame_count(const CanTxMsg *msg)
+{
+	return msg->Data[0] | (msg->Data[1] << 8);
+}
+
+// Pure heap behaviour: arbitration order, FIFO among equal IDs, coalescing
+// and dropping the lowest priority frame when full.
+static void test_order(void)
+{
+	CANTxSchedEntry_t small[4];
+	CanTxMsg msg;
+	uint32_t last = 0;
+	int i;
+
+	can_tx_sched_init(&sched, storage, SCHED_DEPTH);
+
+	// standard beats extended with the same base ID, data beats remote
+	msg = frame(0x123, false, 0);
+	uint32_t std = can_tx_sched_key(&msg);
+	msg.RTR = CAN_RTR_Remote;
+	CHECK(std < can_tx_sched_key(&msg));
+	msg = frame(0x123 << 18, true, 0);
+	CHECK(std < can_tx_sched_key(&msg));
+
+	for(i = 0; i < 40; i++)
+	{
+		msg = frame((i * 389) & 0x7FF, i & 1, i);
+		CHECK(can_tx_sched_push(&sched, &msg, false, i));
+	}
+	for(i = 0; i < 3; i++)
+	{
+		msg = frame(0x100, false, 100 + i);
+		CHECK(can_tx_sched_push(&sched, &msg, false, 50));
+	}
+	for(i = 0; i < 3; i++)
+	{
+		msg = frame(0x101, false, 200 + i);
+		CHECK(can_tx_sched_push(&sched, &msg, true, 50));
+	}
+	CHECK(sched.stats.coalesced == 2);
+
+	i = 0;
+	while(can_tx_sched_pop(&sched, &msg, 60))
+	{
+		uint32_t key = can_tx_sched_key(&msg);
+
+		CHECK(key >= last);
+		if(msg.StdId == 0x100 && msg.IDE == CAN_Id_Standard)
+		{
+			CHECK(frame_count(&msg) == 100 + i++);
+		}
+		if(msg.StdId == 0x101 && msg.IDE == CAN_Id_Standard)
+		{
+			CHECK(frame_count(&msg) == 202);
+		}
+		last = key;
+	}
+	CHECK(i == 3);
+	CHECK(sched.stats.latency_max == 60);
+
+	can_tx_sched_init(&sched, small, 4);
+	for(i = 0; i < 4; i++)
+	{
+		msg = frame(0x300 + i, false, i);
+		CHECK(can_tx_sched_push(&sched, &msg, false, 0));
+	}
+	msg = frame(0x400, false, 0);
+	CHECK(!can_tx_sched_push(&sched, &msg, false, 0));
+	msg = frame(0x001, false, 0);
+	CHECK(can_tx_sched_push(&sched, &msg, false, 0));
+	CHECK(sched.stats.dropped == 2);
+	CHECK(can_tx_sched_pop(&sched, &msg, 0) && msg.StdId == 0x001);
+	while(can_tx_sched_pop(&sched, &msg, 0))
+	{
+		CHECK(msg.StdId != 0x303);
+	}
+}
+
+// Mailbox bookkeeping: same ID frames are held back, and a full set of
+// mailboxes is preempted only by a strictly more urgent frame.
+static void test_mailboxes(void)
+{
+	CanTxMsg msg;
+	int i;
+
+	can_tx_sched_init(&sched, storage, SCHED_DEPTH);
+
+	msg = frame(0x500, false, 0);
+	can_tx_sched_push(&sched, &msg, false, 0);
+	msg = frame(0x500, false, 1);
+	can_tx_sched_push(&sched, &msg, false, 0);
+
+	CHECK(can_tx_sched_peek(&sched, &msg) && frame_count(&msg) == 0);
+	can_tx_sched_load(&sched, 0, 0);
+	CHECK(!can_tx_sched_peek(&sched, &msg));
+	CHECK(can_tx_sched_preempt(&sched) == -1);
+	can_tx_sched_done(&sched, 0, true);
+	CHECK(can_tx_sched_peek(&sched, &msg) && frame_count(&msg) == 1);
+	can_tx_sched_load(&sched, 0, 0);
+
+	for(i = 1; i < CAN_TX_SCHED_MAILBOXES; i++)
+	{
+		msg = frame(0x400 + i, false, 0);
+		can_tx_sched_push(&sched, &msg, false, 0);
+		CHECK(can_tx_sched_peek(&sched, &msg));
+		can_tx_sched_load(&sched, i, 0);
+	}
+
+	msg = frame(0x600, false, 0);
+	can_tx_sched_push(&sched, &msg, false, 0);
+	CHECK(can_tx_sched_preempt(&sched) == -1);
+	can_tx_sched_pop(&sched, NULL, 0);
+
+	msg = frame(0x300, false, 0);
+	can_tx_sched_push(&sched, &msg, false, 0);
+	CHECK(can_tx_sched_preempt(&sched) == 0);
+	CHECK(can_tx_sched_preempt(&sched) == -1);      // one abort at a time
+	can_tx_sched_done(&sched, 0, false);
+	CHECK(sched.stats.preempted == 1);
+	CHECK(can_tx_sched_count(&sched) == 2);
+	CHECK(can_tx_sched_peek(&sched, &msg) && msg.StdId == 0x300);
+	can_tx_sched_load(&sched, 0, 0);
+	CHECK(can_tx_sched_peek(&sched, &msg) && msg.StdId == 0x500 && frame_count(&msg) == 1);
+}
+
+/*
+ * An abort completes, and a can_write gets in before the interrupt does.
+ * CAN_Transmit reuses the aborted mailbox, which clears its RQCP, so the pump
+ * has to report the completion before loading: otherwise the aborted frame is
+ * overwritten without being counted and the abort never ends.
+ */
+static void test_abort_race(void)
+{
+	static const uint32_t ids[] = { 0x600, 0x601, 0x602, 0x300, 0x301 };
+	bool seen[5] = { false };
+	CanTxMsg msg;
+	uint32_t t = 0;
+	uint8_t i;
+
+	can_tx_sched_init(&sched, storage, SCHED_DEPTH);
+	memset(mailbox, 0, sizeof(mailbox));
+	memset(sent_count, 0, sizeof(sent_count));
+
+	for(i = 0; i < 3; i++)
+	{
+		sim_send(ids[i], false, false, t);
+	}
+	on_bus = 0;
+
+	// 0x300 aborts 0x602; the abort completes at once
+	msg = frame(0x300, false, 0);
+	CHECK(can_tx_sched_push(&sched, &msg, false, t));
+	sim_pump(t);
+	CHECK(sched.aborting == 1 << 2 && mailbox[2].complete);
+
+	// before the interrupt, 0x301 is written and takes mailbox 2
+	msg = frame(0x301, false, 0);
+	CHECK(can_tx_sched_push(&sched, &msg, false, t));
+	sim_pump(t);
+	CHECK(mailbox[2].pending && mailbox[2].msg.StdId == 0x300);
+	CHECK(sched.stats.preempted == 1);
+
+	// 0x602 is back in the backlog and the next preemption (0x601 for
+	// 0x301) went ahead
+	CHECK(can_tx_sched_count(&sched) == 2);
+	CHECK(sched.aborting == 1 << 1);
+
+	for(t = 1; t < 10; t++)
+	{
+		sim_complete(t);
+		on_bus = sim_arbitrate();
+		if(on_bus < 0)
+		{
+			break;
+		}
+
+		for(i = 0; i < 5; i++)
+		{
+			if(mailbox[on_bus].msg.StdId == ids[i])
+			{
+				CHECK(!seen[i]);
+				seen[i] = true;
+			}
+		}
+	}
+
+	// 0x600 was on the bus from the start
+	for(i = 1; i < 5; i++)
+	{
+		CHECK(seen[i]);
+	}
+	CHECK(sched.loaded == 0 && sched.aborting == 0);
+	CHECK(sched.stats.preempted == 2 && sched.stats.dropped == 0);
+}
+
+/*
+ * Simulated bxCAN with three mailboxes and identifier priority (TXFP = 0),
+ * driven by the same pump/ISR sequence as can.c.  Each slot is one frame time:
+ * new frames arrive while the previous frame is on the bus, then it completes,
+ * the completion interrupt runs and the mailboxes arbitrate for the next slot.
+ *
+ * At every arbitration the frame that wins must be the most urgent frame in
+ * the whole system, software backlog included.  Frames with the same ID must
+ * reach the bus in submission order.
+ */
+static void test_simulation(void)
+{
+	uint32_t urgent_at = 0;
+	uint32_t urgent_wait_max = 0;
+	bool urgent_pending = false;
+	uint32_t bulk_left = 0;
+	uint32_t t;
+	uint32_t on_bus_total = 0;
+	uint8_t mb;
+
+	can_tx_sched_init(&sched, storage, SCHED_DEPTH);
+	memset(mailbox, 0, sizeof(mailbox));
+	memset(sent_count, 0, sizeof(sent_count));
+	for(t = 0; t < 0x800; t++)
+	{
+		bus_count[t] = -1;
+	}
+	srand(11);
+
+	for(t = 1; t <= SIM_SLOTS; t++)
+	{
+		int8_t best = -1;
+
+		// arrivals while the current frame is on the bus
+		if(bulk_left == 0 && rand() % 40 == 0)
+		{
+			bulk_left = 8 + rand() % 24;
+		}
+		if(bulk_left > 0 && rand() % 2 == 0)
+		{
+			bulk_left--;
+			sim_send(ID_BULK + (bulk_left & 1), false, false, t);
+		}
+		if(t % 10 == 0)
+		{
+			sim_send(ID_STATUS, false, true, t);
+		}
+		if(rand() % 8 == 0)
+		{
+			uint32_t id = 0x100 + rand() % 0x400;
+
+			if(rand() % 4 == 0)
+			{
+				sim_send(id << 18 | (rand() & 0x3FFFF), true, false, t);
+			}
+			else
+			{
+				sim_send(id, false, false, t);
+			}
+		}
+		if(!urgent_pending && rand() % 25 == 0)
+		{
+			sim_send(ID_URGENT, false, false, t);
+			urgent_pending = true;
+			urgent_at = t;
+		}
+
+		// the frame on the bus completes
+		if(on_bus >= 0)
+		{
+			CanTxMsg *msg = &mailbox[on_bus].msg;
+
+			if(msg->IDE == CAN_Id_Standard && msg->StdId != ID_STATUS)
+			{
+				CHECK((int32_t)frame_count(msg) == bus_count[msg->StdId] + 1);
+			}
+			if(msg->IDE == CAN_Id_Standard)
+			{
+				bus_count[msg->StdId] = frame_count(msg);
+			}
+
+			mailbox[on_bus].pending = false;
+			mailbox[on_bus].complete = true;
+			mailbox[on_bus].ok = true;
+			on_bus = -1;
+			on_bus_total++;
+		}
+
+		sim_isr(t);
+
+		best = sim_arbitrate();
+		if(best < 0)
+		{
+			CHECK(can_tx_sched_count(&sched) == 0);
+			continue;
+		}
+
+		// no priority inversion: nothing in the backlog outranks the winner
+		if(can_tx_sched_count(&sched) > 0)
+		{
+			CHECK(can_tx_sched_key(&mailbox[best].msg) <= sched.heap[0].key);
+		}
+
+		if(mailbox[best].msg.StdId == ID_URGENT && mailbox[best].msg.IDE == CAN_Id_Standard)
+		{
+			if(t - urgent_at > urgent_wait_max)
+			{
+				urgent_wait_max = t - urgent_at;
+			}
+			urgent_pending = false;
+		}
+
+		on_bus = best;
+	}
+
+	// an urgent frame only ever waits for the frame already on the bus
+	CHECK(urgent_wait_max == 0);
+	CHECK(sched.stats.preempted > 0);
+	CHECK(sched.stats.dropped == 0);
+
+	// every accepted frame is on the bus, in a mailbox or still pending
+	for(mb = 0; mb < CAN_TX_SCHED_MAILBOXES; mb++)
+	{
+		on_bus_total += mailbox[mb].pending;
+	}
+	CHECK(on_bus_total + can_tx_sched_count(&sched) == sched.stats.queued);
+}
+
+// CAN_Transmit: the lowest numbered mailbox with TME set takes the frame.
+// Setting TXRQ clears the mailbox's RQCP and TXOK, reported or not.
+static uint8_t sim_transmit(CanTxMsg *msg)
+{
+	uint8_t mb;
+
+	for(mb = 0; mb < CAN_TX_SCHED_MAILBOXES; mb++)
+	{
+		if(!mailbox[mb].pending)
+		{
+			mailbox[mb].pending = true;
+			mailbox[mb].complete = false;
+			mailbox[mb].ok = false;
+			mailbox[mb].msg = *msg;
+			return mb;
+		}
+	}
+
+	return CAN_TxStatus_NoMailBox;
+}
+
+// CAN_CancelTransmit: takes effect at once unless the frame is on the bus.
+static void sim_cancel(uint8_t mb)
+{
+	if(mailbox[mb].pending && on_bus != mb)
+	{
+		mailbox[mb].pending = false;
+		mailbox[mb].complete = true;
+		mailbox[mb].ok = false;
+	}
+}
+
+// can_tx_pump: completions first, then refill, then preempt
+static void sim_pump(uint32_t now)
+{
+	CanTxMsg next;
+	int8_t victim;
+	uint8_t mb;
+
+	for(mb = 0; mb < CAN_TX_SCHED_MAILBOXES; mb++)
+	{
+		if(mailbox[mb].complete)
+		{
+			mailbox[mb].complete = false;
+			can_tx_sched_done(&sched, mb, mailbox[mb].ok);
+		}
+	}
+
+	while(can_tx_sched_peek(&sched, &next))
+	{
+		mb = sim_transmit(&next);
+
+		if(mb == CAN_TxStatus_NoMailBox)
+		{
+			break;
+		}
+
+		can_tx_sched_load(&sched, mb, now);
+	}
+
+	victim = can_tx_sched_preempt(&sched);
+	if(victim >= 0)
+	{
+		sim_cancel(victim);
+	}
+}
+
+// can_tx_isr, which keeps firing for as long as a completion is pending
+static void sim_isr(uint32_t now)
+{
+	bool again = true;
+	uint8_t mb;
+
+	while(again)
+	{
+		again = false;
+
+		for(mb = 0; mb < CAN_TX_SCHED_MAILBOXES; mb++)
+		{
+			again |= mailbox[mb].complete;
+		}
+
+		if(again)
+		{
+			sim_pump(now);
+		}
+	}
+}
+
+// arbitration between the mailboxes, lowest key (then mailbox) wins
+static int8_t sim_arbitrate(void)
+{
+	int8_t best = -1;
+	uint8_t mb;
+
+	for(mb = 0; mb < CAN_TX_SCHED_MAILBOXES; mb++)
+	{
+		if(mailbox[mb].pending && (best < 0 ||
+			can_tx_sched_key(&mailbox[mb].msg) < can_tx_sched_key(&mailbox[best].msg)))
+		{
+			best = mb;
+		}
+	}
+
+	return best;
+}
+
+// the frame on the bus goes out and the interrupt runs
+static void sim_complete(uint32_t now)
+{
+	if(on_bus >= 0)
+	{
+		mailbox[on_bus].pending = false;
+		mailbox[on_bus].complete = true;
+		mailbox[on_bus].ok = true;
+		on_bus = -1;
+	}
+
+	sim_isr(now);
+}
+
+// can_send_packet / can_send_periodic_packet
+static void sim_send(uint32_t id, bool ext, bool coalesce, uint32_t now)
+{
+	CanTxMsg msg = frame(id, ext, ext ? 0 : sent_count[id]);
+
+	CHECK(can_tx_sched_push(&sched, &msg, coalesce, now));
+	if(!ext && !coalesce)
+	{
+		sent_count[id]++;
+	}
+
+	// can_write pumps with the interrupt masked; the interrupt runs after
+	sim_pump(now);
+	sim_isr(now);
+}
@@ -0,0 +1,496 @@
+/********************************************************************
+test_foc.c - host tests for the floating point FOC chain.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "foc.h"
+#include "pi.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define NUM_SAMPLES     4096
+#define BENCH_ROUNDS    50
+
+#define SWEEP_STEPS     3600        // 0.1 degree steps over one cycle
+
+// Surface PMSM for the current loop test.  At MOTOR_SPEED the back EMF alone
+// is close to the linear limit of the bus, so a large q current command
+// drives the loop into overmodulation.
+#define MOTOR_R         0.1f        // ohm
+#define MOTOR_L         100e-6f     // henry
+#define MOTOR_PSI       0.011f      // V*s/rad, electrical
+#define MOTOR_SPEED     1200.0f     // rad/s, electrical
+#define MOTOR_VBUS      24.0f
+#define LOOP_DT         50e-6f
+#define LOOP_BW         (2.0f * (float)M_PI * 1000.0f)
+#define MODEL_SUBSTEPS  20
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_step_matches_stages(void);
+static void test_batch_matches_step(void);
+static void test_dpwm(void);
+static void test_svm_auto(void);
+static void test_current_loop(void);
+static void applied_dq(const focControl_t *foc, float *vd, float *vq);
+static bool dpwm_a_high(focSvmMode_t mode, float theta);
+static void set_phase_voltages(focControl_t *foc, float amplitude, float theta);
+static void bench(void);
+static void random_inputs(void);
+static void load_sample(focControl_t *foc, uint32_t i);
+static float frand(float lo, float hi);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static float in_Ia[NUM_SAMPLES], in_Ib[NUM_SAMPLES], in_theta[NUM_SAMPLES];
+static float in_Vd[NUM_SAMPLES], in_Vq[NUM_SAMPLES], in_Vbus[NUM_SAMPLES];
+static float out_sin[NUM_SAMPLES], out_cos[NUM_SAMPLES];
+static float out_Id[NUM_SAMPLES], out_Iq[NUM_SAMPLES];
+static float out_V1[NUM_SAMPLES], out_V2[NUM_SAMPLES], out_V3[NUM_SAMPLES];
+
+static const focBatch_t batch = {
+	in_Ia, in_Ib, in_theta, in_Vd, in_Vq, in_Vbus,
+	out_sin, out_cos, out_Id, out_Iq, out_V1, out_V2, out_V3
+};
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	srand(1);
+	random_inputs();
+
+	test_step_matches_stages();
+	test_batch_matches_step();
+	test_dpwm();
+	test_svm_auto();
+	test_current_loop();
+	bench();
+
+	printf("foc: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief FOC_Step against the six stages called one by one, in every SVM
+  mode; the whole structure must agree bit for bit
+*/
+static void test_step_matches_stages(void)
+{
+	for(focSvmMode_t mode = FOC_SVM_SVPWM; mode <= FOC_SVM_AUTO; mode++)
+	{
+		focControl_t staged, fused;
+
+		// AUTO carries its hysteresis from sample to sample
+		memset(&staged, 0, sizeof(staged));
+		memset(&fused, 0, sizeof(fused));
+
+		for(uint32_t i = 0; i < NUM_SAMPLES; i++)
+		{
+			load_sample(&staged, i);
+			load_sample(&fused, i);
+			staged.svmMode = fused.svmMode = mode;
+
+			FOC_Clarke(&staged);
+			FOC_SinCos(&staged);
+			FOC_Park(&staged);
+			FOC_InvPark(&staged);
+			FOC_InvClarke(&staged);
+			FOC_SVM(&staged);
+
+			FOC_Step(&fused);
+
+			CHECK(memcmp(&staged, &fused, sizeof(staged)) == 0);
+		}
+	}
+}
+
+/**
+  \brief FOC_StepBatch against FOC_Step in SVPWM, bit for bit
+*/
+static void test_batch_matches_step(void)
+{
+	FOC_StepBatch(&batch, NUM_SAMPLES);
+
+	for(uint32_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		focControl_t foc;
+
+		memset(&foc, 0, sizeof(foc));
+		load_sample(&foc, i);
+		foc.svmMode = FOC_SVM_SVPWM;
+		FOC_Step(&foc);
+
+		CHECK(memcmp(&foc.sinTheta, &out_sin[i], sizeof(float)) == 0);
+		CHECK(memcmp(&foc.cosTheta, &out_cos[i], sizeof(float)) == 0);
+		CHECK(memcmp(&foc.Id, &out_Id[i], sizeof(float)) == 0);
+		CHECK(memcmp(&foc.Iq, &out_Iq[i], sizeof(float)) == 0);
+		CHECK(memcmp(&foc.V1, &out_V1[i], sizeof(float)) == 0);
+		CHECK(memcmp(&foc.V2, &out_V2[i], sizeof(float)) == 0);
+		CHECK(memcmp(&foc.V3, &out_V3[i], sizeof(float)) == 0);
+	}
+}
+
+/**
+  \brief sweeps a vector at modulation index 0.87 through one cycle in each
+  mode.  Every mode must apply the commanded line-to-line volt-seconds; the
+  DPWM modes must park exactly one leg on the right rail, in the right
+  window, which removes a third of the switching.
+*/
+static void test_dpwm(void)
+{
+	for(focSvmMode_t mode = FOC_SVM_SVPWM; mode < FOC_SVM_AUTO; mode++)
+	{
+		focControl_t foc;
+		uint32_t switching = 0;
+
+		memset(&foc, 0, sizeof(foc));
+		foc.svmMode = mode;
+		foc.Vbus = 1.0f;
+
+		for(int k = 0; k < SWEEP_STEPS; k++)
+		{
+			float theta = -180.0f + k * (360.0f / SWEEP_STEPS);
+
+			set_phase_voltages(&foc, 0.5f, theta);
+			FOC_SVM(&foc);
+
+			CHECK(foc.svmActive == mode);
+			CHECK_NEAR(foc.modIndex, 0.5 * sqrt(3.0), 1e-5);
+			CHECK_NEAR(foc.Da - foc.Db, foc.Va - foc.Vb, 1e-5);
+			CHECK_NEAR(foc.Db - foc.Dc, foc.Vb - foc.Vc, 1e-5);
+
+			float duty[3] = { foc.Da, foc.Db, foc.Dc };
+
+			// a leg only switches in a period if it is off both rails
+			for(int leg = 0; leg < 3; leg++)
+			{
+				CHECK(duty[leg] >= 0.0f && duty[leg] <= 1.0f);
+				switching += (duty[leg] > 0.0f && duty[leg] < 1.0f);
+			}
+
+			if(mode == FOC_SVM_SVPWM)
+			{
+				CHECK(foc.clampedPhase == FOC_PHASE_NONE);
+				continue;
+			}
+
+			CHECK(foc.clampedPhase >= 0 && foc.clampedPhase < 3);
+			CHECK(duty[foc.clampedPhase] == (foc.clampedHigh ? 1.0f : 0.0f));
+
+			// stay clear of the 30 degree boundaries, where the choice is a tie
+			float edge = fmodf(theta + 180.0f, 30.0f);
+
+			if(edge > 0.5f && edge < 29.5f)
+			{
+				bool a_high = (foc.clampedPhase == 0 && foc.clampedHigh);
+
+				CHECK(a_high == dpwm_a_high(mode, theta));
+			}
+		}
+
+		// two thirds of SVPWM's switching; where two legs tie, both can land
+		// on the rail, which happens at most once per 60 degrees
+		if(mode == FOC_SVM_SVPWM)
+		{
+			CHECK(switching == 3 * SWEEP_STEPS);
+		}
+		else
+		{
+			CHECK(switching <= 2 * SWEEP_STEPS && switching >= 2 * SWEEP_STEPS - 6);
+		}
+	}
+}
+
+/**
+  \brief FOC_SVM_AUTO enters DPWM1 above FOC_SVM_AUTO_DPWM_ENTER and leaves
+  below FOC_SVM_AUTO_DPWM_EXIT, holding its mode in between
+*/
+static void test_svm_auto(void)
+{
+	static const struct {
+		float modIndex;
+		focSvmMode_t active;
+	} steps[] = {
+		{ 0.30f, FOC_SVM_SVPWM },
+		{ 0.60f, FOC_SVM_SVPWM },
+		{ 0.70f, FOC_SVM_DPWM1 },
+		{ 0.60f, FOC_SVM_DPWM1 },
+		{ 0.50f, FOC_SVM_SVPWM },
+		{ 0.60f, FOC_SVM_SVPWM },
+	};
+	focControl_t foc;
+
+	memset(&foc, 0, sizeof(foc));
+	foc.svmMode = FOC_SVM_AUTO;
+	foc.Vbus = 1.0f;
+
+	for(unsigned i = 0; i < sizeof(steps) / sizeof(steps[0]); i++)
+	{
+		set_phase_voltages(&foc, steps[i].modIndex / sqrtf(3.0f), 10.0f);
+		FOC_SVM(&foc);
+
+		CHECK(foc.svmActive == steps[i].active);
+		CHECK((foc.clampedPhase == FOC_PHASE_NONE) == (steps[i].active == FOC_SVM_SVPWM));
+	}
+}
+
+/**
+  \brief d/q current loop on a PMSM model: PI, FOC_LimitVoltage, the float
+  chain, then PI_Track with Vd and Vq as FOC_SVM left them.  Those must be
+  the voltages the duty cycles really apply, in overmodulation too, and the
+  loop must come straight out of saturation when the command drops.
+*/
+static void test_current_loop(void)
+{
+	focControl_t foc;
+	pi_t pi_d, pi_q;
+	focPhase_t phase = 0;
+	const focPhase_t step = (focPhase_t)(MOTOR_SPEED * LOOP_DT / (2.0 * M_PI) * FOC_PHASE_TURN_F);
+	double id = 0.0, iq = 0.0;
+	uint32_t projected = 0;
+
+	memset(&foc, 0, sizeof(foc));
+	foc.Vbus = MOTOR_VBUS;
+	foc.svmMode = FOC_SVM_SVPWM;
+
+	PI_Init(&pi_d, LOOP_DT);
+	PI_Init(&pi_q, LOOP_DT);
+	PI_SetGains(&pi_d, MOTOR_L * LOOP_BW, MOTOR_R * LOOP_BW);
+	PI_SetGains(&pi_q, MOTOR_L * LOOP_BW, MOTOR_R * LOOP_BW);
+	pi_d.outMax = pi_q.outMax = MOTOR_VBUS;
+	pi_d.outMin = pi_q.outMin = -MOTOR_VBUS;
+
+	// 40 A is out of reach for 50 ms, then 5 A for 10 ms
+	for(int k = 0; k < 1200; k++)
+	{
+		float iq_ref = (k < 1000) ? 40.0f : 5.0f;
+
+		// measure
+		double th = FOC_PhaseToRadians(phase);
+		foc.Ia = (float)(id * cos(th) - iq * sin(th));
+		foc.Ib = (float)(id * cos(th - 2.0 * M_PI / 3.0) - iq * sin(th - 2.0 * M_PI / 3.0));
+		FOC_Clarke(&foc);
+		FOC_SinCosPhase(&foc, phase);
+		FOC_Park(&foc);
+
+		// regulate
+		pi_d.reference = 0.0f;
+		pi_d.measured = foc.Id;
+		pi_q.reference = iq_ref;
+		pi_q.measured = foc.Iq;
+		foc.Vd = PI_Control(&pi_d);
+		foc.Vq = PI_Control(&pi_q);
+		FOC_LimitVoltage(&foc, FOC_MOD_INDEX_HEXAGON);
+
+		float vd_limited = foc.Vd, vq_limited = foc.Vq;
+
+		// modulate
+		FOC_InvPark(&foc);
+		FOC_InvClarke(&foc);
+		FOC_SVM(&foc);
+		PI_Track(&pi_d, foc.Vd);
+		PI_Track(&pi_q, foc.Vq);
+
+		float vd, vq;
+
+		applied_dq(&foc, &vd, &vq);
+		CHECK_NEAR(vd, foc.Vd, 1e-3 * MOTOR_VBUS);
+		CHECK_NEAR(vq, foc.Vq, 1e-3 * MOTOR_VBUS);
+		projected += (foc.Vd * foc.Vd + foc.Vq * foc.Vq) <
+				0.99f * (vd_limited * vd_limited + vq_limited * vq_limited);
+
+		// the motor, in the rotor frame, over one period
+		for(int n = 0; n < MODEL_SUBSTEPS; n++)
+		{
+			const double h = LOOP_DT / MODEL_SUBSTEPS;
+			double did = (vd - MOTOR_R * id + MOTOR_SPEED * MOTOR_L * iq) / MOTOR_L;
+			double diq = (vq - MOTOR_R * iq - MOTOR_SPEED * (MOTOR_L * id + MOTOR_PSI)) / MOTOR_L;
+
+			id += did * h;
+			iq += diq * h;
+		}
+		phase += step;
+
+		if(k >= 500 && k < 1000)
+		{
+			CHECK(iq < 35.0);
+		}
+
+		// back-calculation leaves the integrator where the applied voltage
+		// was, so the loop is out of saturation and settled 5 ms after the
+		// command drops
+		if(k >= 1100)
+		{
+			CHECK_NEAR(iq, 5.0, 0.25);
+			CHECK_NEAR(id, 0.0, 0.25);
+		}
+	}
+
+	CHECK(projected > 100);
+}
+
+/**
+  \brief the d/q voltage the duty cycles put across the windings, from the
+  line-to-line voltages so the common mode drops out
+*/
+static void applied_dq(const focControl_t *foc, float *vd, float *vq)
+{
+	float vab = (foc->Da - foc->Db) * foc->Vbus;
+	float vbc = (foc->Db - foc->Dc) * foc->Vbus;
+	float valpha = (2.0f * vab + vbc) / 3.0f;
+	float vbeta = vbc / sqrtf(3.0f);
+
+	*vd =  valpha * foc->cosTheta + vbeta * foc->sinTheta;
+	*vq = -valpha * foc->sinTheta + vbeta * foc->cosTheta;
+}
+
+/**
+  \brief host ns/sample for the stage by stage, fused and batch paths.
+  Reported only; the numbers say nothing about the M4 but show regressions
+  in the batch loop.  FOC_SVM rescales Vd/Vq in place when it limits, so
+  the samples are reloaded, untimed, before every round.
+*/
+static void bench(void)
+{
+	static focControl_t foc[NUM_SAMPLES];
+	double t0, stages_ns = 0.0, step_ns = 0.0, batch_ns;
+
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(uint32_t i = 0; i < NUM_SAMPLES; i++)
+		{
+			load_sample(&foc[i], i);
+			foc[i].svmMode = FOC_SVM_SVPWM;
+		}
+
+		t0 = test_now_ns();
+		for(uint32_t i = 0; i < NUM_SAMPLES; i++)
+		{
+			FOC_Clarke(&foc[i]);
+			FOC_SinCos(&foc[i]);
+			FOC_Park(&foc[i]);
+			FOC_InvPark(&foc[i]);
+			FOC_InvClarke(&foc[i]);
+			FOC_SVM(&foc[i]);
+		}
+		stages_ns += test_now_ns() - t0;
+
+		for(uint32_t i = 0; i < NUM_SAMPLES; i++)
+		{
+			load_sample(&foc[i], i);
+		}
+
+		t0 = test_now_ns();
+		for(uint32_t i = 0; i < NUM_SAMPLES; i++)
+		{
+			FOC_Step(&foc[i]);
+		}
+		step_ns += test_now_ns() - t0;
+	}
+	stages_ns /= BENCH_ROUNDS * NUM_SAMPLES;
+	step_ns /= BENCH_ROUNDS * NUM_SAMPLES;
+
+	// the batch reads its inputs and writes separate outputs
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		FOC_StepBatch(&batch, NUM_SAMPLES);
+	}
+	batch_ns = (test_now_ns() - t0) / BENCH_ROUNDS / NUM_SAMPLES;
+
+	printf("foc: stages %.1f ns/sample, FOC_Step %.1f ns/sample, "
+			"FOC_StepBatch %.1f ns/sample\n", stages_ns, step_ns, batch_ns);
+}
+
+/**
+  \brief whether phase a should be parked on the top rail at theta, from the
+  clamp windows described for focSvmMode_t
+*/
+static bool dpwm_a_high(focSvmMode_t mode, float theta)
+{
+	switch(mode)
+	{
+	case FOC_SVM_DPWM0:
+		return theta >= -60.0f && theta < 0.0f;
+	case FOC_SVM_DPWM1:
+		return theta >= -30.0f && theta < 30.0f;
+	case FOC_SVM_DPWM2:
+		return theta >= 0.0f && theta < 60.0f;
+	case FOC_SVM_DPWM3:
+		return fabsf(theta) >= 30.0f && fabsf(theta) < 60.0f;
+	case FOC_SVM_DPWMMAX:
+		return fabsf(theta) < 60.0f;
+	default:
+		return false;
+	}
+}
+
+/**
+  \brief balanced phase voltages with phase a peaking at theta = 0
+*/
+static void set_phase_voltages(focControl_t *foc, float amplitude, float theta)
+{
+	const float rad = (float)M_PI / 180.0f;
+
+	foc->Va = amplitude * cosf(theta * rad);
+	foc->Vb = amplitude * cosf((theta - 120.0f) * rad);
+	foc->Vc = amplitude * cosf((theta + 120.0f) * rad);
+}
+
+static void random_inputs(void)
+{
+	for(uint32_t i = 0; i < NUM_SAMPLES; i++)
+	{
+		in_Ia[i] = frand(-10.0f, 10.0f);
+		in_Ib[i] = frand(-10.0f, 10.0f);
+		in_theta[i] = frand(-179.0f, 179.0f);     // arm_sin_cos_f32's range
+		in_Vd[i] = frand(-20.0f, 20.0f);          // reaches overmodulation
+		in_Vq[i] = frand(-20.0f, 20.0f);
+		in_Vbus[i] = frand(24.0f, 48.0f);
+	}
+}
+
+static void load_sample(focControl_t *foc, uint32_t i)
+{
+	foc->Ia = in_Ia[i];
+	foc->Ib = in_Ib[i];
+	foc->theta = in_theta[i];
+	foc->Vd = in_Vd[i];
+	foc->Vq = in_Vq[i];
+	foc->Vbus = in_Vbus[i];
+}
+
+static float frand(float lo, float hi)
+{
+	return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+}
@@ -0,0 +1,284 @@
+/********************************************************************
+test_foc_angle.c - host tests for the phase accumulator angle helpers.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "foc_angle.h"
+#include "foc.h"
+#include "arm_math.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define SINCOS_TOL      2e-5        // as documented for FOC_SIN_TABLE_BITS
+
+#define TURN            4294967296.0
+#define PHASE_TO_RAD(p) ((double)(p) * (2.0 * M_PI / TURN))
+
+#define BENCH_SAMPLES   4096
+#define BENCH_ROUNDS    50
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_sincos(void);
+static void test_conversions(void);
+static void test_wrap(void);
+static void test_encoder(void);
+static void bench(void);
+static double phase_error(focPhase_t a, focPhase_t b);
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_sincos();
+	test_conversions();
+	test_wrap();
+	test_encoder();
+	bench();
+
+	printf("foc_angle: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief table sin/cos over the whole turn, including both ends of every
+  table segment
+*/
+static void test_sincos(void)
+{
+	double worst = 0.0;
+
+	for(uint64_t p = 0; p < (1ull << 32); p += 4099)
+	{
+		focPhase_t phase = (focPhase_t)p;
+		float s, c;
+
+		FOC_PhaseSinCos(phase, &s, &c);
+		worst = fmax(worst, fabs(s - sin(PHASE_TO_RAD(phase))));
+		worst = fmax(worst, fabs(c - cos(PHASE_TO_RAD(phase))));
+	}
+
+	for(uint32_t i = 0; i <= FOC_SIN_TABLE_SIZE; i++)
+	{
+		focPhase_t phase = (focPhase_t)((uint64_t)i << (32 - FOC_SIN_TABLE_BITS));
+		float s, c;
+
+		FOC_PhaseSinCos(phase, &s, &c);
+		worst = fmax(worst, fabs(s - sin(PHASE_TO_RAD(phase))));
+		worst = fmax(worst, fabs(c - cos(PHASE_TO_RAD(phase))));
+
+		FOC_PhaseSinCos(phase - 1, &s, &c);
+		worst = fmax(worst, fabs(s - sin(PHASE_TO_RAD(phase - 1))));
+	}
+
+	CHECK_NEAR(worst, 0.0, SINCOS_TOL);
+}
+
+/**
+  \brief degrees and radians in and out, and the signed -180 to 180 view
+*/
+static void test_conversions(void)
+{
+	CHECK(FOC_PhaseFromDegrees(0.0f) == 0);
+	CHECK(FOC_PhaseFromDegrees(90.0f) == 0x40000000u);
+	CHECK(FOC_PhaseFromDegrees(-90.0f) == 0xC0000000u);
+	CHECK(FOC_PhaseFromDegrees(180.0f) == 0x80000000u);
+	CHECK(FOC_PhaseFromDegrees(-180.0f) == 0x80000000u);
+
+	CHECK(FOC_PhaseToDegrees(0x40000000u) == 90.0f);
+	CHECK(FOC_PhaseToDegrees(0xC0000000u) == -90.0f);
+	CHECK(FOC_PhaseToDegrees(0x80000000u) == -180.0f);
+
+	for(float deg = -180.0f; deg < 180.0f; deg += 0.37f)
+	{
+		focPhase_t phase = FOC_PhaseFromDegrees(deg);
+
+		CHECK_NEAR(FOC_PhaseToDegrees(phase), deg, 1e-4);
+		CHECK_NEAR(FOC_PhaseToRadians(phase), deg * M_PI / 180.0, 2e-6);
+		CHECK(phase_error(FOC_PhaseFromRadians(deg * (float)M_PI / 180.0f), phase) < 1e-6);
+	}
+}
+
+/**
+  \brief whole turns are folded away, and an accumulator wraps without
+  drifting
+*/
+static void test_wrap(void)
+{
+	for(float deg = -180.0f; deg < 180.0f; deg += 7.3f)
+	{
+		focPhase_t phase = FOC_PhaseFromDegrees(deg);
+
+		for(int turns = -20; turns <= 20; turns++)
+		{
+			// float keeps fewer fraction bits as the angle grows
+			CHECK(phase_error(FOC_PhaseFromDegrees(deg + 360.0f * turns), phase) < 1e-5);
+		}
+	}
+
+	// 1.5e6 periods at 2.7 degrees a period: exactly where the turns say
+	focPhase_t step = FOC_PhaseFromDegrees(2.7f);
+	focPhase_t acc = 0;
+
+	for(uint32_t i = 0; i < 1500000; i++)
+	{
+		acc += step;
+	}
+
+	CHECK(acc == (focPhase_t)((uint64_t)step * 1500000u));
+}
+
+/**
+  \brief counts to electrical phase, exact for a power of two and within a
+  fraction of a count otherwise
+*/
+static void test_encoder(void)
+{
+	focEncoder_t enc;
+
+	FOC_EncoderInit(&enc, 4096, 7);
+	for(uint32_t count = 0; count < 4096; count++)
+	{
+		CHECK(FOC_EncoderPhase(&enc, count) == (focPhase_t)(((uint64_t)count * 7) << 20));
+	}
+
+	FOC_EncoderInit(&enc, 1000, 7);
+	for(uint32_t count = 0; count <= 1000; count++)
+	{
+		double exact = fmod(count * 7.0 / 1000.0, 1.0) * TURN;
+
+		CHECK(phase_error(FOC_EncoderPhase(&enc, count), (focPhase_t)(uint64_t)exact) <
+				0.01 * 7.0 / 1000.0);
+	}
+
+	FOC_EncoderAlign(&enc, 123, FOC_PhaseFromDegrees(-45.0f));
+	CHECK(FOC_EncoderPhase(&enc, 123) == FOC_PhaseFromDegrees(-45.0f));
+	CHECK(phase_error(FOC_EncoderPhase(&enc, 123 + 1000), FOC_PhaseFromDegrees(-45.0f)) <
+			0.01 * 7.0 / 1000.0);
+}
+
+/**
+  \brief host ns/call for the table sin/cos against arm_sin_cos_f32 and
+  libm, on the same angles, and for FOC_WrapAngle on angles already in
+  range and on angles many turns out.  Reported only.
+*/
+static void bench(void)
+{
+	static focPhase_t phase[BENCH_SAMPLES];
+	static float deg[BENCH_SAMPLES], rad[BENCH_SAMPLES], far[BENCH_SAMPLES];
+	volatile float sink;
+	float s, c, acc = 0.0f;
+	double t0, table_ns, arm_ns, libm_ns, wrap_ns, wrap_far_ns;
+
+	srand(1);
+	for(int i = 0; i < BENCH_SAMPLES; i++)
+	{
+		deg[i] = -179.0f + 358.0f * (float)rand() / (float)RAND_MAX;   // arm_sin_cos_f32's range
+		phase[i] = FOC_PhaseFromDegrees(deg[i]);
+		rad[i] = deg[i] * (float)(M_PI / 180.0);
+		far[i] = deg[i] + 360.0f * (float)(rand() % 20001 - 10000);
+	}
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int i = 0; i < BENCH_SAMPLES; i++)
+		{
+			FOC_PhaseSinCos(phase[i], &s, &c);
+			acc += s + c;
+		}
+	}
+	table_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int i = 0; i < BENCH_SAMPLES; i++)
+		{
+			arm_sin_cos_f32(deg[i], &s, &c);
+			acc += s + c;
+		}
+	}
+	arm_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int i = 0; i < BENCH_SAMPLES; i++)
+		{
+			acc += sinf(rad[i]) + cosf(rad[i]);
+		}
+	}
+	libm_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int i = 0; i < BENCH_SAMPLES; i++)
+		{
+			acc += FOC_WrapAngle(deg[i]);
+		}
+	}
+	wrap_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int i = 0; i < BENCH_SAMPLES; i++)
+		{
+			acc += FOC_WrapAngle(far[i]);
+		}
+	}
+	wrap_far_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	sink = acc;
+	(void)sink;
+
+	// up to 3.6e6 degrees, where a float step is 0.25 degrees
+	for(int i = 0; i < BENCH_SAMPLES; i++)
+	{
+		float w = FOC_WrapAngle(far[i]);
+
+		CHECK(w >= -180.0f && w <= 180.0f);
+		CHECK(fabs(remainder((double)w - far[i], 360.0)) < 0.5);
+	}
+
+	printf("foc_angle: FOC_PhaseSinCos %.1f ns, arm_sin_cos_f32 %.1f ns, "
+			"sinf+cosf %.1f ns\n", table_ns, arm_ns, libm_ns);
+	printf("foc_angle: FOC_WrapAngle %.1f ns in range, %.1f ns 10000 turns out\n",
+			wrap_ns, wrap_far_ns);
+}
+
+/**
+  \brief distance between two phases, in turns
+*/
+static double phase_error(focPhase_t a, focPhase_t b)
+{
+	return fabs((double)(int32_t)(a - b)) / TURN;
+}
@@ -0,0 +1,192 @@
+/********************************************************************
+test_foc_observer.c - host tests for the sensorless flux observer.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "foc_observer.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define MOTOR_R         0.1
+#define MOTOR_L         100e-6
+#define MOTOR_LAMBDA    0.01
+#define DT              50e-6
+
+#define BENCH_SAMPLES   4096
+#define BENCH_ROUNDS    50
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef struct
+{
+	double theta;                   // electrical angle, rad
+	double omega;                   // electrical speed, rad/s
+	double iAlpha;
+	double iBeta;
+} motor_t;
+
+typedef struct
+{
+	double angle;                   // worst angle error, degrees
+	double speed;                   // worst speed error, rad/s
+} errors_t;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static errors_t run(focObserver_t *obs, double theta0, double omega, double accel,
+		double seconds, double settle, double modelR);
+static void motor_step(motor_t *m, focControl_t *foc, double iq, double modelR);
+static void bench(void);
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	focObserver_t obs;
+	errors_t e;
+
+	// locks on from the wrong angle while spinning up, then tracks; the
+	// PLL lags a constant acceleration by accel/bandwidth^2 = 2.9 degrees
+	FOC_ObserverInit(&obs, DT, MOTOR_R, MOTOR_L, MOTOR_LAMBDA);
+	e = run(&obs, 1.0, 0.0, 2000.0, 0.5, 0.3, MOTOR_R);
+	CHECK(e.angle < 3.2);
+	CHECK(e.speed < 0.5);
+
+	// steady speed, both directions
+	for(int dir = -1; dir <= 1; dir += 2)
+	{
+		FOC_ObserverInit(&obs, DT, MOTOR_R, MOTOR_L, MOTOR_LAMBDA);
+		e = run(&obs, -2.0, dir * 1000.0, 0.0, 0.5, 0.2, MOTOR_R);
+		CHECK(e.angle < 0.2);
+		CHECK(e.speed < 0.01);
+	}
+
+	// the flux circle keeps a 30% resistance error from drifting
+	FOC_ObserverInit(&obs, DT, MOTOR_R, MOTOR_L, MOTOR_LAMBDA);
+	e = run(&obs, 0.5, 1000.0, 0.0, 0.5, 0.2, 1.3 * MOTOR_R);
+	CHECK(e.angle < 1.5);
+	CHECK(e.speed < 0.01);
+
+	bench();
+
+	printf("foc_observer: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief runs the motor at 5 A q current from theta0, omega and constant
+  acceleration, and returns the worst errors after settle seconds
+*/
+static errors_t run(focObserver_t *obs, double theta0, double omega, double accel,
+		double seconds, double settle, double modelR)
+{
+	motor_t m = { theta0, omega, 0.0, 0.0 };
+	focControl_t foc;
+	errors_t worst = { 0.0, 0.0 };
+
+	memset(&foc, 0, sizeof(foc));
+
+	for(int n = 0; n < (int)(seconds / DT); n++)
+	{
+		motor_step(&m, &foc, 5.0, modelR);
+		FOC_ObserverUpdate(obs, &foc);
+		m.omega += accel * DT;
+
+		if(n * DT >= settle)
+		{
+			double angle = remainder(FOC_PhaseToRadians(obs->phase) - m.theta, 2.0 * M_PI);
+
+			worst.angle = fmax(worst.angle, fabs(angle) * 180.0 / M_PI);
+			worst.speed = fmax(worst.speed, fabs(obs->omega - m.omega));
+		}
+	}
+
+	return worst;
+}
+
+/**
+  \brief advances the motor one period with the current held on the q axis,
+  and leaves the measured current and the voltage that produced it in foc.
+  The back EMF is taken at the middle of the period; theta ends up at the
+  end of it, where the observer's phase should be.
+*/
+static void motor_step(motor_t *m, focControl_t *foc, double iq, double modelR)
+{
+	double mid = m->theta + 0.5 * m->omega * DT;
+	double end = m->theta + m->omega * DT;
+	double iAlpha = -iq * sin(end);
+	double iBeta = iq * cos(end);
+
+	foc->Valpha = (float)(modelR * 0.5 * (iAlpha + m->iAlpha) + MOTOR_L * (iAlpha - m->iAlpha) / DT -
+			MOTOR_LAMBDA * m->omega * sin(mid));
+	foc->Vbeta = (float)(modelR * 0.5 * (iBeta + m->iBeta) + MOTOR_L * (iBeta - m->iBeta) / DT +
+			MOTOR_LAMBDA * m->omega * cos(mid));
+	foc->Ialpha = (float)iAlpha;
+	foc->Ibeta = (float)iBeta;
+
+	m->iAlpha = iAlpha;
+	m->iBeta = iBeta;
+	m->theta = remainder(end, 2.0 * M_PI);
+}
+
+/**
+  \brief host ns/step for FOC_ObserverUpdate, on a recorded run at steady
+  speed.  Reported only; the host says nothing about the M4, but shows
+  regressions.
+*/
+static void bench(void)
+{
+	static focControl_t samples[BENCH_SAMPLES];
+	motor_t m = { 0.0, 1000.0, 0.0, 0.0 };
+	focObserver_t obs;
+	double t0, ns;
+
+	memset(samples, 0, sizeof(samples));
+	for(int n = 0; n < BENCH_SAMPLES; n++)
+	{
+		motor_step(&m, &samples[n], 5.0, MOTOR_R);
+	}
+
+	FOC_ObserverInit(&obs, DT, MOTOR_R, MOTOR_L, MOTOR_LAMBDA);
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int n = 0; n < BENCH_SAMPLES; n++)
+		{
+			FOC_ObserverUpdate(&obs, &samples[n]);
+		}
+	}
+	ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	printf("foc_observer: FOC_ObserverUpdate %.1f ns/step\n", ns);
+}
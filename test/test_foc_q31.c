@@ -0,0 +1,229 @@
+/********************************************************************
+test_foc_q31.c - host tests for the q31 fixed point FOC path.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "foc.h"
+#include "foc_q31.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define NUM_SAMPLES     100000
+#define BENCH_SAMPLES   4096
+#define BENCH_ROUNDS    50
+
+// Worst case error against the float chain, in full scale units.  The two
+// sin/cos tables and float rounding in the reference give about 2.5e-7.
+#define STEP_TOL        1e-6
+
+#define TO_Q31(x)       ((q31_t)((x) * 2147483648.0))
+#define FROM_Q31(x)     ((x) / 2147483648.0)
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_from_adc(void);
+static void test_step_matches_float(void);
+static void test_saturation(void);
+static void bench(void);
+static void random_sample(focControl_t *f, focControlQ31_t *q);
+static float frand(float lo, float hi);
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	srand(1);
+
+	test_from_adc();
+	test_step_matches_float();
+	test_saturation();
+	bench();
+
+	printf("foc_q31: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief every count either side of the offset, which is built with
+  -fsanitize=shift so a negative left shift fails the test
+*/
+static void test_from_adc(void)
+{
+	const uint16_t full = 1u << FOC_Q31_ADC_BITS;
+	const uint16_t offset = full / 2;
+
+	for(uint32_t count = 0; count < full; count++)
+	{
+		focControlQ31_t foc;
+
+		FOC_Q31_FromADC(&foc, count, full - 1 - count, offset, offset);
+
+		CHECK(FROM_Q31(foc.Ia) == ((double)count - offset) / full);
+		CHECK(FROM_Q31(foc.Ib) == ((double)(full - 1 - count) - offset) / full);
+	}
+}
+
+/**
+  \brief FOC_Q31_Step against FOC_Step inside the linear modulation range
+*/
+static void test_step_matches_float(void)
+{
+	double worst = 0.0;
+
+	for(int i = 0; i < NUM_SAMPLES; i++)
+	{
+		focControl_t f;
+		focControlQ31_t q;
+
+		random_sample(&f, &q);
+
+		FOC_Step(&f);
+		FOC_Q31_Step(&q);
+
+		double err[] = {
+			f.Id - FROM_Q31(q.Id), f.Iq - FROM_Q31(q.Iq),
+			f.Va - FROM_Q31(q.Va), f.Vb - FROM_Q31(q.Vb), f.Vc - FROM_Q31(q.Vc),
+			f.V1 - FROM_Q31(q.V1), f.V2 - FROM_Q31(q.V2), f.V3 - FROM_Q31(q.V3)
+		};
+
+		for(unsigned k = 0; k < sizeof(err) / sizeof(err[0]); k++)
+		{
+			worst = fmax(worst, fabs(err[k]));
+		}
+	}
+
+	CHECK_NEAR(worst, 0.0, STEP_TOL);
+}
+
+/**
+  \brief out of range results clip to full scale instead of wrapping
+*/
+static void test_saturation(void)
+{
+	focControlQ31_t foc;
+
+	memset(&foc, 0, sizeof(foc));
+
+	foc.Ia = TO_Q31(0.9);
+	foc.Ib = TO_Q31(0.9);
+	FOC_Q31_Clarke(&foc);
+	CHECK(foc.Ibeta == INT32_MAX);
+
+	foc.Ia = TO_Q31(-0.9);
+	foc.Ib = TO_Q31(-0.9);
+	FOC_Q31_Clarke(&foc);
+	CHECK(foc.Ibeta == INT32_MIN);
+
+	foc.Valpha = TO_Q31(-0.9);
+	foc.Vbeta = TO_Q31(0.9);
+	FOC_Q31_InvClarke(&foc);
+	CHECK(foc.Vb == INT32_MAX);
+	CHECK_NEAR(FROM_Q31(foc.Vc), 0.45 - 0.9 * sqrt(3.0) / 2.0, 1e-8);
+
+	foc.Va = TO_Q31(0.9);
+	foc.Vb = TO_Q31(-0.9);
+	foc.Vc = 0;
+	foc.Vbus = INT32_MAX;
+	FOC_Q31_SVM(&foc);
+	CHECK(foc.V1 == INT32_MAX);
+	CHECK_NEAR(FROM_Q31(foc.V2), -0.4, 1e-8);
+	CHECK_NEAR(FROM_Q31(foc.V3), 0.5, 1e-8);
+}
+
+/**
+  \brief host ns/sample for FOC_Q31_Step against FOC_Step on the same
+  samples.  Reported only: the host has a float unit and no saturating
+  arithmetic, the opposite of where the q31 path pays off, and this test is
+  built with -fsanitize=shift, which adds a check to every shift.
+*/
+static void bench(void)
+{
+	static focControl_t f[BENCH_SAMPLES], f_in[BENCH_SAMPLES];
+	static focControlQ31_t q[BENCH_SAMPLES], q_in[BENCH_SAMPLES];
+	double t0, step_ns = 0.0, q31_ns = 0.0;
+
+	for(uint32_t i = 0; i < BENCH_SAMPLES; i++)
+	{
+		random_sample(&f_in[i], &q_in[i]);
+	}
+
+	// each round starts from the same inputs, loaded untimed
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		memcpy(f, f_in, sizeof(f));
+		t0 = test_now_ns();
+		for(uint32_t i = 0; i < BENCH_SAMPLES; i++)
+		{
+			FOC_Step(&f[i]);
+		}
+		step_ns += test_now_ns() - t0;
+
+		memcpy(q, q_in, sizeof(q));
+		t0 = test_now_ns();
+		for(uint32_t i = 0; i < BENCH_SAMPLES; i++)
+		{
+			FOC_Q31_Step(&q[i]);
+		}
+		q31_ns += test_now_ns() - t0;
+	}
+
+	printf("foc_q31: FOC_Step %.1f ns/sample, FOC_Q31_Step %.1f ns/sample\n",
+			step_ns / BENCH_ROUNDS / BENCH_SAMPLES, q31_ns / BENCH_ROUNDS / BENCH_SAMPLES);
+}
+
+/**
+  \brief a random sample inside the linear modulation range, as float and
+  as the matching q31
+*/
+static void random_sample(focControl_t *f, focControlQ31_t *q)
+{
+	memset(f, 0, sizeof(*f));
+	memset(q, 0, sizeof(*q));
+
+	f->Ia = frand(-0.4f, 0.4f);
+	f->Ib = frand(-0.4f, 0.4f);
+	f->theta = frand(-179.0f, 179.0f);
+	f->Vd = frand(-0.3f, 0.3f);     // |V| < 0.9/sqrt(3), no overmodulation
+	f->Vq = frand(-0.3f, 0.3f);
+	f->Vbus = 0.9f;
+	f->svmMode = FOC_SVM_SVPWM;
+
+	q->Ia = TO_Q31(f->Ia);
+	q->Ib = TO_Q31(f->Ib);
+	q->theta = TO_Q31(f->theta / 180.0f);
+	q->Vd = TO_Q31(f->Vd);
+	q->Vq = TO_Q31(f->Vq);
+	q->Vbus = TO_Q31(f->Vbus);
+}
+
+static float frand(float lo, float hi)
+{
+	return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+}
@@ -0,0 +1,393 @@
+/********************************************************************
+test_i2c.c - host tests for the interrupt driven I2C transaction engine.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "sim_i2c.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define TIMEOUT         100         // ticks
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_write(void);
+static void test_read(void);
+static void test_nack(void);
+static void test_timeout(void);
+static void test_timeout_queued(void);
+static void test_timeout_polled(void);
+static void test_queue(void);
+static void test_deferred_stop(void);
+static void reset(void);
+static void xfer_init(I2CXfer_t *xfer, uint8_t cmd, const uint8_t *wbuf, uint16_t wlen,
+                      uint8_t *rbuf, uint16_t rlen);
+static void on_done(I2CXfer_t *xfer);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static char done_order[16];
+static uint8_t done_len;
+static I2CXferStatus_t done_status[16];
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	sim_init();
+
+	test_write();
+	test_read();
+	test_nack();
+	test_timeout();
+	test_timeout_queued();
+	test_timeout_polled();
+	test_queue();
+	test_deferred_stop();
+
+	printf("i2c: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief a command byte and a payload go out in one write, then STOP
+*/
+static void test_write(void)
+{
+	const uint8_t data[3] = { 0x01, 0x02, 0x03 };
+	I2CXfer_t xfer;
+
+	reset();
+	xfer_init(&xfer, 0x10, data, 3, NULL, 0);
+
+	CHECK(i2c_xfer(&sim_regs, &xfer) == I2C_XFER_OK);
+	CHECK(strcmp(sim_bus.log, "S A0 10 01 02 03 P") == 0);
+	CHECK(memcmp(&sim_bus.mem[0x10], data, 3) == 0);
+	CHECK((sim_regs.CR2 & SIM_CR2_IT) == 0);
+	CHECK(sim_engine_idle());
+}
+
+/**
+  \brief register reads: a repeated START between the pointer write and the
+  read, every length the receiver handles differently, only the last byte
+  NACKed, and POS left clear afterwards
+*/
+static void test_read(void)
+{
+	static const uint16_t lengths[] = { 1, 2, 3, 4, 5, 9 };
+	static const char *expect[] = {
+		"S A0 20 S A1 7aN P",
+		"S A0 20 S A1 7a 7bN P",
+		"S A0 20 S A1 7a 7b 78N P",
+		"S A0 20 S A1 7a 7b 78 79N P",
+		"S A0 20 S A1 7a 7b 78 79 7eN P",
+		"S A0 20 S A1 7a 7b 78 79 7e 7f 7c 7d 72N P",
+	};
+	uint8_t rbuf[16];
+	I2CXfer_t xfer;
+
+	for(unsigned n = 0; n < sizeof(lengths) / sizeof(lengths[0]); n++)
+	{
+		reset();
+		memset(rbuf, 0, sizeof(rbuf));
+		xfer_init(&xfer, 0x20, NULL, 0, rbuf, lengths[n]);
+
+		CHECK(i2c_xfer(&sim_regs, &xfer) == I2C_XFER_OK);
+		CHECK(strcmp(sim_bus.log, expect[n]) == 0);
+		CHECK(memcmp(rbuf, &sim_bus.mem[0x20], lengths[n]) == 0);
+		CHECK(rbuf[lengths[n]] == 0);
+		CHECK((sim_regs.CR1 & I2C_CR1_POS) == 0);
+	}
+
+	// a plain read has no write phase at all
+	reset();
+	sim_bus.pointer = 0x30;
+	CHECK(i2c_read_bytes(&sim_regs, SIM_SLAVE, rbuf, 3) == 3);
+	CHECK(strcmp(sim_bus.log, "S A1 6a 6b 68N P") == 0);
+	CHECK(memcmp(rbuf, &sim_bus.mem[0x30], 3) == 0);
+}
+
+/**
+  \brief an unacknowledged address or data byte ends the transaction with
+  a STOP and NACK status, and the engine goes on to the next one
+*/
+static void test_nack(void)
+{
+	const uint8_t data[3] = { 0x01, 0x02, 0x03 };
+	uint8_t rbuf[2];
+	I2CXfer_t xfer;
+
+	reset();
+	sim_bus.nack_address = true;
+	xfer_init(&xfer, 0x10, data, 3, NULL, 0);
+	CHECK(i2c_xfer(&sim_regs, &xfer) == I2C_XFER_NACK);
+	CHECK(strcmp(sim_bus.log, "S A0N P") == 0);
+	CHECK((sim_regs.SR1 & SIM_SR1_ERRORS) == 0);
+
+	reset();
+	sim_bus.nack_data = 2;                   // cmd, then the first payload byte
+	xfer_init(&xfer, 0x10, data, 3, NULL, 0);
+	CHECK(i2c_xfer(&sim_regs, &xfer) == I2C_XFER_NACK);
+	CHECK(strcmp(sim_bus.log, "S A0 10 01 02N P") == 0);
+
+	// the failure leaves nothing behind for the next transaction
+	reset();
+	xfer_init(&xfer, 0x40, NULL, 0, rbuf, 2);
+	CHECK(i2c_xfer(&sim_regs, &xfer) == I2C_XFER_OK);
+	CHECK(strcmp(sim_bus.log, "S A0 40 S A1 1a 1bN P") == 0);
+}
+
+/**
+  \brief a transaction the peripheral never answers is expired by
+  i2c_xfer_service, the peripheral is reset, and the queue carries on
+*/
+static void test_timeout(void)
+{
+	const uint8_t data[1] = { 0x55 };
+	I2CXfer_t stuck, next;
+
+	reset();
+	sim_bus.stall = true;
+
+	xfer_init(&stuck, 0x10, data, 1, NULL, 0);
+	stuck.callback = on_done;
+	CHECK(i2c_xfer_submit(&sim_regs, &stuck));
+
+	sim_ticks += TIMEOUT / 2;
+	xfer_init(&next, 0x11, data, 1, NULL, 0);
+	next.callback = on_done;
+	CHECK(i2c_xfer_submit(&sim_regs, &next));
+
+	sim_run();
+	sim_ticks += TIMEOUT / 2 - 1;
+	CHECK(i2c_xfer_service(&sim_regs) == 1);
+	CHECK(stuck.status == I2C_XFER_PENDING && done_len == 0);
+
+	// the timeout callback runs from the service call, in task context;
+	// the next transaction's timeout starts now it is on the wire
+	sim_ticks++;
+	sim_bus.stall = false;
+	CHECK(i2c_xfer_service(&sim_regs) == TIMEOUT);
+	CHECK(stuck.status == I2C_XFER_TIMEOUT);
+	CHECK(done_len == 1 && done_status[0] == I2C_XFER_TIMEOUT);
+	CHECK(sim_bus.resets == 1);
+	CHECK(next.status == I2C_XFER_PENDING);
+
+	sim_run();
+	CHECK(next.status == I2C_XFER_OK);
+	CHECK(strcmp(done_order, "ab") == 0);
+	CHECK(sim_bus.mem[0x11] == 0x55);
+}
+
+/**
+  \brief a transaction's timeout runs from when it reaches the wire: three
+  slow transactions queued together all complete, though the last finishes
+  well over one timeout after it was submitted
+*/
+static void test_timeout_queued(void)
+{
+	const uint8_t data[1] = { 0x42 };
+	I2CXfer_t xfer[3];
+	TickType_t start = sim_ticks;
+
+	reset();
+	sim_bus.start_delay = 2 * TIMEOUT / 5;
+
+	for(int i = 0; i < 3; i++)
+	{
+		xfer_init(&xfer[i], 0x50 + i, data, 1, NULL, 0);
+		xfer[i].callback = on_done;
+		CHECK(i2c_xfer_submit(&sim_regs, &xfer[i]));
+	}
+
+	// only the head is timed; the rest wait their turn
+	CHECK(i2c_xfer_service(&sim_regs) == TIMEOUT);
+
+	while(xfer[2].status == I2C_XFER_PENDING)
+	{
+		ulTaskNotifyTake(pdTRUE, i2c_xfer_service(&sim_regs));
+	}
+
+	CHECK(strcmp(done_order, "abc") == 0);
+	for(int i = 0; i < 3; i++)
+	{
+		CHECK(done_status[i] == I2C_XFER_OK);
+	}
+	CHECK(sim_ticks - start >= 6 * TIMEOUT / 5);
+	CHECK(sim_bus.transactions == 3 && sim_bus.resets == 0);
+}
+
+/**
+  \brief while a polled user holds the bus nothing is on the wire, so
+  queued transactions time out from submission; once the bus is released
+  the survivors run
+*/
+static void test_timeout_polled(void)
+{
+	const uint8_t data[1] = { 0x24 };
+	I2CXfer_t first, second;
+
+	reset();
+	sim_hold_bus(true);
+
+	xfer_init(&first, 0x30, data, 1, NULL, 0);
+	xfer_init(&second, 0x31, data, 1, NULL, 0);
+	first.callback = on_done;
+	second.callback = on_done;
+	CHECK(i2c_xfer_submit(&sim_regs, &first));
+	sim_ticks += 3 * TIMEOUT / 5;
+	CHECK(i2c_xfer_submit(&sim_regs, &second));
+	CHECK(i2c_xfer_service(&sim_regs) == 2 * TIMEOUT / 5);
+
+	sim_ticks += 2 * TIMEOUT / 5;
+	CHECK(i2c_xfer_service(&sim_regs) == 3 * TIMEOUT / 5);
+	CHECK(first.status == I2C_XFER_TIMEOUT && second.status == I2C_XFER_PENDING);
+	CHECK(sim_bus.log[0] == '\0');
+
+	sim_hold_bus(false);
+	sim_run();
+	CHECK(second.status == I2C_XFER_OK);
+	CHECK(strcmp(done_order, "ab") == 0);
+	CHECK(strcmp(sim_bus.log, "S A0 31 24 P") == 0);
+}
+
+/**
+  \brief transactions queued together run back to back in submission order,
+  each one waiting for the previous STOP before its START
+*/
+static void test_queue(void)
+{
+	const uint8_t data[2] = { 0xC0, 0xDE };
+	uint8_t rbuf[3];
+	I2CXfer_t xfer[3];
+
+	reset();
+	xfer_init(&xfer[0], 0x60, data, 2, NULL, 0);
+	xfer_init(&xfer[1], 0x62, data, 1, NULL, 0);
+	xfer_init(&xfer[2], 0x60, NULL, 0, rbuf, 3);
+
+	for(int i = 0; i < 3; i++)
+	{
+		xfer[i].callback = on_done;
+		CHECK(i2c_xfer_submit(&sim_regs, &xfer[i]));
+	}
+
+	// nothing completes until the interrupts run
+	CHECK(done_len == 0 && sim_engine_head() == &xfer[0]);
+
+	sim_run();
+	CHECK(strcmp(done_order, "abc") == 0);
+	CHECK(strcmp(sim_bus.log, "S A0 60 c0 de P S A0 62 c0 P S A0 60 S A1 c0 de c0N P") == 0);
+	CHECK(rbuf[0] == 0xC0 && rbuf[1] == 0xDE && rbuf[2] == sim_bus.mem[0x62]);
+	CHECK(sim_engine_idle());
+
+	// both follow-on starts had to wait for a STOP
+	CHECK(sim_timer_pends == 2);
+}
+
+/**
+  \brief a start that finds the previous STOP still going out does not
+  touch CR1; it is retried from the timer task until the STOP has cleared
+*/
+static void test_deferred_stop(void)
+{
+	const uint8_t data[1] = { 0x99 };
+	I2CXfer_t first, second;
+
+	reset();
+	sim_bus.stop_hold = true;
+
+	xfer_init(&first, 0x70, data, 1, NULL, 0);
+	xfer_init(&second, 0x71, data, 1, NULL, 0);
+	first.callback = on_done;
+	second.callback = on_done;
+	CHECK(i2c_xfer_submit(&sim_regs, &first));
+	CHECK(i2c_xfer_submit(&sim_regs, &second));
+
+	sim_bus_run();
+	CHECK(first.status == I2C_XFER_OK);
+	CHECK(second.status == I2C_XFER_PENDING);
+	CHECK(sim_regs.CR1 & I2C_CR1_STOP);
+	CHECK((sim_regs.CR1 & I2C_CR1_START) == 0);
+	CHECK((sim_regs.CR2 & SIM_CR2_IT) == 0);
+	CHECK(sim_timer_count == 1 && sim_engine_deferred());
+
+	// still going out: the retry pends another retry and nothing else
+	CHECK(sim_timers_run());
+	sim_bus_run();
+	CHECK(second.status == I2C_XFER_PENDING);
+	CHECK((sim_regs.CR1 & I2C_CR1_START) == 0);
+	CHECK(sim_timer_count == 1 && sim_timer_pends == 2);
+
+	sim_bus.stop_hold = false;
+	sim_run();
+	CHECK(second.status == I2C_XFER_OK);
+	CHECK(strcmp(sim_bus.log, "S A0 70 99 P S A0 71 99 P") == 0);
+	CHECK(strcmp(done_order, "ab") == 0);
+	CHECK(!sim_engine_deferred());
+}
+
+/**
+  \brief a fresh bus and no completions recorded
+*/
+static void reset(void)
+{
+	sim_bus_reset();
+	done_len = 0;
+	done_order[0] = '\0';
+}
+
+static void xfer_init(I2CXfer_t *xfer, uint8_t cmd, const uint8_t *wbuf, uint16_t wlen,
+                      uint8_t *rbuf, uint16_t rlen)
+{
+	memset(xfer, 0, sizeof(*xfer));
+	xfer->address = SIM_SLAVE;
+	xfer->cmd[0] = cmd;
+	xfer->cmd_len = 1;
+	xfer->wbuf = wbuf;
+	xfer->wlen = wlen;
+	xfer->rbuf = rbuf;
+	xfer->rlen = rlen;
+	xfer->timeout = TIMEOUT;
+}
+
+/**
+  \brief completion callback: records the order ('a' for the first to
+  finish) and the status
+*/
+static void on_done(I2CXfer_t *xfer)
+{
+	CHECK(done_len < sizeof(done_order) - 1);
+	done_status[done_len] = xfer->status;
+	done_order[done_len] = 'a' + done_len;
+	done_order[++done_len] = '\0';
+}
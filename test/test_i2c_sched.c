@@ -0,0 +1,339 @@
+/********************************************************************
+test_i2c_sched.c - host tests for the periodic I2C job scheduler.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "sim_i2c.h"
+#include <string.h>
+
+// The task's work is private, so the scheduler is built into the test and
+// i2c_sched_poll stands in for the task.
+#include "i2c_sched.c"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define BUS_HZ          100000
+#define TIMEOUT         100         // ticks
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_batch(void);
+static void test_handlers(void);
+static void test_catch_up(void);
+static void test_utilization(void);
+static void test_timeout_batch(void);
+static void start(void);
+static void run_until(TickType_t end);
+static void job_init(I2CJob_t *job, uint8_t reg, uint16_t wlen, uint16_t rlen, char name);
+static void on_done(I2CJob_t *job, I2CXferStatus_t status);
+static void on_done_remove_next(I2CJob_t *job, I2CXferStatus_t status);
+static void on_done_readd(I2CJob_t *job, I2CXferStatus_t status);
+static void on_done_remove_self(I2CJob_t *job, I2CXferStatus_t status);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static I2CSched_t sched;
+static I2CJob_t *victim;            // what on_done_remove_next removes
+static const uint8_t payload[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+static uint8_t rbuf[8];
+
+static char done_log[64];           // job names, in the order handled
+static uint8_t done_len;
+static int failures;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	sim_init();
+
+	test_batch();
+	test_handlers();
+	test_catch_up();
+	test_utilization();
+	test_timeout_batch();
+
+	printf("i2c_sched: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief jobs due together go out as one burst in the order they were added;
+  a one-shot is dropped afterwards and periodic jobs come back on time
+*/
+static void test_batch(void)
+{
+	I2CJob_t a, b, once;
+	TickType_t t0;
+
+	start();
+	t0 = sim_ticks;
+	job_init(&a, 0x10, 2, 0, 'a');
+	job_init(&b, 0x20, 0, 2, 'b');
+	job_init(&once, 0x30, 1, 0, 'o');
+	i2c_sched_add(&sched, &a, 10);
+	i2c_sched_add(&sched, &b, 20);
+	i2c_sched_add(&sched, &once, 0);
+
+	CHECK(i2c_sched_poll(&sched) == 0);
+	CHECK(strcmp(done_log, "abo") == 0);
+	CHECK(sched.stats.bursts == 1 && sched.stats.transactions == 3);
+	CHECK(sim_bus.transactions == 3);
+	CHECK(memcmp(rbuf, &sim_bus.mem[0x20], 2) == 0);
+
+	// nothing more is due; the one-shot is unlinked on the way
+	CHECK(i2c_sched_poll(&sched) == 10);
+	CHECK(sched.jobs == &a && a.next == &b && b.next == NULL);
+
+	run_until(t0 + 20);
+	CHECK(i2c_sched_poll(&sched) == 0);
+	CHECK(strcmp(done_log, "ab") == 0);
+	CHECK(a.stats.runs == 3 && b.stats.runs == 2 && once.stats.runs == 1);
+	CHECK(a.stats.latency_max == 0 && a.stats.failures == 0);
+
+	i2c_sched_remove(&sched, &a);
+	i2c_sched_remove(&sched, &b);
+	CHECK(i2c_sched_poll(&sched) == portMAX_DELAY);
+}
+
+/**
+  \brief done handlers may remove a later job in the same batch (its run
+  still happens but its handler is skipped), remove their own job, or re-add
+  a one-shot to run it again
+*/
+static void test_handlers(void)
+{
+	I2CJob_t first, second, self_remove, again;
+	TickType_t t0;
+
+	start();
+	t0 = sim_ticks;
+	job_init(&first, 0x10, 1, 0, 'f');
+	job_init(&second, 0x11, 1, 0, 's');
+	job_init(&self_remove, 0x12, 1, 0, 'r');
+	job_init(&again, 0x13, 1, 0, 'g');
+	first.done = on_done_remove_next;
+	self_remove.done = on_done_remove_self;
+	again.done = on_done_readd;
+	victim = &second;
+
+	i2c_sched_add(&sched, &first, 10);
+	i2c_sched_add(&sched, &second, 10);
+	i2c_sched_add(&sched, &self_remove, 10);
+	i2c_sched_add(&sched, &again, 0);
+
+	CHECK(i2c_sched_poll(&sched) == 0);
+	CHECK(strcmp(done_log, "frg") == 0);
+	CHECK(sim_bus.transactions == 4);
+	CHECK(second.stats.runs == 0);
+	CHECK(sim_bus.mem[0x11] == payload[0]);
+
+	// the re-added one-shot runs once more, on its own, and stays removed
+	// when its handler does not add it again
+	again.done = on_done;
+	CHECK(i2c_sched_poll(&sched) == 0);
+	CHECK(strcmp(done_log, "frgg") == 0);
+	CHECK(i2c_sched_poll(&sched) == 10);
+	CHECK(sched.jobs == &first && first.next == NULL);
+
+	run_until(t0 + 10);
+	CHECK(i2c_sched_poll(&sched) == 0);
+	CHECK(strcmp(done_log, "f") == 0);
+
+	victim = NULL;
+	i2c_sched_remove(&sched, &first);
+}
+
+/**
+  \brief a job held up by less than a period keeps its phase; one that fell
+  a whole period behind runs once and restarts its period, rather than
+  bursting the runs it missed
+*/
+static void test_catch_up(void)
+{
+	I2CJob_t job;
+
+	start();
+	job_init(&job, 0x40, 1, 0, 'j');
+	i2c_sched_add(&sched, &job, 10);
+	CHECK(i2c_sched_poll(&sched) == 0);
+	CHECK(job.due == sim_ticks + 10);
+
+	sim_ticks += 35;
+	CHECK(i2c_sched_poll(&sched) == 0);
+	CHECK(job.stats.runs == 2 && job.stats.latency_max == 25);
+	CHECK(job.due == sim_ticks + 10);
+	CHECK(i2c_sched_poll(&sched) == 10);
+
+	sim_ticks += 12;
+	CHECK(i2c_sched_poll(&sched) == 0);
+	CHECK(job.stats.runs == 3);
+	CHECK(job.due == sim_ticks + 8);
+	CHECK(job.stats.latency_sum == 25 + 2);
+
+	i2c_sched_remove(&sched, &job);
+}
+
+/**
+  \brief the utilization figure is the bits each transaction puts on the
+  wire, against what the bus could carry in the time
+*/
+static void test_utilization(void)
+{
+	I2CJob_t write, read;
+	TickType_t t0;
+
+	start();
+	t0 = sim_ticks;
+	job_init(&write, 0x50, 2, 0, 'w');      // S, address, 3 bytes, P
+	job_init(&read, 0x60, 0, 2, 'r');       // and Sr, address, 2 bytes
+	i2c_sched_add(&sched, &write, 10);
+	i2c_sched_add(&sched, &read, 20);
+
+	run_until(t0 + 1000);
+	CHECK(write.stats.runs == 100 && read.stats.runs == 50);
+	CHECK(sched.stats.bursts == 100);
+	CHECK(sched.stats.bus_bits == 100 * (2 + 9 * 4) + 50 * (2 + 9 * 2 + 1 + 9 * 3));
+
+	// 6200 bits a second, at 100 kbit/s
+	CHECK_NEAR(i2c_sched_utilization(&sched), 6.2, 1e-4);
+
+	i2c_sched_reset_stats(&sched);
+	CHECK(i2c_sched_utilization(&sched) == 0.0f);
+
+	i2c_sched_remove(&sched, &write);
+	i2c_sched_remove(&sched, &read);
+}
+
+/**
+  \brief a batch of slow transactions all complete: each job's timeout runs
+  from when it reaches the wire, not from when the batch was handed over
+*/
+static void test_timeout_batch(void)
+{
+	I2CJob_t job[4];
+	TickType_t begin;
+
+	start();
+	sim_bus.start_delay = 2 * TIMEOUT / 5;
+
+	for(int i = 0; i < 4; i++)
+	{
+		job_init(&job[i], 0x70 + i, 1, 0, '0' + i);
+		i2c_sched_add(&sched, &job[i], 0);
+	}
+
+	begin = sim_ticks;
+	CHECK(i2c_sched_poll(&sched) == 0);
+	CHECK(strcmp(done_log, "0123") == 0);
+	CHECK(failures == 0 && sched.stats.failures == 0);
+	CHECK(sim_ticks - begin >= 8 * TIMEOUT / 5);
+	CHECK(job[3].stats.latency_max >= 8 * TIMEOUT / 5);
+	CHECK(i2c_sched_poll(&sched) == portMAX_DELAY);
+}
+
+/**
+  \brief a fresh scheduler on a fresh bus
+*/
+static void start(void)
+{
+	sim_bus_reset();
+	CHECK(i2c_sched_start(&sched, &sim_regs, BUS_HZ, 1));
+	memset(rbuf, 0, sizeof(rbuf));
+	done_log[0] = '\0';
+	done_len = 0;
+	failures = 0;
+}
+
+/**
+  \brief what the scheduler task would do up to the given tick; the bus is
+  idle while the task sleeps, so time can jump.  The wire and handler logs
+  are only kept for the last burst.
+*/
+static void run_until(TickType_t end)
+{
+	while(sim_ticks < end)
+	{
+		sim_bus.log[0] = '\0';
+		done_log[0] = '\0';
+		done_len = 0;
+
+		TickType_t wait = i2c_sched_poll(&sched);
+
+		if(wait > end - sim_ticks) wait = end - sim_ticks;
+		sim_ticks += wait;
+	}
+}
+
+/**
+  \brief a job that writes wlen bytes to, or reads rlen bytes from, the
+  slave register reg; name is what on_done logs for it
+*/
+static void job_init(I2CJob_t *job, uint8_t reg, uint16_t wlen, uint16_t rlen, char name)
+{
+	memset(job, 0, sizeof(*job));
+	job->xfer.address = SIM_SLAVE;
+	job->xfer.cmd[0] = reg;
+	job->xfer.cmd_len = 1;
+	job->xfer.wbuf = payload;
+	job->xfer.wlen = wlen;
+	job->xfer.rbuf = rbuf;
+	job->xfer.rlen = rlen;
+	job->xfer.timeout = TIMEOUT;
+	job->done = on_done;
+	job->arg = (void *)(intptr_t)name;
+}
+
+static void on_done(I2CJob_t *job, I2CXferStatus_t status)
+{
+	CHECK(done_len < sizeof(done_log) - 1);
+	done_log[done_len++] = (char)(intptr_t)job->arg;
+	done_log[done_len] = '\0';
+	if(status != I2C_XFER_OK) failures++;
+}
+
+static void on_done_remove_next(I2CJob_t *job, I2CXferStatus_t status)
+{
+	on_done(job, status);
+	if(victim != NULL) i2c_sched_remove(&sched, victim);
+}
+
+static void on_done_readd(I2CJob_t *job, I2CXferStatus_t status)
+{
+	on_done(job, status);
+	i2c_sched_add(&sched, job, 0);
+}
+
+static void on_done_remove_self(I2CJob_t *job, I2CXferStatus_t status)
+{
+	on_done(job, status);
+	i2c_sched_remove(&sched, job);
+}
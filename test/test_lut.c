@@ -0,0 +1,220 @@
+/********************************************************************
+test_lut.c - host tests for the lookup table axes and interpolation.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "lut.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define NX              5
+#define NY              4
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_uniform(void);
+static void test_nonuniform(void);
+static void test_two_points(void);
+static void test_bilinear(void);
+static void check_locate(const lutAxis_t *axis, float x, uint16_t i, float frac);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+// Uneven on purpose: a cell of 0.5 next to one of 10.
+static const float xs[NX] = { -2.0f, -1.5f, 0.0f, 10.0f, 12.5f };
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_uniform();
+	test_nonuniform();
+	test_two_points();
+	test_bilinear();
+
+	printf("lut: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief breakpoints -1, -0.75, ... 0: every breakpoint lands at the start
+  of its cell, the last one at the end of the last cell, and anything
+  beyond either end is held there
+*/
+static void test_uniform(void)
+{
+	lutAxis_t axis;
+
+	LUT_AxisInitUniform(&axis, -1.0f, 0.25f, NX);
+
+	for(uint16_t k = 0; k + 1 < NX; k++)
+	{
+		check_locate(&axis, -1.0f + 0.25f * k, k, 0.0f);
+		check_locate(&axis, -1.0f + 0.25f * k + 0.1f, k, 0.4f);
+	}
+
+	// the last cell reaches its end; nothing past it
+	check_locate(&axis, -0.01f, NX - 2, 0.96f);
+	check_locate(&axis, 0.0f, NX - 2, 1.0f);
+	check_locate(&axis, 3.0f, NX - 2, 1.0f);
+	check_locate(&axis, INFINITY, NX - 2, 1.0f);
+
+	check_locate(&axis, -1.0f, 0, 0.0f);
+	check_locate(&axis, -1.2f, 0, 0.0f);
+	check_locate(&axis, -INFINITY, 0, 0.0f);
+
+	// interpolation follows the cells
+	const float y[NX] = { 0.0f, 1.0f, 4.0f, 9.0f, 16.0f };
+
+	CHECK_NEAR(LUT_Interp1D(&axis, y, -0.625f), 2.5, 1e-6);
+	CHECK(LUT_Interp1D(&axis, y, 1.0f) == 16.0f);
+	CHECK(LUT_Interp1D(&axis, y, -5.0f) == 0.0f);
+}
+
+/**
+  \brief the binary search finds the right cell of uneven widths, at each
+  breakpoint and inside each cell, and clamps like the uniform axis
+*/
+static void test_nonuniform(void)
+{
+	lutAxis_t axis;
+	float inv[NX - 1];
+
+	LUT_AxisInit(&axis, xs, inv, NX);
+
+	for(uint16_t k = 0; k + 1 < NX; k++)
+	{
+		check_locate(&axis, xs[k], k, 0.0f);
+		check_locate(&axis, xs[k] + 0.3f * (xs[k + 1] - xs[k]), k, 0.3f);
+		check_locate(&axis, xs[k] + 0.999f * (xs[k + 1] - xs[k]), k, 0.999f);
+	}
+
+	check_locate(&axis, xs[NX - 1], NX - 2, 1.0f);
+	check_locate(&axis, 100.0f, NX - 2, 1.0f);
+	check_locate(&axis, -3.0f, 0, 0.0f);
+
+	// every input lands in a cell whose ends bracket it
+	for(float x = -2.5f; x < 13.0f; x += 0.01f)
+	{
+		uint16_t i;
+		float f;
+
+		LUT_Locate(&axis, x, &i, &f);
+		CHECK(i <= NX - 2 && f >= 0.0f && f <= 1.0f);
+		if(x >= xs[0] && x <= xs[NX - 1])
+		{
+			CHECK(xs[i] <= x && x <= xs[i + 1]);
+			CHECK_NEAR(xs[i] + f * (xs[i + 1] - xs[i]), x, 1e-5);
+		}
+	}
+}
+
+/**
+  \brief the smallest axis has a single cell, for both kinds
+*/
+static void test_two_points(void)
+{
+	lutAxis_t uniform, nonuniform;
+	const float x[2] = { 1.0f, 3.0f };
+	float inv[1];
+
+	LUT_AxisInitUniform(&uniform, 1.0f, 2.0f, 2);
+	LUT_AxisInit(&nonuniform, x, inv, 2);
+
+	check_locate(&uniform, 0.0f, 0, 0.0f);
+	check_locate(&uniform, 2.5f, 0, 0.75f);
+	check_locate(&uniform, 3.0f, 0, 1.0f);
+	check_locate(&nonuniform, 0.0f, 0, 0.0f);
+	check_locate(&nonuniform, 2.5f, 0, 0.75f);
+	check_locate(&nonuniform, 3.0f, 0, 1.0f);
+}
+
+/**
+  \brief a 2-D table returns its entries exactly at the grid points,
+  corners included, blends linearly along each axis between them, and
+  holds the edges beyond the grid
+*/
+static void test_bilinear(void)
+{
+	lutAxis_t ax, ay;
+	float inv[NX - 1];
+	float z[NY * NX];
+
+	LUT_AxisInit(&ax, xs, inv, NX);
+	LUT_AxisInitUniform(&ay, 0.0f, 10.0f, NY);
+
+	// z = 1 + x + y / 10 + x * y / 100 is bilinear, so interpolation is exact
+	for(uint16_t j = 0; j < NY; j++)
+	{
+		for(uint16_t i = 0; i < NX; i++)
+		{
+			float y = 10.0f * j;
+
+			z[j * NX + i] = 1.0f + xs[i] + y / 10.0f + xs[i] * y / 100.0f;
+		}
+	}
+
+	for(uint16_t j = 0; j < NY; j++)
+	{
+		for(uint16_t i = 0; i < NX; i++)
+		{
+			CHECK_NEAR(LUT_Interp2D(&ax, &ay, z, xs[i], 10.0f * j), z[j * NX + i], 1e-5);
+		}
+	}
+
+	for(float y = -5.0f; y <= 35.0f; y += 1.25f)
+	{
+		for(float x = -3.0f; x <= 14.0f; x += 0.37f)
+		{
+			float cx = fminf(fmaxf(x, xs[0]), xs[NX - 1]);
+			float cy = fminf(fmaxf(y, 0.0f), 10.0f * (NY - 1));
+
+			CHECK_NEAR(LUT_Interp2D(&ax, &ay, z, x, y),
+					1.0f + cx + cy / 10.0f + cx * cy / 100.0f, 1e-4);
+		}
+	}
+
+	// the far corner, reached from beyond it
+	CHECK(LUT_Interp2D(&ax, &ay, z, 50.0f, 50.0f) == z[NY * NX - 1]);
+	CHECK(LUT_Interp2D(&ax, &ay, z, -50.0f, -50.0f) == z[0]);
+	CHECK(LUT_Interp2D(&ax, &ay, z, 50.0f, -50.0f) == z[NX - 1]);
+	CHECK(LUT_Interp2D(&ax, &ay, z, -50.0f, 50.0f) == z[(NY - 1) * NX]);
+}
+
+static void check_locate(const lutAxis_t *axis, float x, uint16_t i, float frac)
+{
+	uint16_t got_i;
+	float got_frac;
+
+	LUT_Locate(axis, x, &got_i, &got_frac);
+	CHECK(got_i == i);
+	CHECK_NEAR(got_frac, frac, 1e-5);
+}
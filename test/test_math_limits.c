@@ -0,0 +1,289 @@
+/********************************************************************
+test_math_limits.c - host tests for the inline clamp and math primitives.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "math_limits.h"
+#include <float.h>
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+// Relative error bounds, as documented in math_limits.h.
+#define RSQRT_TOL       5e-6
+#define RECIP_TOL       7e-6
+
+#define SWEEP_STEP      61          // bit patterns between samples
+
+#define BENCH_SAMPLES   4096
+#define BENCH_ROUNDS    200
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_limit(void);
+static void test_limit_array(void);
+static void test_rsqrt(void);
+static void test_recip(void);
+static void test_q31(void);
+static void bench(void);
+static float from_bits(uint32_t u);
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_limit();
+	test_limit_array();
+	test_rsqrt();
+	test_recip();
+	test_q31();
+	bench();
+
+	printf("math_limits: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief clamps at both ends and passes the range through; a NaN comes out
+  as the lower limit, and infinities clamp like any other value
+*/
+static void test_limit(void)
+{
+	CHECK(limitf32(0.25f, 1.0f, -1.0f) == 0.25f);
+	CHECK(limitf32(1.0f, 1.0f, -1.0f) == 1.0f);
+	CHECK(limitf32(1.5f, 1.0f, -1.0f) == 1.0f);
+	CHECK(limitf32(-1.5f, 1.0f, -1.0f) == -1.0f);
+	CHECK(limitf32(INFINITY, 1.0f, -1.0f) == 1.0f);
+	CHECK(limitf32(-INFINITY, 1.0f, -1.0f) == -1.0f);
+
+	CHECK(limitf32(NAN, 1.0f, -1.0f) == -1.0f);
+	CHECK(limitf32(-NAN, 2.0f, 0.5f) == 0.5f);
+
+	CHECK(max3f32(1.0f, 3.0f, 2.0f) == 3.0f);
+	CHECK(min3f32(1.0f, -3.0f, 2.0f) == -3.0f);
+	CHECK(sqrt_f32(2.25f) == 1.5f);
+	CHECK(isnan(sqrt_f32(-1.0f)));
+}
+
+/**
+  \brief the array clamp is limitf32 on every element, NaN included
+*/
+static void test_limit_array(void)
+{
+	float v[37], expect[37];
+
+	for(int i = 0; i < 37; i++)
+	{
+		v[i] = (i == 11) ? NAN : (i - 18) * 0.1f;
+		expect[i] = limitf32(v[i], 1.0f, -0.5f);
+	}
+
+	limitf32_array(v, 37, 1.0f, -0.5f);
+	CHECK(memcmp(v, expect, sizeof(v)) == 0);
+	CHECK(v[11] == -0.5f && v[0] == -0.5f && v[36] == 1.0f);
+
+	// n = 0 touches nothing
+	v[0] = 5.0f;
+	limitf32_array(v, 0, 1.0f, -0.5f);
+	CHECK(v[0] == 5.0f);
+}
+
+/**
+  \brief within RSQRT_TOL for every normal positive float, sampled across
+  the whole range, and at every power of two
+*/
+static void test_rsqrt(void)
+{
+	double worst = 0.0;
+
+	for(uint32_t u = 0x00800000u; u < 0x7F800000u; u += SWEEP_STEP)
+	{
+		float x = from_bits(u);
+
+		worst = fmax(worst, fabs(rsqrtf32(x) * sqrt((double)x) - 1.0));
+	}
+
+	for(int e = -126; e <= 127; e++)
+	{
+		float x = ldexpf(1.0f, e);
+
+		worst = fmax(worst, fabs(rsqrtf32(x) * sqrt((double)x) - 1.0));
+	}
+
+	CHECK(worst < RSQRT_TOL);
+	CHECK_NEAR(rsqrtf32(FLT_MAX) * sqrt((double)FLT_MAX), 1.0, RSQRT_TOL);
+}
+
+/**
+  \brief within RECIP_TOL for |x| from FLT_MIN to 2^125, either sign
+*/
+static void test_recip(void)
+{
+	double worst = 0.0;
+
+	for(uint32_t u = 0x00800000u; u <= 0x7E000000u; u += SWEEP_STEP)
+	{
+		float x = from_bits(u);
+
+		worst = fmax(worst, fabs(recipf32(x) * (double)x - 1.0));
+		worst = fmax(worst, fabs(recipf32(-x) * (double)-x - 1.0));
+	}
+
+	for(int e = -126; e <= 125; e++)
+	{
+		float x = ldexpf(1.0f, e);
+
+		worst = fmax(worst, fabs(recipf32(x) * (double)x - 1.0));
+	}
+
+	CHECK(worst < RECIP_TOL);
+}
+
+/**
+  \brief q31 arithmetic pins at INT32_MIN/INT32_MAX rather than wrapping
+*/
+static void test_q31(void)
+{
+	CHECK(sat_q31((int64_t)INT32_MAX + 1) == INT32_MAX);
+	CHECK(sat_q31((int64_t)INT32_MIN - 1) == INT32_MIN);
+	CHECK(sat_q31(INT64_MAX) == INT32_MAX);
+	CHECK(sat_q31(INT64_MIN) == INT32_MIN);
+	CHECK(sat_q31(-5) == -5);
+
+	CHECK(add_q31(INT32_MAX, 1) == INT32_MAX);
+	CHECK(add_q31(INT32_MAX, INT32_MAX) == INT32_MAX);
+	CHECK(add_q31(INT32_MIN, -1) == INT32_MIN);
+	CHECK(add_q31(INT32_MIN, INT32_MIN) == INT32_MIN);
+	CHECK(add_q31(INT32_MAX, INT32_MIN) == -1);
+
+	CHECK(sub_q31(INT32_MIN, 1) == INT32_MIN);
+	CHECK(sub_q31(INT32_MAX, -1) == INT32_MAX);
+	CHECK(sub_q31(0, INT32_MIN) == INT32_MAX);
+	CHECK(sub_q31(-1, INT32_MAX) == INT32_MIN);
+
+	// -1 * -1 is the one product out of range
+	CHECK(mul_q31(INT32_MIN, INT32_MIN) == INT32_MAX);
+	CHECK(mul_q31(INT32_MIN, INT32_MAX) == -INT32_MAX);
+	CHECK(mul_q31(INT32_MAX, INT32_MAX) == INT32_MAX - 1);
+	CHECK(mul_q31(1 << 30, 1 << 30) == 1 << 29);            // 0.5 * 0.5
+	CHECK(mul_q31(-(1 << 30), 1 << 30) == -(1 << 29));
+	CHECK(mul_q31(-1, 1) == -1);                            // rounds down
+
+	CHECK(limit_q31(INT32_MAX, 100, -100) == 100);
+	CHECK(limit_q31(INT32_MIN, 100, -100) == -100);
+	CHECK(limit_q31(7, 100, -100) == 7);
+	CHECK(max3_q31(INT32_MIN, 0, INT32_MAX) == INT32_MAX);
+	CHECK(min3_q31(INT32_MIN, 0, INT32_MAX) == INT32_MIN);
+}
+
+/**
+  \brief host ns/element for the divide free estimates against the
+  divides they replace, and for limitf32_array against fmaxf/fminf.
+  Reported only; the M4 trade off is VDIV/VSQRT latency, which the host
+  does not share.
+*/
+static void bench(void)
+{
+	static float x[BENCH_SAMPLES], y[BENCH_SAMPLES];
+	volatile float sink;
+	float acc = 0.0f;
+	double t0, recip_ns, div_ns, rsqrt_ns, sqrt_ns, limit_ns, libm_ns;
+
+	srand(1);
+	for(int i = 0; i < BENCH_SAMPLES; i++)
+	{
+		x[i] = 0.01f + 100.0f * (float)rand() / (float)RAND_MAX;
+	}
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int i = 0; i < BENCH_SAMPLES; i++) y[i] = recipf32(x[i]);
+		acc += y[r % BENCH_SAMPLES];
+	}
+	recip_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int i = 0; i < BENCH_SAMPLES; i++) y[i] = 1.0f / x[i];
+		acc += y[r % BENCH_SAMPLES];
+	}
+	div_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int i = 0; i < BENCH_SAMPLES; i++) y[i] = rsqrtf32(x[i]);
+		acc += y[r % BENCH_SAMPLES];
+	}
+	rsqrt_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int i = 0; i < BENCH_SAMPLES; i++) y[i] = 1.0f / sqrt_f32(x[i]);
+		acc += y[r % BENCH_SAMPLES];
+	}
+	sqrt_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		memcpy(y, x, sizeof(y));
+		limitf32_array(y, BENCH_SAMPLES, 60.0f, 20.0f);
+		acc += y[r % BENCH_SAMPLES];
+	}
+	limit_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		memcpy(y, x, sizeof(y));
+		for(int i = 0; i < BENCH_SAMPLES; i++) y[i] = fminf(fmaxf(y[i], 20.0f), 60.0f);
+		acc += y[r % BENCH_SAMPLES];
+	}
+	libm_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_SAMPLES;
+
+	sink = acc;
+	(void)sink;
+
+	printf("math_limits: recipf32 %.2f ns, 1/x %.2f ns, rsqrtf32 %.2f ns, "
+			"1/sqrt %.2f ns\n", recip_ns, div_ns, rsqrt_ns, sqrt_ns);
+	printf("math_limits: limitf32_array %.2f ns/element, fmaxf/fminf %.2f ns/element\n",
+			limit_ns, libm_ns);
+}
+
+static float from_bits(uint32_t u)
+{
+	float f;
+
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
@@ -0,0 +1,396 @@
+/********************************************************************
+test_nvkv.c - host tests for the log-structured key/value store.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "nvkv.h"
+#include "nvmem.h"
+#include <setjmp.h>
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define MEM_SIZE        512
+#define NUM_KEYS        12
+#define MAX_LEN         40
+#define NUM_OPS         300
+#define REMOUNT_EVERY   17          // ops between remounts after a cut
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+// How written bytes reach the device: straight away, or on flush in
+// ascending or descending address order (the worst case for a cache).
+typedef enum
+{
+	PERSIST_WRITE_THROUGH,
+	PERSIST_FLUSH_UP,
+	PERSIST_FLUSH_DOWN,
+	PERSIST_COUNT
+} persist_t;
+
+typedef struct
+{
+	int len;                        // -1 if the key is absent
+	uint8_t value[MAX_LEN];
+} entry_t;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_torn_compaction(void);
+static void test_power_cut(persist_t persist);
+static void run_op(NvKv_t *kv, unsigned *seed, entry_t *model);
+static bool model_matches(NvKv_t *kv, const entry_t *model);
+static void model_clear(entry_t *model);
+static void mem_reset(void);
+static void mem_power_cut(void);
+static void mem_persist(uint16_t address);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static uint8_t image[MEM_SIZE];     // what survives a power cut
+static uint8_t cache[MEM_SIZE];     // what nvmem_read sees
+static bool dirty[MEM_SIZE];
+
+static persist_t mem_persist_mode;
+static long mem_budget = -1;        // bytes persisted before the cut, -1 = none
+static long mem_persisted;
+static jmp_buf mem_cut;
+
+static entry_t before[NUM_OPS + 1][NUM_KEYS];
+static unsigned seeds[NUM_OPS + 1];
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_torn_compaction();
+
+	for(persist_t p = 0; p < PERSIST_COUNT; p++)
+	{
+		test_power_cut(p);
+	}
+
+	printf("nvkv: ok\n");
+	return 0;
+}
+
+/**
+  \brief stand-in for the nvmem cache; every byte that reaches image counts
+  against mem_budget
+*/
+bool nvmem_write(uint16_t address, void *data, size_t len)
+{
+	CHECK((size_t)address + len <= MEM_SIZE);
+
+	for(size_t i = 0; i < len; i++)
+	{
+		cache[address + i] = ((uint8_t *)data)[i];
+		dirty[address + i] = true;
+
+		if(mem_persist_mode == PERSIST_WRITE_THROUGH)
+		{
+			mem_persist(address + i);
+		}
+	}
+
+	return true;
+}
+
+bool nvmem_read(uint16_t address, void *data, size_t len)
+{
+	CHECK((size_t)address + len <= MEM_SIZE);
+
+	memcpy(data, &cache[address], len);
+	return true;
+}
+
+bool nvmem_flush(void)
+{
+	for(int i = 0; i < MEM_SIZE; i++)
+	{
+		int a = (mem_persist_mode == PERSIST_FLUSH_DOWN) ? MEM_SIZE - 1 - i : i;
+
+		if(dirty[a])
+		{
+			mem_persist(a);
+		}
+	}
+
+	return true;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief a compaction torn after all records were copied, followed by a delete
+  and a completed compaction.  The retry reuses the generation, and whichever
+  key was copied last must not come back from the first attempt's leftovers.
+*/
+static void test_torn_compaction(void)
+{
+	for(uint8_t victim = 1; victim <= 3; victim++)
+	{
+		NvKv_t kv;
+		uint8_t v;
+		uint16_t len;
+
+		mem_persist_mode = PERSIST_WRITE_THROUGH;
+		mem_reset();
+		CHECK(nvkv_mount(&kv, 0, MEM_SIZE));
+
+		for(v = 1; v <= 3; v++)
+		{
+			CHECK(nvkv_set(&kv, v, &v, 1));
+		}
+
+		// cut once the three 7-byte records are copied, before the new header
+		mem_budget = 3 * 7;
+		if(!setjmp(mem_cut))
+		{
+			nvkv_compact(&kv);
+			CHECK(false);
+		}
+		mem_power_cut();
+
+		CHECK(nvkv_mount(&kv, 0, MEM_SIZE));
+		CHECK(nvkv_delete(&kv, victim));
+		CHECK(nvkv_compact(&kv));
+		CHECK(nvkv_mount(&kv, 0, MEM_SIZE));
+
+		for(v = 1; v <= 3; v++)
+		{
+			uint8_t value = 0;
+			bool found = nvkv_get(&kv, v, &value, 1, &len);
+
+			CHECK(found == (v != victim));
+			CHECK(!found || value == v);
+		}
+	}
+}
+
+/**
+  \brief cuts power after every byte of a golden sequence of sets, deletes
+  and compactions.  After each cut the store must hold the state from just
+  before or just after the interrupted op, and must stay consistent while
+  the rest of the sequence runs on it.
+*/
+static void test_power_cut(persist_t persist)
+{
+	NvKv_t kv;
+	entry_t model[NUM_KEYS];
+	unsigned seed = 7;
+
+	mem_persist_mode = persist;
+	mem_reset();
+	CHECK(nvkv_mount(&kv, 0, MEM_SIZE));
+	nvmem_flush();
+
+	uint8_t base[MEM_SIZE];
+	memcpy(base, image, sizeof(base));
+
+	model_clear(model);
+	mem_persisted = 0;
+	for(int i = 0; i < NUM_OPS; i++)
+	{
+		memcpy(before[i], model, sizeof(model));
+		seeds[i] = seed;
+		run_op(&kv, &seed, model);
+	}
+	memcpy(before[NUM_OPS], model, sizeof(model));
+	seeds[NUM_OPS] = seed;
+	CHECK(model_matches(&kv, model));
+
+	long total = mem_persisted;
+	CHECK(total > 4 * MEM_SIZE);    // several compactions in the sequence
+
+	for(long cut = 0; cut < total; cut++)
+	{
+		volatile int i = 0;
+
+		memcpy(image, base, sizeof(image));
+		mem_power_cut();
+		CHECK(nvkv_mount(&kv, 0, MEM_SIZE));
+
+		seed = seeds[0];
+		model_clear(model);
+		mem_persisted = 0;
+		mem_budget = cut;
+		if(!setjmp(mem_cut))
+		{
+			for(i = 0; i < NUM_OPS; i++)
+			{
+				run_op(&kv, &seed, model);
+			}
+			CHECK(false);
+		}
+		mem_power_cut();
+
+		CHECK(nvkv_mount(&kv, 0, MEM_SIZE));
+
+		int next;
+		if(model_matches(&kv, before[i + 1]))
+		{
+			next = i + 1;
+		}
+		else
+		{
+			if(!model_matches(&kv, before[i]))
+			{
+				fprintf(stderr, "mode %d cut %ld in op %d\n", persist, cut, (int)i);
+				CHECK(false);
+			}
+			next = i;
+		}
+
+		// run the rest of the sequence on whatever the cut left behind
+		memcpy(model, before[next], sizeof(model));
+		seed = seeds[next];
+		for(int j = next; j < NUM_OPS; j++)
+		{
+			run_op(&kv, &seed, model);
+
+			if((j - next) % REMOUNT_EVERY == 0)
+			{
+				CHECK(nvkv_mount(&kv, 0, MEM_SIZE));
+				if(!model_matches(&kv, model))
+				{
+					fprintf(stderr, "mode %d cut %ld, op %d after op %d\n",
+							persist, cut, j, (int)i);
+					CHECK(false);
+				}
+			}
+		}
+
+		CHECK(nvkv_mount(&kv, 0, MEM_SIZE));
+		CHECK(model_matches(&kv, model));
+	}
+}
+
+/**
+  \brief one pseudo-random op, mirrored into model
+*/
+static void run_op(NvKv_t *kv, unsigned *seed, entry_t *model)
+{
+	*seed = *seed * 1103515245 + 12345;
+
+	uint16_t key = (*seed >> 8) % NUM_KEYS;
+	unsigned kind = (*seed >> 4) & 15;
+
+	if(kind == 0)
+	{
+		CHECK(nvkv_compact(kv));
+	}
+	else if(kind < 3)
+	{
+		CHECK(nvkv_delete(kv, key));
+		model[key].len = -1;
+	}
+	else
+	{
+		uint8_t value[MAX_LEN];
+		int len = (*seed >> 16) % 12;
+
+		for(int i = 0; i < len; i++)
+		{
+			value[i] = *seed >> (i % 24);
+		}
+
+		CHECK(nvkv_set(kv, key, value, len));
+		model[key].len = len;
+		memcpy(model[key].value, value, len);
+	}
+}
+
+static bool model_matches(NvKv_t *kv, const entry_t *model)
+{
+	for(uint16_t key = 0; key < NUM_KEYS; key++)
+	{
+		uint8_t value[MAX_LEN];
+		uint16_t len;
+		bool found = nvkv_get(kv, key, value, sizeof(value), &len);
+
+		if(model[key].len < 0)
+		{
+			if(found)
+			{
+				return false;
+			}
+		}
+		else if(!found || len != model[key].len ||
+				memcmp(value, model[key].value, len) != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void model_clear(entry_t *model)
+{
+	for(int key = 0; key < NUM_KEYS; key++)
+	{
+		model[key].len = -1;
+	}
+}
+
+static void mem_reset(void)
+{
+	memset(image, 0, sizeof(image));
+	mem_power_cut();
+}
+
+/**
+  \brief drops everything that was not persisted, and the budget with it
+*/
+static void mem_power_cut(void)
+{
+	memcpy(cache, image, sizeof(cache));
+	memset(dirty, 0, sizeof(dirty));
+	mem_budget = -1;
+}
+
+static void mem_persist(uint16_t address)
+{
+	if(mem_budget == 0)
+	{
+		longjmp(mem_cut, 1);
+	}
+
+	if(mem_budget > 0)
+	{
+		mem_budget--;
+	}
+
+	image[address] = cache[address];
+	dirty[address] = false;
+	mem_persisted++;
+}
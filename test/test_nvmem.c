@@ -0,0 +1,472 @@
+/********************************************************************
+test_nvmem.c - host tests for the nvmem write-back cache on an FRAM.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "nvmem.h"
+#include "mb85rcxxx.h"
+#include "semphr.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define FRAM_SIZE       2048        // MB85RC16
+#define FRAM_COUNT      2
+#define LINE            NVMEM_CACHE_LINE_SIZE
+#define MAX_AGE         50          // ticks
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+  \brief an MB85RC on the bus, at the transaction level: a two byte memory
+  address, then data written from or read back from there on.  Counts what
+  goes over the wire, with each START's address byte.
+*/
+typedef struct
+{
+	uint8_t mem[FRAM_SIZE];
+	bool fail;                      // NACK the address
+	uint32_t bus_bytes;
+	uint32_t unsent;                // bytes a NACKed address kept off the wire
+	uint32_t writes;                // transactions
+	uint32_t reads;
+} fram_sim_t;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_write_through(void);
+static void test_merge(void);
+static void test_unchanged(void);
+static void test_burst(void);
+static void test_evict(void);
+static void test_read_gaps(void);
+static void test_service(void);
+static void test_switch(void);
+static void check_stats(uint32_t requested, uint32_t unchanged, uint32_t writes,
+	uint32_t written, uint32_t reads, uint32_t read);
+static void check_bus(void);
+static void fill(uint8_t *buf, size_t len, uint8_t seed);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static fram_sim_t fram[FRAM_COUNT];
+static MB85RCDevice_t fram_dev[FRAM_COUNT];
+static I2C_TypeDef bus;
+static TickType_t ticks;
+
+static NvMemCacheStats_t mark;      // stats at the last check_stats
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	for(int i = 0; i < FRAM_COUNT; i++)
+	{
+		fill(fram[i].mem, FRAM_SIZE, 0x40 * i);
+		mb85rcxx_device_init(&fram_dev[i], &bus, FRAM_SIZE, i);
+	}
+
+	nvmem_set_default(&fram_dev[0].dev);
+
+	test_write_through();
+
+	CHECK(nvmem_cache_enable(MAX_AGE));
+	test_merge();
+	test_unchanged();
+	test_burst();
+	test_evict();
+	test_read_gaps();
+	test_service();
+	test_switch();
+
+	printf("nvmem: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief without the cache every call is one transaction
+*/
+static void test_write_through(void)
+{
+	uint8_t data[10], back[10];
+
+	fill(data, sizeof(data), 0x11);
+	CHECK(nvmem_write(0x123, data, sizeof(data)));
+	CHECK(memcmp(&fram[0].mem[0x123], data, sizeof(data)) == 0);
+	CHECK(nvmem_read(0x123, back, sizeof(back)));
+	CHECK(memcmp(back, data, sizeof(data)) == 0);
+
+	check_stats(10, 0, 1, 10, 1, 10);
+	CHECK(fram[0].bus_bytes == (1 + 2 + 10) + (1 + 2 + 1 + 10));
+
+	// out of range never reaches the bus, and is not counted as if it had
+	CHECK(!nvmem_write(FRAM_SIZE - 4, data, sizeof(data)));
+	CHECK(!nvmem_read(FRAM_SIZE - 4, back, sizeof(back)));
+	check_stats(10, 0, 0, 0, 0, 0);
+	check_bus();
+}
+
+/**
+  \brief writes into one line, with clean bytes between them, flush as a
+  single write of the span from the first dirty byte to the last
+*/
+static void test_merge(void)
+{
+	uint8_t a[2] = { 0xA1, 0xA2 }, b[3] = { 0xB1, 0xB2, 0xB3 };
+	uint8_t before[LINE];
+
+	memcpy(before, &fram[0].mem[0x100], LINE);
+
+	CHECK(nvmem_write(0x10A, b, sizeof(b)));
+	CHECK(nvmem_write(0x105, a, sizeof(a)));
+	check_stats(5, 0, 0, 0, 1, LINE);           // the line is loaded once
+	CHECK(memcmp(&fram[0].mem[0x100], before, LINE) == 0);
+
+	CHECK(nvmem_flush());
+	check_stats(0, 0, 1, 0x10D - 0x105, 0, 0);
+	CHECK(memcmp(&fram[0].mem[0x105], a, sizeof(a)) == 0);
+	CHECK(memcmp(&fram[0].mem[0x10A], b, sizeof(b)) == 0);
+	CHECK(memcmp(&fram[0].mem[0x107], &before[7], 3) == 0);
+	check_bus();
+
+	// nothing is left dirty
+	CHECK(nvmem_flush());
+	check_stats(0, 0, 0, 0, 0, 0);
+}
+
+/**
+  \brief bytes that already hold the value are counted and never written;
+  a line rewritten with its own contents does not go back to the device
+*/
+static void test_unchanged(void)
+{
+	uint8_t same[LINE], some[8];
+	uint32_t bus_bytes = fram[0].bus_bytes;
+
+	CHECK(nvmem_read(0x100, same, sizeof(same)));
+	CHECK(nvmem_write(0x100, same, sizeof(same)));
+	CHECK(nvmem_flush());
+	check_stats(LINE, LINE, 0, 0, 0, 0);
+	CHECK(fram[0].bus_bytes == bus_bytes);
+
+	// only the changed middle of the range is written
+	memcpy(some, &same[4], sizeof(some));
+	some[2] ^= 0xFF;
+	some[5] ^= 0xFF;
+	CHECK(nvmem_write(0x104, some, sizeof(some)));
+	CHECK(nvmem_flush());
+	check_stats(8, 6, 1, 4, 0, 0);
+	CHECK(memcmp(&fram[0].mem[0x104], some, sizeof(some)) == 0);
+	check_bus();
+}
+
+/**
+  \brief a dirty run over consecutive lines goes out as one write; a clean
+  byte in it, or the end of the cache RAM, splits it
+*/
+static void test_burst(void)
+{
+	uint8_t data[70];
+
+	// 0x110..0x155 sits in slots 0 to 2; slot 0 already holds 0x100
+	fill(data, sizeof(data), 0x22);
+	CHECK(nvmem_write(0x110, data, sizeof(data)));
+	check_stats(70, 0, 0, 0, 2, 2 * LINE);
+	CHECK(nvmem_flush());
+	check_stats(0, 0, 1, 70, 0, 0);
+	CHECK(memcmp(&fram[0].mem[0x110], data, sizeof(data)) == 0);
+	CHECK(fram[0].writes == 4);
+	check_bus();
+
+	// the same run with one byte left alone
+	for(size_t i = 0; i < sizeof(data); i++) data[i] ^= 0x0F;
+	CHECK(nvmem_write(0x110, data, 0x30));
+	CHECK(nvmem_write(0x141, &data[0x31], sizeof(data) - 0x31));
+	CHECK(nvmem_flush());
+	check_stats(69, 0, 2, 69, 0, 0);
+	check_bus();
+
+	// 0x1F0..0x20F ends in slot 7 and carries on in slot 0
+	fill(data, 32, 0x33);
+	CHECK(nvmem_write(0x1F0, data, 32));
+	CHECK(nvmem_flush());
+	check_stats(32, 0, 2, 32, 2, 2 * LINE);
+	CHECK(memcmp(&fram[0].mem[0x1F0], data, 32) == 0);
+	check_bus();
+}
+
+/**
+  \brief loading a line writes back the dirty line it replaces first, so
+  evicted data reaches the device without a flush
+*/
+static void test_evict(void)
+{
+	uint8_t data[4] = { 1, 2, 3, 4 }, other[4] = { 5, 6, 7, 8 };
+
+	// 0x300 and 0x400 share slot 0, which holds 0x200 after test_burst
+	CHECK(nvmem_write(0x302, data, sizeof(data)));
+	check_stats(4, 0, 0, 0, 1, LINE);
+	CHECK(memcmp(&fram[0].mem[0x302], data, sizeof(data)) != 0);
+
+	CHECK(nvmem_write(0x40C, other, sizeof(other)));
+	check_stats(4, 0, 1, 4, 1, LINE);
+	CHECK(memcmp(&fram[0].mem[0x302], data, sizeof(data)) == 0);
+	CHECK(memcmp(&fram[0].mem[0x40C], other, sizeof(other)) != 0);
+
+	// an evicted line is read back from the device, uncached
+	uint8_t back[4];
+	CHECK(nvmem_read(0x302, back, sizeof(back)));
+	CHECK(memcmp(back, data, sizeof(data)) == 0);
+	check_stats(0, 0, 0, 0, 1, 4);
+
+	CHECK(nvmem_flush());
+	check_stats(0, 0, 1, 4, 0, 0);
+	CHECK(memcmp(&fram[0].mem[0x40C], other, sizeof(other)) == 0);
+	check_bus();
+}
+
+/**
+  \brief a read spanning cached and uncached lines comes from RAM where it
+  can, with one device read per uncached gap, and sees unflushed data
+*/
+static void test_read_gaps(void)
+{
+	uint8_t dirty = 0x5C, back[0x60], expect[0x60];
+
+	// 0x420 (slot 1) cached and dirty; 0x400 is cached in slot 0 as well
+	CHECK(nvmem_write(0x421, &dirty, 1));
+	check_stats(1, 0, 0, 0, 1, LINE);
+
+	memcpy(expect, &fram[0].mem[0x3F0], sizeof(expect));
+	expect[0x421 - 0x3F0] = dirty;
+	CHECK(nvmem_read(0x3F0, back, sizeof(back)));
+	CHECK(memcmp(back, expect, sizeof(back)) == 0);
+	check_stats(0, 0, 0, 0, 2, 0x10 + 0x10);     // 0x3F0.. and 0x440..
+
+	CHECK(nvmem_flush());
+	check_stats(0, 0, 1, 1, 0, 0);
+	check_bus();
+}
+
+/**
+  \brief nvmem_service flushes only once the oldest dirty byte is max_age
+  old, and a later write does not push that back
+*/
+static void test_service(void)
+{
+	uint8_t v = 0x77, w = 0x78;
+
+	CHECK(nvmem_write(0x405, &v, 1));
+	ticks += MAX_AGE / 2;
+	CHECK(nvmem_write(0x406, &w, 1));
+	CHECK(nvmem_service());
+	check_stats(2, 0, 0, 0, 0, 0);
+
+	ticks += MAX_AGE / 2 - 1;
+	CHECK(nvmem_service());
+	check_stats(0, 0, 0, 0, 0, 0);
+
+	ticks += 1;
+	CHECK(nvmem_service());
+	check_stats(0, 0, 1, 2, 0, 0);
+	CHECK(fram[0].mem[0x405] == v && fram[0].mem[0x406] == w);
+
+	// clean, so nothing to do however long it waits
+	ticks += 10 * MAX_AGE;
+	CHECK(nvmem_service());
+	check_stats(0, 0, 0, 0, 0, 0);
+	check_bus();
+}
+
+/**
+  \brief switching the default device writes back the old device's dirty
+  data and empties the cache; if that fails nothing changes
+*/
+static void test_switch(void)
+{
+	uint8_t data[6] = { 9, 8, 7, 6, 5, 4 }, back[6];
+
+	CHECK(nvmem_write(0x0A0, data, sizeof(data)));
+	check_stats(6, 0, 0, 0, 1, LINE);
+
+	fram[0].fail = true;
+	CHECK(!nvmem_set_default(&fram_dev[1].dev));
+	CHECK(nvmem_get_default() == &fram_dev[0].dev);
+	check_stats(0, 0, 1, 6, 0, 0);
+	CHECK(fram[1].bus_bytes == 0);
+	CHECK(fram[0].unsent == 2 + 6);
+	fram[0].fail = false;
+
+	// the data is still cached and dirty
+	CHECK(nvmem_read(0x0A0, back, sizeof(back)));
+	CHECK(memcmp(back, data, sizeof(data)) == 0);
+	check_stats(0, 0, 0, 0, 0, 0);
+
+	CHECK(nvmem_set_default(&fram_dev[1].dev));
+	CHECK(nvmem_get_default() == &fram_dev[1].dev);
+	check_stats(0, 0, 1, 6, 0, 0);
+	CHECK(memcmp(&fram[0].mem[0x0A0], data, sizeof(data)) == 0);
+
+	// nothing of the old device is served from the cache
+	CHECK(nvmem_read(0x0A0, back, sizeof(back)));
+	CHECK(memcmp(back, &fram[1].mem[0x0A0], sizeof(back)) == 0);
+	CHECK(memcmp(back, data, sizeof(data)) != 0);
+	check_stats(0, 0, 0, 0, 1, sizeof(back));
+	CHECK(fram[1].reads == 1);
+
+	// and the cache carries on against the new one
+	CHECK(nvmem_write(0x0A0, data, sizeof(data)));
+	CHECK(nvmem_flush());
+	check_stats(6, 0, 1, 6, 1, LINE);
+	CHECK(memcmp(&fram[1].mem[0x0A0], data, sizeof(data)) == 0);
+	check_bus();
+}
+
+/**
+  \brief checks the counters moved by exactly this much since the last call
+*/
+static void check_stats(uint32_t requested, uint32_t unchanged, uint32_t writes,
+	uint32_t written, uint32_t reads, uint32_t read)
+{
+	NvMemCacheStats_t now;
+
+	nvmem_get_cache_stats(&now);
+	CHECK(now.bytes_requested - mark.bytes_requested == requested);
+	CHECK(now.bytes_unchanged - mark.bytes_unchanged == unchanged);
+	CHECK(now.device_writes - mark.device_writes == writes);
+	CHECK(now.device_bytes_written - mark.device_bytes_written == written);
+	CHECK(now.device_reads - mark.device_reads == reads);
+	CHECK(now.device_bytes_read - mark.device_bytes_read == read);
+	mark = now;
+}
+
+/**
+  \brief the counters account for every byte on the wire: a write is the
+  address, two memory address bytes and the data; a read adds a repeated
+  START and the address again.  A NACKed transaction still counts, though
+  only its address went out.
+*/
+static void check_bus(void)
+{
+	NvMemCacheStats_t now;
+	uint32_t bus_bytes = 0, writes = 0, reads = 0;
+
+	nvmem_get_cache_stats(&now);
+
+	for(int i = 0; i < FRAM_COUNT; i++)
+	{
+		bus_bytes += fram[i].bus_bytes + fram[i].unsent;
+		writes += fram[i].writes;
+		reads += fram[i].reads;
+	}
+
+	CHECK(writes == now.device_writes && reads == now.device_reads);
+	CHECK(bus_bytes == 3 * now.device_writes + now.device_bytes_written +
+		4 * now.device_reads + now.device_bytes_read);
+}
+
+static void fill(uint8_t *buf, size_t len, uint8_t seed)
+{
+	for(size_t i = 0; i < len; i++)
+	{
+		buf[i] = (uint8_t)(seed + i * 7);
+	}
+}
+
+/****************************************************************************
+ * The bus and the kernel, as far as nvmem and the driver use them
+ ***************************************************************************/
+
+I2CXferStatus_t i2c_xfer(I2C_TypeDef *I2Cx, I2CXfer_t *xfer)
+{
+	CHECK(I2Cx == &bus);
+	CHECK((xfer->address & ~0x07) == 0x50 && (xfer->address & 0x07) < FRAM_COUNT);
+	CHECK(xfer->cmd_len == 2 && (xfer->wlen == 0) != (xfer->rlen == 0));
+
+	fram_sim_t *f = &fram[xfer->address & 0x07];
+	uint16_t pointer = (xfer->cmd[0] << 8 | xfer->cmd[1]) % FRAM_SIZE;
+
+	if(xfer->rlen > 0) f->reads++;
+	else f->writes++;
+
+	if(f->fail)
+	{
+		f->bus_bytes += 1;
+		f->unsent += xfer->cmd_len + xfer->wlen + (xfer->rlen > 0 ? 1 + xfer->rlen : 0);
+		xfer->status = I2C_XFER_NACK;
+		return xfer->status;
+	}
+
+	// the memory address wraps at the end, as on the part
+	f->bus_bytes += 1 + xfer->cmd_len + xfer->wlen;
+	for(uint16_t i = 0; i < xfer->wlen; i++)
+	{
+		f->mem[(pointer + i) % FRAM_SIZE] = xfer->wbuf[i];
+	}
+
+	if(xfer->rlen > 0)
+	{
+		f->bus_bytes += 1 + xfer->rlen;
+		for(uint16_t i = 0; i < xfer->rlen; i++)
+		{
+			xfer->rbuf[i] = f->mem[(pointer + i) % FRAM_SIZE];
+		}
+	}
+
+	xfer->status = I2C_XFER_OK;
+	return xfer->status;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return ticks;
+}
+
+QueueHandle_t xQueueCreateMutex(const uint8_t type)
+{
+	static int mutex;
+
+	return (QueueHandle_t)&mutex;
+}
+
+BaseType_t xQueueGenericReceive(QueueHandle_t queue, void * const buffer, TickType_t wait,
+	const BaseType_t peek)
+{
+	return pdTRUE;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t queue, const void * const item, TickType_t wait,
+	const BaseType_t position)
+{
+	return pdTRUE;
+}
@@ -0,0 +1,448 @@
+/********************************************************************
+test_nvmem_tier.c - host tests for endurance tiering and the RTC backup
+register device.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "nvmem_tier.h"
+#include "rtc_backup.h"
+#include "rtc.h"
+#include "semphr.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define EEPROM_SIZE     256
+#define EEPROM_PAGE     16
+#define FRAM_SIZE       128
+#define SIM_LOG_MAX     16
+#define RTC_REGISTERS   20          // 19 free, and rtc.c's status word
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+/**
+  \brief a byte addressed memory behind the nvmem device interface, which
+  logs each call the device sees
+*/
+typedef struct
+{
+	NvMemDevice_t dev;              // must be first
+	uint8_t mem[EEPROM_SIZE];
+	bool fail;
+	uint8_t writes;                 // entries in log
+	struct
+	{
+		uint16_t address;
+		uint16_t len;
+	} log[SIM_LOG_MAX];
+} sim_dev_t;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_placement(void);
+static void test_no_room(void);
+static void test_span(void);
+static void test_pages(void);
+static void test_rtc_words(void);
+static void test_rtc_partial(void);
+static void sim_init(sim_dev_t *sim, uint16_t size, uint16_t page_size,
+	NvMemEndurance_t endurance);
+static void check_write(const sim_dev_t *sim, uint8_t n, uint16_t address, uint16_t len);
+static void fill(uint8_t *buf, size_t len, uint8_t seed);
+static bool sim_write(NvMemDevice_t *dev, uint16_t address, void * data, size_t len);
+static bool sim_read(NvMemDevice_t *dev, uint16_t address, void * data, size_t len);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static sim_dev_t eeprom, fram;
+static NvMemDevice_t rtc_dev;
+
+static uint32_t backup[RTC_REGISTERS];
+static uint8_t backup_reads, backup_writes;
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	rtc_backup_device_init(&rtc_dev);
+
+	test_placement();
+	test_no_room();
+	test_span();
+	test_pages();
+	test_rtc_words();
+	test_rtc_partial();
+
+	printf("nvmem_tier: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief hot regions take the highest endurance device with room and bulk
+  ones the lowest; a hot region too big for the better devices falls back
+  to whatever has room.  Regions are back to back in the tiered space, and
+  the tiered device is as durable as the worst device it uses.
+*/
+static void test_placement(void)
+{
+	NvMemTiered_t tiered;
+	NvMemDevice_t *devices[3] = { &fram.dev, &rtc_dev, &eeprom.dev };
+	NvMemRegion_t regions[5] = {
+		{ 100, NVMEM_TIER_BULK },
+		{ 40,  NVMEM_TIER_HOT },       // RTC registers
+		{ 60,  NVMEM_TIER_HOT },       // too big for what is left of them
+		{ 80,  NVMEM_TIER_BULK },
+		{ 70,  NVMEM_TIER_HOT },       // only the EEPROM has room
+	};
+
+	sim_init(&eeprom, EEPROM_SIZE, EEPROM_PAGE, NVMEM_ENDURANCE_EEPROM);
+	sim_init(&fram, FRAM_SIZE, 0, NVMEM_ENDURANCE_FRAM);
+
+	NvMemDevice_t *dev = nvmem_tier_init(&tiered, devices, 3, regions, 5);
+
+	CHECK(dev == &tiered.dev);
+	CHECK(regions[0].device == &eeprom.dev && regions[0].device_address == 0);
+	CHECK(regions[1].device == &rtc_dev && regions[1].device_address == 0);
+	CHECK(regions[2].device == &fram.dev && regions[2].device_address == 0);
+	CHECK(regions[3].device == &eeprom.dev && regions[3].device_address == 100);
+	CHECK(regions[4].device == &eeprom.dev && regions[4].device_address == 180);
+
+	CHECK(regions[0].address == 0 && regions[1].address == 100);
+	CHECK(regions[2].address == 140 && regions[3].address == 200);
+	CHECK(regions[4].address == 280);
+	CHECK(dev->size == 350 && dev->page_size == 0);
+	CHECK(dev->endurance == NVMEM_ENDURANCE_EEPROM);
+
+	// with the bulk regions gone, only the better devices are used
+	dev = nvmem_tier_init(&tiered, devices, 3, &regions[1], 2);
+	CHECK(dev != NULL && dev->size == 100);
+	CHECK(regions[1].device == &rtc_dev && regions[2].device == &fram.dev);
+	CHECK(dev->endurance == NVMEM_ENDURANCE_FRAM);
+}
+
+/**
+  \brief a layout that does not fit, or a device list that is empty or too
+  long, is refused
+*/
+static void test_no_room(void)
+{
+	NvMemTiered_t tiered;
+	NvMemDevice_t *devices[NVMEM_TIER_MAX_DEVICES + 1] =
+		{ &eeprom.dev, &fram.dev, &eeprom.dev, &fram.dev, &eeprom.dev };
+	NvMemRegion_t regions[3] = {
+		{ 200, NVMEM_TIER_BULK },
+		{ 100, NVMEM_TIER_HOT },
+		{ 60,  NVMEM_TIER_BULK },      // 56 left on the EEPROM, 28 on the FRAM
+	};
+
+	sim_init(&eeprom, EEPROM_SIZE, EEPROM_PAGE, NVMEM_ENDURANCE_EEPROM);
+	sim_init(&fram, FRAM_SIZE, 0, NVMEM_ENDURANCE_FRAM);
+
+	CHECK(nvmem_tier_init(&tiered, devices, 2, regions, 3) == NULL);
+	CHECK(nvmem_tier_init(&tiered, devices, 2, regions, 2) != NULL);
+	CHECK(nvmem_tier_init(&tiered, devices, 0, regions, 2) == NULL);
+	CHECK(nvmem_tier_init(&tiered, devices, NVMEM_TIER_MAX_DEVICES + 1, regions, 2) == NULL);
+}
+
+/**
+  \brief an access across a region boundary is split between the devices
+  behind the two regions, each piece at its own device address; one past
+  the end, or a failing device, fails the whole access
+*/
+static void test_span(void)
+{
+	NvMemTiered_t tiered;
+	NvMemDevice_t *devices[2] = { &eeprom.dev, &fram.dev };
+	NvMemRegion_t regions[3] = {
+		{ 40, NVMEM_TIER_BULK },
+		{ 30, NVMEM_TIER_HOT },
+		{ 20, NVMEM_TIER_BULK },
+	};
+	uint8_t data[50], back[50];
+
+	sim_init(&eeprom, EEPROM_SIZE, EEPROM_PAGE, NVMEM_ENDURANCE_EEPROM);
+	sim_init(&fram, FRAM_SIZE, 0, NVMEM_ENDURANCE_FRAM);
+
+	NvMemDevice_t *dev = nvmem_tier_init(&tiered, devices, 2, regions, 3);
+
+	CHECK(dev != NULL && dev->size == 90);
+
+	// 10 bytes at the end of region 0, 30 through region 1, 10 into region 2
+	fill(data, sizeof(data), 0x21);
+	CHECK(nvmem_device_write(dev, 30, data, 50));
+	CHECK(memcmp(&eeprom.mem[30], data, 10) == 0);
+	CHECK(memcmp(&fram.mem[0], &data[10], 30) == 0);
+	CHECK(memcmp(&eeprom.mem[40], &data[40], 10) == 0);
+	CHECK(fram.writes == 1);
+	check_write(&fram, 0, 0, 30);
+
+	CHECK(nvmem_device_read(dev, 30, back, 50));
+	CHECK(memcmp(back, data, 50) == 0);
+
+	// the two sides of one boundary, read on their own
+	CHECK(nvmem_device_read(dev, 69, back, 2));
+	CHECK(back[0] == data[39] && back[1] == data[40]);
+
+	CHECK(!nvmem_device_write(dev, 41, data, 50));
+	CHECK(!nvmem_device_read(dev, 90, back, 1));
+	CHECK(nvmem_device_read(dev, 89, back, 1));
+
+	fram.fail = true;
+	CHECK(!nvmem_device_write(dev, 30, data, 50));
+	CHECK(!nvmem_device_read(dev, 35, back, 10));
+	fram.fail = false;
+}
+
+/**
+  \brief nvmem_device_write never hands a paged device a write that crosses
+  a page, whether called directly or through a tiered region that starts
+  part way into a page
+*/
+static void test_pages(void)
+{
+	NvMemTiered_t tiered;
+	NvMemDevice_t *devices[2] = { &eeprom.dev, &fram.dev };
+	NvMemRegion_t regions[2] = {
+		{ 100, NVMEM_TIER_BULK },
+		{ 40,  NVMEM_TIER_BULK },      // EEPROM 100 on, 4 into a page
+	};
+	uint8_t data[64];
+
+	sim_init(&eeprom, EEPROM_SIZE, EEPROM_PAGE, NVMEM_ENDURANCE_EEPROM);
+	sim_init(&fram, FRAM_SIZE, 0, NVMEM_ENDURANCE_FRAM);
+	fill(data, sizeof(data), 0x5A);
+
+	CHECK(nvmem_device_write(&eeprom.dev, 10, data, 40));
+	CHECK(eeprom.writes == 4);
+	check_write(&eeprom, 0, 10, 6);
+	check_write(&eeprom, 1, 16, 16);
+	check_write(&eeprom, 2, 32, 16);
+	check_write(&eeprom, 3, 48, 2);
+	CHECK(memcmp(&eeprom.mem[10], data, 40) == 0);
+
+	// whole pages, and a write within one, go as they are
+	eeprom.writes = 0;
+	CHECK(nvmem_device_write(&eeprom.dev, 64, data, 32));
+	CHECK(nvmem_device_write(&eeprom.dev, 99, data, 13));
+	CHECK(eeprom.writes == 3);
+	check_write(&eeprom, 0, 64, 16);
+	check_write(&eeprom, 1, 80, 16);
+	check_write(&eeprom, 2, 99, 13);
+
+	// the FRAM has no pages
+	CHECK(nvmem_device_write(&fram.dev, 10, data, 64));
+	CHECK(fram.writes == 1);
+	check_write(&fram, 0, 10, 64);
+
+	NvMemDevice_t *dev = nvmem_tier_init(&tiered, devices, 2, regions, 2);
+
+	CHECK(dev != NULL && regions[1].device == &eeprom.dev);
+	eeprom.writes = 0;
+	CHECK(nvmem_device_write(dev, 96, data, 40));
+	CHECK(eeprom.writes == 4);
+	check_write(&eeprom, 0, 96, 4);
+	check_write(&eeprom, 1, 100, 12);
+	check_write(&eeprom, 2, 112, 16);
+	check_write(&eeprom, 3, 128, 8);
+	CHECK(memcmp(&eeprom.mem[96], data, 40) == 0);
+}
+
+/**
+  \brief whole aligned words are stored as one register write, without a
+  read, and come back little endian; the status register and anything past
+  the free ones are never touched
+*/
+static void test_rtc_words(void)
+{
+	const uint8_t word[8] = { 0x01, 0x02, 0x03, 0x04, 0xA1, 0xB2, 0xC3, 0xD4 };
+	uint8_t back[RTC_BACKUP_SIZE];
+
+	for(int i = 0; i < RTC_REGISTERS; i++) backup[i] = 0xEEEEEEEEu;
+	backup_reads = backup_writes = 0;
+
+	CHECK(rtc_dev.size == RTC_BACKUP_SIZE && rtc_dev.page_size == 0);
+	CHECK(rtc_dev.endurance == NVMEM_ENDURANCE_UNLIMITED);
+
+	CHECK(nvmem_device_write(&rtc_dev, 8, (void *)word, 8));
+	CHECK(backup[2] == 0x04030201u && backup[3] == 0xD4C3B2A1u);
+	CHECK(backup_writes == 2 && backup_reads == 0);
+
+	CHECK(nvmem_device_write(&rtc_dev, RTC_BACKUP_SIZE - 4, (void *)word, 4));
+	CHECK(backup[RTC_BACKUP_REGISTERS - 1] == 0x04030201u);
+
+	// one byte too far, called through nvmem or directly
+	backup_writes = 0;
+	CHECK(!nvmem_device_write(&rtc_dev, RTC_BACKUP_SIZE - 3, (void *)word, 4));
+	CHECK(!rtc_dev.write(&rtc_dev, RTC_BACKUP_SIZE - 3, (void *)word, 4));
+	CHECK(!rtc_dev.read(&rtc_dev, RTC_BACKUP_SIZE, back, 1));
+	CHECK(backup_writes == 0);
+	CHECK(backup[RTC_BACKUP_REGISTERS] == 0xEEEEEEEEu);
+
+	CHECK(nvmem_device_read(&rtc_dev, 0, back, RTC_BACKUP_SIZE));
+	CHECK(memcmp(&back[8], word, 8) == 0);
+	CHECK(back[0] == 0xEE && back[RTC_BACKUP_SIZE - 5] == 0xEE);
+}
+
+/**
+  \brief a write that starts or ends part way into a register changes only
+  its own bytes, leaving the rest of the word as it was
+*/
+static void test_rtc_partial(void)
+{
+	const uint8_t data[7] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77 };
+	uint8_t back[12];
+
+	for(int i = 0; i < RTC_REGISTERS; i++) backup[i] = 0xA0B0C0D0u + i;
+	backup_reads = backup_writes = 0;
+
+	// one byte in the middle of register 1
+	CHECK(nvmem_device_write(&rtc_dev, 6, (void *)data, 1));
+	CHECK(backup[1] == 0xA011C0D1u);
+	CHECK(backup[0] == 0xA0B0C0D0u && backup[2] == 0xA0B0C0D2u);
+	CHECK(backup_reads == 1 && backup_writes == 1);
+
+	// the top byte of register 4, all of 5, the low two of 6
+	backup_reads = backup_writes = 0;
+	CHECK(nvmem_device_write(&rtc_dev, 19, (void *)data, 7));
+	CHECK(backup[4] == 0x11B0C0D4u);
+	CHECK(backup[5] == 0x55443322u);
+	CHECK(backup[6] == 0xA0B07766u);
+	CHECK(backup[3] == 0xA0B0C0D3u && backup[7] == 0xA0B0C0D7u);
+	CHECK(backup_reads == 2 && backup_writes == 3);
+
+	CHECK(nvmem_device_read(&rtc_dev, 17, back, 12));
+	CHECK(back[0] == 0xC0 && back[1] == 0xB0);
+	CHECK(memcmp(&back[2], data, 7) == 0);
+	CHECK(back[9] == 0xB0 && back[10] == 0xA0 && back[11] == 0xD7);
+}
+
+static void sim_init(sim_dev_t *sim, uint16_t size, uint16_t page_size,
+	NvMemEndurance_t endurance)
+{
+	memset(sim, 0, sizeof(*sim));
+	memset(sim->mem, 0xFF, sizeof(sim->mem));
+	sim->dev.read = sim_read;
+	sim->dev.write = sim_write;
+	sim->dev.size = size;
+	sim->dev.page_size = page_size;
+	sim->dev.endurance = endurance;
+}
+
+/**
+  \brief the n-th write the device saw since it was last cleared
+*/
+static void check_write(const sim_dev_t *sim, uint8_t n, uint16_t address, uint16_t len)
+{
+	CHECK(n < sim->writes);
+	CHECK(sim->log[n].address == address && sim->log[n].len == len);
+}
+
+static void fill(uint8_t *buf, size_t len, uint8_t seed)
+{
+	for(size_t i = 0; i < len; i++)
+	{
+		buf[i] = (uint8_t)(seed + i * 7);
+	}
+}
+
+static bool sim_write(NvMemDevice_t *dev, uint16_t address, void * data, size_t len)
+{
+	sim_dev_t *sim = (sim_dev_t *)dev;
+
+	CHECK((uint32_t)address + len <= dev->size);
+	CHECK(dev->page_size == 0 || address / dev->page_size == (address + len - 1) / dev->page_size);
+
+	if(sim->fail) return false;
+
+	CHECK(sim->writes < SIM_LOG_MAX);
+	sim->log[sim->writes].address = address;
+	sim->log[sim->writes].len = len;
+	sim->writes++;
+
+	memcpy(&sim->mem[address], data, len);
+	return true;
+}
+
+static bool sim_read(NvMemDevice_t *dev, uint16_t address, void * data, size_t len)
+{
+	sim_dev_t *sim = (sim_dev_t *)dev;
+
+	CHECK((uint32_t)address + len <= dev->size);
+
+	if(sim->fail) return false;
+
+	memcpy(data, &sim->mem[address], len);
+	return true;
+}
+
+/****************************************************************************
+ * The RTC and the kernel, as far as the modules under test use them
+ ***************************************************************************/
+
+void rtc_write_backup_register(uint8_t location, uint32_t value)
+{
+	CHECK(location < RTC_BACKUP_REGISTERS);
+	backup[location] = value;
+	backup_writes++;
+}
+
+uint32_t rtc_read_backup_register(uint8_t location)
+{
+	CHECK(location < RTC_BACKUP_REGISTERS);
+	backup_reads++;
+	return backup[location];
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return 0;
+}
+
+QueueHandle_t xQueueCreateMutex(const uint8_t type)
+{
+	static int mutex;
+
+	return (QueueHandle_t)&mutex;
+}
+
+BaseType_t xQueueGenericReceive(QueueHandle_t queue, void * const buffer, TickType_t wait,
+	const BaseType_t peek)
+{
+	return pdTRUE;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t queue, const void * const item, TickType_t wait,
+	const BaseType_t position)
+{
+	return pdTRUE;
+}
@@ -0,0 +1,231 @@
+/********************************************************************
+test_pi_sched.c - host tests for PI gain scheduling.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "pi_sched.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define DT              1e-3f
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_set_gains(void);
+static void test_schedule_1d(void);
+static void test_schedule_2d(void);
+static void test_bumpless(void);
+static float output(const pi_t *pi);
+static void pi_init(pi_t *pi);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static const float speed[3] = { 0.0f, 1000.0f, 4000.0f };
+static const float kp_1d[3] = { 0.5f, 1.0f, 3.0f };
+static const float ki_1d[3] = { 10.0f, 20.0f, 80.0f };
+
+// 3 speeds by 2 bus voltages, row-major
+static const float kp_2d[6] = { 0.5f, 1.0f, 3.0f,
+                                0.25f, 0.5f, 1.5f };
+static const float ki_2d[6] = { 10.0f, 20.0f, 80.0f,
+                                5.0f, 10.0f, 40.0f };
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_set_gains();
+	test_schedule_1d();
+	test_schedule_2d();
+	test_bumpless();
+
+	printf("pi_sched: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief with an error standing, changing the gains leaves the output where
+  it was, up and down, and the new integral gain takes effect from the next
+  PI_Control
+*/
+static void test_set_gains(void)
+{
+	pi_t pi;
+
+	pi_init(&pi);
+	pi.kp = 0.5f;
+	pi.ki = 10.0f;
+	pi.reference = 1.0f;
+	pi.measured = 0.6f;
+
+	for(int n = 0; n < 20; n++)
+	{
+		PI_Control(&pi);
+	}
+
+	float before = output(&pi);
+
+	PI_SetGains(&pi, 2.0f, 40.0f);
+	CHECK_NEAR(output(&pi), before, 1e-6);
+	CHECK(pi.kp == 2.0f && pi.ki == 40.0f);
+
+	PI_SetGains(&pi, 0.1f, 40.0f);
+	CHECK_NEAR(output(&pi), before, 1e-6);
+
+	// the next step integrates at the new ki
+	float acc = pi.accumulator;
+
+	PI_Control(&pi);
+	CHECK_NEAR(pi.accumulator - acc, 0.4f * 40.0f * DT, 1e-6);
+
+	// a negative error too
+	pi.measured = 1.7f;
+	before = output(&pi);
+	PI_SetGains(&pi, 1.2f, 40.0f);
+	CHECK_NEAR(output(&pi), before, 1e-6);
+}
+
+/**
+  \brief a 1-D schedule applies the table entries at the breakpoints,
+  interpolates between them and holds the ends
+*/
+static void test_schedule_1d(void)
+{
+	lutAxis_t axis;
+	float inv[2];
+	pi_t pi;
+	piSchedule_t sched = { &pi, &axis, NULL, kp_1d, ki_1d };
+
+	LUT_AxisInit(&axis, speed, inv, 3);
+	pi_init(&pi);
+
+	for(int k = 0; k < 3; k++)
+	{
+		PI_ScheduleUpdate(&sched, speed[k], 0.0f);
+		CHECK_NEAR(pi.kp, kp_1d[k], 1e-6);
+		CHECK_NEAR(pi.ki, ki_1d[k], 1e-5);
+	}
+
+	PI_ScheduleUpdate(&sched, 2500.0f, 0.0f);
+	CHECK_NEAR(pi.kp, 2.0, 1e-6);
+	CHECK_NEAR(pi.ki, 50.0, 1e-4);
+
+	PI_ScheduleUpdate(&sched, -100.0f, 123.0f);     // x2 is ignored
+	CHECK(pi.kp == kp_1d[0] && pi.ki == ki_1d[0]);
+
+	PI_ScheduleUpdate(&sched, 1e6f, 0.0f);
+	CHECK(pi.kp == kp_1d[2] && pi.ki == ki_1d[2]);
+}
+
+/**
+  \brief a 2-D schedule hits every table entry, corners included, and
+  blends bilinearly inside a cell
+*/
+static void test_schedule_2d(void)
+{
+	lutAxis_t ax, ay;
+	float inv[2];
+	pi_t pi;
+	piSchedule_t sched = { &pi, &ax, &ay, kp_2d, ki_2d };
+
+	LUT_AxisInit(&ax, speed, inv, 3);
+	LUT_AxisInitUniform(&ay, 24.0f, 24.0f, 2);      // 24 V and 48 V
+	pi_init(&pi);
+
+	for(int j = 0; j < 2; j++)
+	{
+		for(int i = 0; i < 3; i++)
+		{
+			PI_ScheduleUpdate(&sched, speed[i], 24.0f + 24.0f * j);
+			CHECK_NEAR(pi.kp, kp_2d[j * 3 + i], 1e-6);
+			CHECK_NEAR(pi.ki, ki_2d[j * 3 + i], 1e-5);
+		}
+	}
+
+	// the middle of the first cell is the mean of its corners
+	PI_ScheduleUpdate(&sched, 500.0f, 36.0f);
+	CHECK_NEAR(pi.kp, (0.5 + 1.0 + 0.25 + 0.5) / 4.0, 1e-6);
+	CHECK_NEAR(pi.ki, (10.0 + 20.0 + 5.0 + 10.0) / 4.0, 1e-5);
+
+	// beyond both axes, the far corner
+	PI_ScheduleUpdate(&sched, 9000.0f, 60.0f);
+	CHECK_NEAR(pi.kp, kp_2d[5], 1e-6);
+	CHECK_NEAR(pi.ki, ki_2d[5], 1e-5);
+}
+
+/**
+  \brief sweeping the operating point across the schedule with an error
+  standing never steps the output; only the integral moves it
+*/
+static void test_bumpless(void)
+{
+	lutAxis_t ax, ay;
+	float inv[2];
+	pi_t pi;
+	piSchedule_t sched = { &pi, &ax, &ay, kp_2d, ki_2d };
+
+	LUT_AxisInit(&ax, speed, inv, 3);
+	LUT_AxisInitUniform(&ay, 24.0f, 24.0f, 2);
+	pi_init(&pi);
+	pi.reference = 0.3f;
+	pi.measured = 0.1f;
+
+	PI_ScheduleControl(&sched, 0.0f, 24.0f);
+
+	for(float s = 0.0f; s <= 4000.0f; s += 50.0f)
+	{
+		float before = output(&pi);
+
+		PI_ScheduleUpdate(&sched, s, 24.0f + s * 0.006f);
+		CHECK_NEAR(output(&pi), before, 1e-5);
+
+		float u = PI_ScheduleControl(&sched, s, 24.0f + s * 0.006f);
+
+		CHECK_NEAR(u, before + 0.2f * pi.ki * DT, 1e-5);
+	}
+}
+
+/**
+  \brief what PI_Control would return before integrating
+*/
+static float output(const pi_t *pi)
+{
+	float u = (pi->reference - pi->measured) * pi->kp + pi->accumulator;
+
+	return fminf(fmaxf(u, pi->outMin), pi->outMax);
+}
+
+static void pi_init(pi_t *pi)
+{
+	PI_Init(pi, DT);
+	pi->outMax = 100.0f;
+	pi->outMin = -100.0f;
+}
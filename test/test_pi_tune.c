@@ -0,0 +1,225 @@
+/********************************************************************
+test_pi_tune.c - host tests for the relay feedback PI auto-tuner.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "pi_tune.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define DT              1e-3f
+#define MAX_DELAY       1000        // samples
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+// First order plus dead time: K exp(-Ls) / (Ts + 1)
+typedef struct
+{
+	float K;
+	float T;
+	uint32_t delay;                 // L in samples
+	float y;
+	float history[MAX_DELAY];
+	uint32_t n;                     // oldest entry in history
+} plant_t;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_ultimate_point(void);
+static void test_closed_loop(piTuneRule_t rule, double max_overshoot);
+static void test_timeout(void);
+static void tune(piTune_t *tune, pi_t *pi, plant_t *plant, piTuneRule_t rule);
+static float plant_step(plant_t *plant, float u);
+static void plant_init(plant_t *plant, float K, float T, float L);
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_ultimate_point();
+	test_closed_loop(PI_TUNE_ZN, 0.4);
+	test_closed_loop(PI_TUNE_SIMC, 0.1);
+	test_timeout();
+
+	printf("pi_tune: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief the relay finds the plant's ultimate point: the period closely, the
+  gain within what the describing function approximation allows
+*/
+static void test_ultimate_point(void)
+{
+	piTune_t t;
+	pi_t pi;
+	plant_t plant;
+
+	plant_init(&plant, 2.0f, 1.0f, 0.2f);
+	tune(&t, &pi, &plant, PI_TUNE_ZN);
+	CHECK(t.status == PI_TUNE_DONE);
+
+	// solve w*L + atan(w*T) = pi for the exact ultimate point
+	double lo = 0.0, hi = M_PI / 0.2;
+
+	for(int i = 0; i < 60; i++)
+	{
+		double w = 0.5 * (lo + hi);
+
+		if(w * 0.2 + atan(w * 1.0) < M_PI)
+		{
+			lo = w;
+		}
+		else
+		{
+			hi = w;
+		}
+	}
+
+	double wu = 0.5 * (lo + hi);
+	double ku = sqrt(1.0 + wu * wu) / 2.0;
+
+	CHECK_NEAR(t.tu, 2.0 * M_PI / wu, 0.05 * (2.0 * M_PI / wu));
+	CHECK_NEAR(t.ku, ku, 0.25 * ku);
+
+	// Ziegler-Nichols PI from what was measured
+	CHECK_NEAR(pi.kp, 0.45 * t.ku, 1e-5);
+	CHECK_NEAR(pi.ki, pi.kp * 1.2 / t.tu, 1e-4);
+	CHECK(pi.accumulator == 0.0f);
+}
+
+/**
+  \brief the tuned loop settles on the reference; ZN overshoots by design,
+  SIMC should barely
+*/
+static void test_closed_loop(piTuneRule_t rule, double max_overshoot)
+{
+	piTune_t t;
+	pi_t pi;
+	plant_t plant;
+	float peak = 0.0f;
+
+	plant_init(&plant, 2.0f, 1.0f, 0.2f);
+	tune(&t, &pi, &plant, rule);
+	CHECK(t.status == PI_TUNE_DONE);
+
+	// restart from rest so the step response is clean
+	plant_init(&plant, 2.0f, 1.0f, 0.2f);
+	PI_Reset(&pi);
+
+	for(int n = 0; n < (int)(20.0f / DT); n++)
+	{
+		pi.measured = plant.y;
+		plant_step(&plant, PI_Control(&pi));
+		peak = fmaxf(peak, plant.y);
+	}
+
+	CHECK_NEAR(plant.y, pi.reference, 1e-3);
+	CHECK(peak - pi.reference <= max_overshoot * pi.reference);
+}
+
+/**
+  \brief a plant that cannot reach the reference never oscillates; the run
+  fails at the timeout and the gains are left alone
+*/
+static void test_timeout(void)
+{
+	piTune_t t;
+	pi_t pi;
+	plant_t plant;
+	int n = 0;
+
+	plant_init(&plant, 0.5f, 1.0f, 0.2f);
+
+	PI_Init(&pi, DT);
+	pi.kp = 1.5f;
+	pi.ki = 3.0f;
+	pi.outMin = 0.0f;
+	pi.outMax = 1.0f;
+	pi.reference = 1.0f;
+	pi.measured = plant.y;
+
+	PI_TuneStart(&t, &pi, PI_TUNE_SIMC, 0.01f, 3, 2.0f);
+
+	while(t.status == PI_TUNE_RUNNING)
+	{
+		pi.measured = plant.y;
+		plant_step(&plant, PI_TuneStep(&t));
+		n++;
+	}
+
+	CHECK(t.status == PI_TUNE_FAILED);
+	CHECK(n * DT >= 2.0f && n * DT < 2.1f);
+	CHECK(pi.kp == 1.5f && pi.ki == 3.0f);
+	CHECK(PI_TuneStep(&t) == 0.0f);
+}
+
+/**
+  \brief a relay run on plant, from rest, with output limits 0 to 1 and the
+  reference at 1
+*/
+static void tune(piTune_t *t, pi_t *pi, plant_t *plant, piTuneRule_t rule)
+{
+	PI_Init(pi, DT);
+	pi->outMin = 0.0f;
+	pi->outMax = 1.0f;
+	pi->reference = 1.0f;
+	pi->measured = plant->y;
+
+	PI_TuneStart(t, pi, rule, 0.01f, 3, 30.0f);
+
+	while(t->status == PI_TUNE_RUNNING)
+	{
+		pi->measured = plant->y;
+		plant_step(plant, PI_TuneStep(t));
+	}
+}
+
+static float plant_step(plant_t *plant, float u)
+{
+	float delayed = plant->history[plant->n];
+
+	plant->history[plant->n] = u;
+	plant->n = (plant->n + 1) % plant->delay;
+	plant->y += (plant->K * delayed - plant->y) * DT / plant->T;
+
+	return plant->y;
+}
+
+static void plant_init(plant_t *plant, float K, float T, float L)
+{
+	memset(plant, 0, sizeof(*plant));
+	plant->K = K;
+	plant->T = T;
+	plant->delay = (uint32_t)(L / DT + 0.5f);
+	CHECK(plant->delay > 0 && plant->delay <= MAX_DELAY);
+}
@@ -0,0 +1,315 @@
+/********************************************************************
+test_pid_bank.c - host tests for the structure-of-arrays PID bank.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "pid_bank.h"
+#include "pi.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define DT              1e-3f
+#define KP              2.0f
+#define KI              50.0f
+
+#define BENCH_STEPS     1024
+#define BENCH_ROUNDS    200
+
+// first order plant with gain 1.5, stepped once per update
+#define PLANT(x, u)     ((x) + ((u) * 1.5f - (x)) * 0.01f)
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_matches_pi(void);
+static void test_derivative(void);
+static void test_anti_windup(void);
+static void test_loops_independent(void);
+static void test_init_reset(void);
+static void bench(void);
+static double overshoot(float kb);
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_matches_pi();
+	test_derivative();
+	test_anti_windup();
+	test_loops_independent();
+	test_init_reset();
+	bench();
+
+	printf("pid_bank: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief with kd, kb and feedForward zero a loop is PI_Control, through
+  saturation and back
+*/
+static void test_matches_pi(void)
+{
+	pidBank_t bank;
+	pi_t pi;
+	float x_bank = 0.0f, x_pi = 0.0f;
+
+	PID_BankInit(&bank, 1);
+	PID_BankSetGains(&bank, 0, DT, KP, KI, 0.0f, 0.0f);
+	PID_BankSetLimits(&bank, 0, -1.0f, 1.0f);
+
+	PI_Init(&pi, DT);
+	pi.kp = KP;
+	pi.ki = KI;
+	pi.outMax = 1.0f;
+	pi.outMin = -1.0f;
+
+	for(int n = 0; n < 3000; n++)
+	{
+		float r = (n < 1500) ? 2.0f : 0.5f;     // 2.0 is out of reach
+
+		bank.reference[0] = pi.reference = r;
+		bank.measured[0] = x_bank;
+		pi.measured = x_pi;
+
+		PID_BankUpdate(&bank);
+		float u = PI_Control(&pi);
+
+		// ki*dt is folded differently, so allow for rounding
+		CHECK_NEAR(bank.output[0], u, 1e-5);
+
+		x_bank = PLANT(x_bank, bank.output[0]);
+		x_pi = PLANT(x_pi, u);
+	}
+}
+
+/**
+  \brief the derivative acts on the measurement only
+*/
+static void test_derivative(void)
+{
+	pidBank_t bank;
+
+	PID_BankInit(&bank, 1);
+	PID_BankSetGains(&bank, 0, DT, 0.0f, 0.0f, 0.01f, 0.0f);
+	PID_BankSetLimits(&bank, 0, -100.0f, 100.0f);
+
+	bank.measured[0] = 1.0f;
+	PID_BankReset(&bank, 0);
+
+	bank.reference[0] = 5.0f;
+	PID_BankUpdate(&bank);
+	CHECK(bank.output[0] == 0.0f);
+
+	bank.measured[0] = 1.2f;
+	PID_BankUpdate(&bank);
+	CHECK_NEAR(bank.output[0], -0.01 * 0.2 / DT, 1e-4);
+
+	PID_BankUpdate(&bank);
+	CHECK(bank.output[0] == 0.0f);
+}
+
+/**
+  \brief a step the output limit slows down overshoots less with
+  back-calculation than with the integrator clamp alone
+*/
+static void test_anti_windup(void)
+{
+	double clamped = overshoot(0.0f);
+
+	CHECK(clamped > 0.05);
+	CHECK(overshoot(KI / KP) < clamped);
+	CHECK(overshoot(10.0f * KI / KP) * 3.0 < clamped);
+}
+
+/**
+  \brief loops with different gains in one bank run exactly as they would
+  alone
+*/
+static void test_loops_independent(void)
+{
+	pidBank_t all, one[3];
+	float x[3] = { 0.0f, 0.0f, 0.0f };
+	float x_one[3] = { 0.0f, 0.0f, 0.0f };
+
+	PID_BankInit(&all, 3);
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		PID_BankInit(&one[i], 1);
+
+		PID_BankSetGains(&all, i, DT, KP * (i + 1), KI / (i + 1), 0.001f * i, 10.0f * i);
+		PID_BankSetLimits(&all, i, -1.0f - i, 1.0f + i);
+		PID_BankSetGains(&one[i], 0, DT, KP * (i + 1), KI / (i + 1), 0.001f * i, 10.0f * i);
+		PID_BankSetLimits(&one[i], 0, -1.0f - i, 1.0f + i);
+	}
+
+	for(int n = 0; n < 2000; n++)
+	{
+		for(uint8_t i = 0; i < 3; i++)
+		{
+			all.reference[i] = one[i].reference[0] = (n < 1000) ? 3.0f - i : -0.5f * i;
+			all.feedForward[i] = one[i].feedForward[0] = 0.1f * i;
+			all.measured[i] = x[i];
+			one[i].measured[0] = x_one[i];
+		}
+
+		PID_BankUpdate(&all);
+
+		for(uint8_t i = 0; i < 3; i++)
+		{
+			PID_BankUpdate(&one[i]);
+			CHECK(all.output[i] == one[i].output[0]);
+
+			x[i] = PLANT(x[i], all.output[i]);
+			x_one[i] = PLANT(x_one[i], one[i].output[0]);
+		}
+	}
+}
+
+static void test_init_reset(void)
+{
+	pidBank_t bank;
+
+	PID_BankInit(&bank, PID_BANK_MAX_LOOPS + 3);
+	CHECK(bank.count == PID_BANK_MAX_LOOPS);
+
+	PID_BankInit(&bank, 2);
+	PID_BankSetGains(&bank, 1, DT, KP, KI, 0.0f, 0.0f);
+	PID_BankSetLimits(&bank, 1, -1.0f, 1.0f);
+	bank.reference[1] = 1.0f;
+
+	for(int n = 0; n < 10; n++)
+	{
+		PID_BankUpdate(&bank);
+	}
+	CHECK(bank.integrator[1] > 0.0f);
+	CHECK(bank.output[0] == 0.0f);
+
+	PID_BankReset(&bank, 1);
+	CHECK(bank.integrator[1] == 0.0f && bank.output[1] == 0.0f);
+}
+
+/**
+  \brief host ns per loop for PID_BankUpdate over a full bank, against
+  PI_Control called once per loop on the same measurements.  The bank also
+  runs its derivative and back calculation terms.  Reported only.
+*/
+static void bench(void)
+{
+	static float measured[BENCH_STEPS][PID_BANK_MAX_LOOPS];
+	static pidBank_t bank;
+	static pi_t pi[PID_BANK_MAX_LOOPS];
+	volatile float sink;
+	float acc = 0.0f;
+	double t0, bank_ns, pi_ns;
+
+	srand(1);
+	for(int n = 0; n < BENCH_STEPS; n++)
+	{
+		for(int l = 0; l < PID_BANK_MAX_LOOPS; l++)
+		{
+			measured[n][l] = 2.0f * (float)rand() / (float)RAND_MAX - 1.0f;
+		}
+	}
+
+	PID_BankInit(&bank, PID_BANK_MAX_LOOPS);
+	for(uint8_t l = 0; l < PID_BANK_MAX_LOOPS; l++)
+	{
+		PID_BankSetGains(&bank, l, DT, KP, KI, 0.01f, 10.0f);
+		PID_BankSetLimits(&bank, l, -1.0f, 1.0f);
+		bank.reference[l] = 0.1f * l;
+
+		PI_Init(&pi[l], DT);
+		pi[l].kp = KP;
+		pi[l].ki = KI;
+		pi[l].outMax = 1.0f;
+		pi[l].outMin = -1.0f;
+		pi[l].reference = 0.1f * l;
+	}
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int n = 0; n < BENCH_STEPS; n++)
+		{
+			for(int l = 0; l < PID_BANK_MAX_LOOPS; l++)
+			{
+				bank.measured[l] = measured[n][l];
+			}
+			PID_BankUpdate(&bank);
+			acc += bank.output[0];
+		}
+	}
+	bank_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_STEPS / PID_BANK_MAX_LOOPS;
+
+	t0 = test_now_ns();
+	for(int r = 0; r < BENCH_ROUNDS; r++)
+	{
+		for(int n = 0; n < BENCH_STEPS; n++)
+		{
+			for(int l = 0; l < PID_BANK_MAX_LOOPS; l++)
+			{
+				pi[l].measured = measured[n][l];
+				acc += PI_Control(&pi[l]);
+			}
+		}
+	}
+	pi_ns = (test_now_ns() - t0) / BENCH_ROUNDS / BENCH_STEPS / PID_BANK_MAX_LOOPS;
+
+	sink = acc;
+	(void)sink;
+
+	printf("pid_bank: %d loops, PID_BankUpdate %.1f ns/loop, PI_Control %.1f ns/loop\n",
+			PID_BANK_MAX_LOOPS, bank_ns, pi_ns);
+}
+
+/**
+  \brief peak overshoot of a step from 0 to 1, which needs two thirds of the
+  output limit once settled but all of it on the way
+*/
+static double overshoot(float kb)
+{
+	pidBank_t bank;
+	float x = 0.0f, peak = 0.0f;
+
+	PID_BankInit(&bank, 1);
+	PID_BankSetGains(&bank, 0, DT, KP, KI, 0.0f, kb);
+	PID_BankSetLimits(&bank, 0, -1.0f, 1.0f);
+
+	for(int n = 0; n < 4000; n++)
+	{
+		bank.reference[0] = 1.0f;
+		bank.measured[0] = x;
+		PID_BankUpdate(&bank);
+		x = PLANT(x, bank.output[0]);
+		peak = fmaxf(peak, x);
+	}
+
+	return peak - 1.0f;
+}
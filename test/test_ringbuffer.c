@@ -0,0 +1,372 @@
+/********************************************************************
+test_ringbuffer.c - host tests for the ringbuffer.  Built once as is and
+once with RINGBUFF_POW2 (test_ringbuffer_pow2.c).
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "ringbuffer.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define SMALL_SIZE      16
+#define LARGE_SIZE      (1u << 17)  // only fits ringbuff_size_t with RINGBUFF_POW2
+
+#define BENCH_BYTES     (16u << 20)
+#define BENCH_CHUNK     64
+
+#ifdef RINGBUFF_POW2
+#define NAME            "ringbuffer_pow2"
+#else
+#define NAME            "ringbuffer"
+#endif
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_init(void);
+static void test_reserve_wrap(void);
+static void test_peek_wrap(void);
+static void test_full_empty(void);
+static void test_mixed(void);
+#ifdef RINGBUFF_POW2
+static void test_pow2(void);
+#endif
+static void bench(void);
+static void fill(char * dst, ringbuff_size_t n, char first);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static char small_buffer[SMALL_SIZE];
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_init();
+	test_reserve_wrap();
+	test_peek_wrap();
+	test_full_empty();
+	test_mixed();
+#ifdef RINGBUFF_POW2
+	test_pow2();
+#endif
+	bench();
+
+	printf(NAME ": ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief only the power-of-two build is fussy about the size, and a refused
+  size leaves a ringbuffer that takes nothing
+*/
+static void test_init(void)
+{
+	ringbuff rb;
+	char * p;
+
+	CHECK(ringbuff_init(&rb, small_buffer, SMALL_SIZE));
+	CHECK(ringbuff_init(&rb, small_buffer, 1));
+
+#ifdef RINGBUFF_POW2
+	CHECK(!ringbuff_init(&rb, small_buffer, SMALL_SIZE - 4));
+	CHECK(!ringbuff_push_back(&rb, 'a'));
+	CHECK(!ringbuff_push_front(&rb, 'a'));
+	CHECK(ringbuff_reserve_back(&rb, &p) == 0);
+	CHECK(!ringbuff_commit_back(&rb, 1));
+	CHECK(!ringbuff_init(&rb, small_buffer, 0));
+#else
+	CHECK(ringbuff_init(&rb, small_buffer, SMALL_SIZE - 4));
+	CHECK(ringbuff_reserve_back(&rb, &p) == SMALL_SIZE - 4);
+#endif
+}
+
+/**
+  \brief a reservation stops at the end of the storage; partial commits
+  move back along it and the next reservation starts after the wrap
+*/
+static void test_reserve_wrap(void)
+{
+	ringbuff rb;
+	char tmp[SMALL_SIZE];
+	char * p;
+
+	ringbuff_init(&rb, small_buffer, SMALL_SIZE);
+
+	// move both ends to 10
+	CHECK(ringbuff_push_back_s(&rb, tmp, 10));
+	CHECK(ringbuff_pop_front_s(&rb, tmp, 10));
+
+	CHECK(ringbuff_reserve_back(&rb, &p) == 6);
+	CHECK(p == &small_buffer[10]);
+	fill(p, 4, 'a');
+	CHECK(ringbuff_commit_back(&rb, 4));
+
+	CHECK(ringbuff_reserve_back(&rb, &p) == 2);
+	CHECK(p == &small_buffer[14]);
+	fill(p, 2, 'e');
+	CHECK(ringbuff_commit_back(&rb, 2));
+
+	// wrapped: the rest of the room, up to front
+	CHECK(ringbuff_reserve_back(&rb, &p) == 10);
+	CHECK(p == &small_buffer[0]);
+	fill(p, 3, 'g');
+	CHECK(ringbuff_commit_back(&rb, 3));
+
+	CHECK(ringbuff_reserve_back(&rb, &p) == 7);
+	CHECK(p == &small_buffer[3]);
+
+	CHECK(ringbuff_pop_front_s(&rb, tmp, 9));
+	CHECK(memcmp(tmp, "abcdefghi", 9) == 0);
+}
+
+/**
+  \brief a peek stops at the end of the storage; partial consumes move
+  front along it and the next peek picks up after the wrap
+*/
+static void test_peek_wrap(void)
+{
+	ringbuff rb;
+	char tmp[SMALL_SIZE];
+	char * p;
+
+	ringbuff_init(&rb, small_buffer, SMALL_SIZE);
+
+	CHECK(ringbuff_push_back_s(&rb, tmp, 12));
+	CHECK(ringbuff_pop_front_s(&rb, tmp, 12));
+
+	fill(tmp, 9, 'a');
+	CHECK(ringbuff_push_back_s(&rb, tmp, 9));
+
+	CHECK(ringbuff_peek_contig(&rb, &p) == 4);
+	CHECK(p == &small_buffer[12]);
+	CHECK(memcmp(p, "abcd", 4) == 0);
+
+	CHECK(ringbuff_consume(&rb, 3));
+	CHECK(ringbuff_peek_contig(&rb, &p) == 1);
+	CHECK(*p == 'd');
+	CHECK(ringbuff_consume(&rb, 1));
+
+	CHECK(ringbuff_peek_contig(&rb, &p) == 5);
+	CHECK(p == &small_buffer[0]);
+	CHECK(memcmp(p, "efghi", 5) == 0);
+
+	CHECK(!ringbuff_consume(&rb, 6));
+	CHECK(ringbuff_consume(&rb, 5));
+	CHECK(ringbuff_peek_contig(&rb, &p) == 0);
+	CHECK(!ringbuff_consume(&rb, 1));
+}
+
+/**
+  \brief nothing to reserve when full, nothing to peek when empty, and a
+  commit larger than the room is refused without moving anything
+*/
+static void test_full_empty(void)
+{
+	ringbuff rb;
+	char tmp[SMALL_SIZE];
+	char * p;
+
+	ringbuff_init(&rb, small_buffer, SMALL_SIZE);
+	CHECK(ringbuff_peek_contig(&rb, &p) == 0);
+
+	CHECK(ringbuff_reserve_back(&rb, &p) == SMALL_SIZE);
+	CHECK(!ringbuff_commit_back(&rb, SMALL_SIZE + 1));
+	CHECK(ringbuff_commit_back(&rb, SMALL_SIZE));
+	CHECK(ringbuff_reserve_back(&rb, &p) == 0);
+	CHECK(!ringbuff_commit_back(&rb, 1));
+
+	CHECK(ringbuff_peek_contig(&rb, &p) == SMALL_SIZE);
+	CHECK(ringbuff_consume(&rb, SMALL_SIZE));
+
+	// full after a wrap
+	CHECK(ringbuff_push_back_s(&rb, tmp, 5));
+	CHECK(ringbuff_pop_front_s(&rb, tmp, 5));
+	CHECK(ringbuff_reserve_back(&rb, &p) == SMALL_SIZE - 5);
+	CHECK(ringbuff_commit_back(&rb, SMALL_SIZE - 5));
+	CHECK(ringbuff_reserve_back(&rb, &p) == 5);
+	CHECK(ringbuff_commit_back(&rb, 5));
+	CHECK(ringbuff_reserve_back(&rb, &p) == 0);
+	CHECK(!ringbuff_commit_back(&rb, 1));
+}
+
+/**
+  \brief the zero-copy calls and the copying calls see the same bytes in
+  the same order, at every starting offset
+*/
+static void test_mixed(void)
+{
+	ringbuff rb;
+
+	for(ringbuff_size_t start = 0; start < SMALL_SIZE; start++)
+	{
+		char tmp[SMALL_SIZE], out[SMALL_SIZE];
+		ringbuff_size_t n, got;
+		char * p;
+		char c;
+
+		ringbuff_init(&rb, small_buffer, SMALL_SIZE);
+		CHECK(ringbuff_push_back_s(&rb, tmp, start));
+		CHECK(ringbuff_pop_front_s(&rb, tmp, start));
+
+		// zero-copy in, copying out
+		for(n = 0; n < 11; n += got)
+		{
+			got = ringbuff_reserve_back(&rb, &p);
+			got = (got < 11 - n) ? got : 11 - n;
+			fill(p, got, 'a' + n);
+			CHECK(ringbuff_commit_back(&rb, got));
+		}
+		CHECK(ringbuff_pop_front(&rb, &c) && c == 'a');
+		CHECK(ringbuff_pop_back(&rb, &c) && c == 'k');
+		CHECK(ringbuff_pop_front_s(&rb, out, 9));
+		CHECK(memcmp(out, "bcdefghij", 9) == 0);
+
+		// copying in, zero-copy out
+		fill(tmp, 11, 'A');
+		CHECK(ringbuff_push_back_s(&rb, tmp, 11));
+		for(n = 0; n < 11; n += got)
+		{
+			got = ringbuff_peek_contig(&rb, &p);
+			CHECK(got > 0);
+			memcpy(&out[n], p, got);
+			CHECK(ringbuff_consume(&rb, got));
+		}
+		CHECK(memcmp(out, "ABCDEFGHIJK", 11) == 0);
+		CHECK(ringbuff_peek_contig(&rb, &p) == 0);
+	}
+}
+
+#ifdef RINGBUFF_POW2
+/**
+  \brief the free-running indices wrap through 2^32 without a hiccup, and a
+  buffer can be larger than 64 KiB
+*/
+static void test_pow2(void)
+{
+	static char large_buffer[LARGE_SIZE];
+	static char in[LARGE_SIZE], out[LARGE_SIZE];
+	ringbuff rb;
+	char * p;
+	char c;
+
+	ringbuff_init(&rb, small_buffer, SMALL_SIZE);
+	rb.front = rb.back = UINT32_MAX - 5;
+
+	for(int i = 0; i < 3 * SMALL_SIZE; i++)
+	{
+		fill(in, 11, 'a' + i % 8);
+		CHECK(ringbuff_push_back_s(&rb, in, 11));
+		CHECK(ringbuff_pop_front_s(&rb, out, 11));
+		CHECK(memcmp(in, out, 11) == 0);
+	}
+
+	// count is back - front, across the wrap of the indices themselves
+	rb.front = rb.back = UINT32_MAX - 2;
+	CHECK(ringbuff_reserve_back(&rb, &p) == 3);
+	CHECK(p == &small_buffer[SMALL_SIZE - 3]);
+	CHECK(ringbuff_commit_back(&rb, 3));
+	CHECK(ringbuff_push_back_s(&rb, in, 5));
+	CHECK(rb.back == 5);
+	CHECK(ringbuff_peek_contig(&rb, &p) == 3);
+	CHECK(ringbuff_push_front(&rb, 'z'));
+	CHECK(ringbuff_pop_front(&rb, &c) && c == 'z');
+	CHECK(ringbuff_consume(&rb, 8));
+	CHECK(ringbuff_peek_contig(&rb, &p) == 0);
+
+	CHECK(ringbuff_init(&rb, large_buffer, LARGE_SIZE));
+	for(uint32_t i = 0; i < LARGE_SIZE; i++)
+	{
+		in[i] = (char)(i * 2654435761u >> 24);
+	}
+	CHECK(ringbuff_push_back_s(&rb, in, LARGE_SIZE - 1000));
+	CHECK(ringbuff_pop_front_s(&rb, out, LARGE_SIZE - 1000));
+	CHECK(ringbuff_push_back_s(&rb, in, LARGE_SIZE));
+	CHECK(!ringbuff_push_back(&rb, 'a'));
+	CHECK(ringbuff_pop_front_s(&rb, out, LARGE_SIZE));
+	CHECK(memcmp(in, out, LARGE_SIZE) == 0);
+}
+#endif
+
+/**
+  \brief host ns/byte for byte and BENCH_CHUNK byte push/pop.  Reported
+  only; compare the two builds to see what the mask buys over the
+  compare-and-wrap.
+*/
+static void bench(void)
+{
+	static char bench_buffer[256];
+	ringbuff rb;
+	char in[BENCH_CHUNK], out[BENCH_CHUNK];
+	double t0, chunk_ns, byte_ns;
+	uint32_t i, j;
+
+	fill(in, BENCH_CHUNK, 0);
+	ringbuff_init(&rb, small_buffer, SMALL_SIZE);
+
+	t0 = test_now_ns();
+	for(i = 0; i < BENCH_BYTES; i += SMALL_SIZE / 2)
+	{
+		for(j = 0; j < SMALL_SIZE / 2; j++)
+		{
+			ringbuff_push_back(&rb, in[j]);
+		}
+		for(j = 0; j < SMALL_SIZE / 2; j++)
+		{
+			ringbuff_pop_front(&rb, &out[j]);
+		}
+	}
+	byte_ns = (test_now_ns() - t0) / BENCH_BYTES;
+	CHECK(memcmp(in, out, SMALL_SIZE / 2) == 0);
+
+	// a record at a time, as a driver would
+	ringbuff_init(&rb, bench_buffer, sizeof(bench_buffer));
+
+	t0 = test_now_ns();
+	for(i = 0; i < BENCH_BYTES; i += BENCH_CHUNK)
+	{
+		ringbuff_push_back_s(&rb, in, BENCH_CHUNK);
+		ringbuff_pop_front_s(&rb, out, BENCH_CHUNK);
+	}
+	chunk_ns = (test_now_ns() - t0) / BENCH_BYTES;
+	CHECK(memcmp(in, out, BENCH_CHUNK) == 0);
+
+	printf(NAME ": push/pop %.2f ns/byte, push/pop_s %.2f ns/byte\n",
+			byte_ns, chunk_ns);
+}
+
+static void fill(char * dst, ringbuff_size_t n, char first)
+{
+	for(ringbuff_size_t i = 0; i < n; i++)
+	{
+		dst[i] = first + i;
+	}
+}
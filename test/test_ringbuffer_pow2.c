@@ -1,7 +1,7 @@
 /********************************************************************
-math_limits.c
+test_ringbuffer_pow2.c - test_ringbuffer.c built with RINGBUFF_POW2.
 
-Copyright (c) 2015, Jonathan Nutzmann
+Copyright (c) 2016, Jonathan Nutzmann
 
 This program is free software; you can redistribute it and/or modify
 it under the terms of the GNU General Public License as published by
@@ -14,18 +14,5 @@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
 GNU General Public License for more details.
 ********************************************************************/
 
-
-float limitf32 ( float val, float upper, float lower )
-{
-	if ( val > upper )
-	{
-		return upper;
-	}
-
-	if ( val < lower )
-	{
-		return lower;
-	}
-
-	return val;
-}
+// RINGBUFF_POW2 comes from ringbuffer_pow2_CFLAGS so ringbuffer.c sees it too
+#include "test_ringbuffer.c"
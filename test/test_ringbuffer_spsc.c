@@ -0,0 +1,330 @@
+/********************************************************************
+test_ringbuffer_spsc.c - host tests for the lock-free spsc ringbuffer.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "ringbuffer_spsc.h"
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define SMALL_SIZE      257
+#define LARGE_SIZE      40000       // > 32768, so idx + n overflows 16 bits
+#define MAX_SIZE        65535
+
+#define STRESS_BYTES    1000000u
+
+#define BENCH_BYTES     (16u << 20)
+#define BENCH_CHUNK     64
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef struct
+{
+	ringbuff_spsc * rb;
+	uint32_t total;
+	uint32_t chunk;
+} stress_t;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static uint8_t pattern(uint32_t i);
+static void * producer(void * arg);
+static void stress(ringbuff_spsc * rb, uint32_t chunk);
+static void test_large_wrap(void);
+static void bench(void);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+static char small_buffer[SMALL_SIZE];
+static char large_buffer[LARGE_SIZE];
+static char max_buffer[MAX_SIZE];
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	ringbuff_spsc rb;
+
+	test_large_wrap();
+
+	ringbuff_spsc_init(&rb, small_buffer, SMALL_SIZE);
+	stress(&rb, 13);
+
+	ringbuff_spsc_init(&rb, large_buffer, LARGE_SIZE);
+	stress(&rb, 19997);
+
+	ringbuff_spsc_init(&rb, max_buffer, MAX_SIZE);
+	stress(&rb, 32749);
+
+	bench();
+
+	printf("ringbuffer_spsc: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static uint8_t pattern(uint32_t i)
+{
+	return (uint8_t)((i * 2654435761u) >> 24);
+}
+
+// Single threaded: walk both indices past 32768 so that idx + n no longer
+// fits in 16 bits and check the wrap lands on the right byte.
+static void test_large_wrap(void)
+{
+	static uint8_t in[LARGE_SIZE];
+	static uint8_t out[LARGE_SIZE];
+	ringbuff_spsc rb;
+	uint32_t i;
+	int pass;
+
+	ringbuff_spsc_init(&rb, max_buffer, MAX_SIZE);
+
+	for(pass = 0; pass < 8; pass++)
+	{
+		for(i = 0; i < LARGE_SIZE; i++)
+		{
+			in[i] = pattern(i + pass * LARGE_SIZE);
+		}
+
+		CHECK(ringbuff_spsc_push_back_s(&rb, in, LARGE_SIZE));
+		CHECK(ringbuff_spsc_count(&rb) == LARGE_SIZE);
+		CHECK(!ringbuff_spsc_push_back_s(&rb, in, MAX_SIZE - LARGE_SIZE));
+
+		memset(out, 0, sizeof(out));
+		CHECK(ringbuff_spsc_pop_front_s(&rb, out, LARGE_SIZE));
+		CHECK(memcmp(in, out, LARGE_SIZE) == 0);
+		CHECK(ringbuff_spsc_count(&rb) == 0);
+		CHECK(rb.front == rb.back);
+		CHECK(rb.back == (uint32_t)(pass + 1) * LARGE_SIZE % MAX_SIZE);
+	}
+
+	// the zero copy path advances the indices through the same helper
+	for(pass = 0; pass < 8; pass++)
+	{
+		char * p;
+		ringbuff_size_t n = ringbuff_spsc_reserve_back(&rb, &p);
+
+		CHECK(n > 0);
+		CHECK(ringbuff_spsc_commit_back(&rb, n));
+		CHECK(ringbuff_spsc_count(&rb) == n);
+		CHECK(ringbuff_spsc_consume(&rb, n));
+		CHECK(rb.front == rb.back);
+	}
+}
+
+static void * producer(void * arg)
+{
+	stress_t * s = arg;
+	uint8_t * block = malloc(s->chunk);
+	uint32_t i = 0;
+	uint32_t k = 1;
+
+	while(i < s->total)
+	{
+		uint32_t n = k;
+		uint32_t j;
+
+		if(n > s->total - i)
+		{
+			n = s->total - i;
+		}
+
+		if(k & 1)
+		{
+			// copy in
+			for(j = 0; j < n; j++)
+			{
+				block[j] = pattern(i + j);
+			}
+
+			if(!ringbuff_spsc_push_back_s(s->rb, block, n))
+			{
+				sched_yield();
+				continue;
+			}
+		}
+		else
+		{
+			// zero copy
+			char * p;
+			ringbuff_size_t room = ringbuff_spsc_reserve_back(s->rb, &p);
+
+			if(room == 0)
+			{
+				sched_yield();
+				continue;
+			}
+			if(n > room)
+			{
+				n = room;
+			}
+
+			for(j = 0; j < n; j++)
+			{
+				p[j] = pattern(i + j);
+			}
+
+			CHECK(ringbuff_spsc_commit_back(s->rb, n));
+		}
+
+		i += n;
+		k = k % s->chunk + 1 + (k & 3);
+		if(k > s->chunk)
+		{
+			k = 1;
+		}
+	}
+
+	free(block);
+	return NULL;
+}
+
+// One producer thread, consumer on the calling thread.  The consumer
+// alternates between the copying pop and peek/consume and checks every byte.
+// A side that cannot make progress yields so the test also finishes on a
+// single core host.  Both sides move at most chunk bytes at a time; chunk must stay below
+// maxsize/2 or a blocked pop and a blocked push can wait on each other.
+static void stress(ringbuff_spsc * rb, uint32_t chunk)
+{
+	stress_t s = { .rb = rb, .total = STRESS_BYTES, .chunk = chunk };
+	uint8_t * block = malloc(chunk);
+	pthread_t thread;
+	uint32_t i = 0;
+	uint32_t k = 7;
+
+	CHECK(pthread_create(&thread, NULL, producer, &s) == 0);
+
+	while(i < s.total)
+	{
+		uint32_t n = k;
+		uint32_t j;
+
+		if(n > s.total - i)
+		{
+			n = s.total - i;
+		}
+
+		if(k & 1)
+		{
+			if(!ringbuff_spsc_pop_front_s(rb, block, n))
+			{
+				sched_yield();
+				continue;
+			}
+
+			for(j = 0; j < n; j++)
+			{
+				CHECK(block[j] == pattern(i + j));
+			}
+		}
+		else
+		{
+			char * p;
+			ringbuff_size_t avail = ringbuff_spsc_peek_contig(rb, &p);
+
+			if(avail == 0)
+			{
+				sched_yield();
+				continue;
+			}
+			if(n > avail)
+			{
+				n = avail;
+			}
+
+			for(j = 0; j < n; j++)
+			{
+				CHECK((uint8_t)p[j] == pattern(i + j));
+			}
+
+			CHECK(ringbuff_spsc_consume(rb, n));
+		}
+
+		i += n;
+		k = (k * 5 + 3) % chunk + 1;
+	}
+
+	CHECK(pthread_join(thread, NULL) == 0);
+	CHECK(ringbuff_spsc_count(rb) == 0);
+	free(block);
+}
+
+/**
+  \brief host ns/byte for BENCH_CHUNK byte records moved through the memcpy
+  path against the same records moved a byte at a time.  Reported only.
+*/
+static void bench(void)
+{
+	ringbuff_spsc rb;
+	uint8_t in[BENCH_CHUNK], out[BENCH_CHUNK];
+	double t0, memcpy_ns, byte_ns;
+	uint32_t i, j;
+
+	for(j = 0; j < BENCH_CHUNK; j++)
+	{
+		in[j] = pattern(j);
+	}
+
+	// 257 bytes, so the records keep landing across the wrap
+	ringbuff_spsc_init(&rb, small_buffer, SMALL_SIZE);
+
+	t0 = test_now_ns();
+	for(i = 0; i < BENCH_BYTES; i += BENCH_CHUNK)
+	{
+		ringbuff_spsc_push_back_s(&rb, in, BENCH_CHUNK);
+		ringbuff_spsc_pop_front_s(&rb, out, BENCH_CHUNK);
+	}
+	memcpy_ns = (test_now_ns() - t0) / BENCH_BYTES;
+	CHECK(memcmp(in, out, BENCH_CHUNK) == 0);
+
+	t0 = test_now_ns();
+	for(i = 0; i < BENCH_BYTES; i += BENCH_CHUNK)
+	{
+		for(j = 0; j < BENCH_CHUNK; j++)
+		{
+			ringbuff_spsc_push_back(&rb, (char)in[j]);
+		}
+		for(j = 0; j < BENCH_CHUNK; j++)
+		{
+			ringbuff_spsc_pop_front(&rb, (char *)&out[j]);
+		}
+	}
+	byte_ns = (test_now_ns() - t0) / BENCH_BYTES;
+	CHECK(memcmp(in, out, BENCH_CHUNK) == 0);
+
+	printf("ringbuffer_spsc: push/pop_s %.2f ns/byte, byte loop %.2f ns/byte\n",
+			memcpy_ns, byte_ns);
+}
@@ -0,0 +1,206 @@
+/********************************************************************
+test_ringqueue.c - host tests for the fixed-size record ring.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "ringqueue.h"
+#include "foc.h"
+#include <string.h>
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define SMALL_DEPTH     7
+#define FOC_DEPTH       1000        // 1000 * sizeof(focControl_t) > 64 KiB
+
+#define MODEL_MAX       64
+
+/****************************************************************************
+ * Typedefs
+ ***************************************************************************/
+
+typedef struct
+{
+	int32_t seq;
+	char pad[5];
+} record_t;
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_model(void);
+static void test_large(void);
+static void test_init(void);
+
+/****************************************************************************
+ * Private Variables
+ ***************************************************************************/
+
+RINGQUEUE_STATIC(small_q, record_t, SMALL_DEPTH, true);
+RINGQUEUE_STATIC(foc_q, focControl_t, FOC_DEPTH, true);
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_init();
+	test_model();
+	test_large();
+
+	printf("ringqueue: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+static void test_init(void)
+{
+	static char storage[64];
+	ringqueue q;
+	record_t r = { 0 };
+
+	CHECK(ringqueue_init(&q, storage, 8, 8, false));
+	CHECK(q.capacity == 8);
+
+	CHECK(!ringqueue_init(&q, storage, 0, 8, false));
+	CHECK(q.capacity == 0);
+	CHECK(!ringqueue_push(&q, &r));
+	CHECK(ringqueue_at(&q, 0) == NULL);
+
+#ifdef RINGBUFF_POW2
+	CHECK(!ringqueue_init(&q, storage, 0x10000, 0x10000, true));
+	CHECK(q.capacity == 0);
+	CHECK(!ringqueue_push(&q, &r));
+#endif
+}
+
+// Random single/batch pushes, pops and indexed reads on an overwriting queue,
+// checked against a plain array holding the newest SMALL_DEPTH sequence
+// numbers.
+static void test_model(void)
+{
+	int32_t model[MODEL_MAX];
+	int32_t seq = 0;
+	int len = 0;
+	int it;
+
+	srand(3);
+
+	for(it = 0; it < 200000; it++)
+	{
+		record_t rs[10];
+		int op = rand() % 4;
+		int n = rand() % 10;
+		int i;
+
+		if(op == 0)
+		{
+			rs[0].seq = seq++;
+			CHECK(ringqueue_push(&small_q, &rs[0]));
+			model[len++] = rs[0].seq;
+		}
+		else if(op == 1)
+		{
+			for(i = 0; i < n; i++)
+			{
+				rs[i].seq = seq++;
+				model[len++] = rs[i].seq;
+			}
+			CHECK(ringqueue_push_n(&small_q, rs, n) == n);
+		}
+		else if(op == 2)
+		{
+			int k = ringqueue_pop_n(&small_q, rs, n);
+
+			CHECK(k == (n < len ? n : len));
+			for(i = 0; i < k; i++)
+			{
+				CHECK(rs[i].seq == model[i]);
+			}
+			memmove(model, model + k, (len - k) * sizeof(model[0]));
+			len -= k;
+		}
+		else
+		{
+			record_t * p = ringqueue_at(&small_q, n % 8);
+
+			CHECK((p != NULL) == ((n % 8) < len));
+			CHECK(p == NULL || p->seq == model[n % 8]);
+
+			p = ringqueue_at_back(&small_q, n % 8);
+			CHECK(p == NULL || p->seq == model[len - 1 - n % 8]);
+		}
+
+		//overwrite mode keeps only the newest records
+		if(len > SMALL_DEPTH)
+		{
+			memmove(model, model + len - SMALL_DEPTH, SMALL_DEPTH * sizeof(model[0]));
+			len = SMALL_DEPTH;
+		}
+
+		CHECK(ringqueue_count(&small_q) == len);
+	}
+}
+
+// A 116 KB history window: offsets run well past 0xFFFF, so every record has
+// to come back from where it was written.
+static void test_large(void)
+{
+	focControl_t foc;
+	focControl_t * p;
+	int32_t i;
+
+	CHECK((uint32_t)FOC_DEPTH * sizeof(focControl_t) > 0x10000);
+
+	memset(&foc, 0, sizeof(foc));
+
+	for(i = 0; i < 3 * FOC_DEPTH + 17; i++)
+	{
+		foc.Ia = (float)i;
+		foc.Vd = (float)-i;
+		CHECK(ringqueue_push(&foc_q, &foc));
+	}
+
+	CHECK(ringqueue_count(&foc_q) == FOC_DEPTH);
+	CHECK(foc_q.front < FOC_DEPTH * sizeof(focControl_t));
+	CHECK(foc_q.front == foc_q.back);
+
+	for(i = 0; i < FOC_DEPTH; i++)
+	{
+		p = ringqueue_at_back(&foc_q, i);
+		CHECK(p != NULL);
+		CHECK(p->Ia == (float)(3 * FOC_DEPTH + 16 - i));
+		CHECK(p->Vd == -p->Ia);
+		CHECK((char *)p + sizeof(focControl_t) <= (char *)foc_q_storage + sizeof(foc_q_storage));
+	}
+
+	for(i = 0; i < FOC_DEPTH; i++)
+	{
+		CHECK(ringqueue_pop(&foc_q, &foc));
+		CHECK(foc.Ia == (float)(2 * FOC_DEPTH + 17 + i));
+	}
+
+	CHECK(!ringqueue_pop(&foc_q, &foc));
+}
@@ -0,0 +1,289 @@
+/********************************************************************
+test_thermostat.c - host tests for the heater zone thermostat.
+
+Copyright (c) 2016, Jonathan Nutzmann
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+********************************************************************/
+
+/****************************************************************************
+ * Includes
+ ***************************************************************************/
+
+#include "test.h"
+#include "thermostat.h"
+
+/****************************************************************************
+ * Definitions
+ ***************************************************************************/
+
+#define TICK            0.1f        // seconds per thermostat_plan_update
+#define WINDOW          100         // ticks
+#define AMBIENT         20.0f
+#define BUDGET          2000.0f     // W
+
+// first order heater: degrees per joule, and the loss rate to ambient
+#define HEAT(t, w)      ((t) + ((w) * 0.0002f - ((t) - AMBIENT) * 0.0005f) * TICK)
+
+// a heater element between the heater and the sensed load, which keeps
+// heating the load after it is switched off
+#define ELEMENT(h, t, w) ((h) + ((w) * 0.0005f - ((h) - (t)) * 0.01f) * TICK)
+#define LOAD(t, h)       ((t) + (((h) - (t)) * 0.004f - ((t) - AMBIENT) * 0.0005f) * TICK)
+
+/****************************************************************************
+ * Private Prototypes
+ ***************************************************************************/
+
+static void test_bang_bang(void);
+static void test_plan(void);
+static void test_window(void);
+static void test_override(void);
+static void test_overshoot(void);
+static void zone_init(ThermostatZone_t *zone, float *temperature, float reference, float power);
+
+/****************************************************************************
+ * Public Functions
+ ***************************************************************************/
+
+int main(void)
+{
+	test_bang_bang();
+	test_plan();
+	test_window();
+	test_override();
+	test_overshoot();
+
+	printf("thermostat: ok\n");
+	return 0;
+}
+
+/****************************************************************************
+ * Private Functions
+ ***************************************************************************/
+
+/**
+  \brief the single zone controller switches on the coldest sensor, with
+  hysteresis either side of the setpoint
+*/
+static void test_bang_bang(void)
+{
+	float t[2] = { 65.0f, 58.5f };
+	Thermostat_t c = { 60.0f, 2.0f, 2, t, DISABLE };
+
+	CHECK(thermostat_control_heat(&c) == DISABLE);
+	t[1] = 57.9f;
+	CHECK(thermostat_control_heat(&c) == ENABLE);
+
+	c.state = ENABLE;
+	t[1] = 61.9f;
+	CHECK(thermostat_control_heat(&c) == ENABLE);
+	t[1] = 62.1f;
+	CHECK(thermostat_control_heat(&c) == DISABLE);
+
+	c.temperature_count = 0;
+	CHECK(thermostat_control_heat(&c) == DISABLE);
+}
+
+/**
+  \brief three zones whose heaters add up to well over the budget: the load
+  never exceeds it, and every zone settles at its setpoint
+*/
+static void test_plan(void)
+{
+	ThermostatZone_t zones[3];
+	ThermostatPlan_t plan;
+	float t[3] = { AMBIENT, AMBIENT, AMBIENT };
+	const float power[3] = { 1000.0f, 1500.0f, 800.0f };
+	float peak = 0.0f;
+
+	for(uint8_t z = 0; z < 3; z++)
+	{
+		zone_init(&zones[z], &t[z], 60.0f + 5.0f * z, power[z]);
+	}
+	thermostat_plan_init(&plan, zones, 3, WINDOW, BUDGET);
+
+	for(int n = 0; n < (int)(7200.0f / TICK); n++)
+	{
+		float load = 0.0f;
+
+		thermostat_plan_update(&plan);
+
+		for(uint8_t z = 0; z < 3; z++)
+		{
+			float w = (zones[z].state == ENABLE) ? power[z] : 0.0f;
+
+			load += w;
+			t[z] = HEAT(t[z], w);
+		}
+
+		CHECK(load <= BUDGET);
+		peak = fmaxf(peak, load);
+	}
+
+	// the budget is used, not just respected
+	CHECK(peak > BUDGET - power[2]);
+
+	for(uint8_t z = 0; z < 3; z++)
+	{
+		CHECK_NEAR(t[z], zones[z].pi.reference, 0.5);
+		CHECK(zones[z].duty > 0.0f && zones[z].duty < 1.0f);
+
+		// about two switches a window, not one a tick
+		CHECK(zones[z].switches < 3 * 7200.0f / (TICK * WINDOW));
+	}
+}
+
+/**
+  \brief the window is kept within 1 and THERMOSTAT_MAX_WINDOW; a window of
+  one runs each zone fully on or off
+*/
+static void test_window(void)
+{
+	ThermostatZone_t zone;
+	ThermostatPlan_t plan;
+	float t = AMBIENT;
+
+	zone_init(&zone, &t, 60.0f, 1000.0f);
+
+	thermostat_plan_init(&plan, &zone, 1, THERMOSTAT_MAX_WINDOW + 50, BUDGET);
+	CHECK(plan.window == THERMOSTAT_MAX_WINDOW);
+
+	thermostat_plan_init(&plan, &zone, 1, 0, BUDGET);
+	CHECK(plan.window == 1);
+
+	for(int n = 0; n < 10; n++)
+	{
+		thermostat_plan_update(&plan);
+		CHECK(plan.tick == 0);
+		CHECK(zone.state == ENABLE);
+		CHECK(zone.duty == 1.0f);
+	}
+}
+
+/**
+  \brief a zone above its hysteresis band is cut off mid window, and its PI
+  backs off to where it would have asked for off, rather than holding the
+  duty it had wound up to.  It stays off until below the band.
+*/
+static void test_override(void)
+{
+	ThermostatZone_t zone;
+	ThermostatPlan_t plan;
+	float t = AMBIENT;
+
+	zone_init(&zone, &t, 60.0f, 1000.0f);
+	zone.pi.kp = 0.2f;
+	thermostat_plan_init(&plan, &zone, 1, WINDOW, BUDGET);
+
+	// cold for long enough that the integral holds the output at full
+	for(int n = 0; n < 20 * WINDOW; n++)
+	{
+		thermostat_plan_update(&plan);
+	}
+	CHECK(zone.duty == 1.0f);
+	CHECK(zone.pi.accumulator == 1.0f);
+
+	// overheated half way through a window
+	for(int n = 0; n < WINDOW / 2; n++)
+	{
+		thermostat_plan_update(&plan);
+	}
+	CHECK(zone.state == ENABLE);
+
+	t = 62.5f;
+	thermostat_plan_update(&plan);
+	CHECK(zone.state == DISABLE && zone.cutoff == ENABLE);
+	CHECK_NEAR(zone.pi.accumulator, 0.2 * 2.5, 1e-6);
+
+	// back inside the band is not enough: a whole window later the zone
+	// is still off, with no on-time planned and its PI at 0 - 0.2 * -1
+	t = 61.0f;
+	for(int n = 0; n < WINDOW; n++)
+	{
+		thermostat_plan_update(&plan);
+		CHECK(zone.state == DISABLE);
+	}
+	CHECK(zone.duty == 0.0f && zone.on_ticks == 0);
+	CHECK_NEAR(zone.pi.accumulator, 0.2, 1e-6);
+
+	// below the band it is released, and the next window starts from the
+	// tracked integral: 0.2 * 2.5 + 0.2 + 0.01 * 10 * 2.5
+	t = 57.5f;
+	thermostat_plan_update(&plan);
+	CHECK(zone.cutoff == DISABLE);
+	while(plan.tick != 1)
+	{
+		thermostat_plan_update(&plan);
+	}
+	CHECK_NEAR(zone.duty, 0.95, 1e-6);
+	CHECK(zone.state == ENABLE);
+}
+
+/**
+  \brief on a heater that keeps heating after switching off, a wound up
+  zone overshoots no further than thermostat_control_heat on the same heater,
+  and once cut off does not chatter at the top of the band
+*/
+static void test_overshoot(void)
+{
+	ThermostatZone_t zone;
+	ThermostatPlan_t plan;
+	float h[2] = { AMBIENT, AMBIENT }, t[2] = { AMBIENT, AMBIENT };
+	float peak[2] = { AMBIENT, AMBIENT };
+	uint32_t switches = 0;
+	int latched = 0;
+	Thermostat_t c = { 60.0f, 2.0f, 1, &t[0], DISABLE };
+
+	zone_init(&zone, &t[1], 60.0f, 1000.0f);
+	thermostat_plan_init(&plan, &zone, 1, WINDOW, BUDGET);
+
+	for(int n = 0; n < (int)(7200.0f / TICK); n++)
+	{
+		FunctionalState state = thermostat_control_heat(&c);
+
+		if(state != c.state) switches++;
+		c.state = state;
+		thermostat_plan_update(&plan);
+
+		// off from above the band until below it
+		if(t[1] > 62.0f) latched = 1;
+		if(t[1] < 58.0f) latched = 0;
+		CHECK(!(latched && zone.state == ENABLE));
+
+		h[0] = ELEMENT(h[0], t[0], (c.state == ENABLE) ? 1000.0f : 0.0f);
+		h[1] = ELEMENT(h[1], t[1], (zone.state == ENABLE) ? 1000.0f : 0.0f);
+
+		for(int i = 0; i < 2; i++)
+		{
+			t[i] = LOAD(t[i], h[i]);
+			peak[i] = fmaxf(peak[i], t[i]);
+		}
+	}
+
+	printf("thermostat: overshoot %.2f C, thermostat_control_heat %.2f C\n",
+		peak[1] - 60.0f, peak[0] - 60.0f);
+
+	CHECK(peak[1] > 62.0f);                 // the cut off was exercised
+	CHECK(peak[1] <= peak[0]);
+	CHECK(zone.switches <= 2 * switches);
+}
+
+static void zone_init(ThermostatZone_t *zone, float *temperature, float reference, float power)
+{
+	PI_Init(&zone->pi, TICK * WINDOW);
+	zone->pi.kp = 0.5f;
+	zone->pi.ki = 0.01f;
+	zone->pi.reference = reference;
+	zone->hysteresis = 2.0f;
+	zone->power = power;
+	zone->temperature_count = 1;
+	zone->temperatures = temperature;
+}